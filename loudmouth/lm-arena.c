@@ -0,0 +1,323 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (C) 2003 Imendio AB
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, see <https://www.gnu.org/licenses>
+ */
+
+/*
+ * Bump allocator for parsed stanzas.
+ *
+ * Everything the parser builds for one stanza is carved out of the same
+ * arena, which goes away in one piece once the last node and message
+ * holding a reference to it are gone. Nothing is ever freed on its own.
+ *
+ * The first chunk is allocated together with the arena itself, further
+ * chunks are only needed for unusually big stanzas.
+ */
+
+#include <config.h>
+#include <string.h>
+
+#include "lm-arena.h"
+
+/* Enough for any of the structures allocated in here */
+#define ARENA_ALIGN        (MAX (sizeof (gdouble), sizeof (gpointer)))
+#define ARENA_ROUND(n)     (((n) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
+
+/* Chunks never grow beyond this, bigger requests get a chunk of their own */
+#define ARENA_MAX_CHUNK    (64 * 1024)
+
+typedef struct ArenaChunk ArenaChunk;
+
+struct ArenaChunk {
+    ArenaChunk *next;
+};
+
+/* Something else the arena keeps alive, allocated from the arena */
+typedef struct ArenaNotify ArenaNotify;
+
+struct ArenaNotify {
+    ArenaNotify    *next;
+    GDestroyNotify  notify;
+    gpointer        data;
+};
+
+struct LmArena {
+    gint        ref_count;
+
+    gchar      *pos;
+    gchar      *end;
+
+    /* Chunks beyond the first one, most recent first */
+    ArenaChunk *chunks;
+    gsize       next_size;
+
+    gsize       size;
+
+    ArenaNotify *notifies;
+};
+
+#define ARENA_HEADER_SIZE  ARENA_ROUND (sizeof (LmArena))
+#define CHUNK_HEADER_SIZE  ARENA_ROUND (sizeof (ArenaChunk))
+
+static gchar *
+arena_first_chunk (LmArena *arena)
+{
+    return (gchar *) arena + ARENA_HEADER_SIZE;
+}
+
+static void
+arena_run_notifies (LmArena *arena)
+{
+    ArenaNotify *n;
+
+    /* Before the chunks go, they hold the list */
+    for (n = arena->notifies; n; n = n->next) {
+        n->notify (n->data);
+    }
+
+    arena->notifies = NULL;
+}
+
+static void
+arena_free_chunks (LmArena *arena)
+{
+    ArenaChunk *chunk;
+
+    for (chunk = arena->chunks; chunk;) {
+        ArenaChunk *next = chunk->next;
+
+        g_free (chunk);
+        chunk = next;
+    }
+
+    arena->chunks = NULL;
+}
+
+static void
+arena_grow (LmArena *arena, gsize size)
+{
+    ArenaChunk *chunk;
+    gsize       chunk_size;
+
+    chunk_size = MAX (arena->next_size, size);
+    arena->next_size = MIN (arena->next_size * 2, ARENA_MAX_CHUNK);
+
+    chunk = g_malloc (CHUNK_HEADER_SIZE + chunk_size);
+    chunk->next = arena->chunks;
+    arena->chunks = chunk;
+
+    arena->pos = (gchar *) chunk + CHUNK_HEADER_SIZE;
+    arena->end = arena->pos + chunk_size;
+}
+
+/**
+ * _lm_arena_new:
+ * @size: size of the first chunk, 0 for #LM_ARENA_DEFAULT_SIZE
+ *
+ * Creates an arena holding one reference.
+ *
+ * Return value: a newly created #LmArena
+ **/
+LmArena *
+_lm_arena_new (gsize size)
+{
+    LmArena *arena;
+
+    if (size == 0) {
+        size = LM_ARENA_DEFAULT_SIZE;
+    }
+    size = ARENA_ROUND (size);
+
+    arena = g_malloc (ARENA_HEADER_SIZE + size);
+
+    arena->ref_count = 1;
+    arena->size = size;
+    arena->pos = arena_first_chunk (arena);
+    arena->end = arena->pos + size;
+    arena->chunks = NULL;
+    arena->next_size = size * 2;
+    arena->notifies = NULL;
+
+    return arena;
+}
+
+LmArena *
+_lm_arena_ref (LmArena *arena)
+{
+    g_return_val_if_fail (arena != NULL, NULL);
+
+    g_atomic_int_inc (&arena->ref_count);
+
+    return arena;
+}
+
+/**
+ * _lm_arena_unref:
+ * @arena: an #LmArena
+ *
+ * Drops a reference, the last one frees everything allocated from @arena.
+ **/
+void
+_lm_arena_unref (LmArena *arena)
+{
+    g_return_if_fail (arena != NULL);
+
+    if (g_atomic_int_dec_and_test (&arena->ref_count)) {
+        arena_run_notifies (arena);
+        arena_free_chunks (arena);
+        g_free (arena);
+    }
+}
+
+/**
+ * _lm_arena_try_reset:
+ * @arena: an #LmArena
+ *
+ * Makes all of @arena available again, provided that the caller holds the
+ * only reference to it. Saves the parser from allocating a new arena for
+ * each stanza when nobody kept the previous one around.
+ *
+ * Return value: %TRUE if @arena was reset
+ **/
+gboolean
+_lm_arena_try_reset (LmArena *arena)
+{
+    g_return_val_if_fail (arena != NULL, FALSE);
+
+    if (g_atomic_int_get (&arena->ref_count) != 1) {
+        return FALSE;
+    }
+
+    arena_run_notifies (arena);
+    arena_free_chunks (arena);
+
+    arena->pos = arena_first_chunk (arena);
+    arena->end = arena->pos + arena->size;
+    arena->next_size = arena->size * 2;
+
+    return TRUE;
+}
+
+/**
+ * _lm_arena_add_notify:
+ * @arena: an #LmArena
+ * @notify: function to call when @arena goes away
+ * @data: data to pass to @notify
+ *
+ * Lets @arena keep @data alive, for memory which is pointed to by what
+ * is allocated from @arena without being part of it.
+ **/
+void
+_lm_arena_add_notify (LmArena *arena, GDestroyNotify notify, gpointer data)
+{
+    ArenaNotify *n;
+
+    g_return_if_fail (arena != NULL);
+    g_return_if_fail (notify != NULL);
+
+    n = _lm_arena_alloc (arena, sizeof (ArenaNotify));
+    n->notify = notify;
+    n->data = data;
+    n->next = arena->notifies;
+    arena->notifies = n;
+}
+
+static gchar *
+arena_align (gchar *pos)
+{
+    return (gchar *) ARENA_ROUND ((gsize) pos);
+}
+
+gpointer
+_lm_arena_alloc (LmArena *arena, gsize size)
+{
+    gchar *mem;
+
+    mem = arena_align (arena->pos);
+
+    if (mem > arena->end || (gsize) (arena->end - mem) < size) {
+        arena_grow (arena, size);
+        mem = arena->pos;
+    }
+
+    arena->pos = mem + size;
+
+    return mem;
+}
+
+/**
+ * _lm_arena_extend:
+ * @arena: an #LmArena
+ * @mem: memory allocated from @arena
+ * @size: current size of @mem
+ * @new_size: size @mem is wanted to be
+ *
+ * Grows @mem in place, which is only possible for the most recent
+ * allocation and when the chunk it's in has room left.
+ *
+ * Return value: %TRUE if @mem is now @new_size bytes long
+ **/
+gboolean
+_lm_arena_extend (LmArena *arena, gpointer mem, gsize size, gsize new_size)
+{
+    if ((gchar *) mem + size != arena->pos ||
+        (gsize) (arena->end - arena->pos) < new_size - size) {
+        return FALSE;
+    }
+
+    arena->pos = (gchar *) mem + new_size;
+
+    return TRUE;
+}
+
+gpointer
+_lm_arena_alloc0 (LmArena *arena, gsize size)
+{
+    return memset (_lm_arena_alloc (arena, size), 0, size);
+}
+
+gchar *
+_lm_arena_strndup (LmArena *arena, const gchar *str, gsize len)
+{
+    gchar *copy;
+
+    if (!str) {
+        return NULL;
+    }
+
+    /* Strings don't need to be aligned */
+    if ((gsize) (arena->end - arena->pos) < len + 1) {
+        arena_grow (arena, len + 1);
+    }
+
+    copy = arena->pos;
+    arena->pos += len + 1;
+
+    memcpy (copy, str, len);
+    copy[len] = '\0';
+
+    return copy;
+}
+
+gchar *
+_lm_arena_strdup (LmArena *arena, const gchar *str)
+{
+    if (!str) {
+        return NULL;
+    }
+
+    return _lm_arena_strndup (arena, str, strlen (str));
+}
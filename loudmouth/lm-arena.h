@@ -0,0 +1,51 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (C) 2003 Imendio AB
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, see <https://www.gnu.org/licenses>
+ */
+
+#ifndef __LM_ARENA_H__
+#define __LM_ARENA_H__
+
+#include <glib.h>
+
+/* Big enough for a typical stanza in one go */
+#define LM_ARENA_DEFAULT_SIZE 2048
+
+typedef struct LmArena LmArena;
+
+LmArena *  _lm_arena_new         (gsize          size);
+LmArena *  _lm_arena_ref         (LmArena       *arena);
+void       _lm_arena_unref       (LmArena       *arena);
+gboolean   _lm_arena_try_reset   (LmArena       *arena);
+
+gpointer   _lm_arena_alloc       (LmArena       *arena,
+                                  gsize          size);
+gpointer   _lm_arena_alloc0      (LmArena       *arena,
+                                  gsize          size);
+gboolean   _lm_arena_extend      (LmArena       *arena,
+                                  gpointer       mem,
+                                  gsize          size,
+                                  gsize          new_size);
+gchar *    _lm_arena_strndup     (LmArena       *arena,
+                                  const gchar   *str,
+                                  gsize          len);
+gchar *    _lm_arena_strdup      (LmArena       *arena,
+                                  const gchar   *str);
+void       _lm_arena_add_notify  (LmArena       *arena,
+                                  GDestroyNotify notify,
+                                  gpointer       data);
+
+#endif /* __LM_ARENA_H__ */
@@ -0,0 +1,137 @@
+/* Generated by lm-atoms-hash.pl from lm-atoms.h, do not edit */
+
+#define LM_ATOM_HASH_SEED  4956u
+#define LM_ATOM_HASH_SIZE  1024
+#define LM_ATOM_HASH_COUNT 127
+
+/* The id of the only atom that can be in each slot */
+static const guint8 atom_hash_table[LM_ATOM_HASH_SIZE] = {
+    LM_ATOM_ID_MECHANISMS, 0, 0, 0, 0, 0, 0, 0,
+    0, LM_ATOM_ID_NS_TIME, LM_ATOM_ID_NS_REGISTER, 0, 0, 0, 0, 0,
+    LM_ATOM_ID_STATUS, 0, 0, 0, 0, LM_ATOM_ID_NS_SI, 0, 0,
+    0, 0, 0, LM_ATOM_ID_NS_ROSTER, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, LM_ATOM_ID_VER,
+    LM_ATOM_ID_NS_FEATURE_IQ_REGISTER, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, LM_ATOM_ID_NS_XHTML_IM, LM_ATOM_ID_DELAY, 0, 0, 0,
+    0, 0, 0, LM_ATOM_ID_GET, 0, 0, 0, LM_ATOM_ID_PROCEED,
+    0, LM_ATOM_ID_NS_AUTH, 0, 0, 0, 0, 0, 0,
+    0, LM_ATOM_ID_NS_XHTML, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, LM_ATOM_ID_ERROR, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    LM_ATOM_ID_SUCCESS, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, LM_ATOM_ID_NS_CORRECTION,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, LM_ATOM_ID_UNAVAILABLE, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, LM_ATOM_ID_STREAM_FEATURES, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, LM_ATOM_ID_NS_MUC_OWNER, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, LM_ATOM_ID_ID, 0, 0, 0, LM_ATOM_ID_TO, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, LM_ATOM_ID_VERSION, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, LM_ATOM_ID_SUBSCRIBE,
+    0, 0, 0, LM_ATOM_ID_AFFILIATION, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, LM_ATOM_ID_ITEM, 0, 0, 0, 0, 0,
+    0, LM_ATOM_ID_NS_STREAM_ERRORS, 0, 0, 0, LM_ATOM_ID_NS_MAM, 0, LM_ATOM_ID_THREAD,
+    0, 0, 0, 0, LM_ATOM_ID_PRESENCE, 0, 0, 0,
+    0, 0, 0, 0, LM_ATOM_ID_FROM, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, LM_ATOM_ID_NS_STANZAS, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    LM_ATOM_ID_NS_JINGLE, 0, 0, 0, 0, LM_ATOM_ID_AUTH, LM_ATOM_ID_NS_DISCO_ITEMS, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, LM_ATOM_ID_NS_DELAY,
+    0, 0, 0, LM_ATOM_ID_SESSION, 0, 0, 0, 0,
+    0, LM_ATOM_ID_NS_HINTS, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, LM_ATOM_ID_SUBJECT, 0, 0, LM_ATOM_ID_NAME, LM_ATOM_ID_CODE,
+    0, 0, 0, 0, 0, LM_ATOM_ID_NS_MUC, LM_ATOM_ID_NS_COMMANDS, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, LM_ATOM_ID_SUBSCRIBED, 0, 0, LM_ATOM_ID_XMLNS, 0, 0, 0,
+    0, 0, 0, 0, 0, LM_ATOM_ID_NS_SESSION, 0, 0,
+    0, 0, 0, 0, LM_ATOM_ID_NS_PUBSUB_EVENT, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, LM_ATOM_ID_X_ELEMENT, 0, 0, 0, 0, 0,
+    LM_ATOM_ID_STAMP, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, LM_ATOM_ID_NS_SM,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, LM_ATOM_ID_NS_BOB,
+    0, LM_ATOM_ID_NORMAL, 0, LM_ATOM_ID_SET, 0, 0, 0, 0,
+    0, LM_ATOM_ID_NS_NICK, 0, 0, 0, LM_ATOM_ID_NS_LAST, 0, 0,
+    0, 0, 0, LM_ATOM_ID_ROLE, 0, 0, 0, 0,
+    0, 0, 0, LM_ATOM_ID_JID, 0, 0, 0, LM_ATOM_ID_NS_CHAT_MARKERS,
+    0, 0, 0, LM_ATOM_ID_GROUPCHAT, LM_ATOM_ID_NS_MUC_USER, 0, LM_ATOM_ID_NS_CLIENT, 0,
+    LM_ATOM_ID_PROBE, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, LM_ATOM_ID_NS_PUBSUB_OWNER, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, LM_ATOM_ID_NS_PRIVATE,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, LM_ATOM_ID_MESSAGE, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, LM_ATOM_ID_NS_FORWARD, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, LM_ATOM_ID_BIND, 0, 0, 0, LM_ATOM_ID_NS_DISCO_INFO, 0, 0,
+    0, LM_ATOM_ID_NS_IBB, 0, 0, 0, LM_ATOM_ID_NS_CHATSTATES, 0, 0,
+    LM_ATOM_ID_NS_X_DELAY, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, LM_ATOM_ID_MECHANISM, 0, 0,
+    0, 0, 0, 0, 0, 0, LM_ATOM_ID_NS_PRIVACY, 0,
+    LM_ATOM_ID_NS_MUC_ADMIN, 0, 0, 0, 0, 0, 0, 0,
+    0, LM_ATOM_ID_NS_SASL, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, LM_ATOM_ID_NS_CAPS, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, LM_ATOM_ID_SHOW, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, LM_ATOM_ID_NS_RECEIPTS, 0, 0, 0, 0, 0,
+    0, 0, LM_ATOM_ID_FAILURE, 0, 0, 0, 0, 0,
+    0, 0, 0, LM_ATOM_ID_NS_PING, LM_ATOM_ID_TYPE, 0, LM_ATOM_ID_CHALLENGE, LM_ATOM_ID_STARTTLS,
+    0, 0, LM_ATOM_ID_TEXT, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, LM_ATOM_ID_CHAT,
+    0, 0, 0, 0, 0, 0, LM_ATOM_ID_UNSUBSCRIBE, 0,
+    0, 0, LM_ATOM_ID_NS_TLS, 0, 0, LM_ATOM_ID_SUBSCRIPTION, 0, 0,
+    0, LM_ATOM_ID_NS_CARBONS, LM_ATOM_ID_GROUP, 0, 0, 0, 0, LM_ATOM_ID_XML_LANG,
+    0, 0, 0, 0, LM_ATOM_ID_NS_VCARD_UPDATE, 0, 0, 0,
+    0, 0, LM_ATOM_ID_COMPOSING, LM_ATOM_ID_NS_AVATAR_DATA, 0, 0, 0, 0,
+    0, 0, 0, LM_ATOM_ID_ACTIVE, 0, LM_ATOM_ID_HEADLINE, 0, 0,
+    0, 0, 0, 0, 0, LM_ATOM_ID_RESOURCE, 0, LM_ATOM_ID_NS_FEATURE_IQ_AUTH,
+    0, 0, 0, LM_ATOM_ID_C, 0, 0, 0, 0,
+    0, 0, 0, 0, LM_ATOM_ID_NS_AVATAR_METADATA, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, LM_ATOM_ID_NODE, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, LM_ATOM_ID_HASH, LM_ATOM_ID_NS_VCARD,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, LM_ATOM_ID_NS_IQ_OOB, 0, LM_ATOM_ID_NS_DATA, 0,
+    0, LM_ATOM_ID_NS_BLOCKING, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    LM_ATOM_ID_NS_STANZA_ID, 0, 0, 0, 0, 0, 0, 0,
+    0, LM_ATOM_ID_PRIORITY, 0, 0, 0, 0, 0, 0,
+    LM_ATOM_ID_PING, 0, LM_ATOM_ID_STREAM_ERROR, 0, 0, LM_ATOM_ID_BODY, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, LM_ATOM_ID_NS_PUBSUB, LM_ATOM_ID_IQ, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, LM_ATOM_ID_NS_X_OOB, 0, 0, 0,
+    LM_ATOM_ID_RESPONSE, 0, 0, LM_ATOM_ID_RESULT, 0, LM_ATOM_ID_PAUSED, 0, LM_ATOM_ID_QUERY,
+    0, 0, LM_ATOM_ID_NS_X_CONFERENCE, 0, 0, 0, LM_ATOM_ID_STREAM, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, LM_ATOM_ID_NS_STREAMS, LM_ATOM_ID_UNSUBSCRIBED, 0, 0, 0, LM_ATOM_ID_NS_BIND,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    LM_ATOM_ID_NS_BYTESTREAMS, 0, LM_ATOM_ID_NS_VERSION, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, LM_ATOM_ID_NS_SERVER, 0,
+    LM_ATOM_ID_NS_SEARCH, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+};
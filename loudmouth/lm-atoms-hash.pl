@@ -0,0 +1,64 @@
+#!/usr/bin/perl -w
+#
+# Generates lm-atoms-hash.h, the perfect hash table over the atoms listed
+# in lm-atoms.h, by trying seeds until no two atoms end up in the same
+# slot. atoms_hash() in lm-atoms.c has to compute the same function.
+#
+# Usage: lm-atoms-hash.pl lm-atoms.h > lm-atoms-hash.h
+
+use strict;
+
+my $table_size = 1024;
+my @atoms;
+
+while (<>) {
+    if (/^\s*X \((\w+),\s*"([^"]*)"\)/) {
+        push @atoms, [$1, $2];
+    }
+}
+
+die "No atoms found\n" unless @atoms;
+die "Too many atoms for one byte ids\n" if @atoms > 255;
+
+sub atom_hash {
+    my ($seed, $str) = @_;
+    my $hash = $seed;
+
+    foreach my $c (unpack ("C*", $str)) {
+        $hash = (($hash ^ $c) * 16777619) & 0xffffffff;
+    }
+
+    return $hash ^ ($hash >> 16);
+}
+
+SEED: foreach my $seed (1 .. 1000000) {
+    my @slots = (undef) x $table_size;
+
+    foreach my $atom (@atoms) {
+        my $slot = atom_hash ($seed, $atom->[1]) % $table_size;
+
+        next SEED if defined $slots[$slot];
+        $slots[$slot] = $atom->[0];
+    }
+
+    print "/* Generated by lm-atoms-hash.pl from lm-atoms.h, do not edit */\n\n";
+    print "#define LM_ATOM_HASH_SEED  ${seed}u\n";
+    print "#define LM_ATOM_HASH_SIZE  $table_size\n";
+    print "#define LM_ATOM_HASH_COUNT " . scalar (@atoms) . "\n\n";
+    print "/* The id of the only atom that can be in each slot */\n";
+    print "static const guint8 atom_hash_table[LM_ATOM_HASH_SIZE] = {\n";
+
+    for (my $i = 0; $i < $table_size; $i += 8) {
+        my @row;
+
+        for (my $j = $i; $j < $i + 8; ++$j) {
+            push @row, defined $slots[$j] ? "LM_ATOM_ID_$slots[$j]" : "0";
+        }
+        print "    " . join (", ", @row) . ",\n";
+    }
+
+    print "};\n";
+    exit 0;
+}
+
+die "No seed found, try a bigger table\n";
@@ -0,0 +1,158 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (C) 2003 Imendio AB
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, see <https://www.gnu.org/licenses>
+ */
+
+/*
+ * Interned XMPP vocabulary.
+ *
+ * Node and attribute names found in LM_ATOM_LIST are never copied, the
+ * nodes point straight at the atom. Since every name that has an atom is
+ * stored as that atom, two of them are the same string exactly when they
+ * are the same pointer.
+ *
+ * The table is fixed at compile time. Names coming off the wire that
+ * aren't in it are stored as before rather than interned, so that a
+ * peer can't grow it.
+ *
+ * Looking a string up takes a single probe into a perfect hash table,
+ * lm-atoms-hash.h, which lm-atoms-hash.pl generates from LM_ATOM_LIST.
+ * It has to be generated again whenever the list changes.
+ */
+
+#include <config.h>
+#include <string.h>
+
+#include "lm-atoms.h"
+#include "lm-atoms-hash.h"
+
+#define ATOM_INITIALIZER(id, str) LM_ATOM_ID_##id, str,
+
+const LmAtomData _lm_atom_data = {
+    LM_ATOM_LIST (ATOM_INITIALIZER)
+};
+
+#undef ATOM_INITIALIZER
+
+#define ATOM_DATA_START ((const gchar *) &_lm_atom_data)
+#define ATOM_DATA_END   (ATOM_DATA_START + sizeof (_lm_atom_data))
+
+#define ATOM_STRING(id, str) LM_ATOM (id),
+
+static const gchar * const atom_strings[LM_ATOM_N_IDS] = {
+    NULL,
+    LM_ATOM_LIST (ATOM_STRING)
+};
+
+#undef ATOM_STRING
+
+/* Fails to build when lm-atoms-hash.h is older than the list */
+G_STATIC_ASSERT (LM_ATOM_HASH_COUNT == LM_ATOM_N_IDS - 1);
+
+static inline guint
+atoms_hash (const gchar *str)
+{
+    const guchar *p;
+    guint32       hash = LM_ATOM_HASH_SEED;
+
+    for (p = (const guchar *) str; *p; ++p) {
+        hash = (hash ^ *p) * 16777619u;
+    }
+
+    return hash ^ (hash >> 16);
+}
+
+/**
+ * _lm_atom_is_atom:
+ * @str: a string
+ *
+ * Return value: %TRUE if @str is one of the interned strings itself, not
+ * just a pointer into one of them
+ **/
+gboolean
+_lm_atom_is_atom (const gchar *str)
+{
+    guint8 id;
+
+    if ((guintptr) str <= (guintptr) ATOM_DATA_START ||
+        (guintptr) str >= (guintptr) ATOM_DATA_END) {
+        return FALSE;
+    }
+
+    /* Only the start of an atom has its id right before it */
+    id = ((const guint8 *) str)[-1];
+
+    return id < LM_ATOM_N_IDS && atom_strings[id] == str;
+}
+
+/**
+ * _lm_atom_lookup:
+ * @str: a string
+ *
+ * Finds the interned copy of @str.
+ *
+ * Return value: the atom equal to @str or %NULL if there is none
+ **/
+const gchar *
+_lm_atom_lookup (const gchar *str)
+{
+    return atom_strings[_lm_atom_id (str)];
+}
+
+/**
+ * _lm_atom_id:
+ * @str: a string
+ *
+ * Finds the id of the atom equal to @str, without looking at more than
+ * @str itself and that one atom.
+ *
+ * Return value: the id, or %LM_ATOM_ID_NONE if @str has no atom
+ **/
+LmAtomId
+_lm_atom_id (const gchar *str)
+{
+    LmAtomId id;
+
+    if (!str) {
+        return LM_ATOM_ID_NONE;
+    }
+
+    /* Callers inside the library mostly pass LM_ATOM() already */
+    if (_lm_atom_is_atom (str)) {
+        return ((const guint8 *) str)[-1];
+    }
+
+    id = atom_hash_table[atoms_hash (str) % LM_ATOM_HASH_SIZE];
+    if (id != LM_ATOM_ID_NONE && strcmp (atom_strings[id], str) == 0) {
+        return id;
+    }
+
+    return LM_ATOM_ID_NONE;
+}
+
+/**
+ * _lm_atom_from_id:
+ * @id: an atom id
+ *
+ * Return value: the atom with @id, %NULL for %LM_ATOM_ID_NONE
+ **/
+const gchar *
+_lm_atom_from_id (LmAtomId id)
+{
+    g_return_val_if_fail (id < LM_ATOM_N_IDS, NULL);
+
+    return atom_strings[id];
+}
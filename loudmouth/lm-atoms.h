@@ -0,0 +1,197 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (C) 2003 Imendio AB
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, see <https://www.gnu.org/licenses>
+ */
+
+#ifndef __LM_ATOMS_H__
+#define __LM_ATOMS_H__
+
+#include <glib.h>
+
+/* Element names, attribute names, attribute values and namespaces common
+ * enough in XMPP to be shared by every node that uses them.
+ */
+#define LM_ATOM_LIST(X)                                                 \
+    /* Stanzas and stream elements */                                   \
+    X (MESSAGE,         "message")                                      \
+    X (PRESENCE,        "presence")                                     \
+    X (IQ,              "iq")                                           \
+    X (STREAM,          "stream:stream")                                \
+    X (STREAM_ERROR,    "stream:error")                                 \
+    X (STREAM_FEATURES, "stream:features")                              \
+    X (AUTH,            "auth")                                         \
+    X (CHALLENGE,       "challenge")                                    \
+    X (RESPONSE,        "response")                                     \
+    X (SUCCESS,         "success")                                      \
+    X (FAILURE,         "failure")                                      \
+    X (PROCEED,         "proceed")                                      \
+    X (STARTTLS,        "starttls")                                     \
+    X (MECHANISMS,      "mechanisms")                                   \
+    X (MECHANISM,       "mechanism")                                    \
+    X (BIND,            "bind")                                         \
+    X (SESSION,         "session")                                      \
+    X (RESOURCE,        "resource")                                     \
+    /* Children */                                                      \
+    X (BODY,            "body")                                         \
+    X (SUBJECT,         "subject")                                      \
+    X (THREAD,          "thread")                                       \
+    X (ERROR,           "error")                                        \
+    X (QUERY,           "query")                                        \
+    X (X_ELEMENT,       "x")                                            \
+    X (C,               "c")                                            \
+    X (SHOW,            "show")                                         \
+    X (STATUS,          "status")                                       \
+    X (PRIORITY,        "priority")                                     \
+    X (DELAY,           "delay")                                        \
+    X (ITEM,            "item")                                         \
+    X (GROUP,           "group")                                        \
+    X (ACTIVE,          "active")                                       \
+    X (COMPOSING,       "composing")                                    \
+    X (PAUSED,          "paused")                                       \
+    X (PING,            "ping")                                         \
+    X (TEXT,            "text")                                         \
+    /* Attributes */                                                    \
+    X (XMLNS,           "xmlns")                                        \
+    X (ID,              "id")                                           \
+    X (TYPE,            "type")                                         \
+    X (TO,              "to")                                           \
+    X (FROM,            "from")                                         \
+    X (XML_LANG,        "xml:lang")                                     \
+    X (VERSION,         "version")                                      \
+    X (JID,             "jid")                                          \
+    X (NAME,            "name")                                         \
+    X (NODE,            "node")                                         \
+    X (HASH,            "hash")                                         \
+    X (VER,             "ver")                                          \
+    X (CODE,            "code")                                         \
+    X (STAMP,           "stamp")                                        \
+    X (SUBSCRIPTION,    "subscription")                                 \
+    X (AFFILIATION,     "affiliation")                                  \
+    X (ROLE,            "role")                                         \
+    /* Values of the type attribute */                                  \
+    X (NORMAL,          "normal")                                       \
+    X (CHAT,            "chat")                                         \
+    X (GROUPCHAT,       "groupchat")                                    \
+    X (HEADLINE,        "headline")                                     \
+    X (UNAVAILABLE,     "unavailable")                                  \
+    X (PROBE,           "probe")                                        \
+    X (SUBSCRIBE,       "subscribe")                                    \
+    X (UNSUBSCRIBE,     "unsubscribe")                                  \
+    X (SUBSCRIBED,      "subscribed")                                   \
+    X (UNSUBSCRIBED,    "unsubscribed")                                 \
+    X (GET,             "get")                                          \
+    X (SET,             "set")                                          \
+    X (RESULT,          "result")                                       \
+    /* Namespaces */                                                    \
+    X (NS_CLIENT,       "jabber:client")                                \
+    X (NS_SERVER,       "jabber:server")                                \
+    X (NS_STREAMS,      "http://etherx.jabber.org/streams")             \
+    X (NS_ROSTER,       "jabber:iq:roster")                             \
+    X (NS_AUTH,         "jabber:iq:auth")                               \
+    X (NS_VERSION,      "jabber:iq:version")                            \
+    X (NS_DATA,         "jabber:x:data")                                \
+    X (NS_X_DELAY,      "jabber:x:delay")                               \
+    X (NS_TLS,          "urn:ietf:params:xml:ns:xmpp-tls")              \
+    X (NS_SASL,         "urn:ietf:params:xml:ns:xmpp-sasl")             \
+    X (NS_BIND,         "urn:ietf:params:xml:ns:xmpp-bind")             \
+    X (NS_SESSION,      "urn:ietf:params:xml:ns:xmpp-session")          \
+    X (NS_STANZAS,      "urn:ietf:params:xml:ns:xmpp-stanzas")          \
+    X (NS_STREAM_ERRORS,"urn:ietf:params:xml:ns:xmpp-streams")          \
+    X (NS_DISCO_INFO,   "http://jabber.org/protocol/disco#info")        \
+    X (NS_DISCO_ITEMS,  "http://jabber.org/protocol/disco#items")       \
+    X (NS_CAPS,         "http://jabber.org/protocol/caps")              \
+    X (NS_CHATSTATES,   "http://jabber.org/protocol/chatstates")        \
+    X (NS_MUC,          "http://jabber.org/protocol/muc")               \
+    X (NS_MUC_USER,     "http://jabber.org/protocol/muc#user")          \
+    X (NS_PING,         "urn:xmpp:ping")                                \
+    X (NS_DELAY,        "urn:xmpp:delay")                               \
+    X (NS_PRIVATE,      "jabber:iq:private")                            \
+    X (NS_REGISTER,     "jabber:iq:register")                           \
+    X (NS_LAST,         "jabber:iq:last")                               \
+    X (NS_PRIVACY,      "jabber:iq:privacy")                            \
+    X (NS_SEARCH,       "jabber:iq:search")                             \
+    X (NS_IQ_OOB,       "jabber:iq:oob")                                \
+    X (NS_X_OOB,        "jabber:x:oob")                                 \
+    X (NS_X_CONFERENCE, "jabber:x:conference")                          \
+    X (NS_VCARD,        "vcard-temp")                                   \
+    X (NS_VCARD_UPDATE, "vcard-temp:x:update")                          \
+    X (NS_FEATURE_IQ_AUTH, "http://jabber.org/features/iq-auth")        \
+    X (NS_FEATURE_IQ_REGISTER, "http://jabber.org/features/iq-register") \
+    X (NS_MUC_ADMIN,    "http://jabber.org/protocol/muc#admin")         \
+    X (NS_MUC_OWNER,    "http://jabber.org/protocol/muc#owner")         \
+    X (NS_PUBSUB,       "http://jabber.org/protocol/pubsub")            \
+    X (NS_PUBSUB_EVENT, "http://jabber.org/protocol/pubsub#event")      \
+    X (NS_PUBSUB_OWNER, "http://jabber.org/protocol/pubsub#owner")      \
+    X (NS_COMMANDS,     "http://jabber.org/protocol/commands")          \
+    X (NS_NICK,         "http://jabber.org/protocol/nick")              \
+    X (NS_XHTML_IM,     "http://jabber.org/protocol/xhtml-im")          \
+    X (NS_XHTML,        "http://www.w3.org/1999/xhtml")                 \
+    X (NS_IBB,          "http://jabber.org/protocol/ibb")               \
+    X (NS_SI,           "http://jabber.org/protocol/si")                \
+    X (NS_BYTESTREAMS,  "http://jabber.org/protocol/bytestreams")       \
+    X (NS_TIME,         "urn:xmpp:time")                                \
+    X (NS_RECEIPTS,     "urn:xmpp:receipts")                            \
+    X (NS_CARBONS,      "urn:xmpp:carbons:2")                           \
+    X (NS_FORWARD,      "urn:xmpp:forward:0")                           \
+    X (NS_MAM,          "urn:xmpp:mam:2")                               \
+    X (NS_SM,           "urn:xmpp:sm:3")                                \
+    X (NS_BLOCKING,     "urn:xmpp:blocking")                            \
+    X (NS_JINGLE,       "urn:xmpp:jingle:1")                            \
+    X (NS_BOB,          "urn:xmpp:bob")                                 \
+    X (NS_HINTS,        "urn:xmpp:hints")                               \
+    X (NS_CORRECTION,   "urn:xmpp:message-correct:0")                   \
+    X (NS_CHAT_MARKERS, "urn:xmpp:chat-markers:0")                      \
+    X (NS_AVATAR_DATA,  "urn:xmpp:avatar:data")                         \
+    X (NS_AVATAR_METADATA, "urn:xmpp:avatar:metadata")                  \
+    X (NS_STANZA_ID,    "urn:xmpp:sid:0")
+
+/* Numbers the atoms, so that classifying a name is a switch on its id */
+#define LM_ATOM_ENUM(id, str) LM_ATOM_ID_##id,
+
+typedef enum {
+    LM_ATOM_ID_NONE,
+    LM_ATOM_LIST (LM_ATOM_ENUM)
+    LM_ATOM_N_IDS
+} LmAtomId;
+
+#undef LM_ATOM_ENUM
+
+/* All atoms are laid out back to back in one block, which is what makes
+ * telling them apart from other strings cheap. Each one comes right after
+ * the byte holding its id.
+ */
+#define LM_ATOM_MEMBER(id, str) guint8 i_##id; gchar a_##id[sizeof (str)];
+
+typedef struct {
+    LM_ATOM_LIST (LM_ATOM_MEMBER)
+} LmAtomData;
+
+#undef LM_ATOM_MEMBER
+
+/* The id byte in front of each atom has to hold every id */
+G_STATIC_ASSERT (LM_ATOM_N_IDS <= 256);
+
+extern const LmAtomData _lm_atom_data;
+
+/* The interned copy of one of the strings above */
+#define LM_ATOM(id) ((const gchar *) _lm_atom_data.a_##id)
+
+const gchar *  _lm_atom_lookup  (const gchar  *str);
+gboolean       _lm_atom_is_atom (const gchar  *str);
+LmAtomId       _lm_atom_id      (const gchar  *str);
+const gchar *  _lm_atom_from_id (LmAtomId      id);
+
+#endif /* __LM_ATOMS_H__ */
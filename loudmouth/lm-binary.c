@@ -0,0 +1,567 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (C) 2003 Imendio AB
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, see <https://www.gnu.org/licenses>
+ */
+
+/*
+ * A compact form of a node tree for keeping stanzas around or handing them
+ * between processes, which is read back without parsing any XML.
+ *
+ * All numbers are unsigned LEB128 varints. After the magic "LMB" and a
+ * version byte comes the table of names, a count and then each name as a
+ * string. A string is its length, its bytes and a NUL, so that it can be
+ * used right where it is in the buffer. Then the nodes follow in document
+ * order, each one being
+ *
+ *   name      index into the table of names
+ *   flags     one byte, BINARY_NODE_*
+ *   value     a string, only with BINARY_NODE_VALUE
+ *   count     number of attributes, each an index and a string
+ *   count     number of children, which come right after
+ */
+
+#include <config.h>
+
+#include <string.h>
+
+#include "lm-arena.h"
+#include "lm-atoms.h"
+#include "lm-error.h"
+#include "lm-internals.h"
+#include "lm-message.h"
+#include "lm-message-node.h"
+
+#define BINARY_MAGIC      "LMB"
+#define BINARY_MAGIC_LEN  3
+#define BINARY_VERSION    1
+
+enum {
+    BINARY_NODE_VALUE    = 1 << 0,
+    BINARY_NODE_RAW_MODE = 1 << 1,
+    BINARY_NODE_FLAGS    = BINARY_NODE_VALUE | BINARY_NODE_RAW_MODE
+};
+
+/* Stanzas use a handful of names, which are mostly atoms and found by
+ * pointer. Beyond this many they go into a hash table as well.
+ */
+#define BINARY_LINEAR_NAMES 32
+
+typedef struct {
+    GString    *body;
+    GPtrArray  *name_list;
+    /* Name to its index plus one, once there are many */
+    GHashTable *names;
+} BinaryWriter;
+
+typedef struct {
+    const gchar *pos;
+    const gchar *end;
+} BinaryReader;
+
+/* A node whose children are still being read */
+typedef struct {
+    LmMessageNode *node;
+    guint          n_children;
+} BinaryFrame;
+
+static inline void
+binary_put_varint (GString *out, gsize value)
+{
+    while (value >= 0x80) {
+        g_string_append_c (out, (gchar) ((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+
+    g_string_append_c (out, (gchar) value);
+}
+
+static void
+binary_put_string (GString *out, const gchar *str, gsize len)
+{
+    binary_put_varint (out, len);
+    g_string_append_len (out, str, len);
+    g_string_append_c (out, '\0');
+}
+
+static guint
+binary_find_name (BinaryWriter *writer, const gchar *name)
+{
+    const gchar **names = (const gchar **) writer->name_list->pdata;
+    guint         i;
+
+    if (writer->names) {
+        return GPOINTER_TO_UINT (g_hash_table_lookup (writer->names, name));
+    }
+
+    for (i = 0; i < writer->name_list->len; ++i) {
+        if (names[i] == name) {
+            return i + 1;
+        }
+    }
+
+    for (i = 0; i < writer->name_list->len; ++i) {
+        if (strcmp (names[i], name) == 0) {
+            return i + 1;
+        }
+    }
+
+    return 0;
+}
+
+static void
+binary_put_name (BinaryWriter *writer, const gchar *name)
+{
+    guint index;
+
+    index = binary_find_name (writer, name);
+    if (index == 0) {
+        g_ptr_array_add (writer->name_list, (gpointer) name);
+        index = writer->name_list->len;
+
+        if (writer->names) {
+            g_hash_table_insert (writer->names, (gpointer) name,
+                                 GUINT_TO_POINTER (index));
+        } else if (index == BINARY_LINEAR_NAMES) {
+            guint i;
+
+            writer->names = g_hash_table_new (g_str_hash, g_str_equal);
+            for (i = 0; i < index; ++i) {
+                g_hash_table_insert (writer->names,
+                                     writer->name_list->pdata[i],
+                                     GUINT_TO_POINTER (i + 1));
+            }
+        }
+    }
+
+    binary_put_varint (writer->body, index - 1);
+}
+
+static void
+binary_put_node (BinaryWriter *writer, LmMessageNode *node)
+{
+    LmMessageNodeAttribute *a;
+    guint                   flags = 0;
+    guint                   n_attributes = 0;
+
+    if (node->value) {
+        flags |= BINARY_NODE_VALUE;
+    }
+    if (node->raw_mode) {
+        flags |= BINARY_NODE_RAW_MODE;
+    }
+
+    binary_put_name (writer, node->name);
+    g_string_append_c (writer->body, (gchar) flags);
+
+    if (node->value) {
+        binary_put_string (writer->body, node->value, strlen (node->value));
+    }
+
+    for (a = node->attributes; a; a = a->next) {
+        n_attributes++;
+    }
+
+    binary_put_varint (writer->body, n_attributes);
+    for (a = node->attributes; a; a = a->next) {
+        binary_put_name (writer, a->name);
+        binary_put_string (writer->body, a->value, strlen (a->value));
+    }
+
+    binary_put_varint (writer->body, lm_message_node_get_n_children (node));
+}
+
+static gboolean
+binary_get_varint (BinaryReader *reader, guint *value)
+{
+    guint64 v = 0;
+    guint   shift;
+
+    for (shift = 0; shift < 35 && reader->pos < reader->end; shift += 7) {
+        guchar c = (guchar) *reader->pos++;
+
+        v |= (guint64) (c & 0x7f) << shift;
+
+        if (!(c & 0x80)) {
+            if (v > G_MAXUINT) {
+                return FALSE;
+            }
+
+            *value = (guint) v;
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+static gboolean
+binary_get_string (BinaryReader *reader, const gchar **str, guint *len)
+{
+    guint n;
+
+    if (!binary_get_varint (reader, &n) ||
+        (gsize) (reader->end - reader->pos) <= n ||
+        reader->pos[n] != '\0') {
+        return FALSE;
+    }
+
+    *str = reader->pos;
+    *len = n;
+    reader->pos += n + 1;
+
+    return TRUE;
+}
+
+static gboolean
+binary_get_name (BinaryReader  *reader,
+                 const gchar  **names,
+                 guint          n_names,
+                 const gchar  **name)
+{
+    guint index;
+
+    if (!binary_get_varint (reader, &index) || index >= n_names) {
+        return FALSE;
+    }
+
+    *name = names[index];
+
+    return TRUE;
+}
+
+/* Names with an atom have to be stored as the atom, the others stay in
+ * the buffer.
+ */
+static const gchar **
+binary_get_names (BinaryReader *reader, LmArena *arena, guint *n_names)
+{
+    const gchar **names;
+    guint         n, i;
+
+    /* Each name takes at least two bytes */
+    if (!binary_get_varint (reader, &n) ||
+        n > (gsize) (reader->end - reader->pos) / 2) {
+        return NULL;
+    }
+
+    names = _lm_arena_alloc (arena, MAX (n, 1) * sizeof (gchar *));
+
+    for (i = 0; i < n; ++i) {
+        const gchar *name;
+        const gchar *atom;
+        guint        len;
+
+        if (!binary_get_string (reader, &name, &len) || len == 0) {
+            return NULL;
+        }
+
+        atom = _lm_atom_lookup (name);
+        names[i] = atom ? atom : name;
+    }
+
+    *n_names = n;
+
+    return names;
+}
+
+static LmMessageNode *
+binary_get_node (BinaryReader  *reader,
+                 LmArena       *arena,
+                 const gchar  **names,
+                 guint          n_names,
+                 guint         *n_children)
+{
+    LmMessageNode *node;
+    const gchar   *name;
+    const gchar   *value = NULL;
+    guint          value_len = 0;
+    guint          flags;
+    guint          n_attributes;
+    guint          i;
+
+    if (!binary_get_name (reader, names, n_names, &name) ||
+        reader->pos >= reader->end) {
+        return NULL;
+    }
+
+    flags = (guchar) *reader->pos++;
+    if (flags & ~BINARY_NODE_FLAGS) {
+        return NULL;
+    }
+
+    if ((flags & BINARY_NODE_VALUE) &&
+        !binary_get_string (reader, &value, &value_len)) {
+        return NULL;
+    }
+
+    if (!binary_get_varint (reader, &n_attributes)) {
+        return NULL;
+    }
+
+    node = _lm_message_node_new_borrowed (arena, name, n_attributes);
+    node->raw_mode = (flags & BINARY_NODE_RAW_MODE) != 0;
+
+    if (value) {
+        _lm_message_node_set_borrowed_value (node, value, value_len);
+    }
+
+    for (i = 0; i < n_attributes; ++i) {
+        const gchar *attr_value;
+        guint        len;
+
+        if (!binary_get_name (reader, names, n_names, &name) ||
+            !binary_get_string (reader, &attr_value, &len)) {
+            lm_message_node_unref (node);
+            return NULL;
+        }
+
+        _lm_message_node_add_borrowed_attribute (node, name, attr_value);
+    }
+
+    if (!binary_get_varint (reader, n_children)) {
+        lm_message_node_unref (node);
+        return NULL;
+    }
+
+    return node;
+}
+
+static LmMessageNode *
+binary_get_tree (BinaryReader *reader, LmArena *arena)
+{
+    LmMessageNode  *root;
+    const gchar   **names;
+    guint           n_names;
+    GArray         *stack;
+    BinaryFrame     frame;
+
+    if (reader->end - reader->pos < BINARY_MAGIC_LEN + 1 ||
+        memcmp (reader->pos, BINARY_MAGIC, BINARY_MAGIC_LEN) != 0 ||
+        reader->pos[BINARY_MAGIC_LEN] != BINARY_VERSION) {
+        return NULL;
+    }
+    reader->pos += BINARY_MAGIC_LEN + 1;
+
+    names = binary_get_names (reader, arena, &n_names);
+    if (!names) {
+        return NULL;
+    }
+
+    root = binary_get_node (reader, arena, names, n_names, &frame.n_children);
+    if (!root) {
+        return NULL;
+    }
+
+    stack = g_array_new (FALSE, FALSE, sizeof (BinaryFrame));
+    frame.node = root;
+    g_array_append_val (stack, frame);
+
+    while (stack->len > 0) {
+        BinaryFrame   *top = &g_array_index (stack, BinaryFrame, stack->len - 1);
+        LmMessageNode *child;
+
+        if (top->n_children == 0) {
+            g_array_set_size (stack, stack->len - 1);
+            continue;
+        }
+        top->n_children--;
+
+        child = binary_get_node (reader, arena, names, n_names,
+                                 &frame.n_children);
+        if (!child) {
+            break;
+        }
+
+        _lm_message_node_add_child_node (top->node, child);
+        lm_message_node_unref (child);
+
+        if (frame.n_children > 0) {
+            frame.node = child;
+            g_array_append_val (stack, frame);
+        }
+    }
+
+    if (stack->len > 0 || reader->pos != reader->end) {
+        lm_message_node_unref (root);
+        root = NULL;
+    }
+
+    g_array_free (stack, TRUE);
+
+    return root;
+}
+
+/**
+ * lm_message_node_to_binary:
+ * @node: an #LmMessageNode
+ *
+ * Writes @node and everything below it in a compact binary form, which
+ * lm_message_node_new_from_binary() reads back much faster than the XML
+ * could be parsed. Names are only written once, values are written as
+ * they are without any escaping. The form is meant for storing stanzas
+ * or passing them between processes, not for sending to a server.
+ *
+ * Return value: the binary form of @node
+ *
+ * Since 1.5.5
+ **/
+GBytes *
+lm_message_node_to_binary (LmMessageNode *node)
+{
+    BinaryWriter   writer;
+    LmMessageNode *n;
+    GString       *out;
+    guint          i;
+
+    g_return_val_if_fail (node != NULL, NULL);
+
+    writer.body = g_string_sized_new (256);
+    writer.name_list = g_ptr_array_sized_new (16);
+    writer.names = NULL;
+
+    /* Document order without recursing, the parent pointers lead back */
+    n = node;
+    for (;;) {
+        LmMessageNode *child;
+
+        binary_put_node (&writer, n);
+
+        child = lm_message_node_get_children (n);
+        if (child) {
+            n = child;
+            continue;
+        }
+
+        while (n != node && !n->next) {
+            n = n->parent;
+        }
+        if (n == node) {
+            break;
+        }
+        n = n->next;
+    }
+
+    out = g_string_sized_new (writer.body->len + 16 * writer.name_list->len + 16);
+    g_string_append_len (out, BINARY_MAGIC, BINARY_MAGIC_LEN);
+    g_string_append_c (out, BINARY_VERSION);
+
+    binary_put_varint (out, writer.name_list->len);
+    for (i = 0; i < writer.name_list->len; ++i) {
+        const gchar *name = g_ptr_array_index (writer.name_list, i);
+
+        binary_put_string (out, name, strlen (name));
+    }
+
+    g_string_append_len (out, writer.body->str, writer.body->len);
+
+    g_string_free (writer.body, TRUE);
+    if (writer.names) {
+        g_hash_table_destroy (writer.names);
+    }
+    g_ptr_array_free (writer.name_list, TRUE);
+
+    return g_string_free_to_bytes (out);
+}
+
+/**
+ * lm_message_node_new_from_binary:
+ * @bytes: what lm_message_node_to_binary() returned
+ * @error: location to store error, or %NULL
+ *
+ * Reads back a node tree written by lm_message_node_to_binary(). Nothing
+ * is copied, the nodes point right into @bytes which they keep alive
+ * between them, so @bytes can just as well wrap a mapped file. The nodes
+ * can be changed like any others, new strings are stored apart from
+ * @bytes.
+ *
+ * All of @bytes is checked to hold a well formed tree. The strings in it
+ * are taken as they are though, so @bytes should come from a trusted
+ * source.
+ *
+ * Return value: the root node of the tree, or %NULL if @bytes can't be
+ * read.
+ *
+ * Since 1.5.5
+ **/
+LmMessageNode *
+lm_message_node_new_from_binary (GBytes *bytes, GError **error)
+{
+    LmMessageNode *node;
+    BinaryReader   reader;
+    LmArena       *arena;
+    gsize          size;
+
+    g_return_val_if_fail (bytes != NULL, NULL);
+
+    reader.pos = g_bytes_get_data (bytes, &size);
+    reader.end = reader.pos + size;
+
+    /* The nodes are about the size of what they were read from */
+    arena = _lm_arena_new (MIN (size * 2, 64 * 1024));
+    _lm_arena_add_notify (arena, (GDestroyNotify) g_bytes_unref,
+                          g_bytes_ref (bytes));
+
+    node = binary_get_tree (&reader, arena);
+    _lm_arena_unref (arena);
+
+    if (!node) {
+        g_set_error (error,
+                     LM_ERROR,
+                     LM_ERROR_INVALID_BINARY,
+                     "Not a valid binary node tree");
+    }
+
+    return node;
+}
+
+/**
+ * lm_message_new_from_binary:
+ * @bytes: the binary form of the node of a message
+ * @error: location to store error, or %NULL
+ *
+ * Reads back a message whose node was written with
+ * lm_message_node_to_binary(), see lm_message_node_new_from_binary().
+ *
+ * Return value: a newly created #LmMessage, or %NULL if @bytes can't be
+ * read or doesn't hold a stanza.
+ *
+ * Since 1.5.5
+ **/
+LmMessage *
+lm_message_new_from_binary (GBytes *bytes, GError **error)
+{
+    LmMessageNode *node;
+    LmMessage     *message;
+
+    g_return_val_if_fail (bytes != NULL, NULL);
+
+    node = lm_message_node_new_from_binary (bytes, error);
+    if (!node) {
+        return NULL;
+    }
+
+    message = _lm_message_new_from_node (node);
+    lm_message_node_unref (node);
+
+    if (!message) {
+        g_set_error (error,
+                     LM_ERROR,
+                     LM_ERROR_INVALID_BINARY,
+                     "Not a stanza");
+    }
+
+    return message;
+}
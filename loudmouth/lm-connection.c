@@ -95,6 +95,7 @@
 #include "lm-utils.h"
 #include "lm-old-socket.h"
 #include "lm-sasl.h"
+#include "lm-send-queue.h"
 
 typedef struct {
     LmHandlerPriority  priority;
@@ -139,6 +140,24 @@ struct _LmConnection {
     LmCallback        *disconnect_cb;
 
     LmMessageQueue    *queue;
+    LmCallback        *lane_cb;
+
+    /* Reading stops when the queue goes over either high mark and starts
+     * again once it's down to both low marks, 0 for no limit.
+     */
+    guint              queue_high_messages;
+    guint              queue_low_messages;
+    gsize              queue_high_bytes;
+    gsize              queue_low_bytes;
+    gboolean           reading_paused;
+    /* Calls waiting for a reply, which has to be read whatever the queue
+     * holds. They can be nested, one can start from a source dispatched
+     * while another waits.
+     */
+    guint              blocking;
+    LmCallback        *backpressure_cb;
+    /* Read but not counted in any message yet */
+    gsize              in_bytes;
 
     LmConnectionState  state;
 
@@ -146,15 +165,43 @@ struct _LmConnection {
     guint              keep_alive_rate;
     LmFeaturePing     *feature_ping;
 
+    gboolean           lazy_parsing;
+
+    /* Incoming stanzas going over these are dropped, 0 for no limit */
+    gsize              max_stanza_size;
+    guint              max_stanza_depth;
+    guint              max_stanza_attributes;
+    gsize              max_stanza_text;
+    LmCallback        *stanza_limit_cb;
+
+    /* Reused for serializing every outgoing stanza */
+    GString           *send_buffer;
+
+    /* Stanzas sent from other threads, written out by the context's */
+    LmSendQueue       *send_queue;
+
     gint               ref_count;
 };
 
+/* Key of the reply handlers. The hash of the id of an incoming stanza is
+ * worked out when its id is set, so looking up its handler doesn't go over
+ * the id again. The key keeps it as well, so that the table doesn't go
+ * over the ids when it grows.
+ */
+typedef struct {
+    guint        hash;
+    const gchar *id;
+} ReplyId;
+
 typedef enum {
     AUTH_TYPE_PLAIN  = 1,
     AUTH_TYPE_DIGEST = 2,
     AUTH_TYPE_0K     = 4
 } AuthType;
 
+/* Send buffers that grew beyond this for a big stanza aren't kept */
+#define SEND_BUFFER_KEEP_SIZE (64 * 1024)
+
 #define XMPP_NS_BIND "urn:ietf:params:xml:ns:xmpp-bind"
 #define XMPP_NS_SESSION "urn:ietf:params:xml:ns:xmpp-session"
 #define XMPP_NS_STARTTLS "urn:ietf:params:xml:ns:xmpp-tls"
@@ -165,6 +212,10 @@ static void     connection_handle_message    (LmConnection        *connection,
 static void     connection_new_message_cb    (LmParser            *parser,
                                               LmMessage           *message,
                                               LmConnection        *connection);
+static void     connection_stanza_limit_cb   (LmParser            *parser,
+                                              LmStanzaLimit        limit,
+                                              const gchar         *name,
+                                              LmConnection        *connection);
 static gboolean connection_do_open           (LmConnection        *connection,
                                               GError             **error);
 void            connection_do_close          (LmConnection        *connection);
@@ -206,6 +257,7 @@ connection_signal_disconnect                 (LmConnection        *connection,
                                               LmDisconnectReason   reason);
 static void     connection_incoming_data     (LmOldSocket         *socket,
                                               const gchar         *buf,
+                                              gsize                len,
                                               LmConnection        *connection);
 static void     connection_socket_closed_cb  (LmOldSocket            *socket,
                                               LmDisconnectReason   reason,
@@ -286,13 +338,24 @@ connection_free (LmConnection *connection)
     }
 
     lm_connection_set_disconnect_function (connection, NULL, NULL, NULL);
+    lm_connection_set_stanza_limit_function (connection, NULL, NULL, NULL);
+    lm_connection_set_lane_function (connection, NULL, NULL, NULL);
+    lm_connection_set_backpressure_function (connection, NULL, NULL, NULL);
 
     if (connection->proxy) {
         lm_proxy_unref (connection->proxy);
     }
 
+    /* Stops a batch being dispatched from going on with the next message */
+    lm_message_queue_detach (connection->queue);
     lm_message_queue_unref (connection->queue);
 
+    lm_send_queue_free (connection->send_queue);
+
+    if (connection->send_buffer) {
+        g_string_free (connection->send_buffer, TRUE);
+    }
+
     if (connection->context) {
         g_main_context_unref (connection->context);
     }
@@ -304,27 +367,64 @@ connection_free (LmConnection *connection)
     g_slice_free (LmConnection, connection);
 }
 
+/* The id is copied into the same block, freed with g_free() */
+static ReplyId *
+reply_id_new (const gchar *id)
+{
+    ReplyId *reply_id;
+    gsize    len = strlen (id);
+
+    reply_id = g_malloc (sizeof (ReplyId) + len + 1);
+    reply_id->hash = g_str_hash (id);
+    reply_id->id = memcpy (reply_id + 1, id, len + 1);
+
+    return reply_id;
+}
+
+static guint
+reply_id_hash (gconstpointer key)
+{
+    return ((const ReplyId *) key)->hash;
+}
+
+static gboolean
+reply_id_equal (gconstpointer a, gconstpointer b)
+{
+    const ReplyId *id_a = a;
+    const ReplyId *id_b = b;
+
+    return id_a->hash == id_b->hash && strcmp (id_a->id, id_b->id) == 0;
+}
+
 static LmHandlerResult
 connection_run_message_handler (LmConnection *connection, LmMessage *m)
 {
     LmMessageHandler *handler;
-    const gchar      *id;
-    LmHandlerResult   result = LM_HANDLER_RESULT_ALLOW_MORE_HANDLERS;
+    ReplyId           key;
+    gpointer          orig_key;
+    gpointer          value;
+    LmHandlerResult   result;
 
-    id = lm_message_node_get_attribute (m->node, "id");
-    if (!id) {
+    key.id = lm_message_get_id (m);
+    if (!key.id) {
         return LM_HANDLER_RESULT_ALLOW_MORE_HANDLERS;
     }
+    key.hash = _lm_message_get_id_hash (m);
 
-    handler = g_hash_table_lookup (connection->id_handlers, id);
-    if (handler) {
-        result = _lm_message_handler_handle_message (handler,
-                                                     connection,
-                                                     m);
-        g_hash_table_remove (connection->id_handlers,
-                             id);
+    if (!g_hash_table_lookup_extended (connection->id_handlers, &key,
+                                       &orig_key, &value)) {
+        return LM_HANDLER_RESULT_ALLOW_MORE_HANDLERS;
     }
 
+    /* Replies are only handled once, the handler is done with it before
+     * it runs and can't change what is removed.
+     */
+    handler = lm_message_handler_ref (value);
+    g_hash_table_remove (connection->id_handlers, orig_key);
+
+    result = _lm_message_handler_handle_message (handler, connection, m);
+    lm_message_handler_unref (handler);
+
     return result;
 }
 
@@ -371,16 +471,73 @@ connection_handle_message (LmConnection *connection, LmMessage *m)
     return;
 }
 
+/* Tells the socket and whoever listens for it */
+static void
+connection_set_reading_paused (LmConnection *connection, gboolean paused)
+{
+    lm_verbose ("%s reading, %u messages of %u bytes queued\n",
+                paused ? "Pausing" : "Resuming",
+                lm_message_queue_get_length (connection->queue),
+                (guint) lm_message_queue_get_size (connection->queue));
+
+    connection->reading_paused = paused;
+    if (connection->socket) {
+        lm_old_socket_set_reading (connection->socket, !paused);
+    }
+
+    if (connection->backpressure_cb && connection->backpressure_cb->func) {
+        LmCallback *cb = connection->backpressure_cb;
+
+        lm_connection_ref (connection);
+        (* ((LmBackpressureFunction) cb->func)) (connection, paused,
+                                                 cb->user_data);
+        lm_connection_unref (connection);
+    }
+}
+
+/* Pauses or resumes reading from the socket as the queue goes over the
+ * high marks or back down to the low ones.
+ */
+static void
+connection_update_reading (LmConnection *connection)
+{
+    guint    length;
+    gsize    size;
+    gboolean paused;
+
+    length = lm_message_queue_get_length (connection->queue);
+    size = lm_message_queue_get_size (connection->queue);
+
+    if (connection->blocking > 0) {
+        paused = FALSE;
+    } else if (!connection->reading_paused) {
+        paused = (connection->queue_high_messages > 0 &&
+                  length >= connection->queue_high_messages) ||
+                 (connection->queue_high_bytes > 0 &&
+                  size >= connection->queue_high_bytes);
+    } else {
+        paused = !((connection->queue_high_messages == 0 ||
+                    length <= connection->queue_low_messages) &&
+                   (connection->queue_high_bytes == 0 ||
+                    size <= connection->queue_low_bytes));
+    }
+
+    if (paused != connection->reading_paused) {
+        connection_set_reading_paused (connection, paused);
+    }
+}
+
 static void
 connection_new_message_cb (LmParser     *parser,
                            LmMessage    *m,
                            LmConnection *connection)
 {
-    const gchar *from;
+    const gchar   *from;
+    LmMessageLane  lane = LM_MESSAGE_LANE_NORMAL;
 
     lm_message_ref (m);
 
-    from = lm_message_node_get_attribute (m->node, "from");
+    from = lm_message_get_from (m);
     if (!from) {
         from = "unknown";
     }
@@ -389,7 +546,41 @@ connection_new_message_cb (LmParser     *parser,
                 _lm_message_type_to_string (lm_message_get_type (m)),
                 from);
 
-    lm_message_queue_push_tail (connection->queue, m);
+    if (connection->lane_cb && connection->lane_cb->func) {
+        LmCallback *cb = connection->lane_cb;
+
+        lane = (* ((LmLaneFunction) cb->func)) (connection, m, cb->user_data);
+        if ((guint) lane > LM_MESSAGE_LANE_LOW) {
+            g_warning ("Lane %d is out of range", lane);
+            lane = LM_MESSAGE_LANE_NORMAL;
+        }
+    }
+
+    /* Messages are charged for the reads they were completed in, which
+     * adds up to what was read but can be off by a read for each one.
+     */
+    lm_message_queue_push (connection->queue, m, lane, connection->in_bytes);
+    connection->in_bytes = 0;
+
+    connection_update_reading (connection);
+}
+
+static void
+connection_stanza_limit_cb (LmParser      *parser,
+                            LmStanzaLimit  limit,
+                            const gchar   *name,
+                            LmConnection  *connection)
+{
+    lm_verbose ("Dropped incoming stanza %s\n", name ? name : "");
+
+    if (connection->stanza_limit_cb && connection->stanza_limit_cb->func) {
+        LmCallback *cb = connection->stanza_limit_cb;
+
+        lm_connection_ref (connection);
+        (* ((LmStanzaLimitFunction) cb->func)) (connection, limit, name,
+                                                cb->user_data);
+        lm_connection_unref (connection);
+    }
 }
 
 static void
@@ -487,14 +678,58 @@ connection_send (LmConnection  *connection,
     return TRUE;
 }
 
+/* Taken out while in use in case sending ends up in here again */
+static GString *
+connection_take_send_buffer (LmConnection *connection)
+{
+    GString *buffer = connection->send_buffer;
+
+    connection->send_buffer = NULL;
+
+    if (buffer) {
+        g_string_truncate (buffer, 0);
+    } else {
+        buffer = g_string_sized_new (1024);
+    }
+
+    return buffer;
+}
+
+static void
+connection_return_send_buffer (LmConnection *connection, GString *buffer)
+{
+    if (connection->send_buffer == NULL &&
+        buffer->allocated_len <= SEND_BUFFER_KEEP_SIZE) {
+        connection->send_buffer = buffer;
+    } else {
+        g_string_free (buffer, TRUE);
+    }
+}
+
+static void
+connection_send_queue_cb (LmSendQueue  *queue,
+                          const gchar  *buf,
+                          gsize         len,
+                          LmConnection *connection)
+{
+    GError *error = NULL;
+
+    if (!connection_send (connection, buf, len, &error)) {
+        lm_verbose ("Dropped stanzas sent from another thread: %s\n",
+                    error->message);
+        g_error_free (error);
+    }
+}
+
 static void
 connection_message_queue_cb (LmMessageQueue *queue, LmConnection *connection)
 {
     LmMessage *m;
 
-    m = lm_message_queue_pop_nth (connection->queue, 0);
+    m = lm_message_queue_pop_next (connection->queue);
 
     if (m) {
+        connection_update_reading (connection);
         connection_handle_message (connection, m);
         lm_message_unref (m);
     }
@@ -556,6 +791,14 @@ connection_do_close (LmConnection *connection)
 
     lm_message_queue_detach (connection->queue);
 
+    /* Whatever comes next is read from a new socket, which starts out
+     * reading until the queue is looked at once it's connected.
+     */
+    if (connection->reading_paused) {
+        connection_set_reading_paused (connection, FALSE);
+    }
+    connection->in_bytes = 0;
+
     if (!lm_connection_is_open (connection)) {
         /* lm_connection_is_open is FALSE for state OPENING as well */
         connection->state = LM_CONNECTION_STATE_CLOSED;
@@ -877,9 +1120,11 @@ connection_signal_disconnect (LmConnection       *connection,
 static void
 connection_incoming_data (LmOldSocket  *socket,
                           const gchar  *buf,
+                          gsize         len,
                           LmConnection *connection)
 {
-    lm_parser_parse (connection->parser, buf);
+    connection->in_bytes += len;
+    lm_parser_parse_len (connection->parser, buf, len);
 }
 
 static void
@@ -919,6 +1164,8 @@ connection_socket_connect_cb (LmOldSocket  *socket,
         }
 
     } else {
+        /* The queue may still be over the high marks from before */
+        connection_update_reading (connection);
         connection_send_stream_header (connection);
     }
 }
@@ -994,6 +1241,54 @@ _lm_connection_get_server (LmConnection *conn)
     return server;
 }
 
+/* Reading has to go on while waiting for a reply, whatever the queue
+ * holds. Every call with @blocking set has to be matched by one without,
+ * reading can only be paused again once the outermost wait is over.
+ */
+void
+_lm_connection_set_blocking (LmConnection *conn, gboolean blocking)
+{
+    g_return_if_fail (conn != NULL);
+
+    if (blocking) {
+        conn->blocking++;
+    } else {
+        g_return_if_fail (conn->blocking > 0);
+        conn->blocking--;
+    }
+
+    connection_update_reading (conn);
+}
+
+gboolean
+_lm_connection_get_reading_paused (LmConnection *conn)
+{
+    g_return_val_if_fail (conn != NULL, FALSE);
+
+    return conn->reading_paused;
+}
+
+/* The tests stand in for the socket and the source of the queue with
+ * these two.
+ */
+void
+_lm_connection_incoming_data (LmConnection *conn,
+                              const gchar  *buf,
+                              gsize         len)
+{
+    g_return_if_fail (conn != NULL);
+
+    connection_incoming_data (conn->socket, buf, len, conn);
+}
+
+void
+_lm_connection_handle_next (LmConnection *conn)
+{
+    g_return_if_fail (conn != NULL);
+
+    connection_message_queue_cb (conn->queue, conn);
+}
+
 static LmHandlerResult
 connection_bind_reply (LmMessageHandler *handler,
                        LmConnection     *connection,
@@ -1096,7 +1391,7 @@ connection_features_cb (LmMessageHandler *handler,
         int               result;
 
         ns = lm_message_node_get_attribute (bind_node, "xmlns");
-        if (!ns || strcmp (ns, XMPP_NS_BIND) != 0) {
+        if (_lm_atom_lookup (ns) != LM_ATOM (NS_BIND)) {
             return LM_HANDLER_RESULT_ALLOW_MORE_HANDLERS;
         }
 
@@ -1170,6 +1465,23 @@ connection_features_cb (LmMessageHandler *handler,
  **/
 LmConnection *
 lm_connection_new (const gchar *server)
+{
+    return lm_connection_new_with_context (server, NULL);
+}
+
+/**
+ * lm_connection_new_with_context:
+ * @server: The hostname to the server for the connection.
+ * @context: The context this connection should be running in.
+ *
+ * Creates a new closed connection running in a certain context. To open the
+ * connection call #lm_connection_open. @server can be #NULL but must be set
+ * before calling #lm_connection_open.
+ *
+ * Return value: A newly created LmConnection, should be unreffed with lm_connection_unref().
+ **/
+LmConnection *
+lm_connection_new_with_context (const gchar *server, GMainContext *context)
 {
     LmConnection *connection;
     gint          i;
@@ -1191,8 +1503,16 @@ lm_connection_new (const gchar *server)
                                                           connection);
     connection->state       = LM_CONNECTION_STATE_CLOSED;
 
-    connection->id_handlers = g_hash_table_new_full (g_str_hash,
-                                                     g_str_equal,
+    if (context) {
+        connection->context = g_main_context_ref (context);
+    }
+
+    connection->send_queue  = lm_send_queue_new (context,
+                                                 (LmSendQueueFunction) connection_send_queue_cb,
+                                                 connection);
+
+    connection->id_handlers = g_hash_table_new_full (reply_id_hash,
+                                                     reply_id_equal,
                                                      g_free,
                                                      (GDestroyNotify) lm_message_handler_unref);
     connection->ref_count   = 1;
@@ -1204,32 +1524,9 @@ lm_connection_new (const gchar *server)
     connection->parser = lm_parser_new
         ((LmParserMessageFunction) connection_new_message_cb,
          connection, NULL);
-
-    return connection;
-}
-
-/**
- * lm_connection_new_with_context:
- * @server: The hostname to the server for the connection.
- * @context: The context this connection should be running in.
- *
- * Creates a new closed connection running in a certain context. To open the
- * connection call #lm_connection_open. @server can be #NULL but must be set
- * before calling #lm_connection_open.
- *
- * Return value: A newly created LmConnection, should be unreffed with lm_connection_unref().
- **/
-LmConnection *
-lm_connection_new_with_context (const gchar *server, GMainContext *context)
-{
-    LmConnection *connection;
-
-    connection = lm_connection_new (server);
-    connection->context = context;
-
-    if (context) {
-        g_main_context_ref (connection->context);
-    }
+    _lm_parser_set_limit_function
+        (connection->parser,
+         (LmParserLimitFunction) connection_stanza_limit_cb, connection);
 
     return connection;
 }
@@ -1567,6 +1864,446 @@ lm_connection_get_keep_alive_rate (LmConnection *connection)
     return connection->keep_alive_rate;
 }
 
+/**
+ * lm_connection_get_lazy_parsing:
+ * @connection: an #LmConnection
+ *
+ * Checks whether the children of incoming stanzas are built on demand.
+ *
+ * Return value: %TRUE if lazy parsing is enabled
+ *
+ * Since 1.5.5
+ **/
+gboolean
+lm_connection_get_lazy_parsing (LmConnection *connection)
+{
+    g_return_val_if_fail (connection != NULL, FALSE);
+
+    return connection->lazy_parsing;
+}
+
+/**
+ * lm_connection_set_lazy_parsing:
+ * @connection: an #LmConnection
+ * @lazy: whether to build the children of incoming stanzas on demand
+ *
+ * With lazy parsing only the top element of incoming message, presence
+ * and iq stanzas is built straight away, with its attributes. Its
+ * children are built the first time they are asked for through
+ * lm_message_node_get_child(), lm_message_node_find_child() or
+ * lm_message_node_get_children(), which saves most of the work for
+ * stanzas that handlers only route on. A stanza that nobody looked
+ * inside is turned back into the exact text it arrived as by
+ * lm_message_node_to_string().
+ *
+ * Handlers reading the children field of the stanza node directly will
+ * find it empty, so this is off by default.
+ *
+ * Since 1.5.5
+ **/
+void
+lm_connection_set_lazy_parsing (LmConnection *connection, gboolean lazy)
+{
+    g_return_if_fail (connection != NULL);
+
+    connection->lazy_parsing = lazy;
+    _lm_parser_set_lazy (connection->parser, lazy);
+}
+
+/**
+ * lm_connection_get_stanza_limits:
+ * @connection: an #LmConnection
+ * @max_size: return location for the largest stanza size or %NULL
+ * @max_depth: return location for the deepest nesting or %NULL
+ * @max_attributes: return location for the most attributes or %NULL
+ * @max_text: return location for the most text in an element or %NULL
+ *
+ * Gets the limits set with lm_connection_set_stanza_limits().
+ *
+ * Since 1.5.5
+ **/
+void
+lm_connection_get_stanza_limits (LmConnection *connection,
+                                 gsize        *max_size,
+                                 guint        *max_depth,
+                                 guint        *max_attributes,
+                                 gsize        *max_text)
+{
+    g_return_if_fail (connection != NULL);
+
+    if (max_size) {
+        *max_size = connection->max_stanza_size;
+    }
+    if (max_depth) {
+        *max_depth = connection->max_stanza_depth;
+    }
+    if (max_attributes) {
+        *max_attributes = connection->max_stanza_attributes;
+    }
+    if (max_text) {
+        *max_text = connection->max_stanza_text;
+    }
+}
+
+/**
+ * lm_connection_set_stanza_limits:
+ * @connection: an #LmConnection
+ * @max_size: the largest size of a stanza in bytes, tags included
+ * @max_depth: the deepest nesting of elements, the stanza element being 1
+ * @max_attributes: the most attributes on any element of a stanza
+ * @max_text: the most bytes of text directly in any element of a stanza
+ *
+ * Puts a ceiling on the memory an incoming stanza can take. A stanza going
+ * over any of the limits is dropped, the rest of it is read without being
+ * kept and the connection carries on with the next one. The function set
+ * with lm_connection_set_stanza_limit_function() is called for every
+ * dropped stanza. Passing 0 turns a limit off, all of them are off by
+ * default.
+ *
+ * The size is checked as data is read from the socket, so a stanza may go
+ * over it by one read before it's dropped. Limits are not supported when
+ * built with the GMarkup parser.
+ *
+ * Since 1.5.5
+ **/
+void
+lm_connection_set_stanza_limits (LmConnection *connection,
+                                 gsize         max_size,
+                                 guint         max_depth,
+                                 guint         max_attributes,
+                                 gsize         max_text)
+{
+    g_return_if_fail (connection != NULL);
+
+    connection->max_stanza_size = max_size;
+    connection->max_stanza_depth = max_depth;
+    connection->max_stanza_attributes = max_attributes;
+    connection->max_stanza_text = max_text;
+
+    _lm_parser_set_limits (connection->parser, max_size, max_depth,
+                           max_attributes, max_text);
+}
+
+/**
+ * lm_connection_set_stanza_limit_function:
+ * @connection: an #LmConnection
+ * @function: Function to be called when a stanza is dropped.
+ * @user_data: User data passed to @function.
+ * @notify: Function that will be called with @user_data when @user_data needs to be freed. Pass #NULL if it shouldn't be freed.
+ *
+ * Set the callback that will be called when an incoming stanza goes over
+ * one of the limits set with lm_connection_set_stanza_limits().
+ *
+ * Since 1.5.5
+ **/
+void
+lm_connection_set_stanza_limit_function (LmConnection          *connection,
+                                         LmStanzaLimitFunction  function,
+                                         gpointer               user_data,
+                                         GDestroyNotify         notify)
+{
+    g_return_if_fail (connection != NULL);
+
+    if (connection->stanza_limit_cb) {
+        _lm_utils_free_callback (connection->stanza_limit_cb);
+    }
+
+    if (function) {
+        connection->stanza_limit_cb = _lm_utils_new_callback (function,
+                                                              user_data,
+                                                              notify);
+    } else {
+        connection->stanza_limit_cb = NULL;
+    }
+}
+
+/**
+ * lm_connection_get_dispatch_budget:
+ * @connection: an #LmConnection
+ * @max_messages: return location for the most messages in a batch or %NULL
+ * @max_time: return location for the longest a batch may take or %NULL
+ * @fair: return location for whether other sources get a turn or %NULL
+ *
+ * Gets the budget set with lm_connection_set_dispatch_budget().
+ *
+ * Since 1.5.5
+ **/
+void
+lm_connection_get_dispatch_budget (LmConnection *connection,
+                                   guint        *max_messages,
+                                   gint64       *max_time,
+                                   gboolean     *fair)
+{
+    g_return_if_fail (connection != NULL);
+
+    lm_message_queue_get_budget (connection->queue, max_messages,
+                                 max_time, fair);
+}
+
+/**
+ * lm_connection_set_dispatch_budget:
+ * @connection: an #LmConnection
+ * @max_messages: the most incoming messages to handle in one batch
+ * @max_time: the time in microseconds after which no more messages of a
+ * batch are handled
+ * @fair: whether the other sources of the main context get a turn after a
+ * batch that ran out of budget
+ *
+ * Incoming messages can be handled in batches, so that a read with many
+ * stanzas in it doesn't cost an iteration of the main loop for each one.
+ * A batch ends when the messages read so far are all handled or when one
+ * of the limits is reached. Passing 0 turns a limit off, the default is
+ * one message per iteration with no time limit.
+ *
+ * Messages are handled at the default priority, which keeps sources of a
+ * lower priority waiting for as long as messages keep coming. With @fair
+ * set the connection sits out one iteration of the main loop after a
+ * batch that left messages behind, letting any source run in between.
+ *
+ * Since 1.5.5
+ **/
+void
+lm_connection_set_dispatch_budget (LmConnection *connection,
+                                   guint         max_messages,
+                                   gint64        max_time,
+                                   gboolean      fair)
+{
+    g_return_if_fail (connection != NULL);
+
+    lm_message_queue_set_budget (connection->queue, max_messages,
+                                 max_time, fair);
+}
+
+/**
+ * lm_connection_get_queue_stats:
+ * @connection: an #LmConnection
+ * @length: return location for the number of messages waiting or %NULL
+ * @max_length: return location for the most messages that were ever
+ * waiting at once or %NULL
+ * @last_latency: return location for the time the last handled message
+ * waited, in microseconds, or %NULL
+ * @max_latency: return location for the longest any message waited, in
+ * microseconds, or %NULL
+ *
+ * Gets counters for the queue of incoming messages, which are waiting
+ * there from being parsed until they are handled.
+ *
+ * Since 1.5.5
+ **/
+void
+lm_connection_get_queue_stats (LmConnection *connection,
+                               guint        *length,
+                               guint        *max_length,
+                               guint64      *last_latency,
+                               guint64      *max_latency)
+{
+    gint64 last, max;
+
+    g_return_if_fail (connection != NULL);
+
+    lm_message_queue_get_stats (connection->queue, max_length, &last, &max);
+
+    if (length) {
+        *length = lm_message_queue_get_length (connection->queue);
+    }
+    if (last_latency) {
+        *last_latency = last;
+    }
+    if (max_latency) {
+        *max_latency = max;
+    }
+}
+
+/**
+ * lm_connection_set_lane_function:
+ * @connection: an #LmConnection
+ * @function: Function choosing the lane of each incoming message, or %NULL.
+ * @user_data: User data passed to @function.
+ * @notify: Function that will be called with @user_data when @user_data needs to be freed. Pass #NULL if it shouldn't be freed.
+ *
+ * Set the callback that puts each incoming message in one of the lanes of
+ * #LmMessageLane. Messages are handled from the highest lane that has any,
+ * in the order they came in within a lane. So that a lower lane doesn't
+ * starve, it gets one message handled after being passed over eight
+ * times while it had messages waiting.
+ *
+ * Without a function all messages go to %LM_MESSAGE_LANE_NORMAL and are
+ * handled in the order they came in. lm_connection_lane_by_type() can be
+ * used as @function.
+ *
+ * Since 1.5.5
+ **/
+void
+lm_connection_set_lane_function (LmConnection   *connection,
+                                 LmLaneFunction  function,
+                                 gpointer        user_data,
+                                 GDestroyNotify  notify)
+{
+    g_return_if_fail (connection != NULL);
+
+    if (connection->lane_cb) {
+        _lm_utils_free_callback (connection->lane_cb);
+    }
+
+    if (function) {
+        connection->lane_cb = _lm_utils_new_callback (function,
+                                                      user_data,
+                                                      notify);
+    } else {
+        connection->lane_cb = NULL;
+    }
+}
+
+/**
+ * lm_connection_lane_by_type:
+ * @connection: an #LmConnection
+ * @message: an incoming message
+ * @user_data: not used
+ *
+ * A #LmLaneFunction putting replies to IQ requests and the elements of
+ * the stream itself in %LM_MESSAGE_LANE_HIGH, presence in
+ * %LM_MESSAGE_LANE_LOW and everything else, messages and IQ requests, in
+ * %LM_MESSAGE_LANE_NORMAL.
+ *
+ * Returns: the lane for @message
+ *
+ * Since 1.5.5
+ **/
+LmMessageLane
+lm_connection_lane_by_type (LmConnection *connection,
+                            LmMessage    *message,
+                            gpointer      user_data)
+{
+    g_return_val_if_fail (message != NULL, LM_MESSAGE_LANE_NORMAL);
+
+    switch (lm_message_get_type (message)) {
+    case LM_MESSAGE_TYPE_IQ:
+        switch (lm_message_get_sub_type (message)) {
+        case LM_MESSAGE_SUB_TYPE_RESULT:
+        case LM_MESSAGE_SUB_TYPE_ERROR:
+            return LM_MESSAGE_LANE_HIGH;
+        default:
+            return LM_MESSAGE_LANE_NORMAL;
+        }
+    case LM_MESSAGE_TYPE_MESSAGE:
+    case LM_MESSAGE_TYPE_UNKNOWN:
+        return LM_MESSAGE_LANE_NORMAL;
+    case LM_MESSAGE_TYPE_PRESENCE:
+        return LM_MESSAGE_LANE_LOW;
+    default:
+        return LM_MESSAGE_LANE_HIGH;
+    }
+}
+
+/**
+ * lm_connection_get_queue_limits:
+ * @connection: an #LmConnection
+ * @high_messages: return location for the high mark in messages, or %NULL
+ * @low_messages: return location for the low mark in messages, or %NULL
+ * @high_bytes: return location for the high mark in bytes, or %NULL
+ * @low_bytes: return location for the low mark in bytes, or %NULL
+ *
+ * Gets the marks set with lm_connection_set_queue_limits().
+ *
+ * Since 1.5.5
+ **/
+void
+lm_connection_get_queue_limits (LmConnection *connection,
+                                guint        *high_messages,
+                                guint        *low_messages,
+                                gsize        *high_bytes,
+                                gsize        *low_bytes)
+{
+    g_return_if_fail (connection != NULL);
+
+    if (high_messages) {
+        *high_messages = connection->queue_high_messages;
+    }
+    if (low_messages) {
+        *low_messages = connection->queue_low_messages;
+    }
+    if (high_bytes) {
+        *high_bytes = connection->queue_high_bytes;
+    }
+    if (low_bytes) {
+        *low_bytes = connection->queue_low_bytes;
+    }
+}
+
+/**
+ * lm_connection_set_queue_limits:
+ * @connection: an #LmConnection
+ * @high_messages: number of waiting messages at which reading stops, 0 for no limit
+ * @low_messages: number of waiting messages at which reading starts again
+ * @high_bytes: size of the waiting messages at which reading stops, 0 for no limit
+ * @low_bytes: size of the waiting messages at which reading starts again
+ *
+ * Bounds the queue of incoming messages waiting to be handled. Once the
+ * queue reaches either high mark @connection stops reading from the
+ * server, which makes TCP flow control slow the server down, until the
+ * queue is down to the low marks again. Sizes are those of the messages
+ * as they were read. The function set with
+ * lm_connection_set_backpressure_function() is told each time reading
+ * stops or starts again.
+ *
+ * Reading goes on regardless while lm_connection_send_with_reply_and_block()
+ * waits for its reply. There are no limits by default.
+ *
+ * Since 1.5.5
+ **/
+void
+lm_connection_set_queue_limits (LmConnection *connection,
+                                guint         high_messages,
+                                guint         low_messages,
+                                gsize         high_bytes,
+                                gsize         low_bytes)
+{
+    g_return_if_fail (connection != NULL);
+    g_return_if_fail (low_messages <= high_messages);
+    g_return_if_fail (low_bytes <= high_bytes);
+
+    connection->queue_high_messages = high_messages;
+    connection->queue_low_messages = low_messages;
+    connection->queue_high_bytes = high_bytes;
+    connection->queue_low_bytes = low_bytes;
+
+    connection_update_reading (connection);
+}
+
+/**
+ * lm_connection_set_backpressure_function:
+ * @connection: an #LmConnection
+ * @function: Function to be called when reading stops or starts again.
+ * @user_data: User data passed to @function.
+ * @notify: Function that will be called with @user_data when @user_data needs to be freed. Pass #NULL if it shouldn't be freed.
+ *
+ * Set the callback that will be called each time the queue of incoming
+ * messages goes over the limits set with lm_connection_set_queue_limits()
+ * and when it's back under them.
+ *
+ * Since 1.5.5
+ **/
+void
+lm_connection_set_backpressure_function (LmConnection           *connection,
+                                         LmBackpressureFunction  function,
+                                         gpointer                user_data,
+                                         GDestroyNotify          notify)
+{
+    g_return_if_fail (connection != NULL);
+
+    if (connection->backpressure_cb) {
+        _lm_utils_free_callback (connection->backpressure_cb);
+    }
+
+    if (function) {
+        connection->backpressure_cb = _lm_utils_new_callback (function,
+                                                              user_data,
+                                                              notify);
+    } else {
+        connection->backpressure_cb = NULL;
+    }
+}
+
 /**
  * lm_connection_set_keep_alive_rate:
  * @connection: an #LmConnection
@@ -1857,20 +2594,128 @@ lm_connection_send (LmConnection  *connection,
                     LmMessage     *message,
                     GError       **error)
 {
-    gchar    *xml_str;
-    gchar    *ch;
+    GString  *buffer;
     gboolean  result;
 
     g_return_val_if_fail (connection != NULL, FALSE);
     g_return_val_if_fail (message != NULL, FALSE);
 
-    xml_str = lm_message_node_to_string (message->node);
-    if ((ch = strstr (xml_str, "</stream:stream>"))) {
-        *ch = '\0';
+    buffer = connection_take_send_buffer (connection);
+
+    /* The stream stays open until lm_connection_close() */
+    _lm_message_node_write (message->node, buffer,
+                            lm_message_get_type (message) != LM_MESSAGE_TYPE_STREAM,
+                            TRUE);
+
+    result = connection_send (connection, buffer->str, buffer->len, error);
+    connection_return_send_buffer (connection, buffer);
+
+    return result;
+}
+
+/**
+ * lm_connection_send_from_thread:
+ * @connection: #LmConnection to send message over.
+ * @message: #LmMessage to send.
+ *
+ * Sends @message like lm_connection_send() does, but can be called from
+ * any thread. @message is written out right away in the calling thread
+ * and the stanza is left for the thread running the main context of
+ * @connection to send, together with whatever else other threads sent in
+ * the meantime. The order of the stanzas sent from one thread is kept.
+ *
+ * @message has to be frozen with lm_message_freeze() first. Writing out a
+ * message that isn't builds the children of lazily parsed stanzas and of
+ * copies, and fills its wire cache, all of which could race with other
+ * threads reading it. The XML kept for a frozen message with a wire cache
+ * is copied as it is.
+ *
+ * @connection has to be kept alive by the caller. Errors are only logged,
+ * as the stanza is sent after this returns. Stanzas sent while
+ * @connection isn't open are dropped.
+ *
+ * Since 1.5.5
+ **/
+void
+lm_connection_send_from_thread (LmConnection *connection,
+                                LmMessage    *message)
+{
+    GString *buffer;
+
+    g_return_if_fail (connection != NULL);
+    g_return_if_fail (message != NULL);
+    g_return_if_fail (lm_message_node_is_frozen (message->node));
+
+    /* The send buffer of the connection belongs to its own thread */
+    buffer = g_string_sized_new (256);
+    _lm_message_node_write (message->node, buffer,
+                            lm_message_get_type (message) != LM_MESSAGE_TYPE_STREAM,
+                            FALSE);
+
+    lm_send_queue_push (connection->send_queue, buffer->str, buffer->len);
+    g_string_free (buffer, TRUE);
+}
+
+/**
+ * lm_connection_send_raw_from_thread:
+ * @connection: #LmConnection to send the data over.
+ * @str: The string to send.
+ * @len: length of @str in bytes, or -1 if it is nul-terminated
+ *
+ * Sends @str like lm_connection_send_raw() does, from any thread. See
+ * lm_connection_send_from_thread().
+ *
+ * Since 1.5.5
+ **/
+void
+lm_connection_send_raw_from_thread (LmConnection *connection,
+                                    const gchar  *str,
+                                    gssize        len)
+{
+    g_return_if_fail (connection != NULL);
+    g_return_if_fail (str != NULL);
+
+    if (len < 0) {
+        len = strlen (str);
     }
 
-    result = connection_send (connection, xml_str, -1, error);
-    g_free (xml_str);
+    lm_send_queue_push (connection->send_queue, str, len);
+}
+
+/**
+ * lm_connection_send_template:
+ * @connection: #LmConnection to send the stanza over.
+ * @tmpl: an #LmTemplate
+ * @values: a value for each slot of @tmpl, %NULL for an empty one
+ * @error: location to store error, or %NULL
+ *
+ * Sends @tmpl with @values escaped into its slots, see
+ * lm_template_get_slot() for where each value goes. Nothing but the XML
+ * is built, which makes this the cheapest way to send many stanzas that
+ * only differ in a few values. Unlike lm_connection_send() no handlers
+ * can be set up for a reply.
+ *
+ * Return value: Returns #TRUE if no errors where detected while sending, #FALSE otherwise.
+ *
+ * Since 1.5.5
+ **/
+gboolean
+lm_connection_send_template (LmConnection  *connection,
+                             LmTemplate    *tmpl,
+                             const gchar  **values,
+                             GError       **error)
+{
+    GString  *buffer;
+    gboolean  result;
+
+    g_return_val_if_fail (connection != NULL, FALSE);
+    g_return_val_if_fail (tmpl != NULL, FALSE);
+
+    buffer = connection_take_send_buffer (connection);
+    _lm_template_write (tmpl, values, buffer);
+
+    result = connection_send (connection, buffer->str, buffer->len, error);
+    connection_return_send_buffer (connection, buffer);
 
     return result;
 }
@@ -1892,22 +2737,20 @@ lm_connection_send_with_reply (LmConnection      *connection,
                                LmMessageHandler  *handler,
                                GError           **error)
 {
-    gchar *id;
-
     g_return_val_if_fail (connection != NULL, FALSE);
     g_return_val_if_fail (message != NULL, FALSE);
     g_return_val_if_fail (handler != NULL, FALSE);
 
-    if (lm_message_node_get_attribute (message->node, "id")) {
-        id = g_strdup (lm_message_node_get_attribute (message->node,
-                                                      "id"));
-    } else {
-        id = _lm_utils_generate_id ();
+    if (!lm_message_get_id (message)) {
+        gchar *id = _lm_utils_generate_id ();
+
         lm_message_node_set_attributes (message->node, "id", id, NULL);
+        g_free (id);
     }
 
     g_hash_table_insert (connection->id_handlers,
-                         id, lm_message_handler_ref (handler));
+                         reply_id_new (lm_message_get_id (message)),
+                         lm_message_handler_ref (handler));
 
     return lm_connection_send (connection, message, error);
 }
@@ -1942,9 +2785,8 @@ lm_connection_send_with_reply_and_block (LmConnection  *connection,
     }
 
 
-    if (lm_message_node_get_attribute (message->node, "id")) {
-        id = g_strdup (lm_message_node_get_attribute (message->node,
-                                                      "id"));
+    if (lm_message_get_id (message)) {
+        id = g_strdup (lm_message_get_id (message));
     } else {
         id = _lm_utils_generate_id ();
         lm_message_node_set_attributes (message->node, "id", id, NULL);
@@ -1952,36 +2794,29 @@ lm_connection_send_with_reply_and_block (LmConnection  *connection,
 
     lm_message_queue_detach (connection->queue);
 
+    /* Nothing is handled until the reply is in, so the queue can't be let
+     * stop reading.
+     */
+    _lm_connection_set_blocking (connection, TRUE);
+
     lm_connection_send (connection, message, error);
 
+    /* Whatever else comes in waits in the queue, which is indexed by id */
     while (!reply) {
-        const gchar *m_id;
-        guint        n;
-
         g_main_context_iteration (connection->context, TRUE);
 
-        if (lm_message_queue_is_empty (connection->queue)) {
-            continue;
-        }
-
-        for (n = 0; n < lm_message_queue_get_length (connection->queue); n++) {
-            LmMessage *m;
+        reply = lm_message_queue_pop_id (connection->queue, id);
+    }
 
-            m = (LmMessage *) lm_message_queue_peek_nth (connection->queue, n);
+    g_free (id);
 
-            m_id = lm_message_node_get_attribute (m->node, "id");
+    _lm_connection_set_blocking (connection, FALSE);
 
-            if (m_id && strcmp (m_id, id) == 0) {
-                reply = m;
-                lm_message_queue_pop_nth (connection->queue, n);
-                break;
-            }
-        }
+    /* A call waiting further out would have its reply handled otherwise */
+    if (connection->blocking == 0) {
+        lm_message_queue_attach (connection->queue, connection->context);
     }
 
-    g_free (id);
-    lm_message_queue_attach (connection->queue, connection->context);
-
     return reply;
 }
 
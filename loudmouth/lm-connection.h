@@ -26,6 +26,7 @@
 #include <loudmouth/lm-message.h>
 #include <loudmouth/lm-proxy.h>
 #include <loudmouth/lm-ssl.h>
+#include <loudmouth/lm-template.h>
 
 G_BEGIN_DECLS
 
@@ -121,6 +122,22 @@ typedef enum {
     LM_CONNECTION_STATE_AUTHENTICATED
 } LmConnectionState;
 
+/**
+ * LmStanzaLimit:
+ * @LM_STANZA_LIMIT_SIZE: The stanza is bigger than the maximum size.
+ * @LM_STANZA_LIMIT_DEPTH: Elements in the stanza are nested too deep.
+ * @LM_STANZA_LIMIT_ATTRIBUTES: An element in the stanza has too many attributes.
+ * @LM_STANZA_LIMIT_TEXT: An element in the stanza has too much text.
+ *
+ * Sent with #LmStanzaLimitFunction to tell which limit an incoming stanza went over.
+ */
+typedef enum {
+    LM_STANZA_LIMIT_SIZE,
+    LM_STANZA_LIMIT_DEPTH,
+    LM_STANZA_LIMIT_ATTRIBUTES,
+    LM_STANZA_LIMIT_TEXT
+} LmStanzaLimit;
+
 /**
  * LmResultFunction:
  * @connection: an #LmConnection
@@ -145,6 +162,49 @@ typedef void         (* LmDisconnectFunction) (LmConnection       *connection,
                                                LmDisconnectReason  reason,
                                                gpointer            user_data);
 
+/**
+ * LmStanzaLimitFunction:
+ * @connection: an #LmConnection
+ * @limit: the limit that was exceeded
+ * @name: name of the stanza element or %NULL if it wasn't read yet
+ * @user_data: User data passed when function being called.
+ *
+ * Callback called when an incoming stanza is dropped for going over one of
+ * the limits set with lm_connection_set_stanza_limits().
+ */
+typedef void        (* LmStanzaLimitFunction) (LmConnection       *connection,
+                                               LmStanzaLimit       limit,
+                                               const gchar        *name,
+                                               gpointer            user_data);
+
+/**
+ * LmLaneFunction:
+ * @connection: an #LmConnection
+ * @message: an incoming message
+ * @user_data: User data passed when function being called.
+ *
+ * Callback choosing the lane an incoming message waits in until it is
+ * handled, see lm_connection_set_lane_function().
+ *
+ * Returns: the lane for @message
+ */
+typedef LmMessageLane (* LmLaneFunction)      (LmConnection       *connection,
+                                               LmMessage          *message,
+                                               gpointer            user_data);
+
+/**
+ * LmBackpressureFunction:
+ * @connection: an #LmConnection
+ * @paused: %TRUE if reading stopped, %FALSE if it started again
+ * @user_data: User data passed when function being called.
+ *
+ * Callback called when the queue of incoming messages goes over or back
+ * under its limits, see lm_connection_set_queue_limits().
+ */
+typedef void       (* LmBackpressureFunction) (LmConnection       *connection,
+                                               gboolean            paused,
+                                               gpointer            user_data);
+
 LmConnection *lm_connection_new               (const gchar        *server);
 LmConnection *lm_connection_new_with_context  (const gchar        *server,
                                                GMainContext       *context);
@@ -177,6 +237,61 @@ lm_connection_authenticate_and_block          (LmConnection       *connection,
 guint         lm_connection_get_keep_alive_rate (LmConnection     *connection);
 void        lm_connection_set_keep_alive_rate (LmConnection       *connection,
                                                guint               rate);
+gboolean      lm_connection_get_lazy_parsing  (LmConnection       *connection);
+void          lm_connection_set_lazy_parsing  (LmConnection       *connection,
+                                               gboolean            lazy);
+void          lm_connection_get_stanza_limits (LmConnection       *connection,
+                                               gsize              *max_size,
+                                               guint              *max_depth,
+                                               guint              *max_attributes,
+                                               gsize              *max_text);
+void          lm_connection_set_stanza_limits (LmConnection       *connection,
+                                               gsize               max_size,
+                                               guint               max_depth,
+                                               guint               max_attributes,
+                                               gsize               max_text);
+void
+lm_connection_set_stanza_limit_function       (LmConnection       *connection,
+                                               LmStanzaLimitFunction function,
+                                               gpointer             user_data,
+                                               GDestroyNotify       notify);
+void
+lm_connection_get_dispatch_budget             (LmConnection       *connection,
+                                               guint              *max_messages,
+                                               gint64             *max_time,
+                                               gboolean           *fair);
+void
+lm_connection_set_dispatch_budget             (LmConnection       *connection,
+                                               guint               max_messages,
+                                               gint64              max_time,
+                                               gboolean            fair);
+void          lm_connection_get_queue_stats   (LmConnection       *connection,
+                                               guint              *length,
+                                               guint              *max_length,
+                                               guint64            *last_latency,
+                                               guint64            *max_latency);
+void          lm_connection_set_lane_function (LmConnection       *connection,
+                                               LmLaneFunction      function,
+                                               gpointer            user_data,
+                                               GDestroyNotify      notify);
+LmMessageLane lm_connection_lane_by_type      (LmConnection       *connection,
+                                               LmMessage          *message,
+                                               gpointer            user_data);
+void          lm_connection_get_queue_limits  (LmConnection       *connection,
+                                               guint              *high_messages,
+                                               guint              *low_messages,
+                                               gsize              *high_bytes,
+                                               gsize              *low_bytes);
+void          lm_connection_set_queue_limits  (LmConnection       *connection,
+                                               guint               high_messages,
+                                               guint               low_messages,
+                                               gsize               high_bytes,
+                                               gsize               low_bytes);
+void
+lm_connection_set_backpressure_function       (LmConnection       *connection,
+                                               LmBackpressureFunction function,
+                                               gpointer             user_data,
+                                               GDestroyNotify       notify);
 
 gboolean      lm_connection_is_open           (LmConnection       *connection);
 gboolean      lm_connection_is_authenticated  (LmConnection       *connection);
@@ -202,6 +317,16 @@ void          lm_connection_set_proxy         (LmConnection       *connection,
 gboolean      lm_connection_send              (LmConnection       *connection,
                                                LmMessage          *message,
                                                GError            **error);
+void          lm_connection_send_from_thread  (LmConnection       *connection,
+                                               LmMessage          *message);
+void
+lm_connection_send_raw_from_thread            (LmConnection       *connection,
+                                               const gchar        *str,
+                                               gssize              len);
+gboolean      lm_connection_send_template     (LmConnection       *connection,
+                                               LmTemplate         *tmpl,
+                                               const gchar       **values,
+                                               GError            **error);
 gboolean      lm_connection_send_with_reply   (LmConnection       *connection,
                                                LmMessage          *message,
                                                LmMessageHandler   *handler,
@@ -40,6 +40,9 @@ G_BEGIN_DECLS
  * @LM_ERROR_CONNECTION_OPEN: Connection is already open when trying to open it again.
  * @LM_ERROR_AUTH_FAILED: Authentication failed while opening connection
  * @LM_ERROR_CONNECTION_FAILED:
+ * @LM_ERROR_INVALID_TEMPLATE: The XML given to lm_template_new() can't be used
+ * @LM_ERROR_INVALID_SELECTOR: The path given to lm_selector_new() can't be parsed
+ * @LM_ERROR_INVALID_BINARY: The data given to lm_message_node_new_from_binary() can't be read
  *
  * Describes the problem of the error.
  */
@@ -47,7 +50,10 @@ typedef enum {
     LM_ERROR_CONNECTION_NOT_OPEN,
     LM_ERROR_CONNECTION_OPEN,
     LM_ERROR_AUTH_FAILED,
-    LM_ERROR_CONNECTION_FAILED
+    LM_ERROR_CONNECTION_FAILED,
+    LM_ERROR_INVALID_TEMPLATE,
+    LM_ERROR_INVALID_SELECTOR,
+    LM_ERROR_INVALID_BINARY
 } LmError;
 
 GQuark lm_error_quark (void) G_GNUC_CONST;
@@ -0,0 +1,439 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (C) 2003 Imendio AB
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, see <https://www.gnu.org/licenses>
+ */
+
+/*
+ * XML escaping for outgoing text and attribute values.
+ *
+ * The output is the same as that of g_markup_escape_text(), byte for byte.
+ * The kernels look for the bytes which might need escaping: markup
+ * characters, control characters and 0xc2, the lead byte of the C1
+ * controls. Whatever they stop at is decided on by the scalar code, clean
+ * runs in between are copied in one go.
+ */
+
+#include <config.h>
+#include <string.h>
+
+#include "lm-escape.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__)))
+#define ESCAPE_HAVE_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#define ESCAPE_HAVE_NEON 1
+#include <arm_neon.h>
+#endif
+
+/* Bytes looked at one by one before handing over to the kernel */
+#define ESCAPE_SCALAR_RUN 16
+
+typedef gsize (* EscapeKernelFunc) (const guchar *p, gsize len);
+
+/* Bytes the kernels stop at, 1 if the byte has to be looked at */
+static const guint8 escape_special[256] = {
+    /* Control characters, but tab, newline and carriage return */
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 1, 1, 0, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    /*    !  "  #  $  %  &  '  (  )  *  +  ,  -  .  / */
+    0, 0, 1, 0, 0, 0, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0,
+    /* 0  1  2  3  4  5  6  7  8  9  :  ;  <  =  >  ? */
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 1, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    /* DEL */
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    /* 0xc2 */
+    0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+};
+
+static gsize
+escape_kernel_scalar (const guchar *p, gsize len)
+{
+    gsize i;
+
+    for (i = 0; i < len; ++i) {
+        if (escape_special[p[i]]) {
+            break;
+        }
+    }
+
+    return i;
+}
+
+#ifdef ESCAPE_HAVE_X86
+/* Always inlined, so that inside the AVX2 kernel it gets the VEX encoding
+ * and no time is lost switching between the two.
+ */
+static inline __attribute__ ((always_inline)) gint
+escape_special_mask_sse2 (__m128i input)
+{
+    __m128i control, space, markup;
+
+    control = _mm_cmpeq_epi8 (_mm_min_epu8 (input, _mm_set1_epi8 (0x1f)), input);
+    space = _mm_or_si128 (
+        _mm_or_si128 (_mm_cmpeq_epi8 (input, _mm_set1_epi8 ('\t')),
+                      _mm_cmpeq_epi8 (input, _mm_set1_epi8 ('\n'))),
+        _mm_cmpeq_epi8 (input, _mm_set1_epi8 ('\r')));
+    markup = _mm_or_si128 (
+        _mm_or_si128 (
+            _mm_or_si128 (_mm_cmpeq_epi8 (input, _mm_set1_epi8 ('&')),
+                          _mm_cmpeq_epi8 (input, _mm_set1_epi8 ('<'))),
+            _mm_or_si128 (_mm_cmpeq_epi8 (input, _mm_set1_epi8 ('>')),
+                          _mm_cmpeq_epi8 (input, _mm_set1_epi8 ('\'')))),
+        _mm_or_si128 (
+            _mm_or_si128 (_mm_cmpeq_epi8 (input, _mm_set1_epi8 ('"')),
+                          _mm_cmpeq_epi8 (input, _mm_set1_epi8 (0x7f))),
+            _mm_cmpeq_epi8 (input, _mm_set1_epi8 ((char) 0xc2))));
+
+    return _mm_movemask_epi8 (_mm_or_si128 (_mm_andnot_si128 (space, control), markup));
+}
+
+static gsize
+escape_kernel_sse2 (const guchar *p, gsize len)
+{
+    gsize i;
+
+    for (i = 0; i + 16 <= len; i += 16) {
+        __m128i input = _mm_loadu_si128 ((const __m128i *) (p + i));
+        gint    mask = escape_special_mask_sse2 (input);
+
+        if (mask != 0) {
+            return i + __builtin_ctz (mask);
+        }
+    }
+
+    return i + escape_kernel_scalar (p + i, len - i);
+}
+
+__attribute__ ((target ("avx2")))
+static gsize
+escape_kernel_avx2 (const guchar *p, gsize len)
+{
+    const __m256i control_max = _mm256_set1_epi8 (0x1f);
+    gsize         i;
+
+    for (i = 0; i + 32 <= len; i += 32) {
+        __m256i  input = _mm256_loadu_si256 ((const __m256i *) (p + i));
+        __m256i  control, space, markup;
+        guint32  mask;
+
+        control = _mm256_cmpeq_epi8 (_mm256_min_epu8 (input, control_max), input);
+        space = _mm256_or_si256 (
+            _mm256_or_si256 (_mm256_cmpeq_epi8 (input, _mm256_set1_epi8 ('\t')),
+                             _mm256_cmpeq_epi8 (input, _mm256_set1_epi8 ('\n'))),
+            _mm256_cmpeq_epi8 (input, _mm256_set1_epi8 ('\r')));
+        markup = _mm256_or_si256 (
+            _mm256_or_si256 (
+                _mm256_or_si256 (_mm256_cmpeq_epi8 (input, _mm256_set1_epi8 ('&')),
+                                 _mm256_cmpeq_epi8 (input, _mm256_set1_epi8 ('<'))),
+                _mm256_or_si256 (_mm256_cmpeq_epi8 (input, _mm256_set1_epi8 ('>')),
+                                 _mm256_cmpeq_epi8 (input, _mm256_set1_epi8 ('\'')))),
+            _mm256_or_si256 (
+                _mm256_or_si256 (_mm256_cmpeq_epi8 (input, _mm256_set1_epi8 ('"')),
+                                 _mm256_cmpeq_epi8 (input, _mm256_set1_epi8 (0x7f))),
+                _mm256_cmpeq_epi8 (input, _mm256_set1_epi8 ((char) 0xc2))));
+
+        mask = (guint32) _mm256_movemask_epi8 (
+            _mm256_or_si256 (_mm256_andnot_si256 (space, control), markup));
+        if (mask != 0) {
+            return i + __builtin_ctz (mask);
+        }
+    }
+
+    if (i + 16 <= len) {
+        __m128i input = _mm_loadu_si128 ((const __m128i *) (p + i));
+        gint    mask = escape_special_mask_sse2 (input);
+
+        if (mask != 0) {
+            return i + __builtin_ctz (mask);
+        }
+        i += 16;
+    }
+
+    return i + escape_kernel_scalar (p + i, len - i);
+}
+#endif /* ESCAPE_HAVE_X86 */
+
+#ifdef ESCAPE_HAVE_NEON
+static gsize
+escape_kernel_neon (const guchar *p, gsize len)
+{
+    const uint8x16_t control_max = vdupq_n_u8 (0x1f);
+    gsize            i;
+
+    for (i = 0; i + 16 <= len; i += 16) {
+        uint8x16_t input = vld1q_u8 (p + i);
+        uint8x16_t control, space, markup, special;
+        guint64    mask;
+
+        control = vcleq_u8 (input, control_max);
+        space = vorrq_u8 (vorrq_u8 (vceqq_u8 (input, vdupq_n_u8 ('\t')),
+                                    vceqq_u8 (input, vdupq_n_u8 ('\n'))),
+                          vceqq_u8 (input, vdupq_n_u8 ('\r')));
+        markup = vorrq_u8 (
+            vorrq_u8 (vorrq_u8 (vceqq_u8 (input, vdupq_n_u8 ('&')),
+                                vceqq_u8 (input, vdupq_n_u8 ('<'))),
+                      vorrq_u8 (vceqq_u8 (input, vdupq_n_u8 ('>')),
+                                vceqq_u8 (input, vdupq_n_u8 ('\'')))),
+            vorrq_u8 (vorrq_u8 (vceqq_u8 (input, vdupq_n_u8 ('"')),
+                                vceqq_u8 (input, vdupq_n_u8 (0x7f))),
+                      vceqq_u8 (input, vdupq_n_u8 (0xc2))));
+        special = vorrq_u8 (vbicq_u8 (control, space), markup);
+
+        /* Four bits for every byte, there is no movemask */
+        mask = vget_lane_u64 (vreinterpret_u64_u8 (
+            vshrn_n_u16 (vreinterpretq_u16_u8 (special), 4)), 0);
+        if (mask != 0) {
+            return i + (__builtin_ctzll (mask) >> 2);
+        }
+    }
+
+    return i + escape_kernel_scalar (p + i, len - i);
+}
+#endif /* ESCAPE_HAVE_NEON */
+
+static EscapeKernelFunc  escape_kernel = escape_kernel_scalar;
+static const gchar      *escape_kernel_name = "scalar";
+
+static gboolean
+escape_select_kernel (LmEscapeKernel kernel)
+{
+    switch (kernel) {
+    case LM_ESCAPE_KERNEL_AUTO:
+#ifdef ESCAPE_HAVE_X86
+        __builtin_cpu_init ();
+        if (__builtin_cpu_supports ("avx2")) {
+            return escape_select_kernel (LM_ESCAPE_KERNEL_AVX2);
+        }
+        return escape_select_kernel (LM_ESCAPE_KERNEL_SSE2);
+#elif defined(ESCAPE_HAVE_NEON)
+        return escape_select_kernel (LM_ESCAPE_KERNEL_NEON);
+#else
+        return escape_select_kernel (LM_ESCAPE_KERNEL_SCALAR);
+#endif
+    case LM_ESCAPE_KERNEL_SCALAR:
+        escape_kernel = escape_kernel_scalar;
+        escape_kernel_name = "scalar";
+        return TRUE;
+#ifdef ESCAPE_HAVE_X86
+    case LM_ESCAPE_KERNEL_SSE2:
+        escape_kernel = escape_kernel_sse2;
+        escape_kernel_name = "sse2";
+        return TRUE;
+    case LM_ESCAPE_KERNEL_AVX2:
+        __builtin_cpu_init ();
+        if (!__builtin_cpu_supports ("avx2")) {
+            return FALSE;
+        }
+        escape_kernel = escape_kernel_avx2;
+        escape_kernel_name = "avx2";
+        return TRUE;
+#endif
+#ifdef ESCAPE_HAVE_NEON
+    case LM_ESCAPE_KERNEL_NEON:
+        escape_kernel = escape_kernel_neon;
+        escape_kernel_name = "neon";
+        return TRUE;
+#endif
+    default:
+        break;
+    }
+
+    return FALSE;
+}
+
+static EscapeKernelFunc
+escape_get_kernel (void)
+{
+    static gsize initialized = 0;
+
+    if (g_once_init_enter (&initialized)) {
+        escape_select_kernel (LM_ESCAPE_KERNEL_AUTO);
+        g_once_init_leave (&initialized, 1);
+    }
+
+    return escape_kernel;
+}
+
+/* Writes the character reference for @c to @dest if it's not %NULL */
+static inline gsize
+escape_char_ref (gchar *dest, guchar c)
+{
+    static const gchar hex[] = "0123456789abcdef";
+    gchar              buf[6];
+    gsize              n = 0;
+
+    buf[n++] = '&';
+    buf[n++] = '#';
+    buf[n++] = 'x';
+    if (c >= 0x10) {
+        buf[n++] = hex[c >> 4];
+    }
+    buf[n++] = hex[c & 0x0f];
+
+    if (dest) {
+        memcpy (dest, buf, n);
+        dest[n] = ';';
+    }
+
+    return n + 1;
+}
+
+/**
+ * _lm_escape_text:
+ * @dest: where to write the escaped text, or %NULL
+ * @str: the text to escape
+ * @len: number of bytes in @str
+ *
+ * Escapes @str the way g_markup_escape_text() does, writing the result
+ * straight to @dest. With @dest being %NULL nothing is written, which
+ * gives the size to reserve. @dest isn't nul-terminated.
+ *
+ * Return value: the length of the escaped text
+ **/
+gsize
+_lm_escape_text (gchar *dest, const gchar *str, gsize len)
+{
+    const guchar     *p = (const guchar *) str;
+    EscapeKernelFunc  kernel;
+    gsize             out = 0;
+    gsize             start = 0;
+    gsize             i = 0;
+
+    kernel = escape_get_kernel ();
+
+    while (i < len) {
+        const gchar *replacement;
+        gsize        skip = 1;
+        guchar       c;
+
+        if (!escape_special[p[i]]) {
+            gsize stop = MIN (len, i + ESCAPE_SCALAR_RUN);
+
+            /* Short gaps between markup are walked, long ones vectorized */
+            while (i < stop && !escape_special[p[i]]) {
+                i++;
+            }
+            if (i == stop) {
+                i += kernel (p + i, len - i);
+            }
+            if (i == len) {
+                break;
+            }
+        }
+
+        c = p[i];
+        switch (c) {
+        case '&':
+            replacement = "&amp;";
+            break;
+        case '<':
+            replacement = "&lt;";
+            break;
+        case '>':
+            replacement = "&gt;";
+            break;
+        case '\'':
+            replacement = "&apos;";
+            break;
+        case '"':
+            replacement = "&quot;";
+            break;
+        case 0xc2:
+            /* U+0080 to U+009F but NEL, like GLib does */
+            if (i + 1 < len && p[i + 1] >= 0x80 && p[i + 1] <= 0x9f &&
+                p[i + 1] != 0x85) {
+                c = p[i + 1];
+                skip = 2;
+                replacement = NULL;
+                break;
+            }
+            /* Anything else starting with it is left alone */
+            i++;
+            continue;
+        default:
+            replacement = NULL;
+            break;
+        }
+
+        if (dest) {
+            memcpy (dest + out, str + start, i - start);
+        }
+        out += i - start;
+
+        if (replacement) {
+            gsize n = strlen (replacement);
+
+            if (dest) {
+                memcpy (dest + out, replacement, n);
+            }
+            out += n;
+        } else {
+            out += escape_char_ref (dest ? dest + out : NULL, c);
+        }
+
+        i += skip;
+        start = i;
+    }
+
+    if (dest) {
+        memcpy (dest + out, str + start, len - start);
+    }
+
+    return out + len - start;
+}
+
+/**
+ * _lm_escape_set_kernel:
+ * @kernel: the implementation to use
+ *
+ * Overrides the implementation picked at runtime. Not thread safe, only
+ * meant for tests and benchmarks.
+ *
+ * Return value: %FALSE if @kernel isn't available on this machine
+ **/
+gboolean
+_lm_escape_set_kernel (LmEscapeKernel kernel)
+{
+    escape_get_kernel ();
+
+    return escape_select_kernel (kernel);
+}
+
+/**
+ * _lm_escape_get_kernel_name:
+ *
+ * Return value: the name of the implementation in use
+ **/
+const gchar *
+_lm_escape_get_kernel_name (void)
+{
+    escape_get_kernel ();
+
+    return escape_kernel_name;
+}
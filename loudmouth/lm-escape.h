@@ -0,0 +1,40 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (C) 2003 Imendio AB
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, see <https://www.gnu.org/licenses>
+ */
+
+#ifndef __LM_ESCAPE_H__
+#define __LM_ESCAPE_H__
+
+#include <glib.h>
+
+typedef enum {
+    LM_ESCAPE_KERNEL_AUTO,
+    LM_ESCAPE_KERNEL_SCALAR,
+    LM_ESCAPE_KERNEL_SSE2,
+    LM_ESCAPE_KERNEL_AVX2,
+    LM_ESCAPE_KERNEL_NEON
+} LmEscapeKernel;
+
+gsize         _lm_escape_text            (gchar          *dest,
+                                          const gchar    *str,
+                                          gsize           len);
+
+/* Only meant for tests and benchmarks */
+gboolean      _lm_escape_set_kernel      (LmEscapeKernel  kernel);
+const gchar * _lm_escape_get_kernel_name (void);
+
+#endif /* __LM_ESCAPE_H__ */
@@ -25,12 +25,15 @@
 
 #include <sys/types.h>
 
+#include "lm-arena.h"
+#include "lm-atoms.h"
 #include "lm-connection.h"
 #include "lm-message.h"
 #include "lm-message-handler.h"
 #include "lm-message-node.h"
 #include "lm-sock.h"
 #include "lm-old-socket.h"
+#include "lm-template.h"
 
 #define LM_MIN_PORT 1
 #define LM_MAX_PORT 65536
@@ -60,6 +63,13 @@ typedef struct {
 GMainContext *   _lm_connection_get_context       (LmConnection       *conn);
 /* Need to free the return value */
 gchar *          _lm_connection_get_server        (LmConnection       *conn);
+void             _lm_connection_set_blocking      (LmConnection       *conn,
+                                                   gboolean            blocking);
+gboolean         _lm_connection_get_reading_paused (LmConnection      *conn);
+void             _lm_connection_incoming_data     (LmConnection       *conn,
+                                                   const gchar        *buf,
+                                                   gsize               len);
+void             _lm_connection_handle_next       (LmConnection       *conn);
 gboolean         _lm_old_socket_failed_with_error (LmConnectData         *data,
                                                    int                    error);
 gboolean         _lm_old_socket_failed            (LmConnectData         *data);
@@ -77,10 +87,53 @@ const gchar *    _lm_message_type_to_string   (LmMessageType          type);
 const gchar *
 _lm_message_sub_type_to_string                (LmMessageSubType       type);
 LmMessage *      _lm_message_new_from_node    (LmMessageNode         *node);
+guint            _lm_message_get_id_hash      (LmMessage             *message);
 void
 _lm_message_node_add_child_node               (LmMessageNode         *node,
                                                LmMessageNode         *child);
 LmMessageNode *  _lm_message_node_new         (const gchar           *name);
+LmMessageNode *
+_lm_message_node_new_in_arena                 (LmArena               *arena,
+                                               const gchar           *name,
+                                               guint                  n_attributes);
+LmArena *        _lm_message_node_get_arena   (LmMessageNode         *node);
+void
+_lm_message_node_append_arena_value           (LmMessageNode         *node,
+                                               const gchar           *text,
+                                               gsize                  len);
+void
+_lm_message_node_set_arena_attribute          (LmMessageNode         *node,
+                                               const gchar           *name,
+                                               const gchar           *value);
+LmMessageNode *
+_lm_message_node_new_borrowed                 (LmArena               *arena,
+                                               const gchar           *name,
+                                               guint                  n_attributes);
+void
+_lm_message_node_set_borrowed_value           (LmMessageNode         *node,
+                                               const gchar           *value,
+                                               gsize                  len);
+void
+_lm_message_node_add_borrowed_attribute       (LmMessageNode         *node,
+                                               const gchar           *name,
+                                               const gchar           *value);
+guint
+_lm_message_node_attribute_get_hash           (LmMessageNodeAttribute *attribute);
+void
+_lm_message_node_set_lazy                     (LmMessageNode         *node,
+                                               const gchar           *content,
+                                               gsize                  len,
+                                               const gchar           *ns_context,
+                                               gsize                  ns_len,
+                                               gboolean               verbatim);
+gsize
+_lm_message_node_write                        (LmMessageNode         *node,
+                                               GString               *out,
+                                               gboolean               close_root,
+                                               gboolean               cache);
+gsize            _lm_template_write           (LmTemplate            *tmpl,
+                                               const gchar          **values,
+                                               GString               *out);
 void             _lm_debug_init               (void);
 gboolean         _lm_proxy_connect_cb         (GIOChannel            *source,
                                                GIOCondition           condition,
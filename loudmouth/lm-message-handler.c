@@ -35,6 +35,7 @@ struct LmMessageHandler {
     LmHandleMessageFunction function;
     gpointer                user_data;
     GDestroyNotify          notify;
+    LmSelector             *selector;
 };
 
 LmHandlerResult
@@ -49,6 +50,11 @@ _lm_message_handler_handle_message (LmMessageHandler *handler,
         return LM_HANDLER_RESULT_ALLOW_MORE_HANDLERS;
     }
 
+    if (handler->selector &&
+        !lm_selector_find (handler->selector, lm_message_get_node (message))) {
+        return LM_HANDLER_RESULT_ALLOW_MORE_HANDLERS;
+    }
+
     if (handler->function) {
         return (* handler->function) (handler, connection,
                                       message, handler->user_data);
@@ -123,11 +129,41 @@ lm_message_handler_is_valid (LmMessageHandler *handler)
     return handler->valid;
 }
 
+/**
+ * lm_message_handler_set_selector:
+ * @handler: an #LmMessageHandler
+ * @selector: an #LmSelector or %NULL
+ *
+ * Makes @handler only get the messages which have something in them
+ * matched by @selector, the root node of the message being the node the
+ * selector starts at. Other messages are passed on to the next handler.
+ * %NULL lets all messages through again.
+ *
+ * Since 1.5.5
+ **/
+void
+lm_message_handler_set_selector (LmMessageHandler *handler,
+                                 LmSelector       *selector)
+{
+    g_return_if_fail (handler != NULL);
+
+    if (selector) {
+        lm_selector_ref (selector);
+    }
+
+    if (handler->selector) {
+        lm_selector_unref (handler->selector);
+    }
+
+    handler->selector = selector;
+}
+
 /**
  * lm_message_handler_ref:
  * @handler: an #LmMessageHandler
  *
- * Adds a reference to @handler.
+ * Adds a reference to @handler. References can be taken and dropped from
+ * any thread.
  *
  * Return value: the message handler
  **/
@@ -136,7 +172,7 @@ lm_message_handler_ref (LmMessageHandler *handler)
 {
     g_return_val_if_fail (handler != NULL, NULL);
 
-    handler->ref_count++;
+    g_atomic_int_inc (&handler->ref_count);
 
     return handler;
 }
@@ -153,12 +189,13 @@ lm_message_handler_unref (LmMessageHandler *handler)
 {
     g_return_if_fail (handler != NULL);
 
-    handler->ref_count --;
-
-    if (handler->ref_count == 0) {
+    if (g_atomic_int_dec_and_test (&handler->ref_count)) {
         if (handler->notify) {
             (* handler->notify) (handler->user_data);
         }
+        if (handler->selector) {
+            lm_selector_unref (handler->selector);
+        }
         g_free (handler);
     }
 }
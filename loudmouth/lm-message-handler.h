@@ -24,6 +24,7 @@
 #endif
 
 #include <loudmouth/lm-connection.h>
+#include <loudmouth/lm-selector.h>
 
 G_BEGIN_DECLS
 
@@ -48,6 +49,8 @@ LmMessageHandler *lm_message_handler_new   (LmHandleMessageFunction  function,
                                             GDestroyNotify           notify);
 void              lm_message_handler_invalidate (LmMessageHandler   *handler);
 gboolean          lm_message_handler_is_valid   (LmMessageHandler   *handler);
+void              lm_message_handler_set_selector (LmMessageHandler *handler,
+                                                   LmSelector       *selector);
 LmMessageHandler *lm_message_handler_ref   (LmMessageHandler        *handler);
 void              lm_message_handler_unref (LmMessageHandler        *handler);
 
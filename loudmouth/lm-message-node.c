@@ -25,46 +25,385 @@
 #include <config.h>
 #include <string.h>
 
+#include "lm-escape.h"
 #include "lm-internals.h"
 #include "lm-message-node.h"
+#include "lm-parser.h"
+
+/* Where a string of a node came from, and so what to do with it once
+ * the node is done with it.
+ */
+typedef enum {
+    NODE_STRING_HEAP,   /* g_free() it */
+    NODE_STRING_ARENA,  /* goes away with the arena */
+    NODE_STRING_ATOM    /* interned, see lm-atoms.c */
+} NodeStringOwner;
+
+/* The children of a stanza parsed in lazy mode, kept as text until
+ * somebody asks for them. Lives in the arena of the node.
+ */
+typedef struct {
+    const gchar *content;
+    gsize        len;
+    const gchar *ns_context;
+    gsize        ns_len;
+    /* FALSE if the content needs prefixes declared above the stanza */
+    gboolean     verbatim;
+} MessageNodeLazy;
+
+typedef struct {
+    LmMessageNodeAttribute attr;
+
+    guint                  on_heap     : 1;
+    guint                  name_owner  : 2;
+    guint                  value_owner : 2;
+
+    /* g_str_hash() of the value of an id, which replies are looked up
+     * by. Taken whenever the value is set, 0 for other attributes.
+     */
+    guint                  value_hash;
+} MessageNodeAttribute;
+
+/* Attributes allocated along with a node built by the parser, which knows
+ * how many there are. Anything beyond that gets a cell of its own.
+ */
+#define NODE_INLINE_ATTRIBUTES 8
+
+/* Nodes built through the API can't know, this covers what stanzas
+ * usually carry.
+ */
+#define NODE_DEFAULT_ATTRIBUTES 4
+
+/* Every node is allocated as one of these, followed by the cells for its
+ * first few attributes. Nodes built by the parser live in the arena of
+ * their stanza, together with their attributes and strings. Anything
+ * replaced later on goes to the heap instead, so that each string has to
+ * remember where it came from.
+ */
+typedef struct {
+    LmMessageNode           node;
+
+    LmArena                *arena;
+    MessageNodeLazy        *lazy;
+    guint                   name_owner  : 2;
+    guint                   value_owner : 2;
+    guint                   wire_cache  : 1;
+    guint                   wire_valid  : 1;
+    guint                   frozen      : 1;
+
+    /* Length of the value and the space there is for it */
+    gsize                   value_len;
+    gsize                   value_size;
+
+    /* Both lists are appended to at the end, in document order */
+    LmMessageNode          *last_child;
+    guint                   n_children;
+    LmMessageNodeAttribute *last_attribute;
+
+    /* Cells following the node that aren't used yet */
+    guint                   n_attribute_cells;
+    MessageNodeAttribute   *attribute_cells;
+
+    /* The XML of the whole subtree as last written, end tag included,
+     * only kept by the node the writing started from. The nodes below it
+     * know where theirs starts in that of their parent, so a change only
+     * has to go up the parents until it finds one that is out of date
+     * already. A node is only up to date while all of its children are.
+     */
+    gchar                  *wire;
+    gsize                   wire_len;
+    gsize                   wire_start;
+    /* Where the node starts in the XML being written */
+    gsize                   wire_mark;
+
+    /* A copy shares the children of the node it was made from until
+     * either of them changes, see lm_message_node_copy(). The node keeps
+     * track of the copies still sharing its children.
+     */
+    LmMessageNode          *copy_of;
+    GSList                 *copies;
+} MessageNode;
+
+/* Copies of a frozen node can be made and dropped by several threads at
+ * once, all of which add themselves to or remove themselves from its
+ * list of copies.
+ */
+G_LOCK_DEFINE_STATIC (copies);
+
+#define NODE(n) ((MessageNode *) (n))
+#define ATTR(a) ((MessageNodeAttribute *) (a))
 
 static void            message_node_free            (LmMessageNode    *node);
 static LmMessageNode * message_node_last_child      (LmMessageNode    *node);
+static void            message_node_materialize     (LmMessageNode    *node);
+static void            message_node_invalidate      (LmMessageNode    *node);
+static LmMessageNode * message_node_copy_shallow    (LmMessageNode    *node);
+
+static void
+message_node_free_string (gchar *str, guint owner)
+{
+    if (owner == NODE_STRING_HEAP) {
+        g_free (str);
+    }
+}
+
+static gchar *
+message_node_copy_string (const gchar *str,
+                          gsize        len,
+                          LmArena     *arena,
+                          guint       *owner)
+{
+    if (arena) {
+        *owner = NODE_STRING_ARENA;
+        return _lm_arena_strndup (arena, str, len);
+    }
+
+    *owner = NODE_STRING_HEAP;
+    return g_strndup (str, len);
+}
+
+/* Copies a string of another node to the heap, atoms are shared as is */
+static gchar *
+message_node_dup_string (const gchar *str, guint from_owner, guint *owner)
+{
+    if (from_owner == NODE_STRING_ATOM) {
+        *owner = NODE_STRING_ATOM;
+        return (gchar *) str;
+    }
+
+    *owner = NODE_STRING_HEAP;
+    return g_strdup (str);
+}
+
+/* Names never take any space of their own when there is an atom for them */
+static gchar *
+message_node_intern_string (const gchar *str, LmArena *arena, guint *owner)
+{
+    const gchar *atom;
+
+    atom = _lm_atom_lookup (str);
+    if (atom) {
+        *owner = NODE_STRING_ATOM;
+        return (gchar *) atom;
+    }
+
+    return message_node_copy_string (str, strlen (str), arena, owner);
+}
+
+/* Compares a name stored in a node with @name, @atom being the atom for
+ * @name if it has one. Names with an atom are always stored as the atom.
+ */
+static gboolean
+message_node_name_equal (const gchar *stored,
+                         guint        owner,
+                         const gchar *name,
+                         const gchar *atom)
+{
+    if (atom) {
+        return stored == atom;
+    }
+
+    return owner != NODE_STRING_ATOM && strcmp (stored, name) == 0;
+}
 
 static void
 message_node_free (LmMessageNode *node)
 {
     LmMessageNode          *l;
     LmMessageNodeAttribute *a;
+    LmArena                *arena;
 
     g_return_if_fail (node != NULL);
 
     for (l = node->children; l;) {
         LmMessageNode *next = l->next;
 
+        /* A copy might keep the child around */
+        l->parent = NULL;
         lm_message_node_unref (l);
         l = next;
     }
 
-    g_free (node->name);
-    g_free (node->value);
+    if (NODE(node)->copy_of) {
+        LmMessageNode *source = NODE(node)->copy_of;
+
+        G_LOCK (copies);
+        NODE(source)->copies = g_slist_remove (NODE(source)->copies, node);
+        G_UNLOCK (copies);
+        lm_message_node_unref (source);
+    }
+
+    message_node_free_string (node->name, NODE(node)->name_owner);
+    message_node_free_string (node->value, NODE(node)->value_owner);
+    g_free (NODE(node)->wire);
 
     for (a = node->attributes; a;) {
         LmMessageNodeAttribute *next_a = a->next;
 
-        g_free (a->name);
-        g_free (a->value);
-        g_free (a);
+        message_node_free_string (a->name, ATTR(a)->name_owner);
+        message_node_free_string (a->value, ATTR(a)->value_owner);
+        if (ATTR(a)->on_heap) {
+            g_free (a);
+        }
 
         a = next_a;
     }
 
-    g_free (node);
+    arena = NODE(node)->arena;
+    if (arena) {
+        _lm_arena_unref (arena);
+    } else {
+        g_free (node);
+    }
+}
+
+/* Gives a copy children of its own, copies of those of the node it was
+ * made from which in turn share theirs.
+ */
+static void
+message_node_materialize_copy (LmMessageNode *node)
+{
+    LmMessageNode *source = NODE(node)->copy_of;
+    LmMessageNode *l;
+
+    NODE(node)->copy_of = NULL;
+    G_LOCK (copies);
+    NODE(source)->copies = g_slist_remove (NODE(source)->copies, node);
+    G_UNLOCK (copies);
+
+    for (l = lm_message_node_get_children (source); l; l = l->next) {
+        LmMessageNode *child = message_node_copy_shallow (l);
+
+        _lm_message_node_add_child_node (node, child);
+        lm_message_node_unref (child);
+    }
+
+    lm_message_node_unref (source);
+}
+
+static void
+message_node_materialize (LmMessageNode *node)
+{
+    MessageNodeLazy *lazy = NODE(node)->lazy;
+
+    if (G_UNLIKELY (NODE(node)->copy_of != NULL)) {
+        message_node_materialize_copy (node);
+        return;
+    }
+
+    if (G_LIKELY (!lazy)) {
+        return;
+    }
+
+    /* The children are added the usual way, which ends up here again */
+    NODE(node)->lazy = NULL;
+
+    if (!_lm_parser_materialize (node, lazy->content, lazy->len,
+                                 lazy->ns_context, lazy->ns_len)) {
+        g_warning ("Failed to build the children of <%s>", node->name);
+    }
+}
+
+/* Called on every change to @node, its cached XML is part of that of
+ * each of its parents.
+ */
+static void
+message_node_invalidate (LmMessageNode *node)
+{
+    /* The XML kept stays until it's written again, the nodes that didn't
+     * change are copied from it then.
+     */
+    for (; node && NODE(node)->wire_valid; node = node->parent) {
+        NODE(node)->wire_valid = FALSE;
+    }
+}
+
+/* The XML of @node within that kept by the closest of its parents, NULL
+ * if it's out of date or nothing above it keeps any.
+ */
+static const gchar *
+message_node_get_wire (LmMessageNode *node)
+{
+    gsize offset = 0;
+
+    if (!NODE(node)->wire_valid) {
+        return NULL;
+    }
+
+    for (; node; node = node->parent) {
+        if (NODE(node)->wire) {
+            return NODE(node)->wire + offset;
+        }
+
+        offset += NODE(node)->wire_start;
+    }
+
+    return NULL;
+}
+
+static void
+message_node_unshare_path (LmMessageNode *node, gboolean children)
+{
+    if (node->parent) {
+        message_node_unshare_path (node->parent, TRUE);
+    }
+
+    if (children) {
+        while (NODE(node)->copies) {
+            message_node_materialize (NODE(node)->copies->data);
+        }
+    }
+}
+
+/* Called before @node changes, @children being whether its children are
+ * about to. Copies still sharing the children of @node or of one of its
+ * parents get their own first, so that they don't see the change.
+ */
+static void
+message_node_unshare (LmMessageNode *node, gboolean children)
+{
+    LmMessageNode *l;
+
+    for (l = children ? node : node->parent; l; l = l->parent) {
+        if (NODE(l)->copies) {
+            message_node_unshare_path (node, children);
+            return;
+        }
+    }
+}
+
+/* The node a copy shares its children with, at the end of a chain of
+ * copies of copies.
+ */
+static LmMessageNode *
+message_node_copy_source (LmMessageNode *node)
+{
+    while (NODE(node)->copy_of) {
+        node = NODE(node)->copy_of;
+    }
+
+    return node;
+}
+
+/* Drops the cached XML of the whole subtree below @node */
+static void
+message_node_drop_wire (LmMessageNode *node)
+{
+    LmMessageNode *l;
+
+    g_free (NODE(node)->wire);
+    NODE(node)->wire = NULL;
+    NODE(node)->wire_valid = FALSE;
+
+    for (l = node->children; l; l = l->next) {
+        message_node_drop_wire (l);
+    }
 }
 
 static LmMessageNode *
 message_node_last_child (LmMessageNode *node)
 {
+    MessageNode   *n = NODE(node);
     LmMessageNode *l;
 
     g_return_val_if_fail (node != NULL, NULL);
@@ -73,35 +412,373 @@ message_node_last_child (LmMessageNode *node)
         return NULL;
     }
 
-    l = node->children;
+    if (n->last_child && n->last_child->parent == node &&
+        n->last_child->next == NULL) {
+        return n->last_child;
+    }
 
-    while (l->next) {
-        l = l->next;
+    /* Children were linked in through the fields, count them again */
+    n->n_children = 0;
+    for (l = node->children; l; l = l->next) {
+        n->n_children++;
+        n->last_child = l;
     }
 
-    return l;
+    return n->last_child;
+}
+
+static LmMessageNodeAttribute *
+message_node_new_attribute (LmMessageNode *node, LmArena *arena)
+{
+    MessageNode          *n = NODE(node);
+    MessageNodeAttribute *a;
+
+    if (n->n_attribute_cells > 0) {
+        a = n->attribute_cells++;
+        n->n_attribute_cells--;
+    } else if (arena) {
+        a = _lm_arena_alloc (arena, sizeof (MessageNodeAttribute));
+        a->on_heap = FALSE;
+    } else {
+        a = g_new (MessageNodeAttribute, 1);
+        a->on_heap = TRUE;
+    }
+
+    a->attr.next = NULL;
+
+    if (n->last_attribute) {
+        n->last_attribute->next = &a->attr;
+    } else {
+        node->attributes = &a->attr;
+    }
+    n->last_attribute = &a->attr;
+
+    return &a->attr;
+}
+
+/* Allocates a node with room for @n_attributes attributes right behind it */
+static LmMessageNode *
+message_node_alloc (LmArena *arena, guint n_attributes)
+{
+    MessageNode          *n;
+    MessageNodeAttribute *cells;
+    gsize                 size;
+    guint                 i;
+
+    n_attributes = MIN (n_attributes, NODE_INLINE_ATTRIBUTES);
+    size = sizeof (MessageNode) + n_attributes * sizeof (MessageNodeAttribute);
+
+    if (arena) {
+        n = _lm_arena_alloc0 (arena, size);
+    } else {
+        n = g_malloc0 (size);
+    }
+
+    cells = (MessageNodeAttribute *) (n + 1);
+    for (i = 0; i < n_attributes; ++i) {
+        cells[i].on_heap = FALSE;
+    }
+
+    n->attribute_cells = cells;
+    n->n_attribute_cells = n_attributes;
+
+    return &n->node;
+}
+
+static void
+message_node_set_attribute (LmMessageNode *node,
+                            const gchar   *name,
+                            const gchar   *value,
+                            LmArena       *arena)
+{
+    LmMessageNodeAttribute *a;
+    const gchar            *atom;
+    gboolean                intern_value;
+    guint                   owner;
+
+    atom = _lm_atom_lookup (name);
+
+    /* Namespaces and stanza types are worth interning, other values
+     * hardly ever have an atom.
+     */
+    intern_value = atom == LM_ATOM (XMLNS) || atom == LM_ATOM (TYPE) ||
+        strncmp (name, "xmlns:", 6) == 0;
+
+    message_node_invalidate (node);
+
+    for (a = node->attributes; a; a = a->next) {
+        if (message_node_name_equal (a->name, ATTR(a)->name_owner,
+                                     name, atom)) {
+            break;
+        }
+    }
+
+    if (!a) {
+        a = message_node_new_attribute (node, arena);
+
+        if (atom) {
+            a->name = (gchar *) atom;
+            owner = NODE_STRING_ATOM;
+        } else {
+            a->name = message_node_copy_string (name, strlen (name),
+                                                arena, &owner);
+        }
+        ATTR(a)->name_owner = owner;
+    } else {
+        message_node_free_string (a->value, ATTR(a)->value_owner);
+    }
+
+    if (intern_value) {
+        a->value = message_node_intern_string (value, arena, &owner);
+    } else {
+        a->value = message_node_copy_string (value, strlen (value),
+                                             arena, &owner);
+    }
+    ATTR(a)->value_owner = owner;
+    ATTR(a)->value_hash = atom == LM_ATOM (ID) ? g_str_hash (a->value) : 0;
 }
 
 LmMessageNode *
 _lm_message_node_new (const gchar *name)
+{
+    return _lm_message_node_new_in_arena (NULL, name, NODE_DEFAULT_ATTRIBUTES);
+}
+
+/* The node keeps @arena alive for as long as it is around itself. It goes
+ * on the heap if @arena is %NULL. @n_attributes is how many attributes
+ * the node is about to get.
+ */
+LmMessageNode *
+_lm_message_node_new_in_arena (LmArena     *arena,
+                               const gchar *name,
+                               guint        n_attributes)
 {
     LmMessageNode *node;
+    guint          owner;
 
-    node = g_new0 (LmMessageNode, 1);
+    node = message_node_alloc (arena, n_attributes);
 
-    node->name       = g_strdup (name);
-    node->value      = NULL;
-    node->raw_mode   = FALSE;
-    node->attributes = NULL;
-    node->next       = NULL;
-    node->prev       = NULL;
-    node->parent     = NULL;
-    node->children   = NULL;
+    node->name = message_node_intern_string (name, arena, &owner);
+    node->ref_count = 1;
 
-    node->ref_count  = 1;
+    if (arena) {
+        NODE(node)->arena = _lm_arena_ref (arena);
+    }
+    NODE(node)->name_owner = owner;
 
     return node;
 }
+
+/* Copies @node on the heap, sharing its children */
+static LmMessageNode *
+message_node_copy_shallow (LmMessageNode *node)
+{
+    LmMessageNode          *copy;
+    LmMessageNodeAttribute *a;
+    guint                   n_attributes = 0;
+
+    for (a = node->attributes; a; a = a->next) {
+        n_attributes++;
+    }
+
+    copy = _lm_message_node_new_in_arena (NULL, node->name, n_attributes);
+    copy->raw_mode = node->raw_mode;
+
+    if (node->value) {
+        NODE(copy)->value_len = strlen (node->value);
+        NODE(copy)->value_size = NODE(copy)->value_len + 1;
+        copy->value = g_strndup (node->value, NODE(copy)->value_len);
+    }
+
+    /* The names are known to be different, no need to look them up */
+    for (a = node->attributes; a; a = a->next) {
+        LmMessageNodeAttribute *c = message_node_new_attribute (copy, NULL);
+        guint                   owner;
+
+        c->name = message_node_dup_string (a->name, ATTR(a)->name_owner,
+                                           &owner);
+        ATTR(c)->name_owner = owner;
+        c->value = message_node_dup_string (a->value, ATTR(a)->value_owner,
+                                            &owner);
+        ATTR(c)->value_owner = owner;
+        ATTR(c)->value_hash = ATTR(a)->value_hash;
+    }
+
+    if (node->children || NODE(node)->lazy || NODE(node)->copy_of) {
+        NODE(copy)->copy_of = lm_message_node_ref (node);
+        G_LOCK (copies);
+        NODE(node)->copies = g_slist_prepend (NODE(node)->copies, copy);
+        G_UNLOCK (copies);
+    }
+
+    return copy;
+}
+
+LmArena *
+_lm_message_node_get_arena (LmMessageNode *node)
+{
+    g_return_val_if_fail (node != NULL, NULL);
+
+    return NODE(node)->arena;
+}
+
+/* Used by the parser, adds @len bytes of @text to the value of @node in
+ * its arena if it has one. Text can arrive in any number of pieces, the
+ * space for it grows geometrically so that the whole value is copied a
+ * constant number of times on average however it's split.
+ */
+void
+_lm_message_node_append_arena_value (LmMessageNode *node,
+                                     const gchar   *text,
+                                     gsize          len)
+{
+    MessageNode *n = NODE(node);
+    gsize        new_len;
+
+    message_node_invalidate (node);
+
+    if (!node->value) {
+        guint owner;
+
+        node->value = message_node_copy_string (text, len, n->arena, &owner);
+        n->value_owner = owner;
+        n->value_len = len;
+        n->value_size = len + 1;
+        return;
+    }
+
+    new_len = n->value_len + len;
+
+    if (new_len >= n->value_size) {
+        gsize size = MAX (new_len + 1, n->value_size * 2);
+
+        if (n->value_owner == NODE_STRING_HEAP) {
+            node->value = g_realloc (node->value, size);
+        } else if (!_lm_arena_extend (n->arena, node->value,
+                                      n->value_size, size)) {
+            gchar *value = _lm_arena_alloc (n->arena, size);
+
+            memcpy (value, node->value, n->value_len);
+            node->value = value;
+        }
+
+        n->value_size = size;
+    }
+
+    memcpy (node->value + n->value_len, text, len);
+    node->value[new_len] = '\0';
+    n->value_len = new_len;
+}
+
+/* Used by the parser in lazy mode, @node has to live in an arena */
+void
+_lm_message_node_set_lazy (LmMessageNode *node,
+                           const gchar   *content,
+                           gsize          len,
+                           const gchar   *ns_context,
+                           gsize          ns_len,
+                           gboolean       verbatim)
+{
+    LmArena         *arena = NODE(node)->arena;
+    MessageNodeLazy *lazy;
+
+    g_return_if_fail (arena != NULL);
+
+    lazy = _lm_arena_alloc (arena, sizeof (MessageNodeLazy));
+    lazy->content = _lm_arena_strndup (arena, content, len);
+    lazy->len = len;
+    lazy->ns_context = _lm_arena_strndup (arena, ns_context, ns_len);
+    lazy->ns_len = ns_len;
+    lazy->verbatim = verbatim;
+
+    NODE(node)->lazy = lazy;
+}
+
+/* Used by the parser, puts the attribute in the arena of @node if it has one */
+void
+_lm_message_node_set_arena_attribute (LmMessageNode *node,
+                                      const gchar   *name,
+                                      const gchar   *value)
+{
+    message_node_set_attribute (node, name, value, NODE(node)->arena);
+}
+
+/* Used by the binary decoder, which has all of the strings sitting in a
+ * buffer that @arena keeps alive. They are taken as they are instead of
+ * being copied. @name has to be the atom if there is one for it.
+ */
+LmMessageNode *
+_lm_message_node_new_borrowed (LmArena     *arena,
+                               const gchar *name,
+                               guint        n_attributes)
+{
+    LmMessageNode *node;
+
+    node = message_node_alloc (arena, n_attributes);
+
+    node->name = (gchar *) name;
+    node->ref_count = 1;
+
+    NODE(node)->arena = _lm_arena_ref (arena);
+    NODE(node)->name_owner = _lm_atom_is_atom (name) ?
+        NODE_STRING_ATOM : NODE_STRING_ARENA;
+
+    return node;
+}
+
+/* @value is borrowed like the strings of _lm_message_node_new_borrowed() */
+void
+_lm_message_node_set_borrowed_value (LmMessageNode *node,
+                                     const gchar   *value,
+                                     gsize          len)
+{
+    MessageNode *n = NODE(node);
+
+    message_node_free_string (node->value, n->value_owner);
+
+    node->value = (gchar *) value;
+    n->value_owner = NODE_STRING_ARENA;
+    n->value_len = len;
+    n->value_size = len + 1;
+}
+
+/* Doesn't look for an attribute with the same name, the decoder only
+ * takes what was written from a node in the first place. Values are
+ * interned the way message_node_set_attribute() does it.
+ */
+void
+_lm_message_node_add_borrowed_attribute (LmMessageNode *node,
+                                         const gchar   *name,
+                                         const gchar   *value)
+{
+    LmMessageNodeAttribute *a;
+    const gchar            *atom = NULL;
+
+    if (name == LM_ATOM (XMLNS) || name == LM_ATOM (TYPE) ||
+        strncmp (name, "xmlns:", 6) == 0) {
+        atom = _lm_atom_lookup (value);
+    }
+
+    a = message_node_new_attribute (node, NODE(node)->arena);
+    a->name = (gchar *) name;
+    a->value = (gchar *) (atom ? atom : value);
+    ATTR(a)->name_owner = _lm_atom_is_atom (name) ?
+        NODE_STRING_ATOM : NODE_STRING_ARENA;
+    ATTR(a)->value_owner = atom ? NODE_STRING_ATOM : NODE_STRING_ARENA;
+    ATTR(a)->value_hash = name == LM_ATOM (ID) ? g_str_hash (value) : 0;
+}
+
+/* The hash of an id attribute as of the last time it was set through the
+ * lm_message_node_* functions.
+ */
+guint
+_lm_message_node_attribute_get_hash (LmMessageNodeAttribute *attribute)
+{
+    g_return_val_if_fail (attribute != NULL, 0);
+
+    return ATTR(attribute)->value_hash;
+}
+
 void
 _lm_message_node_add_child_node (LmMessageNode *node, LmMessageNode *child)
 {
@@ -109,6 +786,9 @@ _lm_message_node_add_child_node (LmMessageNode *node, LmMessageNode *child)
 
     g_return_if_fail (node != NULL);
 
+    message_node_materialize (node);
+    message_node_invalidate (node);
+
     prev = message_node_last_child (node);
     lm_message_node_ref (child);
 
@@ -120,6 +800,8 @@ _lm_message_node_add_child_node (LmMessageNode *node, LmMessageNode *child)
     }
 
     child->parent = node;
+    NODE(node)->last_child = child;
+    NODE(node)->n_children++;
 }
 
 /**
@@ -149,15 +831,25 @@ void
 lm_message_node_set_value (LmMessageNode *node, const gchar *value)
 {
     g_return_if_fail (node != NULL);
+    g_return_if_fail (!NODE(node)->frozen);
 
-    g_free (node->value);
+    /* The text kept for a lazy node has the old value in it */
+    message_node_materialize (node);
+    message_node_unshare (node, FALSE);
+    message_node_invalidate (node);
+
+    message_node_free_string (node->value, NODE(node)->value_owner);
+    NODE(node)->value_owner = NODE_STRING_HEAP;
 
     if (!value) {
         node->value = NULL;
+        NODE(node)->value_len = NODE(node)->value_size = 0;
         return;
     }
 
-    node->value = g_strdup (value);
+    NODE(node)->value_len = strlen (value);
+    NODE(node)->value_size = NODE(node)->value_len + 1;
+    node->value = g_strndup (value, NODE(node)->value_len);
 }
 
 /**
@@ -179,6 +871,9 @@ lm_message_node_add_child (LmMessageNode *node,
 
     g_return_val_if_fail (node != NULL, NULL);
     g_return_val_if_fail (name != NULL, NULL);
+    g_return_val_if_fail (!NODE(node)->frozen, NULL);
+
+    message_node_unshare (node, TRUE);
 
     child = _lm_message_node_new (name);
 
@@ -233,30 +928,15 @@ lm_message_node_set_attribute (LmMessageNode *node,
                                const gchar   *name,
                                const gchar   *value)
 {
-    gboolean                found = FALSE;
-    LmMessageNodeAttribute *a;
-
     g_return_if_fail (node != NULL);
     g_return_if_fail (name != NULL);
     g_return_if_fail (value != NULL);
+    g_return_if_fail (!NODE(node)->frozen);
 
-    for (a = node->attributes; a; a = a->next) {
-        if (strcmp (a->name, name) == 0) {
-            g_free (a->value);
-            a->value = g_strdup (value);
-            found = TRUE;
-            break;
-        }
-    }
-
-    if (!found) {
-        a = g_new0 (LmMessageNodeAttribute, 1);
-        a->name = g_strdup (name);
-        a->value = g_strdup (value);
+    message_node_unshare (node, FALSE);
 
-        a->next = node->attributes;
-        node->attributes = a;
-    }
+    /* Never into the arena, it would only grow with every change */
+    message_node_set_attribute (node, name, value, NULL);
 }
 
 /**
@@ -273,12 +953,16 @@ lm_message_node_get_attribute (LmMessageNode *node, const gchar *name)
 {
     LmMessageNodeAttribute *a;
     const gchar            *ret_val = NULL;
+    const gchar            *atom;
 
     g_return_val_if_fail (node != NULL, NULL);
     g_return_val_if_fail (name != NULL, NULL);
 
+    atom = _lm_atom_lookup (name);
+
     for (a = node->attributes; a; a = a->next) {
-        if (strcmp (a->name, name) == 0) {
+        if (message_node_name_equal (a->name, ATTR(a)->name_owner,
+                                     name, atom)) {
             ret_val = a->value;
             break;
         }
@@ -287,6 +971,26 @@ lm_message_node_get_attribute (LmMessageNode *node, const gchar *name)
     return ret_val;
 }
 
+/**
+ * lm_message_node_get_namespace:
+ * @node: an #LmMessageNode
+ *
+ * Looks up the namespace set on @node with its xmlns attribute, without
+ * comparing it to each known namespace in turn.
+ *
+ * Return value: the namespace, %LM_NAMESPACE_UNKNOWN if @node has none or
+ * one Loudmouth doesn't know about
+ *
+ * Since 1.5.5
+ **/
+LmNamespace
+lm_message_node_get_namespace (LmMessageNode *node)
+{
+    g_return_val_if_fail (node != NULL, LM_NAMESPACE_UNKNOWN);
+
+    return lm_namespace_from_string (lm_message_node_get_attribute (node, LM_ATOM (XMLNS)));
+}
+
 /**
  * lm_message_node_get_child:
  * @node: an #LmMessageNode
@@ -301,14 +1005,46 @@ LmMessageNode *
 lm_message_node_get_child (LmMessageNode *node, const gchar *child_name)
 {
     LmMessageNode *l;
+    const gchar   *atom;
+
+    g_return_val_if_fail (node != NULL, NULL);
+    g_return_val_if_fail (child_name != NULL, NULL);
+
+    message_node_materialize (node);
+
+    atom = _lm_atom_lookup (child_name);
+
+    for (l = node->children; l; l = l->next) {
+        if (message_node_name_equal (l->name, NODE(l)->name_owner,
+                                     child_name, atom)) {
+            return l;
+        }
+    }
+
+    return NULL;
+}
+
+static LmMessageNode *
+message_node_find_child (LmMessageNode *node,
+                         const gchar   *child_name,
+                         const gchar   *atom)
+{
+    LmMessageNode *l;
+    LmMessageNode *ret_val = NULL;
 
-    g_return_val_if_fail (node != NULL, NULL);
-    g_return_val_if_fail (child_name != NULL, NULL);
+    message_node_materialize (node);
 
     for (l = node->children; l; l = l->next) {
-        if (strcmp (l->name, child_name) == 0) {
+        if (message_node_name_equal (l->name, NODE(l)->name_owner,
+                                     child_name, atom)) {
             return l;
         }
+        if (l->children || NODE(l)->lazy || NODE(l)->copy_of) {
+            ret_val = message_node_find_child (l, child_name, atom);
+            if (ret_val) {
+                return ret_val;
+            }
+        }
     }
 
     return NULL;
@@ -328,25 +1064,57 @@ LmMessageNode *
 lm_message_node_find_child (LmMessageNode *node,
                             const gchar   *child_name)
 {
-    LmMessageNode *l;
-    LmMessageNode *ret_val = NULL;
-
     g_return_val_if_fail (node != NULL, NULL);
     g_return_val_if_fail (child_name != NULL, NULL);
 
-    for (l = node->children; l; l = l->next) {
-        if (strcmp (l->name, child_name) == 0) {
-            return l;
-        }
-        if (l->children) {
-            ret_val = lm_message_node_find_child (l, child_name);
-            if (ret_val) {
-                return ret_val;
-            }
-        }
+    return message_node_find_child (node, child_name,
+                                    _lm_atom_lookup (child_name));
+}
+
+/**
+ * lm_message_node_get_children:
+ * @node: an #LmMessageNode
+ *
+ * Fetches the first child of @node, the rest follow through the next
+ * field. Use this rather than the children field for incoming messages,
+ * see lm_connection_set_lazy_parsing().
+ *
+ * Return value: the first child or %NULL if @node has no children
+ *
+ * Since 1.5.5
+ **/
+LmMessageNode *
+lm_message_node_get_children (LmMessageNode *node)
+{
+    g_return_val_if_fail (node != NULL, NULL);
+
+    message_node_materialize (node);
+
+    return node->children;
+}
+
+/**
+ * lm_message_node_get_n_children:
+ * @node: an #LmMessageNode
+ *
+ * Counts the children of @node without walking them.
+ *
+ * Return value: the number of children of @node
+ *
+ * Since 1.5.5
+ **/
+guint
+lm_message_node_get_n_children (LmMessageNode *node)
+{
+    g_return_val_if_fail (node != NULL, 0);
+
+    message_node_materialize (node);
+
+    if (!message_node_last_child (node)) {
+        return 0;
     }
 
-    return NULL;
+    return NODE(node)->n_children;
 }
 
 /**
@@ -376,15 +1144,135 @@ void
 lm_message_node_set_raw_mode (LmMessageNode *node, gboolean raw_mode)
 {
     g_return_if_fail (node != NULL);
+    g_return_if_fail (!NODE(node)->frozen);
 
+    message_node_unshare (node, FALSE);
+    message_node_invalidate (node);
     node->raw_mode = raw_mode;
 }
 
+/**
+ * lm_message_node_get_wire_cache:
+ * @node: an #LmMessageNode
+ *
+ * Checks if the XML of @node is kept around once it has been sent, see
+ * lm_message_node_set_wire_cache().
+ *
+ * Return value: %TRUE if the XML of @node is cached
+ *
+ * Since 1.5.5
+ **/
+gboolean
+lm_message_node_get_wire_cache (LmMessageNode *node)
+{
+    g_return_val_if_fail (node != NULL, FALSE);
+
+    return NODE(node)->wire_cache;
+}
+
+/**
+ * lm_message_node_set_wire_cache:
+ * @node: an #LmMessageNode
+ * @wire_cache: whether to keep the XML of @node
+ *
+ * Makes the XML of @node stay around once it has been written, usually on
+ * the root node of a message which is sent more than once. Only @node
+ * keeps a copy, the nodes below it remember where their part of it is.
+ * Every change made through the lm_message_node_* functions marks the
+ * changed node and its parents as out of date, so that sending the
+ * message again only writes those out anew and copies everything else
+ * from the XML written before. Changes made through the fields of a node
+ * directly aren't noticed.
+ *
+ * Since 1.5.5
+ **/
+void
+lm_message_node_set_wire_cache (LmMessageNode *node, gboolean wire_cache)
+{
+    g_return_if_fail (node != NULL);
+    g_return_if_fail (!NODE(node)->frozen);
+
+    NODE(node)->wire_cache = wire_cache != FALSE;
+
+    if (!wire_cache) {
+        /* The parents have the dropped XML in theirs */
+        message_node_drop_wire (node);
+        message_node_invalidate (node->parent);
+    }
+}
+
+/**
+ * lm_message_node_freeze:
+ * @node: an #LmMessageNode
+ *
+ * Makes @node and everything below it read only, so that several threads
+ * can read the tree at the same time. Reading a node can change it on the
+ * inside otherwise, lazily parsed children and those of copies are built
+ * on first access and the XML of nodes is cached when written. All of
+ * that is done once here: when @node has a wire cache, see
+ * lm_message_node_set_wire_cache(), its XML is written out and kept so
+ * that sending it only copies that, otherwise nothing is cached for a
+ * frozen tree. The lm_message_node_set_* functions and
+ * lm_message_node_add_child() refuse to change a frozen node, copies made
+ * with lm_message_node_copy() can be changed as usual though.
+ *
+ * References to nodes and messages can be taken and dropped from any
+ * thread, frozen or not.
+ *
+ * Since 1.5.5
+ **/
+void
+lm_message_node_freeze (LmMessageNode *node)
+{
+    LmMessageNode *l;
+
+    g_return_if_fail (node != NULL);
+
+    if (NODE(node)->frozen) {
+        return;
+    }
+
+    message_node_materialize (node);
+    message_node_last_child (node);
+
+    for (l = node->children; l; l = l->next) {
+        lm_message_node_freeze (l);
+    }
+
+    if (NODE(node)->wire_cache && !NODE(node)->wire_valid) {
+        GString *out = g_string_new (NULL);
+
+        _lm_message_node_write (node, out, TRUE, TRUE);
+        g_string_free (out, TRUE);
+    }
+
+    NODE(node)->frozen = TRUE;
+}
+
+/**
+ * lm_message_node_is_frozen:
+ * @node: an #LmMessageNode
+ *
+ * Checks if @node has been made read only with lm_message_node_freeze().
+ *
+ * Return value: %TRUE if @node is frozen
+ *
+ * Since 1.5.5
+ **/
+gboolean
+lm_message_node_is_frozen (LmMessageNode *node)
+{
+    g_return_val_if_fail (node != NULL, FALSE);
+
+    return NODE(node)->frozen;
+}
+
 /**
  * lm_message_node_ref:
  * @node: an #LmMessageNode
  *
- * Adds a reference to @node.
+ * Adds a reference to @node. References can be taken and dropped from
+ * any thread.
  *
  * Return value: the node
  **/
@@ -393,7 +1281,7 @@ lm_message_node_ref (LmMessageNode *node)
 {
     g_return_val_if_fail (node != NULL, NULL);
 
-    node->ref_count++;
+    g_atomic_int_inc (&node->ref_count);
 
     return node;
 }
@@ -413,76 +1301,346 @@ lm_message_node_unref (LmMessageNode *node)
 {
     g_return_if_fail (node != NULL);
 
-    node->ref_count--;
-
-    if (node->ref_count == 0) {
+    if (g_atomic_int_dec_and_test (&node->ref_count)) {
         message_node_free (node);
     }
 }
 
 /**
- * lm_message_node_to_string:
+ * lm_message_node_copy:
  * @node: an #LmMessageNode
  *
- * Returns an XML string representing the node. This is what is sent over the
- * wire. This is used internally Loudmouth and is external for debugging
- * purposes.
+ * Copies @node along with everything below it. Only @node itself is
+ * copied right away, the children are shared with @node and only copied
+ * a level at a time once either side looks into or changes them through
+ * the lm_message_node_* functions. Relaying a message with a small change
+ * costs about as much as the change. As with lazy parsing, use
+ * lm_message_node_get_children() rather than the children field of the
+ * copy.
  *
- * Return value: an XML string representation of @node
+ * Return value: a copy of @node without a parent
+ *
+ * Since 1.5.5
  **/
-gchar *
-lm_message_node_to_string (LmMessageNode *node)
+LmMessageNode *
+lm_message_node_copy (LmMessageNode *node)
 {
-    GString                *ret;
-    LmMessageNodeAttribute *a;
-    LmMessageNode          *child;
-
     g_return_val_if_fail (node != NULL, NULL);
 
-    if (node->name == NULL) {
-        return g_strdup ("");
+    return message_node_copy_shallow (node);
+}
+
+/* Output of the serializer. Nothing is written while dest is NULL, only
+ * the length is counted, which is how the exact size of a stanza is
+ * found before it's written out in a second pass.
+ */
+typedef struct {
+    gchar    *dest;
+    gsize     len;
+    /* Whether nodes with a wire cache get their XML kept */
+    gboolean  cache;
+} NodeWriter;
+
+static inline void
+node_writer_append (NodeWriter *writer, const gchar *str, gsize len)
+{
+    if (writer->dest) {
+        memcpy (writer->dest + writer->len, str, len);
+    }
+
+    writer->len += len;
+}
+
+static inline void
+node_writer_append_str (NodeWriter *writer, const gchar *str)
+{
+    node_writer_append (writer, str, strlen (str));
+}
+
+static void
+node_writer_append_escaped (NodeWriter *writer, const gchar *str)
+{
+    writer->len += _lm_escape_text (writer->dest ? writer->dest + writer->len : NULL,
+                                    str, strlen (str));
+}
+
+static void
+node_writer_append_value (NodeWriter    *writer,
+                          LmMessageNode *node,
+                          const gchar   *value)
+{
+    if (node->raw_mode) {
+        node_writer_append_str (writer, value);
+    } else {
+        node_writer_append_escaped (writer, value);
     }
+}
+
+static void node_writer_write_tree (NodeWriter    *writer,
+                                    LmMessageNode *root,
+                                    gboolean       close_root);
+
+/* Writes the start tag of @node along with its text. Returns FALSE if
+ * there are no children to descend into.
+ */
+static gboolean
+node_writer_open (NodeWriter *writer, LmMessageNode *node)
+{
+    LmMessageNodeAttribute *a;
 
-    ret = g_string_new ("<");
-    g_string_append (ret, node->name);
+    node_writer_append (writer, "<", 1);
+    node_writer_append_str (writer, node->name);
 
     for (a = node->attributes; a; a = a->next) {
-        if (node->raw_mode == FALSE) {
-            gchar *escaped;
+        node_writer_append (writer, " ", 1);
+        node_writer_append_str (writer, a->name);
+        node_writer_append (writer, "=\"", 2);
+        node_writer_append_value (writer, node, a->value);
+        node_writer_append (writer, "\"", 1);
+    }
 
-            escaped = g_markup_escape_text (a->value, -1);
-            g_string_append_printf (ret, " %s=\"%s\"",
-                                    a->name, escaped);
-            g_free (escaped);
-        } else {
-            g_string_append_printf (ret, " %s=\"%s\"",
-                                    a->name, a->value);
+    node_writer_append (writer, ">", 1);
+
+    if (NODE(node)->lazy) {
+        if (NODE(node)->lazy->verbatim) {
+            /* Nobody looked inside, so it goes out the way it came in */
+            node_writer_append (writer, NODE(node)->lazy->content,
+                                NODE(node)->lazy->len);
+            return FALSE;
         }
+
+        message_node_materialize (node);
     }
 
-    g_string_append_c (ret, '>');
+    if (NODE(node)->copy_of) {
+        LmMessageNode *source = message_node_copy_source (node);
+        LmMessageNode *l;
+
+        if (NODE(source)->lazy) {
+            if (NODE(source)->lazy->verbatim) {
+                node_writer_append (writer, NODE(source)->lazy->content,
+                                    NODE(source)->lazy->len);
+                return FALSE;
+            }
+
+            message_node_materialize (source);
+        }
+
+        if (node->value) {
+            node_writer_append_value (writer, node, node->value);
+        }
+
+        /* The children are still those of the original */
+        for (l = source->children; l; l = l->next) {
+            node_writer_write_tree (writer, l, TRUE);
+        }
+
+        return FALSE;
+    }
 
     if (node->value) {
-        gchar *tmp;
+        node_writer_append_value (writer, node, node->value);
+    }
 
-        if (node->raw_mode == FALSE) {
-            tmp = g_markup_escape_text (node->value, -1);
-            g_string_append (ret,  tmp);
-            g_free (tmp);
-        } else {
-            g_string_append (ret, node->value);
+    return node->children != NULL;
+}
+
+/* @node, which isn't the root, has just been written out from its mark.
+ * It remembers where that was within its parent.
+ */
+static void
+node_writer_keep (NodeWriter *writer, LmMessageNode *node)
+{
+    MessageNode *n = NODE(node);
+
+    n->wire_len = writer->len - n->wire_mark;
+    n->wire_start = n->wire_mark - NODE(node->parent)->wire_mark;
+    n->wire_valid = TRUE;
+
+    /* Anything it kept of its own is found through the root now */
+    g_free (n->wire);
+    n->wire = NULL;
+}
+
+/* The root keeps a copy of everything written since its mark */
+static void
+node_writer_keep_root (NodeWriter *writer, LmMessageNode *root)
+{
+    MessageNode *n = NODE(root);
+
+    /* Only now, the nodes that didn't change were copied from it */
+    g_free (n->wire);
+
+    n->wire_len = writer->len - n->wire_mark;
+    n->wire = g_malloc (n->wire_len);
+    memcpy (n->wire, writer->dest + n->wire_mark, n->wire_len);
+    n->wire_valid = TRUE;
+}
+
+/* Copies the XML of @node as last written, if it's still up to date */
+static gboolean
+node_writer_append_wire (NodeWriter    *writer,
+                         LmMessageNode *node,
+                         gboolean       cache)
+{
+    const gchar *wire;
+
+    wire = message_node_get_wire (node);
+    if (!wire) {
+        return FALSE;
+    }
+
+    if (cache) {
+        NODE(node)->wire_mark = writer->len;
+    }
+
+    node_writer_append (writer, wire, NODE(node)->wire_len);
+
+    if (cache && writer->dest) {
+        node_writer_keep (writer, node);
+    }
+
+    return TRUE;
+}
+
+/* Writes the end tag of @node, keeping track of its XML if @cache is set */
+static void
+node_writer_close (NodeWriter *writer, LmMessageNode *node, gboolean cache)
+{
+    node_writer_append (writer, "</", 2);
+    node_writer_append_str (writer, node->name);
+    node_writer_append (writer, ">", 1);
+
+    if (cache && writer->dest) {
+        node_writer_keep (writer, node);
+    }
+}
+
+/* Walks the tree below @root in document order, without recursing.
+ * Subtrees with cached XML are copied as they are.
+ */
+static void
+node_writer_write_tree (NodeWriter    *writer,
+                        LmMessageNode *root,
+                        gboolean       close_root)
+{
+    LmMessageNode *node = root;
+    gboolean       cache;
+
+    /* Frozen trees are written by several threads at a time, the XML of
+     * a root left open isn't worth keeping.
+     */
+    cache = writer->cache && close_root &&
+        NODE(root)->wire_cache && !NODE(root)->frozen;
+
+    if (root->name == NULL) {
+        return;
+    }
+
+    /* The cached XML of the root has its end tag in it */
+    if (close_root && node_writer_append_wire (writer, root, FALSE)) {
+        return;
+    }
+
+    if (cache) {
+        NODE(root)->wire_mark = writer->len;
+    }
+
+    while (TRUE) {
+        if (node == root || !node_writer_append_wire (writer, node, cache)) {
+            if (cache) {
+                NODE(node)->wire_mark = writer->len;
+            }
+
+            if (node->name && node_writer_open (writer, node)) {
+                node = node->children;
+                continue;
+            }
+
+            if (node->name && node != root) {
+                node_writer_close (writer, node, cache);
+            }
+        }
+
+        while (node != root && node->next == NULL) {
+            node = node->parent;
+            if (node != root) {
+                node_writer_close (writer, node, cache);
+            }
         }
+
+        if (node == root) {
+            break;
+        }
+
+        node = node->next;
     }
 
-    for (child = node->children; child; child = child->next) {
-        gchar *child_str = lm_message_node_to_string (child);
-/*        g_string_append_c (ret, ' '); */
-        g_string_append (ret, child_str);
-        g_free (child_str);
+    if (close_root) {
+        node_writer_close (writer, root, FALSE);
+
+        if (cache && writer->dest) {
+            node_writer_keep_root (writer, root);
+        }
     }
+}
+
+/**
+ * _lm_message_node_write:
+ * @node: an #LmMessageNode
+ * @out: string to append to
+ * @close_root: %FALSE to leave out the end tag of @node
+ * @cache: %FALSE to leave the wire cache of the tree as it is
+ *
+ * Appends the XML for @node to @out in one pass over the tree, after
+ * making room for exactly as much as is needed. Lets a caller reuse the
+ * same buffer for every stanza it sends.
+ *
+ * Return value: the number of bytes appended
+ **/
+gsize
+_lm_message_node_write (LmMessageNode *node,
+                        GString       *out,
+                        gboolean       close_root,
+                        gboolean       cache)
+{
+    NodeWriter writer = { NULL, 0, cache };
+    gsize      start;
+
+    g_return_val_if_fail (node != NULL, 0);
+    g_return_val_if_fail (out != NULL, 0);
+
+    node_writer_write_tree (&writer, node, close_root);
+
+    start = out->len;
+    g_string_set_size (out, start + writer.len);
+
+    writer.dest = out->str + start;
+    writer.len = 0;
+    node_writer_write_tree (&writer, node, close_root);
+
+    return writer.len;
+}
+
+/**
+ * lm_message_node_to_string:
+ * @node: an #LmMessageNode
+ *
+ * Returns an XML string representing the node. This is what is sent over the
+ * wire. This is used internally Loudmouth and is external for debugging
+ * purposes.
+ *
+ * Return value: an XML string representation of @node
+ **/
+gchar *
+lm_message_node_to_string (LmMessageNode *node)
+{
+    GString *ret;
+
+    g_return_val_if_fail (node != NULL, NULL);
 
-    /* g_string_append_printf (ret, "</%s>\n", node->name); */
-    g_string_append_printf (ret, "</%s>", node->name);
+    ret = g_string_new (NULL);
+    _lm_message_node_write (node, ret, TRUE, TRUE);
 
     return g_string_free (ret, FALSE);
 }
@@ -24,6 +24,7 @@
 #endif
 
 #include <glib.h>
+#include <loudmouth/lm-namespace.h>
 
 G_BEGIN_DECLS
 
@@ -89,13 +90,26 @@ void           lm_message_node_set_attribute  (LmMessageNode *node,
                                                const gchar   *value);
 const gchar *  lm_message_node_get_attribute  (LmMessageNode *node,
                                                const gchar   *name);
+LmNamespace    lm_message_node_get_namespace  (LmMessageNode *node);
 LmMessageNode *lm_message_node_get_child      (LmMessageNode *node,
                                                const gchar   *child_name);
 LmMessageNode *lm_message_node_find_child     (LmMessageNode *node,
                                                const gchar   *child_name);
+LmMessageNode *lm_message_node_get_children   (LmMessageNode *node);
+guint          lm_message_node_get_n_children (LmMessageNode *node);
 gboolean       lm_message_node_get_raw_mode   (LmMessageNode *node);
 void           lm_message_node_set_raw_mode   (LmMessageNode *node,
                                                gboolean       raw_mode);
+gboolean       lm_message_node_get_wire_cache (LmMessageNode *node);
+void           lm_message_node_set_wire_cache (LmMessageNode *node,
+                                               gboolean       wire_cache);
+LmMessageNode *lm_message_node_copy           (LmMessageNode *node);
+void           lm_message_node_freeze         (LmMessageNode *node);
+gboolean       lm_message_node_is_frozen      (LmMessageNode *node);
+
+GBytes *       lm_message_node_to_binary      (LmMessageNode *node);
+LmMessageNode *lm_message_node_new_from_binary (GBytes        *bytes,
+                                                GError       **error);
 LmMessageNode *lm_message_node_ref            (LmMessageNode *node);
 void           lm_message_node_unref          (LmMessageNode *node);
 gchar *        lm_message_node_to_string      (LmMessageNode *node);
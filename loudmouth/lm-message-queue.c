@@ -16,12 +16,80 @@
  * License along with this program; if not, see <https://www.gnu.org/licenses>
  */
 
+/*
+ * Messages wait in one of a few lanes, each a ring buffer that grows by
+ * doubling. Within a lane each message is known by a sequence number given
+ * out as it's pushed, which is also where it is in the ring, modulo its
+ * size.
+ *
+ * A message taken from the middle leaves a tombstone behind, so that
+ * nothing has to move. Tombstones at the head are dropped right away, the
+ * others when they get to the head or when there are more of them than
+ * messages, at which point the ring is compacted.
+ *
+ * Messages with an id are also in an index from the id to the oldest
+ * message in the lane that has it, so that a reply is found without going
+ * through the queue.
+ *
+ * The next message comes from the first lane that has any, unless a lane
+ * further down has been passed over LANE_MAX_PASSED times while it had
+ * messages waiting. It then gets to hand out one, so that a steady stream
+ * in a higher lane can't hold it up forever.
+ */
+
 #include <config.h>
+#include <string.h>
 
 #include "lm-message-queue.h"
 
+/* Every message is dispatched in a batch with the ones queued after it,
+ * until either budget runs out. 0 is for no limit. One message a batch
+ * unless asked for more, as it has always been.
+ */
+#define DEFAULT_MAX_MESSAGES 1
+#define DEFAULT_MAX_TIME     0
+
+#define INITIAL_SIZE 16
+
+#define N_LANES         (LM_MESSAGE_LANE_LOW + 1)
+#define LANE_MAX_PASSED 8
+
+typedef struct {
+    /* %NULL for a tombstone */
+    LmMessage *message;
+    gint64     queued_at;
+    gsize      size;
+} QueueEntry;
+
+/* Messages with the same id, @seq being that of the oldest */
+typedef struct {
+    guint seq;
+    guint count;
+} QueueIdSlot;
+
+typedef struct {
+    QueueEntry *entries;
+    guint       size;
+
+    /* The ring holds @n_slots entries from @head, @length of them being
+     * messages and the rest tombstones.
+     */
+    guint       head;
+    guint       n_slots;
+    guint       length;
+
+    GHashTable *ids;
+
+    /* Messages handed out from other lanes since this one last had its
+     * turn, counted only while it has some waiting.
+     */
+    guint       n_passed;
+} QueueLane;
+
 struct _LmMessageQueue {
-    GQueue                  *messages;
+    QueueLane               lanes[N_LANES];
+    guint                   length;
+    gsize                   size;
 
     GMainContext            *context;
     GSource                 *source;
@@ -29,6 +97,19 @@ struct _LmMessageQueue {
     LmMessageQueueCallback  callback;
     gpointer                user_data;
 
+    guint                   max_messages;
+    gint64                  max_time;
+    gboolean                fair;
+
+    /* Set when a fair batch ran out of budget, the source then sits out
+     * one iteration of the main loop.
+     */
+    gboolean                yield;
+
+    guint                   max_length;
+    gint64                  last_latency;
+    gint64                  max_latency;
+
     gint                    ref_count;
 };
 
@@ -52,23 +133,225 @@ static GSourceFuncs source_funcs = {
     NULL
 };
 
+#define LANE_ENTRY(lane, seq) (&(lane)->entries[(seq) & ((lane)->size - 1)])
+
+static void
+id_slot_free (QueueIdSlot *slot)
+{
+    g_slice_free (QueueIdSlot, slot);
+}
+
+static void
+lane_init (QueueLane *lane)
+{
+    lane->size = INITIAL_SIZE;
+    lane->entries = g_new (QueueEntry, lane->size);
+    lane->ids = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+                                       (GDestroyNotify) id_slot_free);
+}
+
 static void
-foreach_free_message (LmMessage *m, gpointer user_data)
+lane_clear (QueueLane *lane)
 {
-    lm_message_unref (m);
+    guint i;
+
+    for (i = 0; i < lane->n_slots; ++i) {
+        QueueEntry *entry = LANE_ENTRY (lane, lane->head + i);
+
+        if (entry->message) {
+            lm_message_unref (entry->message);
+        }
+    }
+
+    g_hash_table_destroy (lane->ids);
+    g_free (lane->entries);
 }
 
 static void
 message_queue_free (LmMessageQueue *queue)
 {
+    guint i;
+
     lm_message_queue_detach (queue);
 
-    g_queue_foreach (queue->messages, (GFunc) foreach_free_message, NULL);
-    g_queue_free (queue->messages);
+    for (i = 0; i < N_LANES; ++i) {
+        lane_clear (&queue->lanes[i]);
+    }
 
     g_free (queue);
 }
 
+/* Moves the messages together at the start of the ring, in order. The
+ * index follows those that move.
+ */
+static void
+lane_compact (QueueLane *lane)
+{
+    guint i, n = 0;
+
+    for (i = 0; i < lane->n_slots; ++i) {
+        QueueEntry  *entry = LANE_ENTRY (lane, lane->head + i);
+        const gchar *id;
+
+        if (!entry->message) {
+            continue;
+        }
+
+        if (i != n) {
+            *LANE_ENTRY (lane, lane->head + n) = *entry;
+
+            id = lm_message_get_id (entry->message);
+            if (id) {
+                QueueIdSlot *slot = g_hash_table_lookup (lane->ids, id);
+
+                if (slot->seq == lane->head + i) {
+                    slot->seq = lane->head + n;
+                }
+            }
+        }
+        n++;
+    }
+
+    lane->n_slots = n;
+}
+
+static void
+lane_grow (QueueLane *lane)
+{
+    QueueEntry *entries;
+    guint       size = lane->size * 2;
+    guint       i;
+
+    entries = g_new (QueueEntry, size);
+    for (i = 0; i < lane->n_slots; ++i) {
+        guint seq = lane->head + i;
+
+        entries[seq & (size - 1)] = *LANE_ENTRY (lane, seq);
+    }
+
+    g_free (lane->entries);
+    lane->entries = entries;
+    lane->size = size;
+}
+
+/* The sequence number of the message @n places from the head */
+static guint
+lane_find_nth (QueueLane *lane, guint n)
+{
+    guint i;
+
+    /* Without tombstones the message is right where it is expected */
+    if (lane->length == lane->n_slots) {
+        return lane->head + n;
+    }
+
+    for (i = 0; i < lane->n_slots; ++i) {
+        if (LANE_ENTRY (lane, lane->head + i)->message && n-- == 0) {
+            break;
+        }
+    }
+
+    g_assert (i < lane->n_slots);
+
+    return lane->head + i;
+}
+
+/* Finds the message @n places from the head of the queue, the lanes
+ * being taken one after the other.
+ */
+static QueueLane *
+message_queue_find_nth (LmMessageQueue *queue, guint n, guint *seq)
+{
+    guint i;
+
+    for (i = 0; i < N_LANES; ++i) {
+        QueueLane *lane = &queue->lanes[i];
+
+        if (n < lane->length) {
+            *seq = lane_find_nth (lane, n);
+            return lane;
+        }
+        n -= lane->length;
+    }
+
+    return NULL;
+}
+
+/* The lane the next message is handed out from */
+static QueueLane *
+message_queue_next_lane (LmMessageQueue *queue)
+{
+    QueueLane *next = NULL;
+    guint      i;
+
+    for (i = 0; i < N_LANES; ++i) {
+        QueueLane *lane = &queue->lanes[i];
+
+        if (lane->length == 0) {
+            continue;
+        }
+
+        if (!next) {
+            next = lane;
+        } else if (lane->n_passed >= LANE_MAX_PASSED) {
+            next = lane;
+            break;
+        }
+    }
+
+    return next;
+}
+
+static LmMessage *
+message_queue_remove (LmMessageQueue *queue, QueueLane *lane, guint seq)
+{
+    QueueEntry  *entry = LANE_ENTRY (lane, seq);
+    LmMessage   *m = entry->message;
+    const gchar *id;
+
+    id = lm_message_get_id (m);
+    if (id) {
+        QueueIdSlot *slot = g_hash_table_lookup (lane->ids, id);
+
+        if (--slot->count == 0) {
+            g_hash_table_remove (lane->ids, id);
+        } else if (slot->seq == seq) {
+            /* On to the next message with the same id, which also has
+             * to provide the key from now on.
+             */
+            do {
+                slot->seq++;
+                entry = LANE_ENTRY (lane, slot->seq);
+            } while (!entry->message ||
+                     g_strcmp0 (lm_message_get_id (entry->message), id) != 0);
+
+            g_hash_table_steal (lane->ids, id);
+            g_hash_table_insert (lane->ids,
+                                 (gpointer) lm_message_get_id (entry->message),
+                                 slot);
+        }
+    }
+
+    queue->last_latency = g_get_monotonic_time () - LANE_ENTRY (lane, seq)->queued_at;
+    queue->max_latency = MAX (queue->max_latency, queue->last_latency);
+
+    LANE_ENTRY (lane, seq)->message = NULL;
+    lane->length--;
+    queue->length--;
+    queue->size -= LANE_ENTRY (lane, seq)->size;
+
+    while (lane->n_slots > 0 && !LANE_ENTRY (lane, lane->head)->message) {
+        lane->head++;
+        lane->n_slots--;
+    }
+
+    if (lane->n_slots - lane->length > MAX (lane->length, INITIAL_SIZE)) {
+        lane_compact (lane);
+    }
+
+    return m;
+}
+
 static gboolean
 message_queue_prepare_func (GSource *source, gint *timeout)
 {
@@ -76,7 +359,14 @@ message_queue_prepare_func (GSource *source, gint *timeout)
 
     queue = ((MessageQueueSource *)source)->queue;
 
-    return !g_queue_is_empty (queue->messages);
+    if (queue->yield) {
+        /* Lets sources of lower priority have their turn */
+        queue->yield = FALSE;
+        *timeout = 0;
+        return FALSE;
+    }
+
+    return queue->length > 0;
 }
 
 static gboolean
@@ -91,13 +381,39 @@ message_queue_dispatch_func (GSource     *source,
                              gpointer     user_data)
 {
     LmMessageQueue *queue;
+    gint64          deadline = 0;
+    guint           n_messages = 0;
 
     queue = ((MessageQueueSource *)source)->queue;
 
-    if (queue->callback) {
+    if (!queue->callback) {
+        return TRUE;
+    }
+
+    if (queue->max_time > 0) {
+        deadline = g_get_monotonic_time () + queue->max_time;
+    }
+
+    lm_message_queue_ref (queue);
+
+    while (TRUE) {
         (queue->callback) (queue, queue->user_data);
+        n_messages++;
+
+        /* Detached by the callback, or attached again somewhere else */
+        if (queue->source != source || queue->length == 0) {
+            break;
+        }
+
+        if ((queue->max_messages > 0 && n_messages >= queue->max_messages) ||
+            (deadline > 0 && g_get_monotonic_time () >= deadline)) {
+            queue->yield = queue->fair;
+            break;
+        }
     }
 
+    lm_message_queue_unref (queue);
+
     return TRUE;
 }
 
@@ -106,10 +422,14 @@ lm_message_queue_new (LmMessageQueueCallback  callback,
                       gpointer                user_data)
 {
     LmMessageQueue *queue;
+    guint           i;
 
     queue = g_new0 (LmMessageQueue, 1);
 
-    queue->messages = g_queue_new ();
+    for (i = 0; i < N_LANES; ++i) {
+        lane_init (&queue->lanes[i]);
+    }
+
     queue->context = NULL;
     queue->source = NULL;
     queue->ref_count = 1;
@@ -117,6 +437,9 @@ lm_message_queue_new (LmMessageQueueCallback  callback,
     queue->callback = callback;
     queue->user_data = user_data;
 
+    queue->max_messages = DEFAULT_MAX_MESSAGES;
+    queue->max_time = DEFAULT_MAX_TIME;
+
     return queue;
 }
 
@@ -160,29 +483,149 @@ lm_message_queue_detach (LmMessageQueue *queue)
     queue->context = NULL;
 }
 
+/* @size is what @m took up on the wire, or 0 if that isn't known */
 void
-lm_message_queue_push_tail (LmMessageQueue *queue, LmMessage *m)
+lm_message_queue_push (LmMessageQueue *queue,
+                       LmMessage      *m,
+                       LmMessageLane   lane_id,
+                       gsize           size)
 {
+    QueueLane   *lane;
+    QueueEntry  *entry;
+    const gchar *id;
+    guint        seq;
+
     g_return_if_fail (queue != NULL);
     g_return_if_fail (m != NULL);
+    g_return_if_fail ((guint) lane_id < N_LANES);
+
+    lane = &queue->lanes[lane_id];
+
+    if (lane->n_slots == lane->size) {
+        if (lane->length < lane->n_slots) {
+            lane_compact (lane);
+        } else {
+            lane_grow (lane);
+        }
+    }
+
+    seq = lane->head + lane->n_slots;
+    entry = LANE_ENTRY (lane, seq);
+    entry->message = m;
+    entry->queued_at = g_get_monotonic_time ();
+    entry->size = size;
+
+    lane->n_slots++;
+    lane->length++;
+    queue->length++;
+    queue->size += size;
+    queue->max_length = MAX (queue->max_length, queue->length);
+
+    /* The id lives as long as the message, which the queue holds on to */
+    id = lm_message_get_id (m);
+    if (id) {
+        QueueIdSlot *slot = g_hash_table_lookup (lane->ids, id);
+
+        if (!slot) {
+            slot = g_slice_new (QueueIdSlot);
+            slot->seq = seq;
+            slot->count = 0;
+            g_hash_table_insert (lane->ids, (gpointer) id, slot);
+        }
+        slot->count++;
+    }
+}
 
-    g_queue_push_tail (queue->messages, m);
+void
+lm_message_queue_push_tail (LmMessageQueue *queue, LmMessage *m)
+{
+    lm_message_queue_push (queue, m, LM_MESSAGE_LANE_NORMAL, 0);
 }
 
 LmMessage *
 lm_message_queue_peek_nth (LmMessageQueue *queue, guint n)
 {
+    QueueLane *lane;
+    guint      seq;
+
     g_return_val_if_fail (queue != NULL, NULL);
 
-    return (LmMessage *) g_queue_peek_nth (queue->messages, n);
+    lane = message_queue_find_nth (queue, n, &seq);
+    if (!lane) {
+        return NULL;
+    }
+
+    return LANE_ENTRY (lane, seq)->message;
 }
 
 LmMessage *
 lm_message_queue_pop_nth (LmMessageQueue *queue, guint n)
 {
+    QueueLane *lane;
+    guint      seq;
+
     g_return_val_if_fail (queue != NULL, NULL);
 
-    return (LmMessage *) g_queue_pop_nth (queue->messages, n);
+    lane = message_queue_find_nth (queue, n, &seq);
+    if (!lane) {
+        return NULL;
+    }
+
+    return message_queue_remove (queue, lane, seq);
+}
+
+/* Takes the message that is to be handled next out of the queue, which
+ * is the one lm_message_queue_peek_nth() gives for 0 unless a lane further
+ * down is due its turn.
+ */
+LmMessage *
+lm_message_queue_pop_next (LmMessageQueue *queue)
+{
+    QueueLane *next;
+    guint      i;
+
+    g_return_val_if_fail (queue != NULL, NULL);
+
+    next = message_queue_next_lane (queue);
+    if (!next) {
+        return NULL;
+    }
+
+    for (i = 0; i < N_LANES; ++i) {
+        QueueLane *lane = &queue->lanes[i];
+
+        if (lane == next) {
+            lane->n_passed = 0;
+        } else if (lane->length > 0) {
+            lane->n_passed++;
+        }
+    }
+
+    return message_queue_remove (queue, next, next->head);
+}
+
+/* Takes the oldest message with @id out of the queue, looking through
+ * the lanes in order.
+ */
+LmMessage *
+lm_message_queue_pop_id (LmMessageQueue *queue, const gchar *id)
+{
+    guint i;
+
+    g_return_val_if_fail (queue != NULL, NULL);
+    g_return_val_if_fail (id != NULL, NULL);
+
+    for (i = 0; i < N_LANES; ++i) {
+        QueueLane   *lane = &queue->lanes[i];
+        QueueIdSlot *slot;
+
+        slot = g_hash_table_lookup (lane->ids, id);
+        if (slot) {
+            return message_queue_remove (queue, lane, slot->seq);
+        }
+    }
+
+    return NULL;
 }
 
 guint
@@ -190,7 +633,16 @@ lm_message_queue_get_length (LmMessageQueue *queue)
 {
     g_return_val_if_fail (queue != NULL, 0);
 
-    return g_queue_get_length (queue->messages);
+    return queue->length;
+}
+
+/* The sizes given for the messages in the queue, added up */
+gsize
+lm_message_queue_get_size (LmMessageQueue *queue)
+{
+    g_return_val_if_fail (queue != NULL, 0);
+
+    return queue->size;
 }
 
 gboolean
@@ -198,7 +650,64 @@ lm_message_queue_is_empty (LmMessageQueue *queue)
 {
     g_return_val_if_fail (queue != NULL, TRUE);
 
-    return g_queue_is_empty (queue->messages);
+    return queue->length == 0;
+}
+
+/* @max_messages and @max_time, in microseconds, bound the messages handed
+ * to the callback in one dispatch, 0 being no limit. With @fair the queue
+ * gives the other sources of the main context a turn after a dispatch
+ * that ran out of budget, even those of lower priority.
+ */
+void
+lm_message_queue_set_budget (LmMessageQueue *queue,
+                             guint           max_messages,
+                             gint64          max_time,
+                             gboolean        fair)
+{
+    g_return_if_fail (queue != NULL);
+
+    queue->max_messages = max_messages;
+    queue->max_time = max_time;
+    queue->fair = fair;
+}
+
+void
+lm_message_queue_get_budget (LmMessageQueue *queue,
+                             guint          *max_messages,
+                             gint64         *max_time,
+                             gboolean       *fair)
+{
+    g_return_if_fail (queue != NULL);
+
+    if (max_messages) {
+        *max_messages = queue->max_messages;
+    }
+    if (max_time) {
+        *max_time = queue->max_time;
+    }
+    if (fair) {
+        *fair = queue->fair;
+    }
+}
+
+/* Latencies are the time messages spent in the queue, in microseconds */
+void
+lm_message_queue_get_stats (LmMessageQueue *queue,
+                            guint          *max_length,
+                            gint64         *last_latency,
+                            gint64         *max_latency)
+{
+    g_return_if_fail (queue != NULL);
+
+    if (max_length) {
+        *max_length = queue->max_length;
+    }
+    if (last_latency) {
+        *last_latency = queue->last_latency;
+    }
+    if (max_latency) {
+        *max_latency = queue->max_latency;
+    }
 }
 
 LmMessageQueue *
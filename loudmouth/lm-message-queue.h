@@ -33,14 +33,34 @@ void              lm_message_queue_attach      (LmMessageQueue        *queue,
                                                 GMainContext *context);
 
 void              lm_message_queue_detach      (LmMessageQueue *queue);
+void              lm_message_queue_push        (LmMessageQueue *queue,
+                                                LmMessage      *m,
+                                                LmMessageLane   lane,
+                                                gsize           size);
 void              lm_message_queue_push_tail   (LmMessageQueue *queue,
                                                 LmMessage      *m);
 LmMessage *       lm_message_queue_peek_nth    (LmMessageQueue *queue,
                                                 guint           n);
 LmMessage *       lm_message_queue_pop_nth     (LmMessageQueue *queue,
                                                 guint           n);
+LmMessage *       lm_message_queue_pop_next    (LmMessageQueue *queue);
+LmMessage *       lm_message_queue_pop_id      (LmMessageQueue *queue,
+                                                const gchar    *id);
 guint             lm_message_queue_get_length  (LmMessageQueue *queue);
+gsize             lm_message_queue_get_size    (LmMessageQueue *queue);
 gboolean          lm_message_queue_is_empty    (LmMessageQueue *queue);
+void              lm_message_queue_set_budget  (LmMessageQueue *queue,
+                                                guint           max_messages,
+                                                gint64          max_time,
+                                                gboolean        fair);
+void              lm_message_queue_get_budget  (LmMessageQueue *queue,
+                                                guint          *max_messages,
+                                                gint64         *max_time,
+                                                gboolean       *fair);
+void              lm_message_queue_get_stats   (LmMessageQueue *queue,
+                                                guint          *max_length,
+                                                gint64         *last_latency,
+                                                gint64         *max_latency);
 
 LmMessageQueue *  lm_message_queue_ref         (LmMessageQueue *queue);
 void              lm_message_queue_unref       (LmMessageQueue *queue);
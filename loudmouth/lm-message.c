@@ -37,20 +37,20 @@ static struct TypeNames
     LmMessageType  type;
     const gchar   *name;
 } type_names[] = {
-    { LM_MESSAGE_TYPE_MESSAGE,         "message"         },
-    { LM_MESSAGE_TYPE_PRESENCE,        "presence"        },
-    { LM_MESSAGE_TYPE_IQ,              "iq"              },
-    { LM_MESSAGE_TYPE_STREAM,          "stream:stream"   },
-    { LM_MESSAGE_TYPE_STREAM_ERROR,    "stream:error"    },
-    { LM_MESSAGE_TYPE_STREAM_FEATURES, "stream:features" },
-    { LM_MESSAGE_TYPE_AUTH,            "auth"            },
-    { LM_MESSAGE_TYPE_CHALLENGE,       "challenge"       },
-    { LM_MESSAGE_TYPE_RESPONSE,        "response"        },
-    { LM_MESSAGE_TYPE_SUCCESS,         "success"         },
-    { LM_MESSAGE_TYPE_FAILURE,         "failure"         },
-    { LM_MESSAGE_TYPE_PROCEED,         "proceed"         },
-    { LM_MESSAGE_TYPE_STARTTLS,        "starttls"        },
-    { LM_MESSAGE_TYPE_UNKNOWN,         NULL              }
+    { LM_MESSAGE_TYPE_MESSAGE,         LM_ATOM (MESSAGE)           },
+    { LM_MESSAGE_TYPE_PRESENCE,        LM_ATOM (PRESENCE)          },
+    { LM_MESSAGE_TYPE_IQ,              LM_ATOM (IQ)                },
+    { LM_MESSAGE_TYPE_STREAM,          LM_ATOM (STREAM)            },
+    { LM_MESSAGE_TYPE_STREAM_ERROR,    LM_ATOM (STREAM_ERROR)      },
+    { LM_MESSAGE_TYPE_STREAM_FEATURES, LM_ATOM (STREAM_FEATURES)   },
+    { LM_MESSAGE_TYPE_AUTH,            LM_ATOM (AUTH)              },
+    { LM_MESSAGE_TYPE_CHALLENGE,       LM_ATOM (CHALLENGE)         },
+    { LM_MESSAGE_TYPE_RESPONSE,        LM_ATOM (RESPONSE)          },
+    { LM_MESSAGE_TYPE_SUCCESS,         LM_ATOM (SUCCESS)           },
+    { LM_MESSAGE_TYPE_FAILURE,         LM_ATOM (FAILURE)           },
+    { LM_MESSAGE_TYPE_PROCEED,         LM_ATOM (PROCEED)           },
+    { LM_MESSAGE_TYPE_STARTTLS,        LM_ATOM (STARTTLS)          },
+    { LM_MESSAGE_TYPE_UNKNOWN,         NULL                        }
 };
 
 static struct SubTypeNames
@@ -58,46 +58,74 @@ static struct SubTypeNames
     LmMessageSubType  type;
     const gchar      *name;
 } sub_type_names[] = {
-    { LM_MESSAGE_SUB_TYPE_NORMAL,          "normal"        },
-    { LM_MESSAGE_SUB_TYPE_CHAT,            "chat"          },
-    { LM_MESSAGE_SUB_TYPE_GROUPCHAT,       "groupchat"     },
-    { LM_MESSAGE_SUB_TYPE_HEADLINE,        "headline"      },
-    { LM_MESSAGE_SUB_TYPE_UNAVAILABLE,     "unavailable"   },
-    { LM_MESSAGE_SUB_TYPE_PROBE,           "probe"         },
-    { LM_MESSAGE_SUB_TYPE_SUBSCRIBE,       "subscribe"     },
-    { LM_MESSAGE_SUB_TYPE_UNSUBSCRIBE,     "unsubscribe"   },
-    { LM_MESSAGE_SUB_TYPE_SUBSCRIBED,      "subscribed"    },
-    { LM_MESSAGE_SUB_TYPE_UNSUBSCRIBED,    "unsubscribed"  },
-    { LM_MESSAGE_SUB_TYPE_GET,             "get"           },
-    { LM_MESSAGE_SUB_TYPE_SET,             "set"           },
-    { LM_MESSAGE_SUB_TYPE_RESULT,          "result"        },
-    { LM_MESSAGE_SUB_TYPE_ERROR,           "error"         }
+    { LM_MESSAGE_SUB_TYPE_NORMAL,          LM_ATOM (NORMAL)        },
+    { LM_MESSAGE_SUB_TYPE_CHAT,            LM_ATOM (CHAT)          },
+    { LM_MESSAGE_SUB_TYPE_GROUPCHAT,       LM_ATOM (GROUPCHAT)     },
+    { LM_MESSAGE_SUB_TYPE_HEADLINE,        LM_ATOM (HEADLINE)      },
+    { LM_MESSAGE_SUB_TYPE_UNAVAILABLE,     LM_ATOM (UNAVAILABLE)   },
+    { LM_MESSAGE_SUB_TYPE_PROBE,           LM_ATOM (PROBE)         },
+    { LM_MESSAGE_SUB_TYPE_SUBSCRIBE,       LM_ATOM (SUBSCRIBE)     },
+    { LM_MESSAGE_SUB_TYPE_UNSUBSCRIBE,     LM_ATOM (UNSUBSCRIBE)   },
+    { LM_MESSAGE_SUB_TYPE_SUBSCRIBED,      LM_ATOM (SUBSCRIBED)    },
+    { LM_MESSAGE_SUB_TYPE_UNSUBSCRIBED,    LM_ATOM (UNSUBSCRIBED)  },
+    { LM_MESSAGE_SUB_TYPE_GET,             LM_ATOM (GET)           },
+    { LM_MESSAGE_SUB_TYPE_SET,             LM_ATOM (SET)           },
+    { LM_MESSAGE_SUB_TYPE_RESULT,          LM_ATOM (RESULT)        },
+    { LM_MESSAGE_SUB_TYPE_ERROR,           LM_ATOM (ERROR)         }
 };
 
 struct LmMessagePriv {
     LmMessageType    type;
     LmMessageSubType sub_type;
     gint             ref_count;
+
+    /* The attributes of the root node that dispatch looks at, found once
+     * when the message is made. Attributes are changed in place and never
+     * removed, so these stay valid for as long as the node lives.
+     */
+    LmMessageNodeAttribute *id;
+    LmMessageNodeAttribute *from;
+    LmMessageNodeAttribute *to;
+    LmMessageNodeAttribute *type_attr;
+
+    /* Set when the message was parsed into an arena, see lm-arena.c */
+    LmArena         *arena;
 };
 
+/* All of the type names are atoms, a name is classified by its id */
 static LmMessageType
 message_type_from_string (const gchar *type_str)
 {
-    gint i;
-
-    if (!type_str) {
+    switch (_lm_atom_id (type_str)) {
+    case LM_ATOM_ID_MESSAGE:
+        return LM_MESSAGE_TYPE_MESSAGE;
+    case LM_ATOM_ID_PRESENCE:
+        return LM_MESSAGE_TYPE_PRESENCE;
+    case LM_ATOM_ID_IQ:
+        return LM_MESSAGE_TYPE_IQ;
+    case LM_ATOM_ID_STREAM:
+        return LM_MESSAGE_TYPE_STREAM;
+    case LM_ATOM_ID_STREAM_ERROR:
+        return LM_MESSAGE_TYPE_STREAM_ERROR;
+    case LM_ATOM_ID_STREAM_FEATURES:
+        return LM_MESSAGE_TYPE_STREAM_FEATURES;
+    case LM_ATOM_ID_AUTH:
+        return LM_MESSAGE_TYPE_AUTH;
+    case LM_ATOM_ID_CHALLENGE:
+        return LM_MESSAGE_TYPE_CHALLENGE;
+    case LM_ATOM_ID_RESPONSE:
+        return LM_MESSAGE_TYPE_RESPONSE;
+    case LM_ATOM_ID_SUCCESS:
+        return LM_MESSAGE_TYPE_SUCCESS;
+    case LM_ATOM_ID_FAILURE:
+        return LM_MESSAGE_TYPE_FAILURE;
+    case LM_ATOM_ID_PROCEED:
+        return LM_MESSAGE_TYPE_PROCEED;
+    case LM_ATOM_ID_STARTTLS:
+        return LM_MESSAGE_TYPE_STARTTLS;
+    default:
         return LM_MESSAGE_TYPE_UNKNOWN;
     }
-
-    for (i = LM_MESSAGE_TYPE_MESSAGE;
-         i < LM_MESSAGE_TYPE_UNKNOWN;
-         ++i) {
-        if (strcmp (type_str, type_names[i].name) == 0) {
-            return type_names[i].type;
-        }
-    }
-
-    return LM_MESSAGE_TYPE_UNKNOWN;
 }
 
 
@@ -121,6 +149,40 @@ message_sub_type_from_string (const gchar *type_str)
         return LM_MESSAGE_SUB_TYPE_NOT_SET;
     }
 
+    switch (_lm_atom_id (type_str)) {
+    case LM_ATOM_ID_NORMAL:
+        return LM_MESSAGE_SUB_TYPE_NORMAL;
+    case LM_ATOM_ID_CHAT:
+        return LM_MESSAGE_SUB_TYPE_CHAT;
+    case LM_ATOM_ID_GROUPCHAT:
+        return LM_MESSAGE_SUB_TYPE_GROUPCHAT;
+    case LM_ATOM_ID_HEADLINE:
+        return LM_MESSAGE_SUB_TYPE_HEADLINE;
+    case LM_ATOM_ID_UNAVAILABLE:
+        return LM_MESSAGE_SUB_TYPE_UNAVAILABLE;
+    case LM_ATOM_ID_PROBE:
+        return LM_MESSAGE_SUB_TYPE_PROBE;
+    case LM_ATOM_ID_SUBSCRIBE:
+        return LM_MESSAGE_SUB_TYPE_SUBSCRIBE;
+    case LM_ATOM_ID_UNSUBSCRIBE:
+        return LM_MESSAGE_SUB_TYPE_UNSUBSCRIBE;
+    case LM_ATOM_ID_SUBSCRIBED:
+        return LM_MESSAGE_SUB_TYPE_SUBSCRIBED;
+    case LM_ATOM_ID_UNSUBSCRIBED:
+        return LM_MESSAGE_SUB_TYPE_UNSUBSCRIBED;
+    case LM_ATOM_ID_GET:
+        return LM_MESSAGE_SUB_TYPE_GET;
+    case LM_ATOM_ID_SET:
+        return LM_MESSAGE_SUB_TYPE_SET;
+    case LM_ATOM_ID_RESULT:
+        return LM_MESSAGE_SUB_TYPE_RESULT;
+    case LM_ATOM_ID_ERROR:
+        return LM_MESSAGE_SUB_TYPE_ERROR;
+    default:
+        break;
+    }
+
+    /* Peers sending the type in another case are still understood */
     for (i = LM_MESSAGE_SUB_TYPE_NORMAL;
          i <= LM_MESSAGE_SUB_TYPE_ERROR;
          ++i) {
@@ -169,13 +231,55 @@ message_sub_type_when_unset (LmMessageType type) {
     return sub_type;
 }
 
+/* Fills in the routing attributes of @m in one pass over the attributes
+ * of its root. Their names are atoms, so that it's a switch on the id.
+ */
+static void
+message_find_routing (LmMessage *m)
+{
+    LmMessageNodeAttribute *a;
+
+    PRIV(m)->id = PRIV(m)->from = PRIV(m)->to = PRIV(m)->type_attr = NULL;
+
+    for (a = m->node->attributes; a; a = a->next) {
+        switch (_lm_atom_id (a->name)) {
+        case LM_ATOM_ID_ID:
+            PRIV(m)->id = a;
+            break;
+        case LM_ATOM_ID_FROM:
+            PRIV(m)->from = a;
+            break;
+        case LM_ATOM_ID_TO:
+            PRIV(m)->to = a;
+            break;
+        case LM_ATOM_ID_TYPE:
+            PRIV(m)->type_attr = a;
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+/* Attributes added after the message was made aren't in a slot yet */
+static const gchar *
+message_get_routing (LmMessage              *m,
+                     LmMessageNodeAttribute *attr,
+                     const gchar            *name)
+{
+    if (attr) {
+        return attr->value;
+    }
+
+    return lm_message_node_get_attribute (m->node, name);
+}
+
 LmMessage *
 _lm_message_new_from_node (LmMessageNode *node)
 {
     LmMessage        *m;
     LmMessageType     type;
-    LmMessageSubType  sub_type;
-    const gchar      *sub_type_str;
+    LmArena          *arena;
 
     type = message_type_from_string (node->name);
 
@@ -183,22 +287,28 @@ _lm_message_new_from_node (LmMessageNode *node)
         return NULL;
     }
 
-    sub_type_str = lm_message_node_get_attribute (node, "type");
-    if (sub_type_str) {
-        sub_type = message_sub_type_from_string (sub_type_str);
+    arena = _lm_message_node_get_arena (node);
+    if (arena) {
+        m = _lm_arena_alloc0 (arena, sizeof (LmMessage));
+        m->priv = _lm_arena_alloc0 (arena, sizeof (LmMessagePriv));
+        PRIV(m)->arena = _lm_arena_ref (arena);
     } else {
-        sub_type = message_sub_type_when_unset (type);
+        m = g_new0 (LmMessage, 1);
+        m->priv = g_new0 (LmMessagePriv, 1);
     }
 
-    m = g_new0 (LmMessage, 1);
-    m->priv = g_new0 (LmMessagePriv, 1);
-
     PRIV(m)->ref_count = 1;
     PRIV(m)->type = type;
-    PRIV(m)->sub_type = sub_type;
 
     m->node = lm_message_node_ref (node);
 
+    message_find_routing (m);
+    if (PRIV(m)->type_attr) {
+        PRIV(m)->sub_type = message_sub_type_from_string (PRIV(m)->type_attr->value);
+    } else {
+        PRIV(m)->sub_type = message_sub_type_when_unset (type);
+    }
+
     return m;
 }
 
@@ -243,6 +353,8 @@ lm_message_new (const gchar *to, LmMessageType type)
         lm_message_node_set_attribute (m->node, "type", "get");
     }
 
+    message_find_routing (m);
+
     return m;
 }
 
@@ -273,6 +385,7 @@ lm_message_new_with_sub_type (const gchar      *to,
         lm_message_node_set_attributes (m->node,
                                         "type", type_str, NULL);
         PRIV(m)->sub_type = sub_type;
+        message_find_routing (m);
     }
 
     return m;
@@ -310,6 +423,106 @@ lm_message_get_sub_type (LmMessage *message)
     return PRIV(message)->sub_type;
 }
 
+/**
+ * lm_message_get_id:
+ * @message: an #LmMessage
+ *
+ * Fetches the id attribute of the root node of @message. Unlike
+ * lm_message_node_get_attribute() this doesn't have to look through the
+ * attributes.
+ *
+ * Return value: the id or %NULL if not set
+ *
+ * Since 1.5.5
+ **/
+const gchar *
+lm_message_get_id (LmMessage *message)
+{
+    g_return_val_if_fail (message != NULL, NULL);
+
+    return message_get_routing (message, PRIV(message)->id, LM_ATOM (ID));
+}
+
+/**
+ * lm_message_get_from:
+ * @message: an #LmMessage
+ *
+ * Fetches the from attribute of the root node of @message, see
+ * lm_message_get_id().
+ *
+ * Return value: the sender or %NULL if not set
+ *
+ * Since 1.5.5
+ **/
+const gchar *
+lm_message_get_from (LmMessage *message)
+{
+    g_return_val_if_fail (message != NULL, NULL);
+
+    return message_get_routing (message, PRIV(message)->from, LM_ATOM (FROM));
+}
+
+/**
+ * lm_message_get_to:
+ * @message: an #LmMessage
+ *
+ * Fetches the to attribute of the root node of @message, see
+ * lm_message_get_id().
+ *
+ * Return value: the receipient or %NULL if not set
+ *
+ * Since 1.5.5
+ **/
+const gchar *
+lm_message_get_to (LmMessage *message)
+{
+    g_return_val_if_fail (message != NULL, NULL);
+
+    return message_get_routing (message, PRIV(message)->to, LM_ATOM (TO));
+}
+
+/**
+ * lm_message_get_type_attribute:
+ * @message: an #LmMessage
+ *
+ * Fetches the type attribute of the root node of @message as it is, for
+ * values lm_message_get_sub_type() doesn't know about. See
+ * lm_message_get_id().
+ *
+ * Return value: the type or %NULL if not set
+ *
+ * Since 1.5.5
+ **/
+const gchar *
+lm_message_get_type_attribute (LmMessage *message)
+{
+    g_return_val_if_fail (message != NULL, NULL);
+
+    return message_get_routing (message, PRIV(message)->type_attr, LM_ATOM (TYPE));
+}
+
+/**
+ * _lm_message_get_id_hash:
+ * @message: an #LmMessage
+ *
+ * Return value: g_str_hash() of the id of @message, worked out when the
+ * id was last set rather than here, 0 if it has none.
+ **/
+guint
+_lm_message_get_id_hash (LmMessage *message)
+{
+    const gchar *id;
+
+    if (PRIV(message)->id) {
+        return _lm_message_node_attribute_get_hash (PRIV(message)->id);
+    }
+
+    /* Added after the message was made, it isn't in its slot */
+    id = lm_message_get_id (message);
+
+    return id ? g_str_hash (id) : 0;
+}
+
 /**
  * lm_message_get_node:
  * @message: an #LmMessage
@@ -326,11 +539,62 @@ lm_message_get_node (LmMessage *message)
     return message->node;
 }
 
+/**
+ * lm_message_copy:
+ * @message: an #LmMessage
+ *
+ * Copies @message, see lm_message_node_copy() for how the nodes are
+ * shared until one of the messages changes. The copy is independent of
+ * @message from then on and can be changed and sent on its own.
+ *
+ * Return value: a newly created #LmMessage
+ *
+ * Since 1.5.5
+ **/
+LmMessage *
+lm_message_copy (LmMessage *message)
+{
+    LmMessage *m;
+
+    g_return_val_if_fail (message != NULL, NULL);
+
+    m = g_new0 (LmMessage, 1);
+    m->priv = g_new0 (LmMessagePriv, 1);
+
+    PRIV(m)->ref_count = 1;
+    PRIV(m)->type = PRIV(message)->type;
+    PRIV(m)->sub_type = PRIV(message)->sub_type;
+
+    m->node = lm_message_node_copy (message->node);
+    message_find_routing (m);
+
+    return m;
+}
+
+/**
+ * lm_message_freeze:
+ * @message: an #LmMessage
+ *
+ * Makes the nodes of @message read only, so that it can be handed to other
+ * threads while the one that received it still holds on to it. See
+ * lm_message_node_freeze().
+ *
+ * Since 1.5.5
+ **/
+void
+lm_message_freeze (LmMessage *message)
+{
+    g_return_if_fail (message != NULL);
+
+    lm_message_node_freeze (message->node);
+}
+
 /**
  * lm_message_ref:
  * @message: an #LmMessage
  *
- * Adds a reference to @message.
+ * Adds a reference to @message. References can be taken and dropped from
+ * any thread.
  *
  * Return value: the message
  **/
@@ -339,7 +603,7 @@ lm_message_ref (LmMessage *message)
 {
     g_return_val_if_fail (message != NULL, NULL);
 
-    PRIV(message)->ref_count++;
+    g_atomic_int_inc (&PRIV(message)->ref_count);
 
     return message;
 }
@@ -356,11 +620,16 @@ lm_message_unref (LmMessage *message)
 {
     g_return_if_fail (message != NULL);
 
-    PRIV(message)->ref_count--;
+    if (g_atomic_int_dec_and_test (&PRIV(message)->ref_count)) {
+        LmArena *arena = PRIV(message)->arena;
 
-    if (PRIV(message)->ref_count == 0) {
         lm_message_node_unref (message->node);
-        g_free (message->priv);
-        g_free (message);
+
+        if (arena) {
+            _lm_arena_unref (arena);
+        } else {
+            g_free (message->priv);
+            g_free (message);
+        }
     }
 }
@@ -111,6 +111,23 @@ typedef enum {
     LM_MESSAGE_SUB_TYPE_ERROR
 } LmMessageSubType;
 
+/**
+ * LmMessageLane:
+ * @LM_MESSAGE_LANE_HIGH: handled ahead of the messages in the other lanes
+ * @LM_MESSAGE_LANE_NORMAL: the lane all incoming messages go to unless a #LmLaneFunction is set
+ * @LM_MESSAGE_LANE_LOW: handled after the messages in the other lanes
+ *
+ * Lanes in which incoming messages wait to be handled. Messages in the same
+ * lane are handled in the order they came in. See lm_connection_set_lane_function().
+ *
+ * Since 1.5.5
+ */
+typedef enum {
+    LM_MESSAGE_LANE_HIGH,
+    LM_MESSAGE_LANE_NORMAL,
+    LM_MESSAGE_LANE_LOW
+} LmMessageLane;
+
 LmMessage *      lm_message_new               (const gchar      *to,
                                                LmMessageType     type);
 LmMessage *      lm_message_new_with_sub_type (const gchar      *to,
@@ -118,7 +135,15 @@ LmMessage *      lm_message_new_with_sub_type (const gchar      *to,
                                                LmMessageSubType  sub_type);
 LmMessageType    lm_message_get_type          (LmMessage        *message);
 LmMessageSubType lm_message_get_sub_type      (LmMessage        *message);
+const gchar *    lm_message_get_id            (LmMessage        *message);
+const gchar *    lm_message_get_from          (LmMessage        *message);
+const gchar *    lm_message_get_to            (LmMessage        *message);
+const gchar *    lm_message_get_type_attribute (LmMessage        *message);
 LmMessageNode *  lm_message_get_node          (LmMessage        *message);
+LmMessage *      lm_message_copy              (LmMessage        *message);
+void             lm_message_freeze            (LmMessage        *message);
+LmMessage *      lm_message_new_from_binary   (GBytes           *bytes,
+                                               GError          **error);
 LmMessage *      lm_message_ref               (LmMessage        *message);
 void             lm_message_unref             (LmMessage        *message);
 
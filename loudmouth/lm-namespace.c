@@ -0,0 +1,155 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (C) 2003 Imendio AB
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, see <https://www.gnu.org/licenses>
+ */
+
+/**
+ * SECTION:lm-namespace
+ * @Title: LmNamespace
+ * @Short_description: Well known XML namespaces
+ *
+ * Telling the namespace of a node apart by an #LmNamespace is a switch
+ * statement rather than a string compare for every namespace tried:
+ * |[
+ * switch (lm_message_node_get_namespace (node)) {
+ * case LM_NAMESPACE_ROSTER:
+ *     ...
+ * ]|
+ */
+
+#include <config.h>
+
+#include "lm-atoms.h"
+#include "lm-namespace.h"
+
+/* Every namespace is one of the atoms, the same names with NS_ in front */
+#define NAMESPACE_LIST(X)                                               \
+    X (CLIENT)                                                          \
+    X (SERVER)                                                          \
+    X (STREAMS)                                                         \
+    X (ROSTER)                                                          \
+    X (AUTH)                                                            \
+    X (VERSION)                                                         \
+    X (DATA)                                                            \
+    X (X_DELAY)                                                         \
+    X (TLS)                                                             \
+    X (SASL)                                                            \
+    X (BIND)                                                            \
+    X (SESSION)                                                         \
+    X (STANZAS)                                                         \
+    X (STREAM_ERRORS)                                                   \
+    X (DISCO_INFO)                                                      \
+    X (DISCO_ITEMS)                                                     \
+    X (CAPS)                                                            \
+    X (CHATSTATES)                                                      \
+    X (MUC)                                                             \
+    X (MUC_USER)                                                        \
+    X (PING)                                                            \
+    X (DELAY)                                                           \
+    X (PRIVATE)                                                         \
+    X (REGISTER)                                                        \
+    X (LAST)                                                            \
+    X (PRIVACY)                                                         \
+    X (SEARCH)                                                          \
+    X (IQ_OOB)                                                          \
+    X (X_OOB)                                                           \
+    X (X_CONFERENCE)                                                    \
+    X (VCARD)                                                           \
+    X (VCARD_UPDATE)                                                    \
+    X (FEATURE_IQ_AUTH)                                                 \
+    X (FEATURE_IQ_REGISTER)                                             \
+    X (MUC_ADMIN)                                                       \
+    X (MUC_OWNER)                                                       \
+    X (PUBSUB)                                                          \
+    X (PUBSUB_EVENT)                                                    \
+    X (PUBSUB_OWNER)                                                    \
+    X (COMMANDS)                                                        \
+    X (NICK)                                                            \
+    X (XHTML_IM)                                                        \
+    X (XHTML)                                                           \
+    X (IBB)                                                             \
+    X (SI)                                                              \
+    X (BYTESTREAMS)                                                     \
+    X (TIME)                                                            \
+    X (RECEIPTS)                                                        \
+    X (CARBONS)                                                         \
+    X (FORWARD)                                                         \
+    X (MAM)                                                             \
+    X (SM)                                                              \
+    X (BLOCKING)                                                        \
+    X (JINGLE)                                                          \
+    X (BOB)                                                             \
+    X (HINTS)                                                           \
+    X (CORRECTION)                                                      \
+    X (CHAT_MARKERS)                                                    \
+    X (AVATAR_DATA)                                                     \
+    X (AVATAR_METADATA)                                                 \
+    X (STANZA_ID)
+
+#define NAMESPACE_ATOM(name) LM_ATOM_ID_NS_##name,
+
+static const guint8 namespace_atoms[] = {
+    LM_ATOM_ID_NONE,
+    NAMESPACE_LIST (NAMESPACE_ATOM)
+};
+
+#undef NAMESPACE_ATOM
+
+G_STATIC_ASSERT (G_N_ELEMENTS (namespace_atoms) == LM_NAMESPACE_STANZA_ID + 1);
+
+/**
+ * lm_namespace_from_string:
+ * @str: a namespace URI, or %NULL
+ *
+ * Finds the #LmNamespace for @str. Namespaces are compared exactly, as
+ * XML does.
+ *
+ * Return value: the namespace, %LM_NAMESPACE_UNKNOWN if there is none
+ *
+ * Since 1.5.5
+ **/
+LmNamespace
+lm_namespace_from_string (const gchar *str)
+{
+#define NAMESPACE_CASE(name)                                            \
+    case LM_ATOM_ID_NS_##name: return LM_NAMESPACE_##name;
+
+    switch (_lm_atom_id (str)) {
+    NAMESPACE_LIST (NAMESPACE_CASE)
+    default:
+        break;
+    }
+
+#undef NAMESPACE_CASE
+
+    return LM_NAMESPACE_UNKNOWN;
+}
+
+/**
+ * lm_namespace_to_string:
+ * @ns: an #LmNamespace
+ *
+ * Return value: the URI of @ns, %NULL for %LM_NAMESPACE_UNKNOWN
+ *
+ * Since 1.5.5
+ **/
+const gchar *
+lm_namespace_to_string (LmNamespace ns)
+{
+    g_return_val_if_fail (ns < G_N_ELEMENTS (namespace_atoms), NULL);
+
+    return _lm_atom_from_id (namespace_atoms[ns]);
+}
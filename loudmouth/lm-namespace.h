@@ -0,0 +1,170 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (C) 2003 Imendio AB
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, see <https://www.gnu.org/licenses>
+ */
+
+#ifndef __LM_NAMESPACE_H__
+#define __LM_NAMESPACE_H__
+
+#if !defined (LM_INSIDE_LOUDMOUTH_H) && !defined (LM_COMPILATION)
+#error "Only <loudmouth/loudmouth.h> can be included directly, this file may disappear or change contents."
+#endif
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/**
+ * LmNamespace:
+ * @LM_NAMESPACE_UNKNOWN: no namespace, or one not listed here
+ * @LM_NAMESPACE_CLIENT: jabber:client
+ * @LM_NAMESPACE_SERVER: jabber:server
+ * @LM_NAMESPACE_STREAMS: http://etherx.jabber.org/streams
+ * @LM_NAMESPACE_ROSTER: jabber:iq:roster
+ * @LM_NAMESPACE_AUTH: jabber:iq:auth
+ * @LM_NAMESPACE_VERSION: jabber:iq:version
+ * @LM_NAMESPACE_DATA: jabber:x:data
+ * @LM_NAMESPACE_X_DELAY: jabber:x:delay
+ * @LM_NAMESPACE_TLS: urn:ietf:params:xml:ns:xmpp-tls
+ * @LM_NAMESPACE_SASL: urn:ietf:params:xml:ns:xmpp-sasl
+ * @LM_NAMESPACE_BIND: urn:ietf:params:xml:ns:xmpp-bind
+ * @LM_NAMESPACE_SESSION: urn:ietf:params:xml:ns:xmpp-session
+ * @LM_NAMESPACE_STANZAS: urn:ietf:params:xml:ns:xmpp-stanzas
+ * @LM_NAMESPACE_STREAM_ERRORS: urn:ietf:params:xml:ns:xmpp-streams
+ * @LM_NAMESPACE_DISCO_INFO: http://jabber.org/protocol/disco#info
+ * @LM_NAMESPACE_DISCO_ITEMS: http://jabber.org/protocol/disco#items
+ * @LM_NAMESPACE_CAPS: http://jabber.org/protocol/caps
+ * @LM_NAMESPACE_CHATSTATES: http://jabber.org/protocol/chatstates
+ * @LM_NAMESPACE_MUC: http://jabber.org/protocol/muc
+ * @LM_NAMESPACE_MUC_USER: http://jabber.org/protocol/muc#user
+ * @LM_NAMESPACE_PING: urn:xmpp:ping
+ * @LM_NAMESPACE_DELAY: urn:xmpp:delay
+ * @LM_NAMESPACE_PRIVATE: jabber:iq:private
+ * @LM_NAMESPACE_REGISTER: jabber:iq:register
+ * @LM_NAMESPACE_LAST: jabber:iq:last
+ * @LM_NAMESPACE_PRIVACY: jabber:iq:privacy
+ * @LM_NAMESPACE_SEARCH: jabber:iq:search
+ * @LM_NAMESPACE_IQ_OOB: jabber:iq:oob
+ * @LM_NAMESPACE_X_OOB: jabber:x:oob
+ * @LM_NAMESPACE_X_CONFERENCE: jabber:x:conference
+ * @LM_NAMESPACE_VCARD: vcard-temp
+ * @LM_NAMESPACE_VCARD_UPDATE: vcard-temp:x:update
+ * @LM_NAMESPACE_FEATURE_IQ_AUTH: http://jabber.org/features/iq-auth
+ * @LM_NAMESPACE_FEATURE_IQ_REGISTER: http://jabber.org/features/iq-register
+ * @LM_NAMESPACE_MUC_ADMIN: http://jabber.org/protocol/muc#admin
+ * @LM_NAMESPACE_MUC_OWNER: http://jabber.org/protocol/muc#owner
+ * @LM_NAMESPACE_PUBSUB: http://jabber.org/protocol/pubsub
+ * @LM_NAMESPACE_PUBSUB_EVENT: http://jabber.org/protocol/pubsub#event
+ * @LM_NAMESPACE_PUBSUB_OWNER: http://jabber.org/protocol/pubsub#owner
+ * @LM_NAMESPACE_COMMANDS: http://jabber.org/protocol/commands
+ * @LM_NAMESPACE_NICK: http://jabber.org/protocol/nick
+ * @LM_NAMESPACE_XHTML_IM: http://jabber.org/protocol/xhtml-im
+ * @LM_NAMESPACE_XHTML: http://www.w3.org/1999/xhtml
+ * @LM_NAMESPACE_IBB: http://jabber.org/protocol/ibb
+ * @LM_NAMESPACE_SI: http://jabber.org/protocol/si
+ * @LM_NAMESPACE_BYTESTREAMS: http://jabber.org/protocol/bytestreams
+ * @LM_NAMESPACE_TIME: urn:xmpp:time
+ * @LM_NAMESPACE_RECEIPTS: urn:xmpp:receipts
+ * @LM_NAMESPACE_CARBONS: urn:xmpp:carbons:2
+ * @LM_NAMESPACE_FORWARD: urn:xmpp:forward:0
+ * @LM_NAMESPACE_MAM: urn:xmpp:mam:2
+ * @LM_NAMESPACE_SM: urn:xmpp:sm:3
+ * @LM_NAMESPACE_BLOCKING: urn:xmpp:blocking
+ * @LM_NAMESPACE_JINGLE: urn:xmpp:jingle:1
+ * @LM_NAMESPACE_BOB: urn:xmpp:bob
+ * @LM_NAMESPACE_HINTS: urn:xmpp:hints
+ * @LM_NAMESPACE_CORRECTION: urn:xmpp:message-correct:0
+ * @LM_NAMESPACE_CHAT_MARKERS: urn:xmpp:chat-markers:0
+ * @LM_NAMESPACE_AVATAR_DATA: urn:xmpp:avatar:data
+ * @LM_NAMESPACE_AVATAR_METADATA: urn:xmpp:avatar:metadata
+ * @LM_NAMESPACE_STANZA_ID: urn:xmpp:sid:0
+ *
+ * The XML namespaces Loudmouth knows about. New ones are only ever added
+ * at the end.
+ *
+ * Since 1.5.5
+ */
+typedef enum {
+    LM_NAMESPACE_UNKNOWN,
+    LM_NAMESPACE_CLIENT,
+    LM_NAMESPACE_SERVER,
+    LM_NAMESPACE_STREAMS,
+    LM_NAMESPACE_ROSTER,
+    LM_NAMESPACE_AUTH,
+    LM_NAMESPACE_VERSION,
+    LM_NAMESPACE_DATA,
+    LM_NAMESPACE_X_DELAY,
+    LM_NAMESPACE_TLS,
+    LM_NAMESPACE_SASL,
+    LM_NAMESPACE_BIND,
+    LM_NAMESPACE_SESSION,
+    LM_NAMESPACE_STANZAS,
+    LM_NAMESPACE_STREAM_ERRORS,
+    LM_NAMESPACE_DISCO_INFO,
+    LM_NAMESPACE_DISCO_ITEMS,
+    LM_NAMESPACE_CAPS,
+    LM_NAMESPACE_CHATSTATES,
+    LM_NAMESPACE_MUC,
+    LM_NAMESPACE_MUC_USER,
+    LM_NAMESPACE_PING,
+    LM_NAMESPACE_DELAY,
+    LM_NAMESPACE_PRIVATE,
+    LM_NAMESPACE_REGISTER,
+    LM_NAMESPACE_LAST,
+    LM_NAMESPACE_PRIVACY,
+    LM_NAMESPACE_SEARCH,
+    LM_NAMESPACE_IQ_OOB,
+    LM_NAMESPACE_X_OOB,
+    LM_NAMESPACE_X_CONFERENCE,
+    LM_NAMESPACE_VCARD,
+    LM_NAMESPACE_VCARD_UPDATE,
+    LM_NAMESPACE_FEATURE_IQ_AUTH,
+    LM_NAMESPACE_FEATURE_IQ_REGISTER,
+    LM_NAMESPACE_MUC_ADMIN,
+    LM_NAMESPACE_MUC_OWNER,
+    LM_NAMESPACE_PUBSUB,
+    LM_NAMESPACE_PUBSUB_EVENT,
+    LM_NAMESPACE_PUBSUB_OWNER,
+    LM_NAMESPACE_COMMANDS,
+    LM_NAMESPACE_NICK,
+    LM_NAMESPACE_XHTML_IM,
+    LM_NAMESPACE_XHTML,
+    LM_NAMESPACE_IBB,
+    LM_NAMESPACE_SI,
+    LM_NAMESPACE_BYTESTREAMS,
+    LM_NAMESPACE_TIME,
+    LM_NAMESPACE_RECEIPTS,
+    LM_NAMESPACE_CARBONS,
+    LM_NAMESPACE_FORWARD,
+    LM_NAMESPACE_MAM,
+    LM_NAMESPACE_SM,
+    LM_NAMESPACE_BLOCKING,
+    LM_NAMESPACE_JINGLE,
+    LM_NAMESPACE_BOB,
+    LM_NAMESPACE_HINTS,
+    LM_NAMESPACE_CORRECTION,
+    LM_NAMESPACE_CHAT_MARKERS,
+    LM_NAMESPACE_AVATAR_DATA,
+    LM_NAMESPACE_AVATAR_METADATA,
+    LM_NAMESPACE_STANZA_ID
+} LmNamespace;
+
+LmNamespace   lm_namespace_from_string (const gchar *str);
+const gchar * lm_namespace_to_string   (LmNamespace  ns);
+
+G_END_DECLS
+
+#endif /* __LM_NAMESPACE_H__ */
@@ -66,6 +66,9 @@ struct _LmOldSocket {
 
     GIOChannel        *io_channel;
     GSource           *watch_in;
+    /* Reads what SSL already has once reading starts again */
+    GSource           *watch_resume;
+    gboolean           reading_paused;
     GSource           *watch_err;
     GSource           *watch_hup;
 
@@ -98,6 +101,7 @@ static gboolean     socket_connect_cb              (GIOChannel     *source,
 static gboolean     socket_in_event                (GIOChannel     *source,
                                                     GIOCondition    condition,
                                                     LmOldSocket    *socket);
+static gboolean     socket_resume_cb               (LmOldSocket    *socket);
 static gboolean     socket_hup_event               (GIOChannel     *source,
                                                     GIOCondition    condition,
                                                     LmOldSocket    *socket);
@@ -254,7 +258,9 @@ socket_in_event (GIOChannel   *source,
         return FALSE;
     }
 
-    while (socket_read_incoming (socket, buf, IN_BUFFER_SIZE,
+    /* Reading may be paused or the socket closed by data_func */
+    while (socket->watch_in &&
+           socket_read_incoming (socket, buf, IN_BUFFER_SIZE,
                                  &bytes_read, &hangup, &reason)) {
 
         g_log (LM_LOG_DOMAIN, LM_LOG_LEVEL_NET, "\nRECV [%d]:\n",
@@ -267,7 +273,7 @@ socket_in_event (GIOChannel   *source,
 
         lm_verbose ("Read: %d chars\n", (int)bytes_read);
 
-        (socket->data_func) (socket, buf, socket->user_data);
+        (socket->data_func) (socket, buf, bytes_read, socket->user_data);
 
         read_anything = TRUE;
     }
@@ -282,6 +288,16 @@ socket_in_event (GIOChannel   *source,
     return TRUE;
 }
 
+static gboolean
+socket_resume_cb (LmOldSocket *socket)
+{
+    socket->watch_resume = NULL;
+
+    socket_in_event (socket->io_channel, G_IO_IN, socket);
+
+    return FALSE;
+}
+
 static gboolean
 socket_hup_event (GIOChannel   *source,
                   GIOCondition  condition,
@@ -416,12 +432,14 @@ _lm_old_socket_succeeded (LmConnectData *connect_data)
         }
     }
 
-    socket->watch_in =
-        lm_misc_add_io_watch (socket->context,
-                              socket->io_channel,
-                              G_IO_IN,
-                              (GIOFunc) socket_in_event,
-                              socket);
+    if (!socket->reading_paused) {
+        socket->watch_in =
+            lm_misc_add_io_watch (socket->context,
+                                  socket->io_channel,
+                                  G_IO_IN,
+                                  (GIOFunc) socket_in_event,
+                                  socket);
+    }
 
     /* FIXME: if we add these, we don't get ANY
      * response from the server, this is to do with the way that
@@ -985,6 +1003,11 @@ lm_old_socket_close (LmOldSocket *socket)
             socket->watch_in = NULL;
         }
 
+        if (socket->watch_resume) {
+            g_source_destroy (socket->watch_resume);
+            socket->watch_resume = NULL;
+        }
+
         if (socket->watch_err) {
             g_source_destroy (socket->watch_err);
             socket->watch_err = NULL;
@@ -1011,6 +1034,52 @@ lm_old_socket_close (LmOldSocket *socket)
     }
 }
 
+/* Stops watching for incoming data, or starts again. While reading is
+ * paused the kernel buffers fill up and TCP flow control makes the peer
+ * slow down.
+ */
+void
+lm_old_socket_set_reading (LmOldSocket *socket, gboolean reading)
+{
+    g_return_if_fail (socket != NULL);
+
+    socket->reading_paused = !reading;
+
+    if (!socket->io_channel) {
+        /* Picked up once connected */
+        return;
+    }
+
+    if (!reading) {
+        if (socket->watch_in) {
+            g_source_destroy (socket->watch_in);
+            socket->watch_in = NULL;
+        }
+        if (socket->watch_resume) {
+            g_source_destroy (socket->watch_resume);
+            socket->watch_resume = NULL;
+        }
+        return;
+    }
+
+    if (socket->watch_in) {
+        return;
+    }
+
+    socket->watch_in = lm_misc_add_io_watch (socket->context,
+                                             socket->io_channel,
+                                             G_IO_IN,
+                                             (GIOFunc) socket_in_event,
+                                             socket);
+
+    /* Data SSL has decrypted already won't make the channel readable */
+    if (socket->ssl_started) {
+        socket->watch_resume = lm_misc_add_idle (socket->context,
+                                                 (GSourceFunc) socket_resume_cb,
+                                                 socket);
+    }
+}
+
 gchar *
 lm_old_socket_get_local_host (LmOldSocket *socket)
 {
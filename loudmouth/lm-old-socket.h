@@ -27,6 +27,7 @@ typedef struct _LmOldSocket LmOldSocket;
 
 typedef void    (* IncomingDataFunc)  (LmOldSocket         *socket,
                                        const gchar         *buf,
+                                       gsize                len,
                                        gpointer             user_data);
 
 typedef void    (* SocketClosedFunc)  (LmOldSocket         *socket,
@@ -59,6 +60,8 @@ void           lm_old_socket_unref          (LmOldSocket        *socket);
 gboolean       lm_old_socket_starttls       (LmOldSocket        *socket);
 gboolean       lm_old_socket_set_keepalive  (LmOldSocket        *socket,
                                              int                 delay);
+void           lm_old_socket_set_reading    (LmOldSocket        *socket,
+                                             gboolean            reading);
 gchar *        lm_old_socket_get_local_host (LmOldSocket        *socket);
 void           lm_old_socket_asyncns_cancel (LmOldSocket        *socket);
 
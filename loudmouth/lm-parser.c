@@ -16,6 +16,19 @@
  * License along with this program; if not, see <https://www.gnu.org/licenses>
  */
 
+/*
+ * The stream is parsed by a small pull tokenizer which only knows the
+ * subset of XML allowed in XMPP (RFC 6120, section 11): no DTDs, no
+ * entities apart from the predefined ones and character references.
+ * It keeps its state between reads, so a token can be split anywhere,
+ * and builds the LmMessageNode tree as it goes. Names, attributes and
+ * text are collected in buffers owned by the parser which are reused
+ * for every token.
+ *
+ * Configuring with --enable-gmarkup-parser (LM_PARSER_USE_GMARKUP)
+ * brings back the GMarkup based parser.
+ */
+
 #include <config.h>
 #include <string.h>
 
@@ -25,12 +38,49 @@
 #include "lm-internals.h"
 #include "lm-message-node.h"
 #include "lm-parser.h"
+#include "lm-utf8.h"
 
 #define SHORT_END_TAG "/>"
-#define XML_MAX_DEPTH 5
 
 #define LM_PARSER(o) ((LmParser *) o)
 
+#ifndef LM_PARSER_USE_GMARKUP
+/* Longest entity we know about is "#x10FFFF" */
+#define PARSER_MAX_ENTITY_LEN 10
+
+/* Most of a tag kept while dropping a stanza, none of it is used */
+#define PARSER_SKIP_TOKEN_MAX 1024
+
+/* Largest buffers kept by the parser cached for materializing */
+#define PARSER_MATERIALIZE_KEEP_MAX 16384
+
+typedef enum {
+    PARSER_STATE_TEXT,
+    PARSER_STATE_ENTITY,
+    PARSER_STATE_TAG_OPEN,
+    PARSER_STATE_START_NAME,
+    PARSER_STATE_IN_TAG,
+    PARSER_STATE_EMPTY_CLOSE,
+    PARSER_STATE_ATTR_NAME,
+    PARSER_STATE_ATTR_EQ,
+    PARSER_STATE_ATTR_QUOTE,
+    PARSER_STATE_ATTR_VALUE,
+    PARSER_STATE_END_NAME,
+    PARSER_STATE_END_CLOSE,
+    PARSER_STATE_BANG,
+    PARSER_STATE_COMMENT,
+    PARSER_STATE_CDATA,
+    PARSER_STATE_PI
+} ParserState;
+
+/* A namespace declaration, the strings live in ns_data */
+typedef struct {
+    gsize prefix;
+    gsize uri;
+    guint depth;
+} ParserNsBinding;
+#endif /* LM_PARSER_USE_GMARKUP */
+
 struct LmParser {
     LmParserMessageFunction  function;
     gpointer                 user_data;
@@ -39,12 +89,207 @@ struct LmParser {
     LmMessageNode           *cur_root;
     LmMessageNode           *cur_node;
 
+    /* Where the current stanza is built, kept for the next one when
+     * nobody else holds on to it.
+     */
+    gboolean                 use_arena;
+    LmArena                 *arena;
+
+    /* Limits on incoming stanzas, 0 for none */
+    gsize                    max_size;
+    guint                    max_depth;
+    guint                    max_attributes;
+    gsize                    max_text;
+    LmParserLimitFunction    limit_function;
+    gpointer                 limit_user_data;
+
+#ifdef LM_PARSER_USE_GMARKUP
     GMarkupParser           *m_parser;
     GMarkupParseContext     *context;
-    gchar                   *incomplete; /* incomplete utf-8 character
-                                            found at the end of buffer */
+#else
+    ParserState              state;
+
+    /* Entity being read and where to go once it's decoded */
+    gchar                    entity[PARSER_MAX_ENTITY_LEN];
+    guint                    entity_len;
+    ParserState              entity_return;
+
+    /* Quote around the current attribute value */
+    gchar                    quote;
+    /* Progress through the terminator of a comment, CDATA or PI */
+    guint                    match;
+
+    /* Character data of the current node */
+    GString                 *text;
+    /* Tag name followed by attribute names and values, nul separated */
+    GString                 *token;
+    /* Offsets into token of each attribute name and value */
+    GArray                  *attrs;
+    /* Node name when it had to be rewritten */
+    GString                 *name;
+
+    /* Namespaces in scope */
+    GString                 *ns_data;
+    GArray                  *ns_stack;
+
+    /* Qualified names of the open elements, nul separated */
+    GString                 *open_data;
+    GArray                  *open_stack;
+
+    /* Lazy mode, the children of stanzas are kept as text and only
+     * built when asked for, see _lm_parser_materialize().
+     */
+    gboolean                 lazy;
+    gboolean                 capturing;
+    /* Elements open inside the stanza being kept as text */
+    guint                    lazy_depth;
+    /* Content of the stanza so far and where the part of the current
+     * buffer that isn't in it yet starts.
+     */
+    GString                 *raw;
+    const gchar             *raw_from;
+    /* Offset into raw of the last '<' */
+    gsize                    tag_start;
+    /* Whether the content uses prefixes declared above the stanza */
+    gboolean                 outer_ns;
+    /* How far parser_feed() got, for the element callbacks */
+    const gchar             *pos;
+
+    /* Filling in a lazily parsed node, its own text is already set */
+    gboolean                 materializing;
+
+    /* Open elements outside of the current stanza */
+    guint                    root_depth;
+    /* Size of the stanza so far and where the part of the current buffer
+     * that isn't counted yet starts, only kept with a size limit.
+     */
+    gboolean                 counting;
+    gsize                    stanza_size;
+    const gchar             *stanza_from;
+    /* Character data of the current node, including what isn't kept */
+    gsize                    text_len;
+    /* Dropping a stanza that went over a limit and how many of its
+     * elements are still open.
+     */
+    gboolean                 skipping;
+    guint                    skip_depth;
+#endif
+
+    /* Leading bytes of an utf-8 character split across two reads */
+    gchar                    incomplete[4];
+    gsize                    incomplete_len;
+
+    /* Scratch space, only used when the input needs repairing */
+    GString                 *repaired;
 };
 
+static void    parser_reset         (LmParser             *parser);
+
+#ifndef LM_PARSER_USE_GMARKUP
+/* Each thread keeps a parser around for building lazy nodes, so that
+ * a node being looked at doesn't cost a new parser and its buffers.
+ */
+static GPrivate materialize_parser =
+    G_PRIVATE_INIT ((GDestroyNotify) lm_parser_free);
+#endif
+
+/* @n_attributes is how many attributes the node is going to get */
+static void
+parser_open_node (LmParser *parser, const gchar *name, guint n_attributes)
+{
+    if (!parser->cur_root) {
+        /* New toplevel element */
+        if (parser->use_arena) {
+            if (parser->arena && !_lm_arena_try_reset (parser->arena)) {
+                _lm_arena_unref (parser->arena);
+                parser->arena = NULL;
+            }
+            if (!parser->arena) {
+                parser->arena = _lm_arena_new (0);
+            }
+        }
+
+        parser->cur_root = _lm_message_node_new_in_arena (parser->use_arena ?
+                                                          parser->arena : NULL,
+                                                          name, n_attributes);
+        parser->cur_node = parser->cur_root;
+    } else {
+        LmMessageNode *parent_node;
+        LmArena       *arena;
+
+        parent_node = parser->cur_node;
+        arena = _lm_message_node_get_arena (parser->cur_root);
+
+        parser->cur_node = _lm_message_node_new_in_arena (arena, name,
+                                                          n_attributes);
+        _lm_message_node_add_child_node (parent_node,
+                                         parser->cur_node);
+    }
+}
+
+static void
+parser_close_node (LmParser *parser)
+{
+    if (parser->cur_node == parser->cur_root) {
+        LmMessage *m;
+
+        m = _lm_message_new_from_node (parser->cur_root);
+
+        if (!m) {
+            g_log (LM_LOG_DOMAIN, LM_LOG_LEVEL_PARSER,
+                   "Couldn't create message: %s\n",
+                   parser->cur_root->name);
+        } else {
+            g_log (LM_LOG_DOMAIN, LM_LOG_LEVEL_PARSER,
+               "Have a new message\n");
+            if (parser->function) {
+                (* parser->function) (parser, m, parser->user_data);
+            }
+            lm_message_unref (m);
+        }
+
+        lm_message_node_unref (parser->cur_root);
+        parser->cur_node = parser->cur_root = NULL;
+    } else {
+        LmMessageNode *tmp_node;
+        tmp_node = parser->cur_node;
+        parser->cur_node = parser->cur_node->parent;
+
+        lm_message_node_unref (tmp_node);
+    }
+}
+
+/* Lets go of the stanza being built */
+static void
+parser_drop_stanza (LmParser *parser)
+{
+    if (parser->cur_root) {
+        /* Open elements hold a reference of their own */
+        while (parser->cur_node != parser->cur_root) {
+            LmMessageNode *parent = parser->cur_node->parent;
+
+            lm_message_node_unref (parser->cur_node);
+            parser->cur_node = parent;
+        }
+
+        lm_message_node_unref (parser->cur_root);
+    }
+
+    parser->cur_root = parser->cur_node = NULL;
+}
+
+#ifdef LM_PARSER_USE_GMARKUP
+
+static void
+parser_set_attribute (LmParser    *parser,
+                      const gchar *name,
+                      const gchar *value)
+{
+    g_log (LM_LOG_DOMAIN, LM_LOG_LEVEL_PARSER,
+           "ATTRIBUTE: %s = %s\n", name, value);
+
+    _lm_message_node_set_arena_attribute (parser->cur_node, name, value);
+}
 
 /* Used while parsing */
 static void    parser_start_node_cb (GMarkupParseContext  *context,
@@ -91,39 +336,20 @@ parser_start_node_cb (GMarkupParseContext  *context,
     else
         ++node_name_unq;
 
-    if (!parser->cur_root) {
-        /* New toplevel element */
-        parser->cur_root = _lm_message_node_new (node_name_unq);
-        parser->cur_node = parser->cur_root;
-    } else {
-        LmMessageNode *parent_node;
-
-        parent_node = parser->cur_node;
-
-        parser->cur_node = _lm_message_node_new (node_name_unq);
-        _lm_message_node_add_child_node (parent_node,
-                                         parser->cur_node);
-    }
+    parser_open_node (parser, node_name_unq,
+                      g_strv_length ((gchar **) attribute_names));
 
     for (i = 0; attribute_names[i]; ++i) {
-        g_log (LM_LOG_DOMAIN, LM_LOG_LEVEL_PARSER,
-               "ATTRIBUTE: %s = %s\n",
-               attribute_names[i],
-               attribute_values[i]);
         //FIXME: strip namespace suffix from xmlns: attribute if exists
 
-        lm_message_node_set_attributes (parser->cur_node,
-                                        attribute_names[i],
-                                        attribute_values[i],
-                                        NULL);
+        parser_set_attribute (parser,
+                              attribute_names[i],
+                              attribute_values[i]);
         if (!strncmp(attribute_names[i], "xmlns:", 6))
             xmlns = attribute_values[i];
     }
     if (xmlns && !lm_message_node_get_attribute(parser->cur_node, "xmlns")) {
-        lm_message_node_set_attribute (parser->cur_node, "xmlns", xmlns);
-        g_log (LM_LOG_DOMAIN, LM_LOG_LEVEL_PARSER,
-               "ATTRIBUTE: %s = %s\n",
-               "xmlns", xmlns);
+        parser_set_attribute (parser, "xmlns", xmlns);
     }
 
     if (strcmp ("stream:stream", node_name) == 0) {
@@ -167,33 +393,7 @@ parser_end_node_cb (GMarkupParseContext  *context,
         return;
     }
 
-    if (parser->cur_node == parser->cur_root) {
-        LmMessage *m;
-
-        m = _lm_message_new_from_node (parser->cur_root);
-
-        if (!m) {
-            g_log (LM_LOG_DOMAIN, LM_LOG_LEVEL_PARSER,
-                   "Couldn't create message: %s\n",
-                   parser->cur_root->name);
-        } else {
-            g_log (LM_LOG_DOMAIN, LM_LOG_LEVEL_PARSER,
-               "Have a new message\n");
-            if (parser->function) {
-                (* parser->function) (parser, m, parser->user_data);
-            }
-            lm_message_unref (m);
-        }
-
-        lm_message_node_unref (parser->cur_root);
-        parser->cur_node = parser->cur_root = NULL;
-    } else {
-        LmMessageNode *tmp_node;
-        tmp_node = parser->cur_node;
-        parser->cur_node = parser->cur_node->parent;
-
-        lm_message_node_unref (tmp_node);
-    }
+    parser_close_node (parser);
 }
 
 static void
@@ -209,8 +409,9 @@ parser_text_cb (GMarkupParseContext   *context,
 
     parser = LM_PARSER (user_data);
 
-    if (parser->cur_node && strcmp (text, "") != 0) {
-        lm_message_node_set_value (parser->cur_node, text);
+    /* The text of an element can come in several pieces */
+    if (parser->cur_node && text_len > 0) {
+        _lm_message_node_append_arena_value (parser->cur_node, text, text_len);
     }
 }
 
@@ -226,27 +427,10 @@ parser_error_cb (GMarkupParseContext *context,
            "Parsing failed: %s\n", error->message);
 }
 
-LmParser *
-lm_parser_new (LmParserMessageFunction function,
-               gpointer                user_data,
-               GDestroyNotify          notify)
+static void
+parser_init_state (LmParser *parser)
 {
-    LmParser *parser;
-
-    parser = g_new0 (LmParser, 1);
-    if (!parser) {
-        return NULL;
-    }
-
     parser->m_parser = g_new0 (GMarkupParser, 1);
-    if (!parser->m_parser) {
-        g_free (parser);
-        return NULL;
-    }
-
-    parser->function  = function;
-    parser->user_data = user_data;
-    parser->notify    = notify;
 
     parser->m_parser->start_element = parser_start_node_cb;
     parser->m_parser->end_element   = parser_end_node_cb;
@@ -255,116 +439,1461 @@ lm_parser_new (LmParserMessageFunction function,
 
     parser->context = g_markup_parse_context_new (parser->m_parser, 0,
                                                   parser, NULL);
+}
 
-    parser->cur_root = NULL;
-    parser->cur_node = NULL;
+static void
+parser_reset_state (LmParser *parser)
+{
+    if (parser->context) {
+        g_markup_parse_context_free (parser->context);
+        parser->context = NULL;
+    }
+}
+
+static void
+parser_free_state (LmParser *parser)
+{
+    g_free (parser->m_parser);
+}
 
-    parser->incomplete = NULL;
+static gboolean
+parser_feed (LmParser *parser, const gchar *buffer, gsize len)
+{
+    if (len == 0) {
+        return TRUE;
+    }
 
-    return parser;
+    if (!parser->context) {
+        parser->context = g_markup_parse_context_new (parser->m_parser, 0,
+                                                      parser, NULL);
+    }
+
+    if (!g_markup_parse_context_parse (parser->context, buffer,
+                                       (gssize) len, NULL)) {
+        parser_reset (parser);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+#else /* LM_PARSER_USE_GMARKUP */
+
+/* Bytes which end a name */
+static const guint8 parser_name_end[256] = {
+    ['\0'] = 1, ['\t'] = 1, ['\n'] = 1, ['\r'] = 1, [' '] = 1,
+    ['"'] = 1, ['&'] = 1, ['\''] = 1, ['/'] = 1, ['<'] = 1,
+    ['='] = 1, ['>'] = 1, ['?'] = 1, ['!'] = 1
+};
+
+static inline gboolean
+parser_is_space (gchar c)
+{
+    return c == ' ' || c == '\n' || c == '\t' || c == '\r';
 }
 
-static gchar *
-_lm_parser_make_valid (const gchar *buffer, gchar **incomplete)
+static inline gboolean
+parser_is_name_start (gchar c)
 {
-    GString *string;
-    const gchar *remainder, *invalid;
-    gint remaining_bytes, valid_bytes;
-    gunichar code; /*error code for invalid character*/
+    return !parser_name_end[(guchar) c] &&
+        c != '-' && c != '.' && !g_ascii_isdigit (c);
+}
 
-    g_return_val_if_fail (buffer != NULL, NULL);
+static gboolean
+parser_error (LmParser *parser, const gchar *message)
+{
+    g_log (LM_LOG_DOMAIN, LM_LOG_LEVEL_VERBOSE,
+           "Parsing failed: %s\n", message);
 
-    string = NULL;
-    remainder = buffer;
-    remaining_bytes = strlen (buffer);
+    parser_reset (parser);
 
-    while (remaining_bytes != 0)
-    {
-        if (g_utf8_validate (remainder, remaining_bytes, &invalid))
-            break;
-        valid_bytes = invalid - remainder;
+    return FALSE;
+}
 
-        if (string == NULL)
-            string = g_string_sized_new (remaining_bytes);
+static const gchar *parser_limit_names[] = {
+    "size", "depth", "attributes", "text"
+};
+
+/* Gives up on the current stanza. The rest of it is read without
+ * building anything, the stream carries on after its end tag.
+ */
+static void
+parser_skip_stanza (LmParser *parser, LmStanzaLimit limit, const gchar *name)
+{
+    g_log (LM_LOG_DOMAIN, LM_LOG_LEVEL_VERBOSE,
+           "Dropping stanza %s, over the %s limit\n",
+           name ? name : "", parser_limit_names[limit]);
+
+    if (parser->limit_function) {
+        (* parser->limit_function) (parser, limit, name,
+                                    parser->limit_user_data);
+    }
 
-        g_string_append_len (string, remainder, valid_bytes);
+    if (!parser->cur_root) {
+        /* Still in the start tag of the stanza */
+        parser->root_depth = parser->open_stack->len;
+    }
 
-        remainder = g_utf8_find_next_char(invalid, NULL);
-        remaining_bytes -= valid_bytes + (remainder - invalid);
+    parser->skipping = TRUE;
+    parser->skip_depth = parser->open_stack->len - parser->root_depth;
+    parser->counting = FALSE;
 
-        code = g_utf8_get_char_validated (invalid, -1);
+    parser_drop_stanza (parser);
 
-        if (code == -1) {
-            /* A complete but invalid codepoint */
-            /* append U+FFFD REPLACEMENT CHARACTER */
-            g_string_append (string, "\357\277\275");
-            g_log (LM_LOG_DOMAIN, LM_LOG_LEVEL_VERBOSE, "invalid character!\n");
-        } else if (code == -2) {
-            /* Beginning of what could be a character */
-            *incomplete = g_strdup (invalid);
-            g_log (LM_LOG_DOMAIN, LM_LOG_LEVEL_VERBOSE,
-                           "incomplete character: %s\n", *incomplete);
+    while (parser->ns_stack->len > 0) {
+        ParserNsBinding *binding;
 
-            g_assert (remaining_bytes == 0);
-            g_assert (*(g_utf8_find_next_char(invalid, NULL)) == '\0');
+        binding = &g_array_index (parser->ns_stack, ParserNsBinding,
+                                  parser->ns_stack->len - 1);
+        if (binding->depth < parser->root_depth) {
+            break;
         }
+
+        g_string_truncate (parser->ns_data, binding->prefix);
+        g_array_set_size (parser->ns_stack, parser->ns_stack->len - 1);
     }
 
-    if (string == NULL)
-        return g_strdup (buffer);
+    if (parser->skip_depth > 0) {
+        g_string_truncate (parser->open_data,
+                           g_array_index (parser->open_stack, gsize,
+                                          parser->root_depth));
+        g_array_set_size (parser->open_stack, parser->root_depth);
+    }
+
+    parser->capturing = FALSE;
+    parser->lazy_depth = 0;
+    parser->raw_from = NULL;
+    g_string_truncate (parser->raw, 0);
 
-    g_string_append (string, remainder);
+    g_string_truncate (parser->text, 0);
+    parser->text_len = 0;
+}
 
-    g_assert (g_utf8_validate (string->str, -1, NULL));
+static void
+parser_skip_end_element (LmParser *parser)
+{
+    if (parser->skip_depth > 0) {
+        parser->skip_depth--;
+    }
 
-    return g_string_free (string, FALSE);
+    if (parser->skip_depth == 0) {
+        parser->skipping = FALSE;
+        g_log (LM_LOG_DOMAIN, LM_LOG_LEVEL_VERBOSE, "Dropped stanza\n");
+    }
 }
 
+static void
+parser_skip_start_element (LmParser *parser, gboolean empty)
+{
+    if (!empty) {
+        parser->skip_depth++;
+    } else if (parser->skip_depth == 0) {
+        parser_skip_end_element (parser);
+    }
+}
 
-gboolean
-lm_parser_parse (LmParser *parser, const gchar *string)
+static const gchar *
+parser_stanza_name (LmParser *parser)
 {
-    gboolean parsed;
-    gchar *valid, *completed;
-    g_return_val_if_fail (parser != NULL, FALSE);
+    if (parser->cur_root) {
+        return parser->cur_root->name;
+    }
 
-    if (!parser->context) {
-        parser->context = g_markup_parse_context_new (parser->m_parser, 0,
-                                                      parser, NULL);
+    /* Once past it, the start tag being read begins with its name */
+    return parser->state == PARSER_STATE_START_NAME ? NULL : parser->token->str;
+}
+
+/* The stream element isn't a stanza, it's only limited once it turns
+ * out that the start tag being read isn't its.
+ */
+static gboolean
+parser_in_stream_tag (LmParser *parser)
+{
+    const gchar *colon;
+
+    if (parser->cur_root || parser->state == PARSER_STATE_START_NAME) {
+        return FALSE;
     }
-    if (parser->incomplete) {
-        completed = g_strdup_printf("%s%s", parser->incomplete, string);
-        g_free(parser->incomplete);
-        parser->incomplete = NULL;
-    } else {
-        completed = g_strdup(string);
+
+    colon = strchr (parser->token->str, ':');
+
+    return strcmp (colon ? colon + 1 : parser->token->str, "stream") == 0;
+}
+
+/* Text the current node got before its last child, only needed when
+ * it's limited.
+ */
+static gsize
+parser_node_text_len (LmParser *parser)
+{
+    if (!parser->max_text || !parser->cur_node || !parser->cur_node->value) {
+        return 0;
     }
-    valid = _lm_parser_make_valid (completed, &parser->incomplete);
-    g_free(completed);
-    if (g_markup_parse_context_parse (parser->context, valid,
-                                      (gssize)strlen (valid), NULL)) {
-        parsed = TRUE;
-    } else {
-        g_markup_parse_context_free (parser->context);
-        parser->context = NULL;
-        parsed = FALSE;
+
+    return strlen (parser->cur_node->value);
+}
+
+/* Counts character data of the current node, returns FALSE if the
+ * stanza had to be dropped for it.
+ */
+static gboolean
+parser_count_text (LmParser *parser, gsize len)
+{
+    parser->text_len += len;
+
+    if (parser->text_len > parser->max_text) {
+        parser_skip_stanza (parser, LM_STANZA_LIMIT_TEXT,
+                            parser_stanza_name (parser));
+        return FALSE;
     }
-    g_free(valid);
-    return parsed;
+
+    return TRUE;
 }
 
-void
-lm_parser_free (LmParser *parser)
+static void
+parser_append_text (LmParser *parser, const gchar *text, gsize len)
 {
-    if (parser->notify) {
-        (* parser->notify) (parser->user_data);
+    /* Whitespace between stanzas isn't worth keeping, neither is text
+     * inside of what is kept as text anyway.
+     */
+    if (!parser->cur_node || len == 0) {
+        return;
     }
 
-    if (parser->context) {
-        g_markup_parse_context_free (parser->context);
+    if (parser->max_text && !parser_count_text (parser, len)) {
+        return;
+    }
+
+    if (parser->lazy_depth == 0) {
+        g_string_append_len (parser->text, text, (gssize) len);
+    }
+}
+
+static void
+parser_flush_text (LmParser *parser)
+{
+    if (parser->text->len == 0) {
+        return;
+    }
+
+    if (parser->cur_node &&
+        !(parser->materializing && parser->cur_node == parser->cur_root)) {
+        _lm_message_node_append_arena_value (parser->cur_node,
+                                             parser->text->str,
+                                             parser->text->len);
+    }
+
+    g_string_truncate (parser->text, 0);
+}
+
+static gboolean
+parser_decode_entity (LmParser *parser, GString *out)
+{
+    const gchar *entity = parser->entity;
+    guint        len = parser->entity_len;
+    gunichar     c = 0;
+    guint        i, base = 10;
+
+    if (len == 2 && entity[1] == 't') {
+        if (entity[0] == 'l') {
+            g_string_append_c (out, '<');
+            return TRUE;
+        } else if (entity[0] == 'g') {
+            g_string_append_c (out, '>');
+            return TRUE;
+        }
+    } else if (len == 3 && strncmp (entity, "amp", 3) == 0) {
+        g_string_append_c (out, '&');
+        return TRUE;
+    } else if (len == 4 && strncmp (entity, "apos", 4) == 0) {
+        g_string_append_c (out, '\'');
+        return TRUE;
+    } else if (len == 4 && strncmp (entity, "quot", 4) == 0) {
+        g_string_append_c (out, '"');
+        return TRUE;
+    }
+
+    if (len < 2 || entity[0] != '#') {
+        return FALSE;
+    }
+
+    i = 1;
+    if (entity[1] == 'x') {
+        base = 16;
+        i = 2;
+    }
+
+    if (i == len) {
+        return FALSE;
+    }
+
+    for (; i < len; ++i) {
+        gint digit;
+
+        digit = base == 16 ?
+            g_ascii_xdigit_value (entity[i]) :
+            g_ascii_digit_value (entity[i]);
+        if (digit < 0) {
+            return FALSE;
+        }
+
+        c = c * base + digit;
+        if (c > 0x10ffff) {
+            return FALSE;
+        }
+    }
+
+    if (c == 0 || (c >= 0xd800 && c <= 0xdfff)) {
+        return FALSE;
+    }
+
+    g_string_append_unichar (out, c);
+
+    return TRUE;
+}
+
+static void
+parser_push_ns (LmParser    *parser,
+                const gchar *prefix,
+                const gchar *uri,
+                guint        depth)
+{
+    ParserNsBinding binding;
+
+    binding.prefix = parser->ns_data->len;
+    g_string_append_len (parser->ns_data, prefix, strlen (prefix) + 1);
+    binding.uri = parser->ns_data->len;
+    g_string_append_len (parser->ns_data, uri, strlen (uri) + 1);
+    binding.depth = depth;
+
+    g_array_append_val (parser->ns_stack, binding);
+}
+
+static ParserNsBinding *
+parser_lookup_binding (LmParser *parser, const gchar *prefix, gsize len)
+{
+    guint i;
+
+    for (i = parser->ns_stack->len; i > 0; --i) {
+        ParserNsBinding *binding;
+        const gchar     *bound;
+
+        binding = &g_array_index (parser->ns_stack, ParserNsBinding, i - 1);
+        bound = parser->ns_data->str + binding->prefix;
+
+        if (strncmp (bound, prefix, len) == 0 && bound[len] == '\0') {
+            return binding;
+        }
+    }
+
+    return NULL;
+}
+
+static const gchar *
+parser_lookup_ns (LmParser *parser, const gchar *prefix, gsize len)
+{
+    ParserNsBinding *binding = parser_lookup_binding (parser, prefix, len);
+
+    return binding ? parser->ns_data->str + binding->uri : NULL;
+}
+
+/* Whether @qname has a prefix that only an ancestor of the stanza being
+ * kept as text declares. Prefixes declared inside of the stanza aren't
+ * on the stack, so any shadowing one goes unnoticed.
+ */
+static gboolean
+parser_is_outer_prefix (LmParser *parser, const gchar *qname)
+{
+    const gchar     *colon = strchr (qname, ':');
+    ParserNsBinding *binding;
+    gsize            len;
+
+    if (!colon) {
+        return FALSE;
+    }
+
+    len = colon - qname;
+    if ((len == 5 && strncmp (qname, "xmlns", 5) == 0) ||
+        (len == 3 && strncmp (qname, "xml", 3) == 0)) {
+        return FALSE;
+    }
+
+    binding = parser_lookup_binding (parser, qname, len);
+
+    return binding && binding->depth < parser->root_depth;
+}
+
+/* Checks the element whose start tag was just read against the limits,
+ * returns FALSE if the stanza had to be dropped.
+ */
+static gboolean
+parser_check_element (LmParser *parser, const gchar *name)
+{
+    LmStanzaLimit limit;
+    guint         depth = 1;
+
+    if (parser->cur_root) {
+        depth += parser->open_stack->len - parser->root_depth;
+    }
+
+    if (parser->counting &&
+        parser->stanza_size + (parser->pos - parser->stanza_from) > parser->max_size) {
+        limit = LM_STANZA_LIMIT_SIZE;
+    } else if (parser->max_depth && depth > parser->max_depth) {
+        limit = LM_STANZA_LIMIT_DEPTH;
+    } else if (parser->max_attributes &&
+               parser->attrs->len / 2 > parser->max_attributes) {
+        limit = LM_STANZA_LIMIT_ATTRIBUTES;
+    } else {
+        return TRUE;
+    }
+
+    parser_skip_stanza (parser, limit,
+                        parser->cur_root ? parser->cur_root->name : name);
+
+    return FALSE;
+}
+
+/* Stanzas are kept as text, anything on the stream level is needed by
+ * the connection itself and built right away.
+ */
+static gboolean
+parser_is_lazy_root (LmParser *parser)
+{
+    const gchar *name;
+
+    if (!parser->lazy || !parser->cur_root ||
+        parser->cur_node != parser->cur_root ||
+        !_lm_message_node_get_arena (parser->cur_root)) {
+        return FALSE;
+    }
+
+    name = parser->cur_root->name;
+
+    return name == LM_ATOM (MESSAGE) || name == LM_ATOM (PRESENCE) ||
+        name == LM_ATOM (IQ);
+}
+
+/* Hands the content of the stanza to its node, along with the namespace
+ * prefixes needed to make sense of it later on.
+ */
+static void
+parser_finish_capture (LmParser *parser)
+{
+    GString *ns = parser->name;
+    guint    i;
+
+    g_string_append_len (parser->raw, parser->raw_from,
+                         parser->pos - parser->raw_from);
+
+    g_string_truncate (ns, 0);
+    for (i = 0; i < parser->ns_stack->len; ++i) {
+        ParserNsBinding *binding;
+        const gchar     *prefix;
+        const gchar     *uri;
+
+        binding = &g_array_index (parser->ns_stack, ParserNsBinding, i);
+        prefix = parser->ns_data->str + binding->prefix;
+        uri = parser->ns_data->str + binding->uri;
+
+        if (*prefix != '\0') {
+            g_string_append_len (ns, prefix, strlen (prefix) + 1);
+            g_string_append_len (ns, uri, strlen (uri) + 1);
+        }
+    }
+
+    _lm_message_node_set_lazy (parser->cur_root,
+                               parser->raw->str, parser->tag_start,
+                               ns->str, ns->len, !parser->outer_ns);
+
+    parser->capturing = FALSE;
+    parser->raw_from = NULL;
+}
+
+static gboolean
+parser_end_element (LmParser *parser, const gchar *qname)
+{
+    guint depth = parser->open_stack->len;
+    gsize offset;
+
+    if (parser->skipping) {
+        parser_skip_end_element (parser);
+        return TRUE;
+    }
+
+    if (depth == 0) {
+        return parser_error (parser, "closing tag without an open element");
+    }
+
+    offset = g_array_index (parser->open_stack, gsize, depth - 1);
+
+    if (qname && strcmp (parser->open_data->str + offset, qname) != 0) {
+        return parser_error (parser, "closing tag doesn't match the open element");
+    }
+
+    if (parser->lazy_depth > 0) {
+        g_string_truncate (parser->open_data, offset);
+        g_array_set_size (parser->open_stack, depth - 1);
+        parser->lazy_depth--;
+        parser->text_len = parser->lazy_depth > 0 ?
+            0 : parser_node_text_len (parser);
+
+        return TRUE;
+    }
+
+    /* Also catches stanzas that went over the size and ended in one read */
+    if (parser->counting && parser->cur_root &&
+        parser->cur_node == parser->cur_root &&
+        parser->stanza_size + (parser->pos - parser->stanza_from) > parser->max_size) {
+        parser_skip_stanza (parser, LM_STANZA_LIMIT_SIZE,
+                            parser->cur_root->name);
+        parser_skip_end_element (parser);
+        return TRUE;
+    }
+
+    if (parser->capturing) {
+        parser_finish_capture (parser);
+    }
+
+    parser_flush_text (parser);
+
+    while (parser->ns_stack->len > 0) {
+        ParserNsBinding *binding;
+
+        binding = &g_array_index (parser->ns_stack, ParserNsBinding,
+                                  parser->ns_stack->len - 1);
+        if (binding->depth < depth - 1) {
+            break;
+        }
+
+        g_string_truncate (parser->ns_data, binding->prefix);
+        g_array_set_size (parser->ns_stack, parser->ns_stack->len - 1);
+    }
+
+    g_string_truncate (parser->open_data, offset);
+    g_array_set_size (parser->open_stack, depth - 1);
+
+    /* Nothing to do for the stream element, it was handed out already */
+    if (parser->cur_node) {
+        parser_close_node (parser);
+    }
+    parser->text_len = parser_node_text_len (parser);
+
+    if (!parser->cur_root) {
+        parser->counting = FALSE;
+    }
+
+    return TRUE;
+}
+
+static gboolean
+parser_start_element (LmParser *parser, gboolean empty)
+{
+    const gchar *qname = parser->token->str;
+    const gchar *name = qname;
+    const gchar *colon;
+    const gchar *uri = NULL;
+    gboolean     has_xmlns = FALSE;
+    gboolean     is_stream = FALSE;
+    guint        depth = parser->open_stack->len;
+    gsize        offset;
+    guint        i;
+
+    parser_flush_text (parser);
+
+    if (parser->skipping) {
+        parser_skip_start_element (parser, empty);
+        return TRUE;
+    }
+
+    if (parser->capturing) {
+        if (!parser_check_element (parser, qname)) {
+            parser_skip_start_element (parser, empty);
+            return TRUE;
+        }
+
+        /* Those would be undeclared once the stanza is written out */
+        if (!parser->outer_ns) {
+            parser->outer_ns = parser_is_outer_prefix (parser, qname);
+            for (i = 0; i < parser->attrs->len && !parser->outer_ns; i += 2) {
+                parser->outer_ns = parser_is_outer_prefix (parser,
+                                                           parser->token->str +
+                                                           g_array_index (parser->attrs, gsize, i));
+            }
+        }
+
+        /* Only the nesting is checked inside of a stanza kept as text */
+        if (!empty) {
+            offset = parser->open_data->len;
+            g_string_append_len (parser->open_data, qname, strlen (qname) + 1);
+            g_array_append_val (parser->open_stack, offset);
+            parser->lazy_depth++;
+            parser->text_len = 0;
+        }
+
+        return TRUE;
+    }
+
+    /* Declarations are in scope on the element itself */
+    for (i = 0; i < parser->attrs->len; i += 2) {
+        const gchar *attr;
+        const gchar *value;
+
+        attr = parser->token->str + g_array_index (parser->attrs, gsize, i);
+        value = parser->token->str + g_array_index (parser->attrs, gsize, i + 1);
+
+        if (strcmp (attr, "xmlns") == 0) {
+            parser_push_ns (parser, "", value, depth);
+            has_xmlns = TRUE;
+        } else if (strncmp (attr, "xmlns:", 6) == 0) {
+            parser_push_ns (parser, attr + 6, value, depth);
+        }
+    }
+
+    colon = strchr (qname, ':');
+    if (colon) {
+        gsize prefix_len = colon - qname;
+
+        uri = parser_lookup_ns (parser, qname, prefix_len);
+        if (_lm_atom_lookup (uri) == LM_ATOM (NS_STREAMS)) {
+            /* Stream level elements are known by their "stream:" names */
+            if (prefix_len != 6 || strncmp (qname, "stream", 6) != 0) {
+                g_string_assign (parser->name, "stream:");
+                g_string_append (parser->name, colon + 1);
+                name = parser->name->str;
+            }
+            is_stream = strcmp (colon + 1, "stream") == 0;
+            uri = NULL;
+        } else if (!uri && prefix_len == 6 && strncmp (qname, "stream", 6) == 0) {
+            is_stream = strcmp (colon + 1, "stream") == 0;
+        } else {
+            if (!uri) {
+                g_log (LM_LOG_DOMAIN, LM_LOG_LEVEL_PARSER,
+                       "Undeclared namespace prefix: %s\n", qname);
+            }
+            name = colon + 1;
+        }
+    }
+
+    /* The stream element is only ever limited by size */
+    if (!is_stream && !parser_check_element (parser, name)) {
+        parser_skip_start_element (parser, empty);
+        return TRUE;
+    }
+
+    if (!parser->cur_root) {
+        parser->root_depth = depth;
+    }
+
+    offset = parser->open_data->len;
+    g_string_append_len (parser->open_data, qname, strlen (qname) + 1);
+    g_array_append_val (parser->open_stack, offset);
+
+    parser_open_node (parser, name,
+                      parser->attrs->len / 2 + (uri && !has_xmlns ? 1 : 0));
+    parser->text_len = 0;
+
+    /* No per attribute debug output here, formatting it costs more
+     * than the parsing does.
+     */
+    for (i = 0; i < parser->attrs->len; i += 2) {
+        _lm_message_node_set_arena_attribute (parser->cur_node,
+                                              parser->token->str +
+                                              g_array_index (parser->attrs, gsize, i),
+                                              parser->token->str +
+                                              g_array_index (parser->attrs, gsize, i + 1));
+    }
+
+    if (uri && !has_xmlns) {
+        _lm_message_node_set_arena_attribute (parser->cur_node, "xmlns", uri);
+    }
+
+    /* The stream element stays open until the connection is closed but
+     * is handed out straight away, its children are the stanzas.
+     */
+    if (is_stream && parser->cur_node == parser->cur_root) {
+        parser_close_node (parser);
+        parser->counting = FALSE;
+    }
+
+    if (!empty && parser_is_lazy_root (parser)) {
+        parser->capturing = TRUE;
+        parser->raw_from = parser->pos;
+        parser->tag_start = 0;
+        parser->outer_ns = FALSE;
+        g_string_truncate (parser->raw, 0);
+    }
+
+    if (empty) {
+        return parser_end_element (parser, NULL);
+    }
+
+    return TRUE;
+}
+
+static void
+parser_init_state (LmParser *parser)
+{
+    parser->state = PARSER_STATE_TEXT;
+
+    parser->text = g_string_sized_new (256);
+    parser->token = g_string_sized_new (256);
+    parser->attrs = g_array_sized_new (FALSE, FALSE, sizeof (gsize), 16);
+    parser->name = g_string_sized_new (32);
+    parser->ns_data = g_string_sized_new (128);
+    parser->ns_stack = g_array_sized_new (FALSE, FALSE,
+                                          sizeof (ParserNsBinding), 4);
+    parser->open_data = g_string_sized_new (128);
+    parser->open_stack = g_array_sized_new (FALSE, FALSE, sizeof (gsize), 8);
+    parser->raw = g_string_sized_new (1024);
+}
+
+static void
+parser_reset_state (LmParser *parser)
+{
+    parser->state = PARSER_STATE_TEXT;
+    parser->entity_len = 0;
+    parser->match = 0;
+
+    g_string_truncate (parser->text, 0);
+    g_string_truncate (parser->token, 0);
+    g_array_set_size (parser->attrs, 0);
+    g_string_truncate (parser->ns_data, 0);
+    g_array_set_size (parser->ns_stack, 0);
+    g_string_truncate (parser->open_data, 0);
+    g_array_set_size (parser->open_stack, 0);
+
+    parser->capturing = FALSE;
+    parser->lazy_depth = 0;
+    parser->raw_from = NULL;
+    g_string_truncate (parser->raw, 0);
+
+    parser->root_depth = 0;
+    parser->counting = FALSE;
+    parser->text_len = 0;
+    parser->skipping = FALSE;
+    parser->skip_depth = 0;
+}
+
+static void
+parser_free_state (LmParser *parser)
+{
+    g_string_free (parser->text, TRUE);
+    g_string_free (parser->token, TRUE);
+    g_array_free (parser->attrs, TRUE);
+    g_string_free (parser->name, TRUE);
+    g_string_free (parser->ns_data, TRUE);
+    g_array_free (parser->ns_stack, TRUE);
+    g_string_free (parser->open_data, TRUE);
+    g_array_free (parser->open_stack, TRUE);
+    g_string_free (parser->raw, TRUE);
+}
+
+static gboolean
+parser_feed (LmParser *parser, const gchar *buffer, gsize len)
+{
+    const gchar *p = buffer;
+    const gchar *end = buffer + len;
+
+    if (parser->capturing) {
+        parser->raw_from = buffer;
+    }
+    if (parser->counting) {
+        parser->stanza_from = buffer;
+    }
+
+    while (p < end) {
+        const gchar *start = p;
+        gsize        offset;
+
+        /* Nothing of the tags is needed while dropping a stanza */
+        if (G_UNLIKELY (parser->skipping) &&
+            (parser->token->len > PARSER_SKIP_TOKEN_MAX ||
+             parser->attrs->len > PARSER_SKIP_TOKEN_MAX)) {
+            g_string_truncate (parser->token, 0);
+            g_array_set_size (parser->attrs, 0);
+        }
+
+        switch (parser->state) {
+        case PARSER_STATE_TEXT:
+            while (p < end && *p != '<' && *p != '&') {
+                p++;
+            }
+            parser_append_text (parser, start, p - start);
+            if (p == end) {
+                break;
+            }
+
+            if (*p == '&') {
+                parser->entity_len = 0;
+                parser->entity_return = PARSER_STATE_TEXT;
+                parser->state = PARSER_STATE_ENTITY;
+            } else {
+                if (parser->capturing) {
+                    parser->tag_start = parser->raw->len +
+                        (p - parser->raw_from);
+                }
+                parser->state = PARSER_STATE_TAG_OPEN;
+            }
+            p++;
+            break;
+
+        case PARSER_STATE_ENTITY:
+            while (p < end && *p != ';') {
+                if (parser->entity_len == PARSER_MAX_ENTITY_LEN) {
+                    return parser_error (parser, "unknown entity");
+                }
+                parser->entity[parser->entity_len++] = *p++;
+            }
+            if (p == end) {
+                break;
+            }
+            p++;
+
+            if (parser->entity_return == PARSER_STATE_TEXT) {
+                offset = parser->text->len;
+                if (!parser_decode_entity (parser, parser->text)) {
+                    return parser_error (parser, "unknown entity");
+                }
+                if (parser->cur_node && parser->max_text) {
+                    parser_count_text (parser, parser->text->len - offset);
+                }
+                if (!parser->cur_node || parser->lazy_depth > 0) {
+                    g_string_truncate (parser->text, 0);
+                }
+            } else if (!parser_decode_entity (parser, parser->token)) {
+                return parser_error (parser, "unknown entity");
+            }
+            parser->state = parser->entity_return;
+            break;
+
+        case PARSER_STATE_TAG_OPEN:
+            if (*p == '/') {
+                g_string_truncate (parser->token, 0);
+                parser->state = PARSER_STATE_END_NAME;
+                p++;
+            } else if (*p == '!') {
+                parser->entity_len = 0;
+                parser->state = PARSER_STATE_BANG;
+                p++;
+            } else if (*p == '?') {
+                parser->match = 0;
+                parser->state = PARSER_STATE_PI;
+                p++;
+            } else if (parser_is_name_start (*p)) {
+                g_string_truncate (parser->token, 0);
+                g_array_set_size (parser->attrs, 0);
+                parser->state = PARSER_STATE_START_NAME;
+
+                if (parser->max_size && !parser->cur_root &&
+                    !parser->skipping) {
+                    /* A new stanza, counting from its '<' */
+                    parser->counting = TRUE;
+                    parser->stanza_size = 1;
+                    parser->stanza_from = p;
+                }
+            } else {
+                return parser_error (parser, "invalid character after '<'");
+            }
+            break;
+
+        case PARSER_STATE_START_NAME:
+        case PARSER_STATE_ATTR_NAME:
+        case PARSER_STATE_END_NAME:
+            while (p < end && !parser_name_end[(guchar) *p]) {
+                p++;
+            }
+            g_string_append_len (parser->token, start, p - start);
+            if (p == end) {
+                break;
+            }
+
+            g_string_append_c (parser->token, '\0');
+            if (parser->state == PARSER_STATE_START_NAME) {
+                parser->state = PARSER_STATE_IN_TAG;
+            } else if (parser->state == PARSER_STATE_ATTR_NAME) {
+                parser->state = PARSER_STATE_ATTR_EQ;
+            } else {
+                parser->state = PARSER_STATE_END_CLOSE;
+            }
+            break;
+
+        case PARSER_STATE_IN_TAG:
+            while (p < end && parser_is_space (*p)) {
+                p++;
+            }
+            if (p == end) {
+                break;
+            }
+
+            if (*p == '>') {
+                p++;
+                parser->pos = p;
+                parser->state = PARSER_STATE_TEXT;
+                if (!parser_start_element (parser, FALSE)) {
+                    return FALSE;
+                }
+            } else if (*p == '/') {
+                p++;
+                parser->state = PARSER_STATE_EMPTY_CLOSE;
+            } else if (parser_is_name_start (*p)) {
+                offset = parser->token->len;
+                g_array_append_val (parser->attrs, offset);
+                parser->state = PARSER_STATE_ATTR_NAME;
+            } else {
+                return parser_error (parser, "invalid character in tag");
+            }
+            break;
+
+        case PARSER_STATE_EMPTY_CLOSE:
+            if (*p != '>') {
+                return parser_error (parser, "expected '>' after '/'");
+            }
+            p++;
+            parser->pos = p;
+            parser->state = PARSER_STATE_TEXT;
+            if (!parser_start_element (parser, TRUE)) {
+                return FALSE;
+            }
+            break;
+
+        case PARSER_STATE_ATTR_EQ:
+            while (p < end && parser_is_space (*p)) {
+                p++;
+            }
+            if (p == end) {
+                break;
+            }
+
+            if (*p != '=') {
+                return parser_error (parser, "expected '=' after attribute name");
+            }
+            p++;
+            parser->state = PARSER_STATE_ATTR_QUOTE;
+            break;
+
+        case PARSER_STATE_ATTR_QUOTE:
+            while (p < end && parser_is_space (*p)) {
+                p++;
+            }
+            if (p == end) {
+                break;
+            }
+
+            if (*p != '\'' && *p != '"') {
+                return parser_error (parser, "attribute value isn't quoted");
+            }
+            parser->quote = *p++;
+            offset = parser->token->len;
+            g_array_append_val (parser->attrs, offset);
+            parser->state = PARSER_STATE_ATTR_VALUE;
+            break;
+
+        case PARSER_STATE_ATTR_VALUE:
+            while (p < end && *p != parser->quote && *p != '&' && *p != '<') {
+                p++;
+            }
+            g_string_append_len (parser->token, start, p - start);
+            if (p == end) {
+                break;
+            }
+
+            if (*p == '<') {
+                return parser_error (parser, "'<' in attribute value");
+            } else if (*p == '&') {
+                parser->entity_len = 0;
+                parser->entity_return = PARSER_STATE_ATTR_VALUE;
+                parser->state = PARSER_STATE_ENTITY;
+            } else {
+                g_string_append_c (parser->token, '\0');
+                parser->state = PARSER_STATE_IN_TAG;
+            }
+            p++;
+            break;
+
+        case PARSER_STATE_END_CLOSE:
+            while (p < end && parser_is_space (*p)) {
+                p++;
+            }
+            if (p == end) {
+                break;
+            }
+
+            if (*p != '>') {
+                return parser_error (parser, "invalid character in closing tag");
+            }
+            p++;
+            parser->pos = p;
+            parser->state = PARSER_STATE_TEXT;
+            if (!parser_end_element (parser, parser->token->str)) {
+                return FALSE;
+            }
+            break;
+
+        case PARSER_STATE_BANG:
+            /* Either "<!--" or "<![CDATA[", DTDs aren't allowed */
+            while (p < end) {
+                parser->entity[parser->entity_len++] = *p++;
+
+                if (parser->entity_len == 2 &&
+                    strncmp (parser->entity, "--", 2) == 0) {
+                    parser->match = 0;
+                    parser->state = PARSER_STATE_COMMENT;
+                    break;
+                }
+
+                if (strncmp (parser->entity, "[CDATA[",
+                             parser->entity_len) != 0 &&
+                    strncmp (parser->entity, "--",
+                             MIN (parser->entity_len, 2)) != 0) {
+                    return parser_error (parser, "unexpected markup after '<!'");
+                }
+
+                if (parser->entity_len == 7) {
+                    parser->match = 0;
+                    parser->state = PARSER_STATE_CDATA;
+                    break;
+                }
+            }
+            break;
+
+        case PARSER_STATE_COMMENT:
+            while (p < end) {
+                gchar c;
+
+                if (parser->match == 0) {
+                    p = memchr (p, '-', end - p);
+                    if (!p) {
+                        p = end;
+                        break;
+                    }
+                }
+
+                c = *p++;
+                if (c == '-') {
+                    parser->match++;
+                } else if (c == '>' && parser->match >= 2) {
+                    parser->state = PARSER_STATE_TEXT;
+                    break;
+                } else {
+                    parser->match = 0;
+                }
+            }
+            break;
+
+        case PARSER_STATE_CDATA:
+            while (p < end) {
+                gchar c;
+
+                if (parser->match == 0) {
+                    start = p;
+                    while (p < end && *p != ']') {
+                        p++;
+                    }
+                    parser_append_text (parser, start, p - start);
+                    if (p == end) {
+                        break;
+                    }
+                }
+
+                c = *p++;
+                if (c == ']') {
+                    parser->match++;
+                } else if (c == '>' && parser->match >= 2) {
+                    /* Only the last two close the section */
+                    while (parser->match > 2) {
+                        parser_append_text (parser, "]", 1);
+                        parser->match--;
+                    }
+                    parser->match = 0;
+                    parser->state = PARSER_STATE_TEXT;
+                    break;
+                } else {
+                    while (parser->match > 0) {
+                        parser_append_text (parser, "]", 1);
+                        parser->match--;
+                    }
+                    parser_append_text (parser, &c, 1);
+                }
+            }
+            break;
+
+        case PARSER_STATE_PI:
+            /* Processing instructions, the XML declaration really */
+            while (p < end) {
+                gchar c = *p++;
+
+                if (c == '?') {
+                    parser->match = 1;
+                } else if (c == '>' && parser->match) {
+                    parser->state = PARSER_STATE_TEXT;
+                    break;
+                } else {
+                    parser->match = 0;
+                }
+            }
+            break;
+        }
+    }
+
+    if (parser->counting) {
+        parser->stanza_size += end - parser->stanza_from;
+        parser->stanza_from = NULL;
+
+        if (parser->stanza_size > parser->max_size &&
+            !parser_in_stream_tag (parser)) {
+            parser_skip_stanza (parser, LM_STANZA_LIMIT_SIZE,
+                                parser_stanza_name (parser));
+        }
+    }
+
+    if (parser->capturing) {
+        g_string_append_len (parser->raw, parser->raw_from,
+                             end - parser->raw_from);
+        parser->raw_from = NULL;
+    }
+
+    return TRUE;
+}
+
+#endif /* LM_PARSER_USE_GMARKUP */
+
+LmParser *
+lm_parser_new (LmParserMessageFunction function,
+               gpointer                user_data,
+               GDestroyNotify          notify)
+{
+    LmParser *parser;
+
+    parser = g_new0 (LmParser, 1);
+    if (!parser) {
+        return NULL;
+    }
+
+    parser->function  = function;
+    parser->user_data = user_data;
+    parser->notify    = notify;
+
+    parser_init_state (parser);
+
+    parser->cur_root = NULL;
+    parser->cur_node = NULL;
+
+    parser->use_arena = TRUE;
+    parser->arena = NULL;
+
+    parser->incomplete_len = 0;
+    parser->repaired = NULL;
+
+    return parser;
+}
+
+static void
+parser_reset (LmParser *parser)
+{
+    parser_reset_state (parser);
+    parser_drop_stanza (parser);
+
+    parser->incomplete_len = 0;
+}
+
+/* Slow path, only taken when the input contains invalid utf-8. Every
+ * offending sequence is replaced with U+FFFD REPLACEMENT CHARACTER.
+ */
+static const gchar *
+parser_repair (LmParser *parser, const gchar *buffer, gsize len)
+{
+    if (!parser->repaired) {
+        parser->repaired = g_string_sized_new (len + 16);
+    }
+    g_string_truncate (parser->repaired, 0);
+
+    if (_lm_utf8_repair (buffer, len, parser->repaired) > 0) {
+        g_log (LM_LOG_DOMAIN, LM_LOG_LEVEL_VERBOSE, "invalid character!\n");
+    }
+
+    return parser->repaired->str;
+}
+
+/* Completes the character left over from the previous read. Returns the
+ * number of bytes used from @buffer.
+ */
+static gsize
+parser_complete_incomplete (LmParser    *parser,
+                            const gchar *buffer,
+                            gsize        len,
+                            gboolean    *result)
+{
+    gsize seq_len;
+    gsize used = 0;
+
+    seq_len = _lm_utf8_sequence_length ((guchar) parser->incomplete[0]);
+
+    while (parser->incomplete_len < seq_len && used < len) {
+        if (((guchar) buffer[used] & 0xc0) != 0x80) {
+            break;
+        }
+        parser->incomplete[parser->incomplete_len++] = buffer[used++];
+    }
+
+    if (parser->incomplete_len < seq_len && used == len) {
+        /* Still not enough, wait for the next read */
+        *result = TRUE;
+        return used;
+    }
+
+    if (parser->incomplete_len == seq_len &&
+        _lm_utf8_validate (parser->incomplete, seq_len) == seq_len) {
+        *result = parser_feed (parser, parser->incomplete, seq_len);
+    } else {
+        g_log (LM_LOG_DOMAIN, LM_LOG_LEVEL_VERBOSE, "invalid character!\n");
+        *result = parser_feed (parser, LM_UTF8_REPLACEMENT,
+                               LM_UTF8_REPLACEMENT_LEN);
+    }
+
+    parser->incomplete_len = 0;
+
+    return used;
+}
+
+/**
+ * lm_parser_parse_len:
+ * @parser: an #LmParser
+ * @buffer: data read from the stream, doesn't need to be nul-terminated
+ * @len: number of bytes in @buffer
+ *
+ * Parses @len bytes from @buffer. Valid utf-8 is handed to the XML parser
+ * as is, only the bytes of a character split between two reads are kept
+ * until the next call.
+ *
+ * Return value: %FALSE if the stream couldn't be parsed
+ **/
+gboolean
+lm_parser_parse_len (LmParser *parser, const gchar *buffer, gsize len)
+{
+    gboolean result = TRUE;
+    gsize    valid, tail;
+
+    g_return_val_if_fail (parser != NULL, FALSE);
+    g_return_val_if_fail (buffer != NULL || len == 0, FALSE);
+
+    if (parser->incomplete_len > 0) {
+        gsize used;
+
+        used = parser_complete_incomplete (parser, buffer, len, &result);
+        if (!result) {
+            return FALSE;
+        }
+
+        buffer += used;
+        len -= used;
+    }
+
+    if (len == 0) {
+        return result;
+    }
+
+    valid = _lm_utf8_validate (buffer, len);
+    if (valid == len) {
+        return parser_feed (parser, buffer, len);
+    }
+
+    tail = _lm_utf8_incomplete_tail (buffer, len);
+    if (tail > 0 && valid == len - tail) {
+        /* The buffer is fine apart from a character cut in half */
+        memcpy (parser->incomplete, buffer + len - tail, tail);
+        parser->incomplete_len = tail;
+
+        g_log (LM_LOG_DOMAIN, LM_LOG_LEVEL_VERBOSE,
+               "incomplete character, %d bytes kept\n", (int) tail);
+
+        return parser_feed (parser, buffer, len - tail);
+    }
+
+    if (tail > 0) {
+        memcpy (parser->incomplete, buffer + len - tail, tail);
+        parser->incomplete_len = tail;
+        len -= tail;
+    }
+
+    buffer = parser_repair (parser, buffer, len);
+
+    return parser_feed (parser, buffer, parser->repaired->len);
+}
+
+/**
+ * lm_parser_parse:
+ * @parser: an #LmParser
+ * @string: a nul-terminated string
+ *
+ * Same as lm_parser_parse_len() for nul-terminated data.
+ *
+ * Return value: %FALSE if the stream couldn't be parsed
+ **/
+gboolean
+lm_parser_parse (LmParser *parser, const gchar *string)
+{
+    g_return_val_if_fail (parser != NULL, FALSE);
+    g_return_val_if_fail (string != NULL, FALSE);
+
+    return lm_parser_parse_len (parser, string, strlen (string));
+}
+
+/* Only meant for tests and benchmarks, arenas are used by default */
+void
+_lm_parser_set_use_arena (LmParser *parser, gboolean use_arena)
+{
+    g_return_if_fail (parser != NULL);
+
+    parser->use_arena = use_arena;
+}
+
+/* Only meant for tests and connections asking for it, the children of
+ * stanzas aren't there until something asks for them through the
+ * lm_message_node API. Not supported by the GMarkup parser.
+ */
+void
+_lm_parser_set_lazy (LmParser *parser, gboolean lazy)
+{
+    g_return_if_fail (parser != NULL);
+
+#ifndef LM_PARSER_USE_GMARKUP
+    parser->lazy = lazy;
+#endif
+}
+
+/**
+ * _lm_parser_set_limits:
+ * @parser: an #LmParser
+ * @max_size: most bytes in a stanza, tags included
+ * @max_depth: deepest nesting of elements in a stanza, counting the
+ * stanza element itself
+ * @max_attributes: most attributes on any one element
+ * @max_text: most bytes of text directly in any one element
+ *
+ * A stanza going over any of these, 0 meaning no limit, is dropped
+ * without building the rest of it and the stream carries on after its
+ * end tag. The size is checked as data comes in, a stanza may go over
+ * it by as much as one read before it's noticed. Not supported by the
+ * GMarkup parser.
+ **/
+void
+_lm_parser_set_limits (LmParser *parser,
+                       gsize     max_size,
+                       guint     max_depth,
+                       guint     max_attributes,
+                       gsize     max_text)
+{
+    g_return_if_fail (parser != NULL);
+
+    parser->max_size = max_size;
+    parser->max_depth = max_depth;
+    parser->max_attributes = max_attributes;
+    parser->max_text = max_text;
+}
+
+/* Called for every stanza dropped for going over a limit */
+void
+_lm_parser_set_limit_function (LmParser              *parser,
+                               LmParserLimitFunction  function,
+                               gpointer               user_data)
+{
+    g_return_if_fail (parser != NULL);
+
+    parser->limit_function = function;
+    parser->limit_user_data = user_data;
+}
+
+/**
+ * _lm_parser_materialize:
+ * @node: a node parsed in lazy mode
+ * @content: what was between the start and end tags of @node
+ * @len: length of @content
+ * @ns_context: prefix and namespace pairs in scope, nul separated
+ * @ns_len: length of @ns_context
+ *
+ * Builds the children of @node from its content. Any text directly in
+ * @node is left alone, its value was set when it was parsed.
+ *
+ * Return value: %TRUE on success, @content was checked once already so
+ * failing means something is badly wrong.
+ **/
+gboolean
+_lm_parser_materialize (LmMessageNode *node,
+                        const gchar   *content,
+                        gsize          len,
+                        const gchar   *ns_context,
+                        gsize          ns_len)
+{
+#ifdef LM_PARSER_USE_GMARKUP
+    return FALSE;
+#else
+    LmParser    *parser;
+    const gchar *p;
+    gsize        offset = 0;
+    gboolean     result;
+
+    /* Taken out of the cache while in use, in case building the
+     * children ends up materializing another node.
+     */
+    parser = g_private_get (&materialize_parser);
+    if (parser) {
+        g_private_set (&materialize_parser, NULL);
+    } else {
+        parser = lm_parser_new (NULL, NULL, NULL);
+        parser->materializing = TRUE;
+    }
+
+    /* Stands in for @node, which is open as far as the content goes.
+     * The parser gives the reference back when it's reset.
+     */
+    parser->cur_root = parser->cur_node = lm_message_node_ref (node);
+    g_string_append_c (parser->open_data, '\0');
+    g_array_append_val (parser->open_stack, offset);
+
+    for (p = ns_context; p < ns_context + ns_len;) {
+        const gchar *uri = p + strlen (p) + 1;
+
+        parser_push_ns (parser, p, uri, 0);
+        p = uri + strlen (uri) + 1;
+    }
+
+    result = parser_feed (parser, content, len) &&
+        parser->state == PARSER_STATE_TEXT &&
+        parser->open_stack->len == 1;
+
+    parser_reset (parser);
+
+    /* Keep it for the next node unless a big one made it grow */
+    if (!g_private_get (&materialize_parser) &&
+        parser->text->allocated_len <= PARSER_MATERIALIZE_KEEP_MAX &&
+        parser->token->allocated_len <= PARSER_MATERIALIZE_KEEP_MAX) {
+        g_private_set (&materialize_parser, parser);
+    } else {
+        lm_parser_free (parser);
+    }
+
+    return result;
+#endif
+}
+
+void
+lm_parser_free (LmParser *parser)
+{
+    if (parser->notify) {
+        (* parser->notify) (parser->user_data);
+    }
+
+    parser_reset (parser);
+    parser_free_state (parser);
+
+    if (parser->arena) {
+        _lm_arena_unref (parser->arena);
+    }
+
+    if (parser->repaired) {
+        g_string_free (parser->repaired, TRUE);
     }
-    g_free (parser->incomplete);
-    g_free (parser->m_parser);
     g_free (parser);
 }
 
@@ -20,6 +20,7 @@
 #define __LM_PARSER_H__
 
 #include <glib.h>
+#include "lm-connection.h"
 #include "lm-message.h"
 
 typedef struct LmParser LmParser;
@@ -27,12 +28,37 @@ typedef struct LmParser LmParser;
 typedef void (* LmParserMessageFunction) (LmParser     *parser,
                                           LmMessage    *message,
                                           gpointer      user_data);
+typedef void (* LmParserLimitFunction)   (LmParser     *parser,
+                                          LmStanzaLimit limit,
+                                          const gchar  *name,
+                                          gpointer      user_data);
 
 LmParser *   lm_parser_new       (LmParserMessageFunction  function,
                                   gpointer                 user_data,
                                   GDestroyNotify           notify);
 gboolean     lm_parser_parse     (LmParser                *parser,
                                   const gchar             *string);
+gboolean     lm_parser_parse_len (LmParser                *parser,
+                                  const gchar             *buffer,
+                                  gsize                    len);
 void         lm_parser_free      (LmParser                *parser);
 
+void         _lm_parser_set_use_arena (LmParser           *parser,
+                                       gboolean            use_arena);
+void         _lm_parser_set_lazy      (LmParser           *parser,
+                                       gboolean            lazy);
+void         _lm_parser_set_limits    (LmParser           *parser,
+                                       gsize               max_size,
+                                       guint               max_depth,
+                                       guint               max_attributes,
+                                       gsize               max_text);
+void         _lm_parser_set_limit_function (LmParser      *parser,
+                                            LmParserLimitFunction function,
+                                            gpointer       user_data);
+gboolean     _lm_parser_materialize   (LmMessageNode      *node,
+                                       const gchar        *content,
+                                       gsize               len,
+                                       const gchar        *ns_context,
+                                       gsize               ns_len);
+
 #endif /* __LM_PARSER_H__ */
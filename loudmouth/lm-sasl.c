@@ -763,7 +763,7 @@ sasl_challenge_cb (LmMessageHandler *handler,
     const gchar *ns;
 
     ns = lm_message_node_get_attribute (message->node, "xmlns");
-    if (!ns || strcmp (ns, XMPP_NS_SASL_AUTH) != 0) {
+    if (_lm_atom_lookup (ns) != LM_ATOM (NS_SASL)) {
         return LM_HANDLER_RESULT_ALLOW_MORE_HANDLERS;
     }
 
@@ -806,7 +806,7 @@ sasl_success_cb (LmMessageHandler *handler,
     const gchar *ns;
 
     ns = lm_message_node_get_attribute (message->node, "xmlns");
-    if (!ns || strcmp (ns, XMPP_NS_SASL_AUTH) != 0) {
+    if (_lm_atom_lookup (ns) != LM_ATOM (NS_SASL)) {
         return LM_HANDLER_RESULT_ALLOW_MORE_HANDLERS;
     }
 
@@ -878,7 +878,7 @@ sasl_failure_cb (LmMessageHandler *handler,
     const gchar *reason = "unknown reason";
 
     ns = lm_message_node_get_attribute (message->node, "xmlns");
-    if (!ns || strcmp (ns, XMPP_NS_SASL_AUTH) != 0) {
+    if (_lm_atom_lookup (ns) != LM_ATOM (NS_SASL)) {
         return LM_HANDLER_RESULT_ALLOW_MORE_HANDLERS;
     }
 
@@ -987,7 +987,7 @@ sasl_set_auth_type (LmSASL *sasl, LmMessageNode *mechanisms)
     sasl->auth_type = 0;
 
     ns = lm_message_node_get_attribute (mechanisms, "xmlns");
-    if (!ns || strcmp (ns, XMPP_NS_SASL_AUTH) != 0) {
+    if (_lm_atom_lookup (ns) != LM_ATOM (NS_SASL)) {
         return FALSE;
     }
 
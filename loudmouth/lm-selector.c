@@ -0,0 +1,484 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (C) 2003 Imendio AB
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, see <https://www.gnu.org/licenses>
+ */
+
+/**
+ * SECTION:lm-selector
+ * @Title: LmSelector
+ * @Short_description: Compiled paths to nodes in a message
+ *
+ * A selector is a path of element names from a node down into its
+ * children, compiled once and then matched in a single walk over the
+ * tree. The first step is matched against the node the walk starts at,
+ * and every "/" goes down to the children:
+ * |[
+ * message/event[xmlns='http://jabber.org/protocol/pubsub#event']/items/item
+ * ]|
+ * A step is an element name or "*" for any element. It can have any
+ * number of predicates, [@name] for an attribute which has to be there
+ * and [@name='value'] for one which has to have that value. [xmlns='...']
+ * is short for [@xmlns='...']. A step after "//" rather than "/" is
+ * looked for at any depth, "//item" finds every item in the tree.
+ *
+ * Selectors can be set on an #LmMessageHandler with
+ * lm_message_handler_set_selector() so that the handler only gets the
+ * messages it is interested in.
+ */
+
+#include <config.h>
+#include <string.h>
+
+#include "lm-error.h"
+#include "lm-internals.h"
+#include "lm-selector.h"
+
+/* The state of the walk is one bit per step */
+#define SELECTOR_MAX_STEPS 32
+
+typedef struct {
+    gchar *name;
+    gchar *value;   /* NULL if the attribute only has to be there */
+} SelectorPredicate;
+
+typedef struct {
+    gchar       *name;        /* NULL for any element */
+    const gchar *atom;        /* The atom for name, compared by address */
+    gboolean     descendant;  /* Matched at any depth, after a "//" */
+    GArray      *predicates;
+} SelectorStep;
+
+struct LmSelector {
+    gint    ref_count;
+    GArray *steps;
+};
+
+static gboolean
+selector_is_name_char (gchar c)
+{
+    return c != '\0' && c != '/' && c != '[' && c != ']' && c != '=' &&
+        c != '@' && c != '\'' && c != '"' && !g_ascii_isspace (c);
+}
+
+static gchar *
+selector_parse_name (const gchar **p)
+{
+    const gchar *start = *p;
+
+    while (selector_is_name_char (**p)) {
+        (*p)++;
+    }
+
+    if (*p == start) {
+        return NULL;
+    }
+
+    return g_strndup (start, *p - start);
+}
+
+/* [@name], [@name='value'] or [xmlns='value'] */
+static gboolean
+selector_parse_predicate (SelectorStep *step, const gchar **p)
+{
+    SelectorPredicate predicate;
+    gchar             quote;
+    const gchar      *end;
+
+    /* Past the '[' */
+    (*p)++;
+
+    if (**p == '@') {
+        (*p)++;
+        predicate.name = selector_parse_name (p);
+    } else if (strncmp (*p, "xmlns", 5) == 0 && !selector_is_name_char ((*p)[5])) {
+        *p += 5;
+        predicate.name = g_strdup ("xmlns");
+    } else {
+        return FALSE;
+    }
+
+    if (!predicate.name) {
+        return FALSE;
+    }
+
+    predicate.value = NULL;
+
+    if (**p == '=') {
+        (*p)++;
+        quote = **p;
+        if (quote != '\'' && quote != '"') {
+            g_free (predicate.name);
+            return FALSE;
+        }
+
+        end = strchr (*p + 1, quote);
+        if (!end) {
+            g_free (predicate.name);
+            return FALSE;
+        }
+
+        predicate.value = g_strndup (*p + 1, end - *p - 1);
+        *p = end + 1;
+    }
+
+    g_array_append_val (step->predicates, predicate);
+
+    if (**p != ']') {
+        return FALSE;
+    }
+    (*p)++;
+
+    return TRUE;
+}
+
+static gboolean
+selector_parse_step (LmSelector *selector, const gchar **p, gboolean descendant)
+{
+    SelectorStep *step;
+    gchar        *name = NULL;
+
+    if (**p == '*') {
+        (*p)++;
+    } else {
+        name = selector_parse_name (p);
+        if (!name) {
+            return FALSE;
+        }
+    }
+
+    g_array_set_size (selector->steps, selector->steps->len + 1);
+    step = &g_array_index (selector->steps, SelectorStep, selector->steps->len - 1);
+
+    step->name = name;
+    step->atom = name ? _lm_atom_lookup (name) : NULL;
+    step->descendant = descendant;
+    step->predicates = g_array_new (FALSE, FALSE, sizeof (SelectorPredicate));
+
+    while (**p == '[') {
+        if (!selector_parse_predicate (step, p)) {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+static gboolean
+selector_compile (LmSelector *selector, const gchar *p)
+{
+    gboolean descendant;
+
+    /* The first step is matched against the node itself unless it's
+     * looked for at any depth.
+     */
+    descendant = strncmp (p, "//", 2) == 0;
+    if (descendant) {
+        p += 2;
+    }
+
+    while (TRUE) {
+        if (selector->steps->len == SELECTOR_MAX_STEPS ||
+            !selector_parse_step (selector, &p, descendant)) {
+            return FALSE;
+        }
+
+        if (*p == '\0') {
+            return TRUE;
+        }
+
+        if (*p != '/') {
+            return FALSE;
+        }
+        p++;
+
+        descendant = *p == '/';
+        if (descendant) {
+            p++;
+        }
+    }
+}
+
+static gboolean
+selector_step_matches (SelectorStep *step, LmMessageNode *node)
+{
+    guint i;
+
+    if (step->atom) {
+        /* Names with an atom are always stored as the atom */
+        if (node->name != step->atom) {
+            return FALSE;
+        }
+    } else if (step->name && strcmp (node->name, step->name) != 0) {
+        return FALSE;
+    }
+
+    for (i = 0; i < step->predicates->len; ++i) {
+        SelectorPredicate *predicate;
+        const gchar       *value;
+
+        predicate = &g_array_index (step->predicates, SelectorPredicate, i);
+        value = lm_message_node_get_attribute (node, predicate->name);
+
+        if (!value || (predicate->value && strcmp (value, predicate->value) != 0)) {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+/* Tries the steps in @states on @node. Returns the steps for its children
+ * to try, @matched is set if @node matched the last step.
+ */
+static guint32
+selector_advance (LmSelector    *selector,
+                  LmMessageNode *node,
+                  guint32        states,
+                  gboolean      *matched)
+{
+    guint32 next = 0;
+    guint   last = selector->steps->len - 1;
+    guint   i;
+
+    *matched = FALSE;
+
+    for (i = 0; states != 0; ++i, states >>= 1) {
+        SelectorStep *step;
+
+        if (!(states & 1)) {
+            continue;
+        }
+
+        step = &g_array_index (selector->steps, SelectorStep, i);
+
+        /* Still looked for further down, whether it matched here or not */
+        if (step->descendant) {
+            next |= 1U << i;
+        }
+
+        if (!selector_step_matches (step, node)) {
+            continue;
+        }
+
+        if (i == last) {
+            *matched = TRUE;
+        } else {
+            next |= 1U << (i + 1);
+        }
+    }
+
+    return next;
+}
+
+/**
+ * lm_selector_new:
+ * @selector: the path to compile
+ * @error: location to store error, or %NULL
+ *
+ * Compiles @selector, see the description of #LmSelector for what it
+ * can contain. Up to 32 steps are supported.
+ *
+ * Return value: a newly created #LmSelector or %NULL if @selector isn't valid
+ *
+ * Since 1.5.5
+ **/
+LmSelector *
+lm_selector_new (const gchar *selector, GError **error)
+{
+    LmSelector *ret_val;
+
+    g_return_val_if_fail (selector != NULL, NULL);
+
+    ret_val = g_new0 (LmSelector, 1);
+    ret_val->ref_count = 1;
+    ret_val->steps = g_array_new (FALSE, FALSE, sizeof (SelectorStep));
+
+    if (!selector_compile (ret_val, selector)) {
+        g_set_error (error, LM_ERROR, LM_ERROR_INVALID_SELECTOR,
+                     "Invalid selector '%s'", selector);
+        lm_selector_unref (ret_val);
+        return NULL;
+    }
+
+    return ret_val;
+}
+
+/**
+ * lm_selector_foreach:
+ * @selector: an #LmSelector
+ * @node: the node to start at
+ * @func: function to call for each match
+ * @user_data: user data passed to @func
+ *
+ * Calls @func for every node below @node, @node itself included, matched
+ * by @selector. The tree is walked once, only going into children which
+ * could still lead to a match.
+ *
+ * Since 1.5.5
+ **/
+void
+lm_selector_foreach (LmSelector     *selector,
+                     LmMessageNode  *node,
+                     LmSelectorFunc  func,
+                     gpointer        user_data)
+{
+    LmMessageNode *root = node;
+    GArray        *states;
+    guint32        first = 1;
+    guint          depth = 0;
+
+    g_return_if_fail (selector != NULL);
+    g_return_if_fail (node != NULL);
+    g_return_if_fail (func != NULL);
+
+    /* The steps to try on the nodes at each depth */
+    states = g_array_sized_new (FALSE, FALSE, sizeof (guint32), 8);
+    g_array_append_val (states, first);
+
+    while (TRUE) {
+        LmMessageNode *children = NULL;
+        gboolean       matched;
+        guint32        next;
+
+        next = selector_advance (selector, node,
+                                 g_array_index (states, guint32, depth),
+                                 &matched);
+
+        if (matched && !func (selector, node, user_data)) {
+            break;
+        }
+
+        if (next) {
+            children = lm_message_node_get_children (node);
+        }
+
+        if (children) {
+            depth++;
+            if (depth == states->len) {
+                g_array_append_val (states, next);
+            } else {
+                g_array_index (states, guint32, depth) = next;
+            }
+            node = children;
+            continue;
+        }
+
+        while (node != root && node->next == NULL) {
+            node = node->parent;
+            depth--;
+        }
+
+        if (node == root) {
+            break;
+        }
+
+        node = node->next;
+    }
+
+    g_array_free (states, TRUE);
+}
+
+static gboolean
+selector_find_cb (LmSelector *selector, LmMessageNode *node, gpointer user_data)
+{
+    *(LmMessageNode **) user_data = node;
+
+    return FALSE;
+}
+
+/**
+ * lm_selector_find:
+ * @selector: an #LmSelector
+ * @node: the node to start at
+ *
+ * Finds the first node, in document order, matched by @selector below
+ * @node or @node itself.
+ *
+ * Return value: the first match or %NULL if there is none
+ *
+ * Since 1.5.5
+ **/
+LmMessageNode *
+lm_selector_find (LmSelector *selector, LmMessageNode *node)
+{
+    LmMessageNode *ret_val = NULL;
+
+    g_return_val_if_fail (selector != NULL, NULL);
+    g_return_val_if_fail (node != NULL, NULL);
+
+    lm_selector_foreach (selector, node, selector_find_cb, &ret_val);
+
+    return ret_val;
+}
+
+/**
+ * lm_selector_ref:
+ * @selector: an #LmSelector
+ *
+ * Adds a reference to @selector.
+ *
+ * Return value: the selector
+ *
+ * Since 1.5.5
+ **/
+LmSelector *
+lm_selector_ref (LmSelector *selector)
+{
+    g_return_val_if_fail (selector != NULL, NULL);
+
+    g_atomic_int_inc (&selector->ref_count);
+
+    return selector;
+}
+
+/**
+ * lm_selector_unref:
+ * @selector: an #LmSelector
+ *
+ * Removes a reference from @selector. When no more references are present
+ * the selector is freed.
+ *
+ * Since 1.5.5
+ **/
+void
+lm_selector_unref (LmSelector *selector)
+{
+    guint i, j;
+
+    g_return_if_fail (selector != NULL);
+
+    if (!g_atomic_int_dec_and_test (&selector->ref_count)) {
+        return;
+    }
+
+    for (i = 0; i < selector->steps->len; ++i) {
+        SelectorStep *step = &g_array_index (selector->steps, SelectorStep, i);
+
+        for (j = 0; j < step->predicates->len; ++j) {
+            SelectorPredicate *predicate;
+
+            predicate = &g_array_index (step->predicates, SelectorPredicate, j);
+            g_free (predicate->name);
+            g_free (predicate->value);
+        }
+
+        g_array_free (step->predicates, TRUE);
+        g_free (step->name);
+    }
+
+    g_array_free (selector->steps, TRUE);
+    g_free (selector);
+}
@@ -0,0 +1,65 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (C) 2003 Imendio AB
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, see <https://www.gnu.org/licenses>
+ */
+
+#ifndef __LM_SELECTOR_H__
+#define __LM_SELECTOR_H__
+
+#if !defined (LM_INSIDE_LOUDMOUTH_H) && !defined (LM_COMPILATION)
+#error "Only <loudmouth/loudmouth.h> can be included directly, this file may disappear or change contents."
+#endif
+
+#include <loudmouth/lm-message-node.h>
+
+G_BEGIN_DECLS
+
+/**
+ * LmSelector:
+ *
+ * A compiled path to nodes in a message tree.
+ */
+typedef struct LmSelector LmSelector;
+
+/**
+ * LmSelectorFunc:
+ * @selector: the #LmSelector
+ * @node: a node matched by @selector
+ * @user_data: user data passed to lm_selector_foreach()
+ *
+ * Called for each node matched by lm_selector_foreach(), in document
+ * order.
+ *
+ * Returns: %TRUE to go on with the next match, %FALSE to stop
+ */
+typedef gboolean (* LmSelectorFunc) (LmSelector    *selector,
+                                     LmMessageNode *node,
+                                     gpointer       user_data);
+
+LmSelector *    lm_selector_new     (const gchar     *selector,
+                                     GError         **error);
+LmMessageNode * lm_selector_find    (LmSelector      *selector,
+                                     LmMessageNode   *node);
+void            lm_selector_foreach (LmSelector      *selector,
+                                     LmMessageNode   *node,
+                                     LmSelectorFunc   func,
+                                     gpointer         user_data);
+LmSelector *    lm_selector_ref     (LmSelector      *selector);
+void            lm_selector_unref   (LmSelector      *selector);
+
+G_END_DECLS
+
+#endif /* __LM_SELECTOR_H__ */
@@ -0,0 +1,249 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (C) 2008 Imendio AB
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, see <https://www.gnu.org/licenses>
+ */
+
+/*
+ * Data sent from any thread, written out by the thread of a main context.
+ *
+ * Producers push onto a stack with compare-and-swap and never take
+ * anything off it. The consumer takes the whole stack at once, swapping
+ * in an empty one, and reverses it to get back the order things were
+ * pushed in. As nothing is ever popped off the top by itself, an item
+ * being freed and its memory pushed again can't confuse a producer.
+ *
+ * The producer that finds the stack empty wakes the main context up,
+ * whose source then sees the stack isn't empty. GLib does the waking
+ * through an eventfd where there is one.
+ */
+
+#include <config.h>
+#include <string.h>
+
+#include "lm-send-queue.h"
+
+/* Items are written out in batches of about this many bytes */
+#define BATCH_SIZE 16384
+
+typedef struct _LmSendItem LmSendItem;
+
+struct _LmSendItem {
+    LmSendItem *next;
+    gsize       len;
+    gchar       data[1];
+};
+
+struct _LmSendQueue {
+    /* Newest first, pushed onto by any thread */
+    LmSendItem          *top;
+
+    GMainContext        *context;
+    GSource             *source;
+
+    LmSendQueueFunction  function;
+    gpointer             user_data;
+
+    /* Only touched by the thread of @context */
+    GString             *batch;
+};
+
+typedef struct {
+    GSource      source;
+    LmSendQueue *queue;
+} SendQueueSource;
+
+static gboolean    send_queue_prepare_func    (GSource     *source,
+                                               gint        *timeout);
+static gboolean    send_queue_check_func      (GSource     *source);
+static gboolean    send_queue_dispatch_func   (GSource     *source,
+                                               GSourceFunc  callback,
+                                               gpointer     user_data);
+
+static GSourceFuncs source_funcs = {
+    send_queue_prepare_func,
+    send_queue_check_func,
+    send_queue_dispatch_func,
+    NULL
+};
+
+static gboolean
+send_queue_prepare_func (GSource *source, gint *timeout)
+{
+    LmSendQueue *queue = ((SendQueueSource *) source)->queue;
+
+    return g_atomic_pointer_get (&queue->top) != NULL;
+}
+
+static gboolean
+send_queue_check_func (GSource *source)
+{
+    LmSendQueue *queue = ((SendQueueSource *) source)->queue;
+
+    return g_atomic_pointer_get (&queue->top) != NULL;
+}
+
+static gboolean
+send_queue_dispatch_func (GSource     *source,
+                          GSourceFunc  callback,
+                          gpointer     user_data)
+{
+    lm_send_queue_flush (((SendQueueSource *) source)->queue);
+
+    return TRUE;
+}
+
+/* Takes everything pushed so far, oldest first */
+static LmSendItem *
+send_queue_take_all (LmSendQueue *queue)
+{
+    LmSendItem *top;
+    LmSendItem *items = NULL;
+
+    do {
+        top = g_atomic_pointer_get (&queue->top);
+    } while (top && !g_atomic_pointer_compare_and_exchange (&queue->top, top, NULL));
+
+    while (top) {
+        LmSendItem *next = top->next;
+
+        top->next = items;
+        items = top;
+        top = next;
+    }
+
+    return items;
+}
+
+/* Hands @queue the data pushed from other threads as the thread of
+ * @context gets to it, through @function.
+ */
+LmSendQueue *
+lm_send_queue_new (GMainContext        *context,
+                   LmSendQueueFunction  function,
+                   gpointer             user_data)
+{
+    LmSendQueue *queue;
+
+    g_return_val_if_fail (function != NULL, NULL);
+
+    queue = g_new0 (LmSendQueue, 1);
+
+    if (context) {
+        queue->context = g_main_context_ref (context);
+    }
+
+    queue->function = function;
+    queue->user_data = user_data;
+    queue->batch = g_string_sized_new (BATCH_SIZE);
+
+    queue->source = g_source_new (&source_funcs, sizeof (SendQueueSource));
+    ((SendQueueSource *) queue->source)->queue = queue;
+    g_source_attach (queue->source, queue->context);
+
+    return queue;
+}
+
+/* Safe to call from any thread for as long as @queue isn't freed */
+void
+lm_send_queue_push (LmSendQueue *queue, const gchar *buf, gsize len)
+{
+    LmSendItem *item;
+    LmSendItem *top;
+
+    g_return_if_fail (queue != NULL);
+    g_return_if_fail (buf != NULL || len == 0);
+
+    if (len == 0) {
+        return;
+    }
+
+    item = g_malloc (G_STRUCT_OFFSET (LmSendItem, data) + len);
+    item->len = len;
+    memcpy (item->data, buf, len);
+
+    do {
+        top = g_atomic_pointer_get (&queue->top);
+        item->next = top;
+    } while (!g_atomic_pointer_compare_and_exchange (&queue->top, top, item));
+
+    /* The queue was empty, so the main context may be asleep */
+    if (!top) {
+        g_main_context_wakeup (queue->context);
+    }
+}
+
+/* Hands everything pushed so far to the function of @queue. Only called
+ * from the thread of its main context.
+ *
+ * Return value: the number of pushes that were handed on
+ */
+guint
+lm_send_queue_flush (LmSendQueue *queue)
+{
+    LmSendItem *items;
+    guint       n_items = 0;
+
+    g_return_val_if_fail (queue != NULL, 0);
+
+    items = send_queue_take_all (queue);
+
+    while (items) {
+        LmSendItem *item = items;
+
+        items = item->next;
+
+        g_string_append_len (queue->batch, item->data, item->len);
+        g_free (item);
+        n_items++;
+
+        if (queue->batch->len >= BATCH_SIZE || !items) {
+            (queue->function) (queue, queue->batch->str, queue->batch->len,
+                               queue->user_data);
+            g_string_truncate (queue->batch, 0);
+        }
+    }
+
+    return n_items;
+}
+
+/* Whatever is still in @queue is dropped. No other thread can be pushing
+ * onto it any longer.
+ */
+void
+lm_send_queue_free (LmSendQueue *queue)
+{
+    LmSendItem *items;
+
+    g_return_if_fail (queue != NULL);
+
+    g_source_destroy (queue->source);
+    g_source_unref (queue->source);
+
+    if (queue->context) {
+        g_main_context_unref (queue->context);
+    }
+
+    items = send_queue_take_all (queue);
+    while (items) {
+        LmSendItem *next = items->next;
+
+        g_free (items);
+        items = next;
+    }
+
+    g_string_free (queue->batch, TRUE);
+    g_free (queue);
+}
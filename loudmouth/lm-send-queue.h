@@ -0,0 +1,43 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (C) 2008 Imendio AB
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, see <https://www.gnu.org/licenses>
+ */
+
+#ifndef __LM_SEND_QUEUE_H__
+#define __LM_SEND_QUEUE_H__
+
+#include <glib.h>
+
+typedef struct _LmSendQueue LmSendQueue;
+
+/* Called in the thread of the main context with what was pushed, in order
+ * and put together into batches.
+ */
+typedef void (* LmSendQueueFunction) (LmSendQueue *queue,
+                                      const gchar *buf,
+                                      gsize        len,
+                                      gpointer     user_data);
+
+LmSendQueue * lm_send_queue_new        (GMainContext        *context,
+                                        LmSendQueueFunction  function,
+                                        gpointer             user_data);
+void          lm_send_queue_push       (LmSendQueue         *queue,
+                                        const gchar         *buf,
+                                        gsize                len);
+guint         lm_send_queue_flush      (LmSendQueue         *queue);
+void          lm_send_queue_free       (LmSendQueue         *queue);
+
+#endif /* __LM_SEND_QUEUE_H__ */
@@ -0,0 +1,407 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (C) 2003 Imendio AB
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, see <https://www.gnu.org/licenses>
+ */
+
+/**
+ * SECTION:lm-template
+ * @Title: LmTemplate
+ * @Short_description: Stanzas compiled once and sent many times
+ *
+ * A template is the XML of a stanza with named slots in attribute values
+ * and text, such as
+ * |[
+ * <message to="{to}" type="chat"><body>{body}</body></message>
+ * ]|
+ * It is sent with lm_connection_send_template(), which writes it straight
+ * to the output with the values escaped into the slots, without building
+ * an #LmMessage. Use "{{" for a literal "{".
+ */
+
+#include <config.h>
+#include <string.h>
+
+#include "lm-error.h"
+#include "lm-escape.h"
+#include "lm-internals.h"
+#include "lm-template.h"
+
+/* Where a slot may go */
+typedef enum {
+    TEMPLATE_STATE_TEXT,
+    TEMPLATE_STATE_TAG,
+    TEMPLATE_STATE_VALUE
+} TemplateState;
+
+/* A run of the XML followed by a slot, -1 if it's the last one */
+typedef struct {
+    gsize start;
+    gsize len;
+    gint  slot;
+} TemplatePart;
+
+struct LmTemplate {
+    gint       ref_count;
+
+    /* The XML with the slots taken out */
+    gchar     *literal;
+    GArray    *parts;
+    GPtrArray *slots;
+};
+
+static gboolean
+template_is_name_char (gchar c)
+{
+    return g_ascii_isalnum (c) || c == '_' || c == '-' || c == '.';
+}
+
+static void
+template_add_part (LmTemplate *tmpl, GString *literal, gsize *start, gint slot)
+{
+    TemplatePart part;
+
+    part.start = *start;
+    part.len = literal->len - *start;
+    part.slot = slot;
+    g_array_append_val (tmpl->parts, part);
+
+    *start = literal->len;
+}
+
+static gint
+template_add_slot (LmTemplate *tmpl, const gchar *name, gsize len)
+{
+    guint i;
+
+    for (i = 0; i < tmpl->slots->len; ++i) {
+        const gchar *slot = g_ptr_array_index (tmpl->slots, i);
+
+        if (strncmp (slot, name, len) == 0 && slot[len] == '\0') {
+            return i;
+        }
+    }
+
+    g_ptr_array_add (tmpl->slots, g_strndup (name, len));
+
+    return tmpl->slots->len - 1;
+}
+
+/* The XML with empty slots has to be well-formed on its own */
+static gboolean
+template_check_markup (const gchar *literal, GError **error)
+{
+    static const GMarkupParser parser = { NULL, NULL, NULL, NULL, NULL };
+    GMarkupParseContext       *context;
+    GError                    *markup_error = NULL;
+
+    context = g_markup_parse_context_new (&parser, 0, NULL, NULL);
+
+    if (g_markup_parse_context_parse (context, literal, -1, &markup_error)) {
+        g_markup_parse_context_end_parse (context, &markup_error);
+    }
+
+    g_markup_parse_context_free (context);
+
+    if (markup_error) {
+        g_set_error (error, LM_ERROR, LM_ERROR_INVALID_TEMPLATE,
+                     "Template is not well-formed: %s", markup_error->message);
+        g_error_free (markup_error);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static gboolean
+template_compile (LmTemplate *tmpl, const gchar *xml, GError **error)
+{
+    TemplateState  state = TEMPLATE_STATE_TEXT;
+    GString       *literal;
+    const gchar   *p;
+    gchar          quote = '\0';
+    gsize          start = 0;
+
+    literal = g_string_sized_new (strlen (xml));
+
+    for (p = xml; *p; ++p) {
+        const gchar *end;
+
+        if (*p == '{' && p[1] == '{') {
+            g_string_append_c (literal, '{');
+            ++p;
+            continue;
+        }
+
+        if (*p == '{') {
+            for (end = p + 1; template_is_name_char (*end); ++end) {
+                /* Nothing */
+            }
+
+            if (state == TEMPLATE_STATE_TAG || *end != '}' || end == p + 1) {
+                g_set_error (error, LM_ERROR, LM_ERROR_INVALID_TEMPLATE,
+                             "Invalid slot at offset %d of template",
+                             (gint) (p - xml));
+                g_string_free (literal, TRUE);
+                return FALSE;
+            }
+
+            template_add_part (tmpl, literal, &start,
+                               template_add_slot (tmpl, p + 1, end - p - 1));
+            p = end;
+            continue;
+        }
+
+        switch (state) {
+        case TEMPLATE_STATE_TEXT:
+            if (*p == '<') {
+                state = TEMPLATE_STATE_TAG;
+            }
+            break;
+        case TEMPLATE_STATE_TAG:
+            if (*p == '"' || *p == '\'') {
+                quote = *p;
+                state = TEMPLATE_STATE_VALUE;
+            } else if (*p == '>') {
+                state = TEMPLATE_STATE_TEXT;
+            }
+            break;
+        case TEMPLATE_STATE_VALUE:
+            if (*p == quote) {
+                state = TEMPLATE_STATE_TAG;
+            }
+            break;
+        }
+
+        g_string_append_c (literal, *p);
+    }
+
+    template_add_part (tmpl, literal, &start, -1);
+    tmpl->literal = g_string_free (literal, FALSE);
+
+    return template_check_markup (tmpl->literal, error);
+}
+
+/* Counts the bytes of the filled in template if @dest is %NULL */
+static gsize
+template_write (LmTemplate *tmpl, const gchar **values, gchar *dest)
+{
+    gsize len = 0;
+    guint i;
+
+    for (i = 0; i < tmpl->parts->len; ++i) {
+        TemplatePart *part = &g_array_index (tmpl->parts, TemplatePart, i);
+        const gchar  *value;
+
+        if (dest) {
+            memcpy (dest + len, tmpl->literal + part->start, part->len);
+        }
+        len += part->len;
+
+        if (part->slot < 0) {
+            continue;
+        }
+
+        value = values[part->slot];
+        if (value) {
+            len += _lm_escape_text (dest ? dest + len : NULL,
+                                    value, strlen (value));
+        }
+    }
+
+    return len;
+}
+
+/**
+ * _lm_template_write:
+ * @tmpl: an #LmTemplate
+ * @values: a value for each slot
+ * @out: string to append to
+ *
+ * Appends @tmpl to @out with @values escaped into the slots, after making
+ * room for exactly as much as is needed.
+ *
+ * Return value: the number of bytes appended
+ **/
+gsize
+_lm_template_write (LmTemplate   *tmpl,
+                    const gchar **values,
+                    GString      *out)
+{
+    gsize start;
+    gsize len;
+
+    g_return_val_if_fail (tmpl != NULL, 0);
+    g_return_val_if_fail (out != NULL, 0);
+    g_return_val_if_fail (values != NULL || tmpl->slots->len == 0, 0);
+
+    len = template_write (tmpl, values, NULL);
+
+    start = out->len;
+    g_string_set_size (out, start + len);
+    template_write (tmpl, values, out->str + start);
+
+    return len;
+}
+
+/**
+ * lm_template_new:
+ * @xml: the XML of the stanza, with slots
+ * @error: location to store error, or %NULL
+ *
+ * Compiles @xml into a template. Slots are written as {name} and can go
+ * in attribute values and text, a name used more than once is the same
+ * slot every time. The XML has to be well-formed with the slots left
+ * empty.
+ *
+ * Return value: a newly created #LmTemplate or %NULL if @xml isn't valid
+ *
+ * Since 1.5.5
+ **/
+LmTemplate *
+lm_template_new (const gchar *xml, GError **error)
+{
+    LmTemplate *tmpl;
+
+    g_return_val_if_fail (xml != NULL, NULL);
+
+    tmpl = g_new0 (LmTemplate, 1);
+    tmpl->ref_count = 1;
+    tmpl->parts = g_array_new (FALSE, FALSE, sizeof (TemplatePart));
+    tmpl->slots = g_ptr_array_new_with_free_func (g_free);
+
+    if (!template_compile (tmpl, xml, error)) {
+        lm_template_unref (tmpl);
+        return NULL;
+    }
+
+    return tmpl;
+}
+
+/**
+ * lm_template_get_slot:
+ * @tmpl: an #LmTemplate
+ * @name: the name of a slot
+ *
+ * Looks up where the value for the slot @name goes in the array of values
+ * passed to lm_connection_send_template(). Slots are numbered in the
+ * order they first appear in.
+ *
+ * Return value: the index of the slot or -1 if there is none by that name
+ *
+ * Since 1.5.5
+ **/
+gint
+lm_template_get_slot (LmTemplate *tmpl, const gchar *name)
+{
+    guint i;
+
+    g_return_val_if_fail (tmpl != NULL, -1);
+    g_return_val_if_fail (name != NULL, -1);
+
+    for (i = 0; i < tmpl->slots->len; ++i) {
+        if (strcmp (g_ptr_array_index (tmpl->slots, i), name) == 0) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * lm_template_get_n_slots:
+ * @tmpl: an #LmTemplate
+ *
+ * Fetches the number of different slots in @tmpl, which is how many
+ * values have to be passed when sending it.
+ *
+ * Return value: the number of slots
+ *
+ * Since 1.5.5
+ **/
+guint
+lm_template_get_n_slots (LmTemplate *tmpl)
+{
+    g_return_val_if_fail (tmpl != NULL, 0);
+
+    return tmpl->slots->len;
+}
+
+/**
+ * lm_template_to_string:
+ * @tmpl: an #LmTemplate
+ * @values: a value for each slot, %NULL for an empty one
+ *
+ * Fills in @tmpl the way lm_connection_send_template() does. This is
+ * mostly for debugging purposes.
+ *
+ * Return value: the XML that would be sent, free with g_free()
+ *
+ * Since 1.5.5
+ **/
+gchar *
+lm_template_to_string (LmTemplate *tmpl, const gchar **values)
+{
+    GString *ret;
+
+    g_return_val_if_fail (tmpl != NULL, NULL);
+
+    ret = g_string_new (NULL);
+    _lm_template_write (tmpl, values, ret);
+
+    return g_string_free (ret, FALSE);
+}
+
+/**
+ * lm_template_ref:
+ * @tmpl: an #LmTemplate
+ *
+ * Adds a reference to @tmpl.
+ *
+ * Return value: the template
+ *
+ * Since 1.5.5
+ **/
+LmTemplate *
+lm_template_ref (LmTemplate *tmpl)
+{
+    g_return_val_if_fail (tmpl != NULL, NULL);
+
+    g_atomic_int_inc (&tmpl->ref_count);
+
+    return tmpl;
+}
+
+/**
+ * lm_template_unref:
+ * @tmpl: an #LmTemplate
+ *
+ * Removes a reference from @tmpl. When no more references are present
+ * the template is freed.
+ *
+ * Since 1.5.5
+ **/
+void
+lm_template_unref (LmTemplate *tmpl)
+{
+    g_return_if_fail (tmpl != NULL);
+
+    if (g_atomic_int_dec_and_test (&tmpl->ref_count)) {
+        g_free (tmpl->literal);
+        g_array_free (tmpl->parts, TRUE);
+        g_ptr_array_free (tmpl->slots, TRUE);
+        g_free (tmpl);
+    }
+}
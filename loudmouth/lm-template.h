@@ -0,0 +1,49 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (C) 2003 Imendio AB
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, see <https://www.gnu.org/licenses>
+ */
+
+#ifndef __LM_TEMPLATE_H__
+#define __LM_TEMPLATE_H__
+
+#if !defined (LM_INSIDE_LOUDMOUTH_H) && !defined (LM_COMPILATION)
+#error "Only <loudmouth/loudmouth.h> can be included directly, this file may disappear or change contents."
+#endif
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/**
+ * LmTemplate:
+ *
+ * A stanza compiled once with slots to fill in every time it is sent.
+ */
+typedef struct LmTemplate LmTemplate;
+
+LmTemplate *  lm_template_new         (const gchar  *xml,
+                                       GError      **error);
+gint          lm_template_get_slot    (LmTemplate   *tmpl,
+                                       const gchar  *name);
+guint         lm_template_get_n_slots (LmTemplate   *tmpl);
+gchar *       lm_template_to_string   (LmTemplate   *tmpl,
+                                       const gchar **values);
+LmTemplate *  lm_template_ref         (LmTemplate   *tmpl);
+void          lm_template_unref       (LmTemplate   *tmpl);
+
+G_END_DECLS
+
+#endif /* __LM_TEMPLATE_H__ */
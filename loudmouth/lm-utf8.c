@@ -0,0 +1,601 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (C) 2003 Imendio AB
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, see <https://www.gnu.org/licenses>
+ */
+
+/*
+ * utf-8 validation for the inbound stream.
+ *
+ * The vector kernels only answer "is this block valid", they never try to
+ * locate the error. Whatever they can't vouch for is walked by the scalar
+ * decoder below, which is the reference for what counts as valid: the same
+ * rules as g_utf8_validate(), nul bytes included.
+ *
+ * The SSE2 kernel only skips ASCII, AVX2 and NEON check multi-byte
+ * sequences too, using the lookup tables from "Validating UTF-8 In Less
+ * Than One Instruction Per Byte" (Keiser, Lemire).
+ */
+
+#include <config.h>
+#include <string.h>
+
+#include "lm-utf8.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__)))
+#define UTF8_HAVE_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#define UTF8_HAVE_NEON 1
+#include <arm_neon.h>
+#endif
+
+/* Bytes the scalar decoder walks before handing back to the kernel */
+#define UTF8_RESYNC_LEN 64
+
+typedef gsize (* Utf8KernelFunc) (const guchar *p, gsize len);
+
+/* Lookup tables, see the paper for how the error classes combine */
+#define TOO_SHORT      (1 << 0)
+#define TOO_LONG       (1 << 1)
+#define OVERLONG_3     (1 << 2)
+#define TOO_LARGE      (1 << 3)
+#define SURROGATE      (1 << 4)
+#define OVERLONG_2     (1 << 5)
+#define TOO_LARGE_1000 (1 << 6)
+#define OVERLONG_4     (1 << 6)
+#define TWO_CONTS      (1 << 7)
+#define CARRY          (TOO_SHORT | TOO_LONG | TWO_CONTS)
+
+#if defined(UTF8_HAVE_X86) || defined(UTF8_HAVE_NEON)
+static const guint8 utf8_byte_1_high[16] = {
+    /* 0xxx, ASCII */
+    TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+    TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+    /* 10xx, continuation */
+    TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+    /* 1100 */
+    TOO_SHORT | OVERLONG_2,
+    /* 1101 */
+    TOO_SHORT,
+    /* 1110 */
+    TOO_SHORT | OVERLONG_3 | SURROGATE,
+    /* 1111 */
+    TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4
+};
+
+static const guint8 utf8_byte_1_low[16] = {
+    /* xxxx0000 */
+    CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4,
+    /* xxxx0001 */
+    CARRY | OVERLONG_2,
+    /* xxxx001x */
+    CARRY,
+    CARRY,
+    /* xxxx0100 */
+    CARRY | TOO_LARGE,
+    /* xxxx0101 - xxxx1100 */
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    /* xxxx1101 */
+    CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,
+    /* xxxx111x */
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000
+};
+
+static const guint8 utf8_byte_2_high[16] = {
+    /* 0xxx, ASCII */
+    TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+    TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+    /* 1000 */
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4,
+    /* 1001 */
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,
+    /* 101x */
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+    /* 11xx, lead byte */
+    TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT
+};
+#endif
+
+/* Checks the character at @p. Returns its length, or 0 if it is
+ * ill-formed, in which case @subpart is set to the length of the maximal
+ * subpart: the bytes which could still have been the start of a valid
+ * character.
+ */
+static inline gsize
+utf8_check_char (const guchar *p, gsize avail, gsize *subpart)
+{
+    guchar c = p[0];
+    guchar lo = 0x80, hi = 0xbf;
+    gsize  need, i;
+
+    if (c < 0x80) {
+        if (c == 0) {
+            *subpart = 1;
+            return 0;
+        }
+        return 1;
+    }
+
+    if (c < 0xc2) {
+        *subpart = 1;
+        return 0;
+    } else if (c < 0xe0) {
+        need = 2;
+    } else if (c < 0xf0) {
+        need = 3;
+        if (c == 0xe0) {
+            lo = 0xa0;
+        } else if (c == 0xed) {
+            hi = 0x9f;
+        }
+    } else if (c < 0xf5) {
+        need = 4;
+        if (c == 0xf0) {
+            lo = 0x90;
+        } else if (c == 0xf4) {
+            hi = 0x8f;
+        }
+    } else {
+        *subpart = 1;
+        return 0;
+    }
+
+    for (i = 1; i < need; ++i) {
+        if (i >= avail || p[i] < lo || p[i] > hi) {
+            *subpart = i;
+            return 0;
+        }
+        lo = 0x80;
+        hi = 0xbf;
+    }
+
+    return need;
+}
+
+/* Plain C, eight bytes at a time while the input is ASCII */
+static gsize
+utf8_kernel_scalar (const guchar *p, gsize len)
+{
+    const guint64 high = G_GUINT64_CONSTANT (0x8080808080808080);
+    const guint64 ones = G_GUINT64_CONSTANT (0x0101010101010101);
+    gsize         i;
+
+    for (i = 0; i + 8 <= len; i += 8) {
+        guint64 word;
+
+        memcpy (&word, p + i, sizeof (word));
+        if ((word & high) || ((word - ones) & ~word & high)) {
+            break;
+        }
+    }
+
+    return i;
+}
+
+#ifdef UTF8_HAVE_X86
+static gsize
+utf8_kernel_sse2 (const guchar *p, gsize len)
+{
+    const __m128i zero = _mm_setzero_si128 ();
+    gsize         i;
+
+    for (i = 0; i + 16 <= len; i += 16) {
+        __m128i input = _mm_loadu_si128 ((const __m128i *) (p + i));
+        gint    mask;
+
+        /* High bit set either because the byte isn't ASCII or is nul */
+        mask = _mm_movemask_epi8 (_mm_or_si128 (input,
+                                                _mm_cmpeq_epi8 (input, zero)));
+        if (mask != 0) {
+            return i + __builtin_ctz (mask);
+        }
+    }
+
+    return i;
+}
+
+#define AVX2_PREV(input, prev, n)                                         \
+    _mm256_alignr_epi8 ((input),                                          \
+                        _mm256_permute2x128_si256 ((prev), (input), 0x21), \
+                        16 - (n))
+
+__attribute__ ((target ("avx2")))
+static gsize
+utf8_kernel_avx2 (const guchar *p, gsize len)
+{
+    const __m256i zero = _mm256_setzero_si256 ();
+    const __m256i nibble = _mm256_set1_epi8 (0x0f);
+    const __m256i table_1_high = _mm256_broadcastsi128_si256 (
+        _mm_loadu_si128 ((const __m128i *) utf8_byte_1_high));
+    const __m256i table_1_low = _mm256_broadcastsi128_si256 (
+        _mm_loadu_si128 ((const __m128i *) utf8_byte_1_low));
+    const __m256i table_2_high = _mm256_broadcastsi128_si256 (
+        _mm_loadu_si128 ((const __m128i *) utf8_byte_2_high));
+    /* Anything above these can't end a block, a byte is missing */
+    const __m256i incomplete_max = _mm256_setr_epi8 (
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        (char) (0xf0 - 1), (char) (0xe0 - 1), (char) (0xc0 - 1));
+    __m256i prev_input = zero;
+    __m256i prev_incomplete = zero;
+    gsize   i;
+
+    for (i = 0; i + 32 <= len; i += 32) {
+        __m256i input = _mm256_loadu_si256 ((const __m256i *) (p + i));
+        __m256i error;
+
+        if (_mm256_movemask_epi8 (input) == 0) {
+            error = prev_incomplete;
+            prev_incomplete = zero;
+        } else {
+            __m256i prev1, prev2, prev3, special, must23;
+
+            prev1 = AVX2_PREV (input, prev_input, 1);
+            prev2 = AVX2_PREV (input, prev_input, 2);
+            prev3 = AVX2_PREV (input, prev_input, 3);
+
+            special = _mm256_and_si256 (
+                _mm256_and_si256 (
+                    _mm256_shuffle_epi8 (table_1_high,
+                        _mm256_and_si256 (_mm256_srli_epi16 (prev1, 4), nibble)),
+                    _mm256_shuffle_epi8 (table_1_low,
+                        _mm256_and_si256 (prev1, nibble))),
+                _mm256_shuffle_epi8 (table_2_high,
+                    _mm256_and_si256 (_mm256_srli_epi16 (input, 4), nibble)));
+
+            /* Third and fourth bytes of a sequence must be continuations */
+            must23 = _mm256_or_si256 (
+                _mm256_subs_epu8 (prev2, _mm256_set1_epi8 ((char) (0xe0 - 0x80))),
+                _mm256_subs_epu8 (prev3, _mm256_set1_epi8 ((char) (0xf0 - 0x80))));
+            must23 = _mm256_and_si256 (must23, _mm256_set1_epi8 ((char) 0x80));
+
+            error = _mm256_xor_si256 (must23, special);
+            prev_incomplete = _mm256_subs_epu8 (input, incomplete_max);
+        }
+
+        error = _mm256_or_si256 (error, _mm256_cmpeq_epi8 (input, zero));
+        if (!_mm256_testz_si256 (error, error)) {
+            break;
+        }
+
+        prev_input = input;
+    }
+
+    return i;
+}
+#endif /* UTF8_HAVE_X86 */
+
+#ifdef UTF8_HAVE_NEON
+static gsize
+utf8_kernel_neon (const guchar *p, gsize len)
+{
+    const uint8x16_t zero = vdupq_n_u8 (0);
+    const uint8x16_t table_1_high = vld1q_u8 (utf8_byte_1_high);
+    const uint8x16_t table_1_low = vld1q_u8 (utf8_byte_1_low);
+    const uint8x16_t table_2_high = vld1q_u8 (utf8_byte_2_high);
+    static const guint8 incomplete_max_bytes[16] = {
+        0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+        0xff, 0xff, 0xff, 0xff, 0xff, 0xf0 - 1, 0xe0 - 1, 0xc0 - 1
+    };
+    const uint8x16_t incomplete_max = vld1q_u8 (incomplete_max_bytes);
+    uint8x16_t prev_input = zero;
+    uint8x16_t prev_incomplete = zero;
+    gsize      i;
+
+    for (i = 0; i + 16 <= len; i += 16) {
+        uint8x16_t input = vld1q_u8 (p + i);
+        uint8x16_t error;
+
+        if (vmaxvq_u8 (input) < 0x80) {
+            error = prev_incomplete;
+            prev_incomplete = zero;
+        } else {
+            uint8x16_t prev1, prev2, prev3, special, must23;
+
+            prev1 = vextq_u8 (prev_input, input, 15);
+            prev2 = vextq_u8 (prev_input, input, 14);
+            prev3 = vextq_u8 (prev_input, input, 13);
+
+            special = vandq_u8 (
+                vandq_u8 (vqtbl1q_u8 (table_1_high, vshrq_n_u8 (prev1, 4)),
+                          vqtbl1q_u8 (table_1_low,
+                                      vandq_u8 (prev1, vdupq_n_u8 (0x0f)))),
+                vqtbl1q_u8 (table_2_high, vshrq_n_u8 (input, 4)));
+
+            must23 = vorrq_u8 (vcgeq_u8 (prev2, vdupq_n_u8 (0xe0)),
+                               vcgeq_u8 (prev3, vdupq_n_u8 (0xf0)));
+            must23 = vandq_u8 (must23, vdupq_n_u8 (0x80));
+
+            error = veorq_u8 (must23, special);
+            prev_incomplete = vqsubq_u8 (input, incomplete_max);
+        }
+
+        error = vorrq_u8 (error, vceqq_u8 (input, zero));
+        if (vmaxvq_u8 (error) != 0) {
+            break;
+        }
+
+        prev_input = input;
+    }
+
+    return i;
+}
+#endif /* UTF8_HAVE_NEON */
+
+static Utf8KernelFunc  utf8_kernel = utf8_kernel_scalar;
+static const gchar    *utf8_kernel_name = "scalar";
+
+static gboolean
+utf8_select_kernel (LmUtf8Kernel kernel)
+{
+    switch (kernel) {
+    case LM_UTF8_KERNEL_AUTO:
+#ifdef UTF8_HAVE_X86
+        __builtin_cpu_init ();
+        if (__builtin_cpu_supports ("avx2")) {
+            return utf8_select_kernel (LM_UTF8_KERNEL_AVX2);
+        }
+        return utf8_select_kernel (LM_UTF8_KERNEL_SSE2);
+#elif defined(UTF8_HAVE_NEON)
+        return utf8_select_kernel (LM_UTF8_KERNEL_NEON);
+#else
+        return utf8_select_kernel (LM_UTF8_KERNEL_SCALAR);
+#endif
+    case LM_UTF8_KERNEL_SCALAR:
+        utf8_kernel = utf8_kernel_scalar;
+        utf8_kernel_name = "scalar";
+        return TRUE;
+#ifdef UTF8_HAVE_X86
+    case LM_UTF8_KERNEL_SSE2:
+        utf8_kernel = utf8_kernel_sse2;
+        utf8_kernel_name = "sse2";
+        return TRUE;
+    case LM_UTF8_KERNEL_AVX2:
+        __builtin_cpu_init ();
+        if (!__builtin_cpu_supports ("avx2")) {
+            return FALSE;
+        }
+        utf8_kernel = utf8_kernel_avx2;
+        utf8_kernel_name = "avx2";
+        return TRUE;
+#endif
+#ifdef UTF8_HAVE_NEON
+    case LM_UTF8_KERNEL_NEON:
+        utf8_kernel = utf8_kernel_neon;
+        utf8_kernel_name = "neon";
+        return TRUE;
+#endif
+    default:
+        break;
+    }
+
+    return FALSE;
+}
+
+static Utf8KernelFunc
+utf8_get_kernel (void)
+{
+    static gsize initialized = 0;
+
+    if (g_once_init_enter (&initialized)) {
+        utf8_select_kernel (LM_UTF8_KERNEL_AUTO);
+        g_once_init_leave (&initialized, 1);
+    }
+
+    return utf8_kernel;
+}
+
+/* Start of the character which byte @pos - 1 belongs to, never before
+ * @lower. Used to step back over a character the kernel left half checked.
+ */
+static inline gsize
+utf8_char_start (const guchar *p, gsize lower, gsize pos)
+{
+    gsize k;
+
+    if (pos == lower || p[pos - 1] < 0x80) {
+        return pos;
+    }
+
+    for (k = pos - 1; k > lower && pos - k < 4; --k) {
+        if ((p[k] & 0xc0) != 0x80) {
+            break;
+        }
+    }
+
+    return k;
+}
+
+/**
+ * _lm_utf8_validate:
+ * @buffer: the data to check
+ * @len: number of bytes in @buffer
+ *
+ * Finds the first byte of @buffer which isn't part of a well-formed utf-8
+ * character. A character cut off by the end of @buffer counts as invalid,
+ * as does a nul byte.
+ *
+ * Return value: the length of the valid prefix, @len if all of it is valid
+ **/
+gsize
+_lm_utf8_validate (const gchar *buffer, gsize len)
+{
+    const guchar   *p = (const guchar *) buffer;
+    Utf8KernelFunc  kernel;
+    gsize           i = 0;
+
+    kernel = utf8_get_kernel ();
+
+    while (i < len) {
+        gsize stop;
+
+        i = utf8_char_start (p, i, i + kernel (p + i, len - i));
+        stop = MIN (len, i + UTF8_RESYNC_LEN);
+
+        while (i < stop) {
+            gsize n, subpart;
+
+            if (p[i] != 0 && p[i] < 0x80) {
+                i++;
+                continue;
+            }
+
+            n = utf8_check_char (p + i, len - i, &subpart);
+            if (n == 0) {
+                return i;
+            }
+            i += n;
+        }
+    }
+
+    return len;
+}
+
+/**
+ * _lm_utf8_sequence_length:
+ * @c: the first byte of a character
+ *
+ * Return value: the number of bytes in a character starting with @c, 0 if
+ * @c can't start one
+ **/
+gsize
+_lm_utf8_sequence_length (guchar c)
+{
+    if (c < 0x80) {
+        return 1;
+    } else if (c >= 0xc2 && c <= 0xdf) {
+        return 2;
+    } else if (c >= 0xe0 && c <= 0xef) {
+        return 3;
+    } else if (c >= 0xf0 && c <= 0xf4) {
+        return 4;
+    }
+
+    return 0;
+}
+
+/**
+ * _lm_utf8_incomplete_tail:
+ * @buffer: the data to check
+ * @len: number of bytes in @buffer
+ *
+ * Return value: the length of the tail of @buffer which is the beginning
+ * of a valid but incomplete character, 0 if there is no such tail
+ **/
+gsize
+_lm_utf8_incomplete_tail (const gchar *buffer, gsize len)
+{
+    gsize i;
+
+    for (i = 1; i <= 3 && i <= len; ++i) {
+        guchar c = (guchar) buffer[len - i];
+
+        if ((c & 0xc0) != 0x80) {
+            gsize subpart;
+
+            if (_lm_utf8_sequence_length (c) > i &&
+                utf8_check_char ((const guchar *) buffer + len - i,
+                                 i, &subpart) == 0 &&
+                subpart == i) {
+                return i;
+            }
+            return 0;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * _lm_utf8_repair:
+ * @buffer: the data to repair
+ * @len: number of bytes in @buffer
+ * @out: string the result is appended to
+ *
+ * Appends @buffer to @out, replacing every ill-formed part with U+FFFD.
+ * Valid runs are found with _lm_utf8_validate() and copied in one go.
+ *
+ * Return value: the number of replacements made
+ **/
+gsize
+_lm_utf8_repair (const gchar *buffer, gsize len, GString *out)
+{
+    gsize replaced = 0;
+
+    g_return_val_if_fail (out != NULL, 0);
+
+    while (len > 0) {
+        gsize valid, subpart = 1;
+
+        valid = _lm_utf8_validate (buffer, len);
+        g_string_append_len (out, buffer, (gssize) valid);
+        if (valid == len) {
+            break;
+        }
+
+        utf8_check_char ((const guchar *) buffer + valid,
+                         len - valid, &subpart);
+        g_string_append_len (out, LM_UTF8_REPLACEMENT,
+                             LM_UTF8_REPLACEMENT_LEN);
+        replaced++;
+
+        buffer += valid + subpart;
+        len -= valid + subpart;
+    }
+
+    return replaced;
+}
+
+/**
+ * _lm_utf8_set_kernel:
+ * @kernel: the implementation to use
+ *
+ * Overrides the implementation picked at runtime. Not thread safe, only
+ * meant for tests and benchmarks.
+ *
+ * Return value: %FALSE if @kernel isn't available on this machine
+ **/
+gboolean
+_lm_utf8_set_kernel (LmUtf8Kernel kernel)
+{
+    utf8_get_kernel ();
+
+    return utf8_select_kernel (kernel);
+}
+
+/**
+ * _lm_utf8_get_kernel_name:
+ *
+ * Return value: the name of the implementation in use
+ **/
+const gchar *
+_lm_utf8_get_kernel_name (void)
+{
+    utf8_get_kernel ();
+
+    return utf8_kernel_name;
+}
@@ -0,0 +1,49 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (C) 2003 Imendio AB
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, see <https://www.gnu.org/licenses>
+ */
+
+#ifndef __LM_UTF8_H__
+#define __LM_UTF8_H__
+
+#include <glib.h>
+
+/* The utf-8 replacement character, U+FFFD */
+#define LM_UTF8_REPLACEMENT "\357\277\275"
+#define LM_UTF8_REPLACEMENT_LEN 3
+
+typedef enum {
+    LM_UTF8_KERNEL_AUTO,
+    LM_UTF8_KERNEL_SCALAR,
+    LM_UTF8_KERNEL_SSE2,
+    LM_UTF8_KERNEL_AVX2,
+    LM_UTF8_KERNEL_NEON
+} LmUtf8Kernel;
+
+gsize         _lm_utf8_validate          (const gchar  *buffer,
+                                          gsize         len);
+gsize         _lm_utf8_sequence_length   (guchar        c);
+gsize         _lm_utf8_incomplete_tail   (const gchar  *buffer,
+                                          gsize         len);
+gsize         _lm_utf8_repair            (const gchar  *buffer,
+                                          gsize         len,
+                                          GString      *out);
+
+/* Only meant for tests and benchmarks */
+gboolean      _lm_utf8_set_kernel        (LmUtf8Kernel  kernel);
+const gchar * _lm_utf8_get_kernel_name   (void);
+
+#endif /* __LM_UTF8_H__ */
@@ -26,9 +26,12 @@
 #include <loudmouth/lm-message.h>
 #include <loudmouth/lm-message-handler.h>
 #include <loudmouth/lm-message-node.h>
+#include <loudmouth/lm-namespace.h>
 #include <loudmouth/lm-proxy.h>
+#include <loudmouth/lm-selector.h>
 #include <loudmouth/lm-utils.h>
 #include <loudmouth/lm-ssl.h>
+#include <loudmouth/lm-template.h>
 
 #undef LM_INSIDE_LOUDMOUTH_H
 
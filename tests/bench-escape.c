@@ -0,0 +1,174 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (C) 2008 Imendio AB
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, see <https://www.gnu.org/licenses>
+ */
+
+/*
+ * Compares escaping values for the wire with the way it used to be done:
+ * g_markup_escape_text() into a new string which is then appended to the
+ * output. Chat-sized values and multi-kilobyte ones, clean and with
+ * markup in them.
+ *
+ * Usage: bench-escape [megabytes per run]
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+
+#include "loudmouth/lm-escape.h"
+
+static const gchar *chat_clean =
+    "Art thou not Romeo, and a Montague? Neither, fair saint, if either "
+    "thee dislike.";
+
+static const gchar *chat_markup =
+    "<3 \"Romeo\" & 'Juliet' -> Act II, Scene II";
+
+static const gchar *text_mixed =
+    "Ch\303\250re Juliette, \320\224\320\276\320\261\321\200\321\213\320\271 "
+    "\320\262\320\265\321\207\320\265\321\200 \344\275\240\345\245\275 "
+    "\360\237\214\271 ";
+
+static gchar *
+make_value (const gchar *piece, gsize size)
+{
+    GString *str;
+
+    str = g_string_sized_new (size + strlen (piece));
+    while (str->len < size) {
+        g_string_append (str, piece);
+    }
+    g_string_truncate (str, size);
+
+    /* Don't end on half a character */
+    while (str->len > 0 && ((guchar) str->str[str->len - 1] & 0x80)) {
+        g_string_truncate (str, str->len - 1);
+    }
+
+    return g_string_free (str, FALSE);
+}
+
+static gdouble
+run_old (const gchar *value, guint count, GString *out)
+{
+    GTimer *timer;
+    guint   i;
+    gdouble elapsed;
+
+    timer = g_timer_new ();
+
+    for (i = 0; i < count; ++i) {
+        gchar *escaped;
+
+        g_string_truncate (out, 0);
+        escaped = g_markup_escape_text (value, -1);
+        g_string_append (out, escaped);
+        g_free (escaped);
+    }
+
+    g_timer_stop (timer);
+    elapsed = g_timer_elapsed (timer, NULL);
+    g_timer_destroy (timer);
+
+    return elapsed;
+}
+
+/* Measured and then written, the way the serializer does it */
+static gdouble
+run_new (const gchar *value, guint count, GString *out)
+{
+    GTimer *timer;
+    gsize   len = strlen (value);
+    guint   i;
+    gdouble elapsed;
+
+    timer = g_timer_new ();
+
+    for (i = 0; i < count; ++i) {
+        g_string_set_size (out, _lm_escape_text (NULL, value, len));
+        _lm_escape_text (out->str, value, len);
+    }
+
+    g_timer_stop (timer);
+    elapsed = g_timer_elapsed (timer, NULL);
+    g_timer_destroy (timer);
+
+    return elapsed;
+}
+
+static void
+bench (const gchar *name, const gchar *value, gsize total)
+{
+    static const LmEscapeKernel kernels[] = {
+        LM_ESCAPE_KERNEL_SCALAR,
+        LM_ESCAPE_KERNEL_SSE2,
+        LM_ESCAPE_KERNEL_AVX2,
+        LM_ESCAPE_KERNEL_NEON
+    };
+    GString *out;
+    gsize    len = strlen (value);
+    guint    count = MAX (1, total / len);
+    gdouble  mb = (gdouble) len * count / (1024.0 * 1024.0);
+    guint    i;
+
+    out = g_string_sized_new (len * 6);
+
+    g_print ("%-14s %6" G_GSIZE_FORMAT " %-8s %10.1f MB/s\n", name, len,
+             "old", mb / run_old (value, count, out));
+
+    for (i = 0; i < G_N_ELEMENTS (kernels); ++i) {
+        if (!_lm_escape_set_kernel (kernels[i])) {
+            continue;
+        }
+
+        g_print ("%-14s %6" G_GSIZE_FORMAT " %-8s %10.1f MB/s\n", name, len,
+                 _lm_escape_get_kernel_name (),
+                 mb / run_new (value, count, out));
+    }
+
+    _lm_escape_set_kernel (LM_ESCAPE_KERNEL_AUTO);
+    g_string_free (out, TRUE);
+}
+
+int
+main (int argc, char **argv)
+{
+    gsize  size = 64;
+    gchar *value;
+
+    if (argc > 1) {
+        size = MAX (1, atoi (argv[1]));
+    }
+    size *= 1024 * 1024;
+
+    bench ("chat-clean", chat_clean, size);
+    bench ("chat-markup", chat_markup, size);
+
+    value = make_value (chat_clean, 4096);
+    bench ("4k-clean", value, size);
+    g_free (value);
+
+    value = make_value (text_mixed, 4096);
+    bench ("4k-utf8", value, size);
+    g_free (value);
+
+    value = make_value (chat_markup, 4096);
+    bench ("4k-markup", value, size);
+    g_free (value);
+
+    return 0;
+}
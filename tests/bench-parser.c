@@ -0,0 +1,564 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (C) 2008 Imendio AB
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, see <https://www.gnu.org/licenses>
+ */
+
+/*
+ * Parser and serializer throughput over synthetic streams of the kinds of
+ * traffic a client sees: chat, presence floods, MUC history, roster
+ * pushes, PubSub events and big base64 payloads. The corpora are built
+ * from a fixed seed so every run parses the same bytes.
+ *
+ * Built twice, as bench-parser with the built-in tokenizer and as
+ * bench-parser-gmarkup with LM_PARSER_USE_GMARKUP. Each corpus is fed
+ * the way the socket does it, with stanzas allocated in an arena, on the
+ * heap and, for the built-in parser, with their children left unparsed.
+ * The stanzas are then serialized again with lm_message_node_to_string(),
+ * and written to and read back from the binary form, which is what
+ * storing stanzas would otherwise parse the XML again for.
+ *
+ * Every measurement is printed as one JSON object per line.
+ *
+ * Usage: bench-parser [megabytes per corpus] [runs] [corpus]
+ */
+
+#include <config.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+
+#include "loudmouth/lm-debug.h"
+#include "loudmouth/lm-parser.h"
+
+#ifdef LM_PARSER_USE_GMARKUP
+#define PARSER_NAME "gmarkup"
+#else
+#define PARSER_NAME "built-in"
+#endif
+
+/* Same as IN_BUFFER_SIZE in lm-old-socket.c */
+#define READ_SIZE 1024
+
+/* Stanzas kept around for serializing */
+#define SERIALIZE_STANZAS 4096
+
+#define CORPUS_SEED 42
+
+typedef void (* StanzaFunction) (GString *str, GRand *rand, guint i);
+
+typedef struct {
+    const gchar    *name;
+    StanzaFunction  function;
+} Corpus;
+
+enum {
+    MODE_ARENA,
+    MODE_HEAP,
+    MODE_LAZY,
+    N_MODES
+};
+
+static const gchar *mode_names[] = { "arena", "heap", "lazy" };
+
+static const gchar *stream_header =
+    "<?xml version='1.0'?>"
+    "<stream:stream from='example.com' id='someid' xmlns='jabber:client' "
+    "xmlns:stream='http://etherx.jabber.org/streams' version='1.0'>";
+
+static const gchar *words[] = {
+    "art", "thou", "not", "Romeo", "and", "a", "Montague", "wherefore",
+    "&amp;", "&lt;3", "O", "swear", "by", "the", "moon", "inconstant",
+    "that", "monthly", "changes", "in", "her", "circled", "orb",
+    "caf\303\251", "\320\277\321\200\320\270\320\262\320\265\321\202",
+    "\344\275\240\345\245\275", "\360\237\214\271"
+};
+
+static const gchar *names[] = {
+    "juliet", "romeo", "mercutio", "benvolio", "tybalt", "nurse",
+    "capulet", "montague", "paris", "escalus", "balthasar", "rosaline"
+};
+
+static void
+append_words (GString *str, GRand *rand, guint min, guint max)
+{
+    guint n, i;
+
+    n = g_rand_int_range (rand, min, max + 1);
+    for (i = 0; i < n; ++i) {
+        if (i > 0) {
+            g_string_append_c (str, ' ');
+        }
+        g_string_append (str, words[g_rand_int_range (rand, 0, G_N_ELEMENTS (words))]);
+    }
+}
+
+static const gchar *
+random_name (GRand *rand)
+{
+    return names[g_rand_int_range (rand, 0, G_N_ELEMENTS (names))];
+}
+
+static void
+chat_stanza (GString *str, GRand *rand, guint i)
+{
+    g_string_append_printf (str,
+                            "<message from='%s@example.com/balcony' "
+                            "to='%s@example.net' type='chat' id='msg%u' "
+                            "xml:lang='en'><body>",
+                            random_name (rand), random_name (rand), i);
+    append_words (str, rand, 1, 30);
+    g_string_append_printf (str,
+                            "</body><thread>%08x</thread>"
+                            "<active xmlns='http://jabber.org/protocol/chatstates'/>"
+                            "</message>",
+                            g_rand_int (rand));
+}
+
+static void
+presence_stanza (GString *str, GRand *rand, guint i)
+{
+    static const gchar *shows[] = { "away", "chat", "dnd", "xa" };
+
+    if (g_rand_int_range (rand, 0, 8) == 0) {
+        g_string_append_printf (str,
+                                "<presence from='%s@example.com/r%u' "
+                                "type='unavailable'/>",
+                                random_name (rand), i % 50);
+        return;
+    }
+
+    g_string_append_printf (str,
+                            "<presence from='%s@example.com/r%u' "
+                            "to='juliet@example.com/balcony'>"
+                            "<show>%s</show><status>",
+                            random_name (rand), i % 50,
+                            shows[g_rand_int_range (rand, 0, G_N_ELEMENTS (shows))]);
+    append_words (str, rand, 0, 6);
+    g_string_append_printf (str,
+                            "</status><priority>%d</priority>"
+                            "<c xmlns='http://jabber.org/protocol/caps' "
+                            "hash='sha-1' node='http://example.org/client' "
+                            "ver='QgayPKawpkPSDYmwT/WM94u%04x='/>"
+                            "</presence>",
+                            g_rand_int_range (rand, -1, 10),
+                            g_rand_int_range (rand, 0, 0x10000));
+}
+
+static void
+muc_history_stanza (GString *str, GRand *rand, guint i)
+{
+    g_string_append_printf (str,
+                            "<message from='coven@chat.example.com/%s' "
+                            "to='juliet@example.com/balcony' type='groupchat' "
+                            "id='hist%u'><body>",
+                            random_name (rand), i);
+    append_words (str, rand, 3, 40);
+    g_string_append_printf (str,
+                            "</body><delay xmlns='urn:xmpp:delay' "
+                            "from='coven@chat.example.com' "
+                            "stamp='2002-10-13T23:%02u:%02uZ'/>"
+                            "<x xmlns='http://jabber.org/protocol/muc#user'>"
+                            "<item affiliation='none' role='participant' "
+                            "jid='%s@example.com/pda'/></x></message>",
+                            (i / 60) % 60, i % 60, random_name (rand));
+}
+
+static void
+roster_stanza (GString *str, GRand *rand, guint i)
+{
+    static const gchar *subscriptions[] = { "none", "to", "from", "both" };
+
+    g_string_append_printf (str,
+                            "<iq type='set' id='push%u' "
+                            "to='juliet@example.com/balcony'>"
+                            "<query xmlns='jabber:iq:roster' ver='ver%u'>"
+                            "<item jid='%s%u@example.net' name='%s' "
+                            "subscription='%s'>",
+                            i, i, random_name (rand), i, random_name (rand),
+                            subscriptions[g_rand_int_range (rand, 0, G_N_ELEMENTS (subscriptions))]);
+    if (g_rand_int_range (rand, 0, 2)) {
+        g_string_append (str, "<group>Friends</group>");
+    }
+    if (g_rand_int_range (rand, 0, 2)) {
+        g_string_append (str, "<group>Verona</group>");
+    }
+    g_string_append (str, "</item></query></iq>");
+}
+
+static void
+pubsub_stanza (GString *str, GRand *rand, guint i)
+{
+    g_string_append_printf (str,
+                            "<message from='pubsub.example.com' "
+                            "to='juliet@example.com' id='ev%u'>"
+                            "<event xmlns='http://jabber.org/protocol/pubsub#event'>"
+                            "<items node='urn:xmpp:microblog:0'>"
+                            "<item id='%08x%08x'>"
+                            "<entry xmlns='http://www.w3.org/2005/Atom'>"
+                            "<title type='text'>",
+                            i, g_rand_int (rand), g_rand_int (rand));
+    append_words (str, rand, 2, 8);
+    g_string_append (str, "</title><content type='text'>");
+    append_words (str, rand, 10, 60);
+    g_string_append_printf (str,
+                            "</content><author><name>%s</name>"
+                            "<uri>xmpp:%s@example.com</uri></author>"
+                            "<published>2008-06-25T%02u:%02u:00Z</published>"
+                            "</entry></item></items></event>"
+                            "<headers xmlns='http://jabber.org/protocol/shim'>"
+                            "<header name='Collection'>microblog</header>"
+                            "</headers></message>",
+                            random_name (rand), random_name (rand),
+                            (i / 60) % 24, i % 60);
+}
+
+/* In-band bytestream data, the way files and avatars come in */
+static void
+base64_stanza (GString *str, GRand *rand, guint i)
+{
+    guchar  data[3072];
+    gchar  *encoded;
+    guint   j;
+
+    for (j = 0; j < sizeof (data); ++j) {
+        data[j] = g_rand_int_range (rand, 0, 256);
+    }
+    encoded = g_base64_encode (data, sizeof (data));
+
+    g_string_append_printf (str,
+                            "<iq from='romeo@example.net/orchard' "
+                            "to='juliet@example.com/balcony' type='set' "
+                            "id='ibb%u'><data xmlns='http://jabber.org/protocol/ibb' "
+                            "seq='%u' sid='i781hf64'>%s</data></iq>",
+                            i, i % 65536, encoded);
+
+    g_free (encoded);
+}
+
+static const Corpus corpora[] = {
+    { "chat",        chat_stanza },
+    { "presence",    presence_stanza },
+    { "muc_history", muc_history_stanza },
+    { "roster",      roster_stanza },
+    { "pubsub",      pubsub_stanza },
+    { "base64",      base64_stanza }
+};
+
+static guint stanza_count;
+
+static void
+count_message_cb (LmParser *parser, LmMessage *message, gpointer user_data)
+{
+    stanza_count++;
+}
+
+static guint
+count_nodes (LmMessageNode *node)
+{
+    LmMessageNode *child;
+    guint          n = 1;
+
+    for (child = lm_message_node_get_children (node); child; child = child->next) {
+        n += count_nodes (child);
+    }
+
+    return n;
+}
+
+static void
+count_nodes_cb (LmParser *parser, LmMessage *message, gpointer user_data)
+{
+    if (lm_message_get_type (message) != LM_MESSAGE_TYPE_STREAM) {
+        *(guint *) user_data += count_nodes (message->node);
+    }
+}
+
+static void
+keep_message_cb (LmParser *parser, LmMessage *message, gpointer user_data)
+{
+    GPtrArray *messages = (GPtrArray *) user_data;
+
+    if (lm_message_get_type (message) != LM_MESSAGE_TYPE_STREAM &&
+        messages->len < SERIALIZE_STANZAS) {
+        g_ptr_array_add (messages, lm_message_ref (message));
+    }
+}
+
+static void
+ignore_log_cb (const gchar    *domain,
+               GLogLevelFlags  level,
+               const gchar    *message,
+               gpointer        user_data)
+{
+}
+
+static gchar *
+make_corpus (const Corpus *corpus, gsize size, guint *n_stanzas)
+{
+    GString *str;
+    GRand   *rand;
+    guint    i = 0;
+
+    str = g_string_sized_new (size + 8192);
+    rand = g_rand_new_with_seed (CORPUS_SEED);
+    g_string_append (str, stream_header);
+
+    while (str->len < size) {
+        corpus->function (str, rand, i++);
+        g_string_append_c (str, '\n');
+    }
+
+    g_rand_free (rand);
+    *n_stanzas = i;
+
+    return g_string_free (str, FALSE);
+}
+
+static void
+feed (LmParser *parser, const gchar *data, gsize len)
+{
+    gsize pos;
+
+    for (pos = 0; pos < len; pos += READ_SIZE) {
+        if (!lm_parser_parse_len (parser, data + pos,
+                                  MIN (READ_SIZE, len - pos))) {
+            g_error ("Parsing failed at offset %" G_GSIZE_FORMAT, pos);
+        }
+    }
+}
+
+static gdouble
+run_parse (const gchar *data, gsize len, guint mode)
+{
+    LmParser *parser;
+    GTimer   *timer;
+    gdouble   elapsed;
+
+    parser = lm_parser_new (count_message_cb, NULL, NULL);
+    _lm_parser_set_use_arena (parser, mode != MODE_HEAP);
+    _lm_parser_set_lazy (parser, mode == MODE_LAZY);
+    stanza_count = 0;
+
+    timer = g_timer_new ();
+    feed (parser, data, len);
+    g_timer_stop (timer);
+
+    elapsed = g_timer_elapsed (timer, NULL);
+    g_timer_destroy (timer);
+    lm_parser_free (parser);
+
+    return elapsed;
+}
+
+static gdouble
+run_serialize (GPtrArray *messages, gsize *bytes)
+{
+    GTimer  *timer;
+    gdouble  elapsed;
+    guint    i;
+
+    *bytes = 0;
+
+    timer = g_timer_new ();
+    for (i = 0; i < messages->len; ++i) {
+        gchar *str;
+
+        str = lm_message_node_to_string (((LmMessage *) messages->pdata[i])->node);
+        *bytes += strlen (str);
+        g_free (str);
+    }
+    g_timer_stop (timer);
+
+    elapsed = g_timer_elapsed (timer, NULL);
+    g_timer_destroy (timer);
+
+    return elapsed;
+}
+
+static gdouble
+run_to_binary (GPtrArray *messages, GPtrArray *blobs, gsize *bytes)
+{
+    GTimer  *timer;
+    gdouble  elapsed;
+    guint    i;
+
+    *bytes = 0;
+    g_ptr_array_set_size (blobs, 0);
+
+    timer = g_timer_new ();
+    for (i = 0; i < messages->len; ++i) {
+        GBytes *blob;
+
+        blob = lm_message_node_to_binary (((LmMessage *) messages->pdata[i])->node);
+        *bytes += g_bytes_get_size (blob);
+        g_ptr_array_add (blobs, blob);
+    }
+    g_timer_stop (timer);
+
+    elapsed = g_timer_elapsed (timer, NULL);
+    g_timer_destroy (timer);
+
+    return elapsed;
+}
+
+static gdouble
+run_from_binary (GPtrArray *blobs)
+{
+    GTimer  *timer;
+    gdouble  elapsed;
+    guint    i;
+
+    timer = g_timer_new ();
+    for (i = 0; i < blobs->len; ++i) {
+        LmMessageNode *node;
+
+        node = lm_message_node_new_from_binary (blobs->pdata[i], NULL);
+        g_assert (node != NULL);
+        lm_message_node_unref (node);
+    }
+    g_timer_stop (timer);
+
+    elapsed = g_timer_elapsed (timer, NULL);
+    g_timer_destroy (timer);
+
+    return elapsed;
+}
+
+static void
+print_result (const gchar *bench,
+              const gchar *corpus,
+              const gchar *mode,
+              gsize        bytes,
+              guint        stanzas,
+              gdouble      seconds,
+              gdouble      nodes_per_stanza)
+{
+    g_print ("{\"bench\": \"%s\", \"parser\": \"%s\", \"corpus\": \"%s\", "
+             "\"mode\": \"%s\", \"bytes\": %" G_GSIZE_FORMAT ", "
+             "\"stanzas\": %u, \"seconds\": %.6f, \"mb_per_s\": %.1f, "
+             "\"stanzas_per_s\": %.0f",
+             bench, PARSER_NAME, corpus, mode, bytes, stanzas, seconds,
+             bytes / (1024.0 * 1024.0) / seconds, stanzas / seconds);
+
+    if (nodes_per_stanza > 0) {
+        g_print (", \"nodes_per_stanza\": %.2f", nodes_per_stanza);
+    }
+
+    g_print ("}\n");
+}
+
+static void
+bench_corpus (const Corpus *corpus, gsize size, guint runs)
+{
+    LmParser  *parser;
+    GPtrArray *messages;
+    GPtrArray *blobs;
+    gchar     *data;
+    gsize      len, bytes = 0;
+    guint      n_stanzas, n_nodes = 0, mode, i;
+    gdouble    best;
+
+    data = make_corpus (corpus, size, &n_stanzas);
+    len = strlen (data);
+
+    parser = lm_parser_new (count_nodes_cb, &n_nodes, NULL);
+    feed (parser, data, len);
+    lm_parser_free (parser);
+
+    for (mode = 0; mode < N_MODES; ++mode) {
+#ifdef LM_PARSER_USE_GMARKUP
+        if (mode == MODE_LAZY) {
+            continue;
+        }
+#endif
+        best = G_MAXDOUBLE;
+        for (i = 0; i < runs; ++i) {
+            best = MIN (best, run_parse (data, len, mode));
+        }
+
+        /* The stream header comes out as a message too */
+        g_assert (stanza_count == n_stanzas + 1);
+
+        print_result ("parse", corpus->name, mode_names[mode], len,
+                      n_stanzas, best, (gdouble) n_nodes / n_stanzas);
+    }
+
+    messages = g_ptr_array_new_with_free_func ((GDestroyNotify) lm_message_unref);
+    parser = lm_parser_new (keep_message_cb, messages, NULL);
+    feed (parser, data, len);
+    lm_parser_free (parser);
+
+    best = G_MAXDOUBLE;
+    for (i = 0; i < runs; ++i) {
+        best = MIN (best, run_serialize (messages, &bytes));
+    }
+
+    print_result ("serialize", corpus->name, mode_names[MODE_ARENA], bytes,
+                  messages->len, best, 0);
+
+    blobs = g_ptr_array_new_with_free_func ((GDestroyNotify) g_bytes_unref);
+
+    best = G_MAXDOUBLE;
+    for (i = 0; i < runs; ++i) {
+        best = MIN (best, run_to_binary (messages, blobs, &bytes));
+    }
+
+    print_result ("to-binary", corpus->name, "binary", bytes,
+                  messages->len, best, 0);
+
+    best = G_MAXDOUBLE;
+    for (i = 0; i < runs; ++i) {
+        best = MIN (best, run_from_binary (blobs));
+    }
+
+    print_result ("from-binary", corpus->name, "binary", bytes,
+                  messages->len, best, 0);
+
+    g_ptr_array_free (blobs, TRUE);
+    g_ptr_array_free (messages, TRUE);
+    g_free (data);
+}
+
+int
+main (int argc, char **argv)
+{
+    const gchar *only = NULL;
+    gsize        size = 8;
+    guint        runs = 5, i;
+
+    if (argc > 1) {
+        size = MAX (1, atoi (argv[1]));
+    }
+    if (argc > 2) {
+        runs = MAX (1, atoi (argv[2]));
+    }
+    if (argc > 3) {
+        only = argv[3];
+    }
+
+    /* Parser debug output would dominate the numbers */
+    g_log_set_handler (LM_LOG_DOMAIN, LM_LOG_LEVEL_ALL, ignore_log_cb, NULL);
+
+    for (i = 0; i < G_N_ELEMENTS (corpora); ++i) {
+        if (only && strcmp (only, corpora[i].name) != 0) {
+            continue;
+        }
+
+        bench_corpus (&corpora[i], size * 1024 * 1024, runs);
+    }
+
+    return 0;
+}
@@ -0,0 +1,158 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (C) 2008 Imendio AB
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, see <https://www.gnu.org/licenses>
+ */
+
+/*
+ * Stanzas sent from worker threads, through the send queue and the way
+ * it had to be done before: a g_main_context_invoke() for each one. The
+ * main thread stands in for the connection and only counts the bytes it
+ * gets.
+ *
+ * Usage: bench-send-queue [thousands of stanzas per thread]
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+
+#include "loudmouth/lm-send-queue.h"
+
+static const gchar *stanza =
+    "<message to='romeo@example.net' type='chat' id='m1'>"
+    "<body>Wherefore art thou?</body></message>";
+
+typedef struct {
+    GMainContext *context;
+    LmSendQueue  *queue;
+    guint         n_stanzas;
+    gsize         received;
+} Bench;
+
+static void
+count_cb (LmSendQueue *queue, const gchar *buf, gsize len, gpointer user_data)
+{
+    ((Bench *) user_data)->received += len;
+}
+
+static gpointer
+queue_thread (gpointer user_data)
+{
+    Bench *bench = user_data;
+    gsize  len = strlen (stanza);
+    guint  i;
+
+    for (i = 0; i < bench->n_stanzas; ++i) {
+        lm_send_queue_push (bench->queue, stanza, len);
+    }
+
+    return NULL;
+}
+
+typedef struct {
+    Bench *bench;
+    gchar *str;
+} Invoke;
+
+static gboolean
+invoke_cb (gpointer user_data)
+{
+    Invoke *invoke = user_data;
+
+    invoke->bench->received += strlen (invoke->str);
+    g_free (invoke->str);
+    g_slice_free (Invoke, invoke);
+
+    return FALSE;
+}
+
+static gpointer
+invoke_thread (gpointer user_data)
+{
+    Bench *bench = user_data;
+    guint  i;
+
+    for (i = 0; i < bench->n_stanzas; ++i) {
+        Invoke *invoke = g_slice_new (Invoke);
+
+        invoke->bench = bench;
+        invoke->str = g_strdup (stanza);
+        g_main_context_invoke (bench->context, invoke_cb, invoke);
+    }
+
+    return NULL;
+}
+
+static void
+run (const gchar *name, GThreadFunc func, guint n_threads, guint n_stanzas)
+{
+    Bench     bench;
+    GThread **threads;
+    GTimer   *timer;
+    gsize     total = strlen (stanza) * n_stanzas * n_threads;
+    gdouble   elapsed;
+    guint     i;
+
+    bench.context = g_main_context_new ();
+    bench.queue = lm_send_queue_new (bench.context, count_cb, &bench);
+    bench.n_stanzas = n_stanzas;
+    bench.received = 0;
+
+    threads = g_new (GThread *, n_threads);
+    timer = g_timer_new ();
+
+    for (i = 0; i < n_threads; ++i) {
+        threads[i] = g_thread_new (name, func, &bench);
+    }
+
+    while (bench.received < total) {
+        g_main_context_iteration (bench.context, TRUE);
+    }
+
+    g_timer_stop (timer);
+    elapsed = g_timer_elapsed (timer, NULL);
+
+    for (i = 0; i < n_threads; ++i) {
+        g_thread_join (threads[i]);
+    }
+
+    g_print ("%-8s %2u threads %10.0f stanzas/s\n", name, n_threads,
+             n_stanzas * n_threads / elapsed);
+
+    g_timer_destroy (timer);
+    g_free (threads);
+    lm_send_queue_free (bench.queue);
+    g_main_context_unref (bench.context);
+}
+
+int
+main (int argc, char **argv)
+{
+    guint n_stanzas = 200;
+    guint n_threads;
+
+    if (argc > 1) {
+        n_stanzas = MAX (1, atoi (argv[1]));
+    }
+    n_stanzas *= 1000;
+
+    for (n_threads = 1; n_threads <= 8; n_threads *= 2) {
+        run ("queue", queue_thread, n_threads, n_stanzas);
+        run ("invoke", invoke_thread, n_threads, n_stanzas);
+    }
+
+    return 0;
+}
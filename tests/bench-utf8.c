@@ -0,0 +1,236 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (C) 2008 Imendio AB
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, see <https://www.gnu.org/licenses>
+ */
+
+/*
+ * Compares the utf-8 check done on every read from the socket with the
+ * way it used to be done: g_utf8_validate() followed by a copy of the
+ * whole buffer.
+ *
+ * Usage: bench-utf8 [megabytes per run]
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+
+#include "loudmouth/lm-utf8.h"
+
+/* Same as IN_BUFFER_SIZE in lm-old-socket.c */
+#define READ_SIZE 1024
+
+static const gchar *stanza_ascii =
+    "<message from='juliet@example.com/balcony' to='romeo@example.net' "
+    "type='chat' id='ktx72v49'><body>Art thou not Romeo, and a Montague?"
+    "</body><thread>e0ffe42b28561960c6b12b944a092794b9683a38</thread>"
+    "</message>";
+
+static const gchar *stanza_mixed =
+    "<message from='juliet@example.com/balcony' to='romeo@example.net' "
+    "type='chat' id='ktx72v49'><body>Ch\303\250re Juliette, "
+    "\320\224\320\276\320\261\321\200\321\213\320\271 "
+    "\320\262\320\265\321\207\320\265\321\200 "
+    "\344\275\240\345\245\275\344\270\226\347\225\214 "
+    "\360\237\214\271\360\237\214\271</body></message>";
+
+/* The way lm_parser_parse() used to make the input valid */
+static gchar *
+old_make_valid (const gchar *buffer, gchar **incomplete)
+{
+    GString     *string;
+    const gchar *remainder, *invalid;
+    gint         remaining_bytes, valid_bytes;
+    gunichar     code;
+
+    string = NULL;
+    remainder = buffer;
+    remaining_bytes = strlen (buffer);
+
+    while (remaining_bytes != 0) {
+        if (g_utf8_validate (remainder, remaining_bytes, &invalid)) {
+            break;
+        }
+        valid_bytes = invalid - remainder;
+
+        if (string == NULL) {
+            string = g_string_sized_new (remaining_bytes);
+        }
+
+        g_string_append_len (string, remainder, valid_bytes);
+
+        remainder = g_utf8_find_next_char (invalid, NULL);
+        remaining_bytes -= valid_bytes + (remainder - invalid);
+
+        code = g_utf8_get_char_validated (invalid, -1);
+
+        if (code == (gunichar) -1) {
+            g_string_append (string, "\357\277\275");
+        } else if (code == (gunichar) -2) {
+            *incomplete = g_strdup (invalid);
+        }
+    }
+
+    if (string == NULL) {
+        return g_strdup (buffer);
+    }
+
+    g_string_append (string, remainder);
+
+    return g_string_free (string, FALSE);
+}
+
+static gchar *
+make_corpus (const gchar *stanza, gsize size, gboolean corrupt)
+{
+    GString *str;
+    GRand   *rand;
+
+    str = g_string_sized_new (size + strlen (stanza));
+    rand = g_rand_new_with_seed (42);
+
+    while (str->len < size) {
+        gsize start = str->len;
+
+        g_string_append (str, stanza);
+        if (corrupt) {
+            /* A stray byte in every stanza, never a nul */
+            str->str[start + g_rand_int_range (rand, 0, strlen (stanza))] =
+                (gchar) g_rand_int_range (rand, 0x80, 0x100);
+        }
+    }
+
+    g_rand_free (rand);
+
+    return g_string_free (str, FALSE);
+}
+
+static gdouble
+run_old (const gchar *corpus, gsize len)
+{
+    GTimer *timer;
+    gchar   chunk[READ_SIZE + 1];
+    gsize   pos;
+    gdouble elapsed;
+
+    timer = g_timer_new ();
+
+    for (pos = 0; pos < len; pos += READ_SIZE) {
+        gsize  n = MIN (READ_SIZE, len - pos);
+        gchar *incomplete = NULL;
+        gchar *valid;
+
+        memcpy (chunk, corpus + pos, n);
+        chunk[n] = '\0';
+
+        valid = old_make_valid (chunk, &incomplete);
+        g_free (valid);
+        g_free (incomplete);
+    }
+
+    g_timer_stop (timer);
+    elapsed = g_timer_elapsed (timer, NULL);
+    g_timer_destroy (timer);
+
+    return elapsed;
+}
+
+static gdouble
+run_new (const gchar *corpus, gsize len)
+{
+    GTimer  *timer;
+    GString *repaired;
+    gsize    pos;
+    gdouble  elapsed;
+
+    repaired = g_string_sized_new (READ_SIZE * 2);
+    timer = g_timer_new ();
+
+    for (pos = 0; pos < len; pos += READ_SIZE) {
+        const gchar *chunk = corpus + pos;
+        gsize        n = MIN (READ_SIZE, len - pos);
+        gsize        tail;
+
+        if (_lm_utf8_validate (chunk, n) == n) {
+            continue;
+        }
+
+        tail = _lm_utf8_incomplete_tail (chunk, n);
+        g_string_truncate (repaired, 0);
+        _lm_utf8_repair (chunk, n - tail, repaired);
+    }
+
+    g_timer_stop (timer);
+    elapsed = g_timer_elapsed (timer, NULL);
+    g_timer_destroy (timer);
+    g_string_free (repaired, TRUE);
+
+    return elapsed;
+}
+
+static void
+bench (const gchar *name, const gchar *corpus, gsize len)
+{
+    static const LmUtf8Kernel kernels[] = {
+        LM_UTF8_KERNEL_SCALAR,
+        LM_UTF8_KERNEL_SSE2,
+        LM_UTF8_KERNEL_AVX2,
+        LM_UTF8_KERNEL_NEON
+    };
+    gdouble mb = len / (1024.0 * 1024.0);
+    guint   i;
+
+    g_print ("%-10s %-8s %10.1f MB/s\n", name, "old",
+             mb / run_old (corpus, len));
+
+    for (i = 0; i < G_N_ELEMENTS (kernels); ++i) {
+        if (!_lm_utf8_set_kernel (kernels[i])) {
+            continue;
+        }
+
+        g_print ("%-10s %-8s %10.1f MB/s\n", name,
+                 _lm_utf8_get_kernel_name (),
+                 mb / run_new (corpus, len));
+    }
+
+    _lm_utf8_set_kernel (LM_UTF8_KERNEL_AUTO);
+}
+
+int
+main (int argc, char **argv)
+{
+    gsize  size = 64;
+    gchar *corpus;
+
+    if (argc > 1) {
+        size = MAX (1, atoi (argv[1]));
+    }
+    size *= 1024 * 1024;
+
+    corpus = make_corpus (stanza_ascii, size, FALSE);
+    bench ("ascii", corpus, strlen (corpus));
+    g_free (corpus);
+
+    corpus = make_corpus (stanza_mixed, size, FALSE);
+    bench ("mixed", corpus, strlen (corpus));
+    g_free (corpus);
+
+    corpus = make_corpus (stanza_mixed, size, TRUE);
+    bench ("corrupted", corpus, strlen (corpus));
+    g_free (corpus);
+
+    return 0;
+}
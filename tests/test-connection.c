@@ -0,0 +1,330 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (C) 2008 Imendio AB
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, see <https://www.gnu.org/licenses>
+ */
+
+/*
+ * Backpressure on the incoming queue. Stanzas are fed to the connection
+ * as if they had been read from its socket, which it doesn't have, and
+ * handled one at a time as if the queue's source had dispatched them.
+ */
+
+#include <config.h>
+#include <string.h>
+#include <glib.h>
+
+#include "loudmouth/lm-internals.h"
+
+/* Length of each stanza fed, which is what it's charged in the queue */
+#define STANZA_LEN 18
+
+typedef struct {
+    LmConnection *connection;
+    /* 'p' for each pause reported, 'r' for each resume */
+    GString      *events;
+    guint         n_fed;
+    guint         n_handled;
+} BackpressureTest;
+
+static void
+backpressure_cb (LmConnection *connection, gboolean paused, gpointer user_data)
+{
+    BackpressureTest *test = user_data;
+
+    g_assert (connection == test->connection);
+    g_assert (_lm_connection_get_reading_paused (connection) == paused);
+
+    g_string_append_c (test->events, paused ? 'p' : 'r');
+}
+
+static LmHandlerResult
+handle_message_cb (LmMessageHandler *handler,
+                   LmConnection     *connection,
+                   LmMessage        *m,
+                   gpointer          user_data)
+{
+    BackpressureTest *test = user_data;
+    gchar             id[8];
+
+    /* Handled in the order they were fed */
+    g_snprintf (id, sizeof (id), "%02u", test->n_handled);
+    g_assert_cmpstr (lm_message_get_id (m), ==, id);
+    test->n_handled++;
+
+    return LM_HANDLER_RESULT_REMOVE_MESSAGE;
+}
+
+static void
+backpressure_setup (BackpressureTest *test)
+{
+    LmMessageHandler *handler;
+
+    test->connection = lm_connection_new (NULL);
+    test->events = g_string_new (NULL);
+    test->n_fed = 0;
+    test->n_handled = 0;
+
+    lm_connection_set_backpressure_function (test->connection,
+                                             backpressure_cb, test, NULL);
+
+    handler = lm_message_handler_new (handle_message_cb, test, NULL);
+    lm_connection_register_message_handler (test->connection, handler,
+                                            LM_MESSAGE_TYPE_MESSAGE,
+                                            LM_HANDLER_PRIORITY_NORMAL);
+    lm_message_handler_unref (handler);
+}
+
+static void
+backpressure_teardown (BackpressureTest *test)
+{
+    lm_connection_unref (test->connection);
+    g_string_free (test->events, TRUE);
+}
+
+/* Each stanza comes in a read of its own */
+static void
+feed (BackpressureTest *test, guint n)
+{
+    for (; n > 0; --n) {
+        gchar buf[STANZA_LEN + 1];
+
+        g_snprintf (buf, sizeof (buf), "<message id='%02u'/>", test->n_fed++);
+        g_assert_cmpuint (strlen (buf), ==, STANZA_LEN);
+        _lm_connection_incoming_data (test->connection, buf, STANZA_LEN);
+    }
+}
+
+static void
+handle (BackpressureTest *test, guint n)
+{
+    guint expected = test->n_handled + n;
+
+    for (; n > 0; --n) {
+        _lm_connection_handle_next (test->connection);
+    }
+
+    g_assert_cmpuint (test->n_handled, ==, expected);
+}
+
+static void
+assert_state (BackpressureTest *test, const gchar *events, gboolean paused)
+{
+    g_assert_cmpstr (test->events->str, ==, events);
+    g_assert (_lm_connection_get_reading_paused (test->connection) == paused);
+}
+
+static void
+test_messages ()
+{
+    BackpressureTest test;
+
+    backpressure_setup (&test);
+    lm_connection_set_queue_limits (test.connection, 4, 2, 0, 0);
+
+    feed (&test, 3);
+    assert_state (&test, "", FALSE);
+
+    feed (&test, 1);
+    assert_state (&test, "p", TRUE);
+
+    /* Whatever was read already still gets queued */
+    feed (&test, 2);
+    assert_state (&test, "p", TRUE);
+
+    /* Under the high mark isn't enough */
+    handle (&test, 3);
+    assert_state (&test, "p", TRUE);
+
+    handle (&test, 1);
+    assert_state (&test, "pr", FALSE);
+
+    feed (&test, 1);
+    assert_state (&test, "pr", FALSE);
+
+    feed (&test, 1);
+    assert_state (&test, "prp", TRUE);
+
+    /* New limits are applied straight away */
+    lm_connection_set_queue_limits (test.connection, 10, 5, 0, 0);
+    assert_state (&test, "prpr", FALSE);
+
+    lm_connection_set_queue_limits (test.connection, 0, 0, 0, 0);
+    feed (&test, 20);
+    handle (&test, 24);
+    assert_state (&test, "prpr", FALSE);
+
+    backpressure_teardown (&test);
+}
+
+static void
+test_bytes ()
+{
+    BackpressureTest test;
+
+    backpressure_setup (&test);
+    lm_connection_set_queue_limits (test.connection, 0, 0,
+                                    5 * STANZA_LEN, 2 * STANZA_LEN);
+
+    feed (&test, 4);
+    assert_state (&test, "", FALSE);
+
+    feed (&test, 1);
+    assert_state (&test, "p", TRUE);
+
+    handle (&test, 2);
+    assert_state (&test, "p", TRUE);
+
+    handle (&test, 1);
+    assert_state (&test, "pr", FALSE);
+
+    handle (&test, 2);
+    assert_state (&test, "pr", FALSE);
+
+    backpressure_teardown (&test);
+}
+
+/* Either high mark pauses, resuming takes both low ones */
+static void
+test_both ()
+{
+    BackpressureTest test;
+
+    backpressure_setup (&test);
+    lm_connection_set_queue_limits (test.connection, 4, 2,
+                                    3 * STANZA_LEN, 1 * STANZA_LEN);
+
+    /* The bytes go over first */
+    feed (&test, 3);
+    assert_state (&test, "p", TRUE);
+
+    feed (&test, 1);
+    assert_state (&test, "p", TRUE);
+
+    /* Down to the low mark for messages, not for bytes */
+    handle (&test, 2);
+    assert_state (&test, "p", TRUE);
+
+    handle (&test, 1);
+    assert_state (&test, "pr", FALSE);
+
+    handle (&test, 1);
+    assert_state (&test, "pr", FALSE);
+
+    /* Then the messages do */
+    lm_connection_set_queue_limits (test.connection, 2, 1,
+                                    100 * STANZA_LEN, 50 * STANZA_LEN);
+    feed (&test, 1);
+    assert_state (&test, "pr", FALSE);
+
+    feed (&test, 1);
+    assert_state (&test, "prp", TRUE);
+
+    handle (&test, 1);
+    assert_state (&test, "prpr", FALSE);
+
+    handle (&test, 1);
+    assert_state (&test, "prpr", FALSE);
+
+    backpressure_teardown (&test);
+}
+
+/* Waiting for a reply keeps reading whatever the queue holds */
+static void
+test_blocking ()
+{
+    BackpressureTest test;
+
+    backpressure_setup (&test);
+    lm_connection_set_queue_limits (test.connection, 2, 1, 0, 0);
+
+    feed (&test, 2);
+    assert_state (&test, "p", TRUE);
+
+    _lm_connection_set_blocking (test.connection, TRUE);
+    assert_state (&test, "pr", FALSE);
+
+    feed (&test, 3);
+    assert_state (&test, "pr", FALSE);
+
+    /* The queue is still over the high mark afterwards */
+    _lm_connection_set_blocking (test.connection, FALSE);
+    assert_state (&test, "prp", TRUE);
+
+    handle (&test, 3);
+    assert_state (&test, "prp", TRUE);
+
+    handle (&test, 1);
+    assert_state (&test, "prpr", FALSE);
+
+    /* Nothing to do if it isn't over it */
+    _lm_connection_set_blocking (test.connection, TRUE);
+    _lm_connection_set_blocking (test.connection, FALSE);
+    assert_state (&test, "prpr", FALSE);
+
+    handle (&test, 1);
+    assert_state (&test, "prpr", FALSE);
+
+    backpressure_teardown (&test);
+}
+
+/* A wait started while another one is going on doesn't end it */
+static void
+test_nested_blocking ()
+{
+    BackpressureTest test;
+
+    backpressure_setup (&test);
+    lm_connection_set_queue_limits (test.connection, 2, 1, 0, 0);
+
+    _lm_connection_set_blocking (test.connection, TRUE);
+    _lm_connection_set_blocking (test.connection, TRUE);
+
+    feed (&test, 3);
+    assert_state (&test, "", FALSE);
+
+    /* The inner one is done, the outer one still needs its reply */
+    _lm_connection_set_blocking (test.connection, FALSE);
+    assert_state (&test, "", FALSE);
+
+    feed (&test, 1);
+    assert_state (&test, "", FALSE);
+
+    _lm_connection_set_blocking (test.connection, FALSE);
+    assert_state (&test, "p", TRUE);
+
+    handle (&test, 3);
+    assert_state (&test, "pr", FALSE);
+
+    handle (&test, 1);
+    assert_state (&test, "pr", FALSE);
+
+    backpressure_teardown (&test);
+}
+
+int
+main (int argc, char **argv)
+{
+    g_test_init (&argc, &argv, NULL);
+
+    g_test_add_func ("/connection/backpressure/messages", test_messages);
+    g_test_add_func ("/connection/backpressure/bytes", test_bytes);
+    g_test_add_func ("/connection/backpressure/both", test_both);
+    g_test_add_func ("/connection/backpressure/blocking", test_blocking);
+    g_test_add_func ("/connection/backpressure/blocking/nested",
+                     test_nested_blocking);
+
+    return g_test_run ();
+}
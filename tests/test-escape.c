@@ -0,0 +1,176 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (C) 2008 Imendio AB
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, see <https://www.gnu.org/licenses>
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+
+#include "loudmouth/lm-escape.h"
+
+static const LmEscapeKernel kernels[] = {
+    LM_ESCAPE_KERNEL_SCALAR,
+    LM_ESCAPE_KERNEL_SSE2,
+    LM_ESCAPE_KERNEL_AVX2,
+    LM_ESCAPE_KERNEL_NEON
+};
+
+static const struct {
+    const gchar *input;
+    const gchar *output;
+} escape_cases[] = {
+    { "", "" },
+    { "plain", "plain" },
+    { "a < b & c > d", "a &lt; b &amp; c &gt; d" },
+    { "'quoted' \"too\"", "&apos;quoted&apos; &quot;too&quot;" },
+    { "tab\tline\ncr\r", "tab\tline\ncr\r" },
+    { "\001\037\177", "&#x1;&#x1f;&#x7f;" },
+    /* C1 controls but NEL, other characters starting with 0xc2 stay */
+    { "\302\200\302\205\302\237\302\240\302\251", "&#x80;\302\205&#x9f;\302\240\302\251" },
+    { "caf\303\251 \360\237\214\271", "caf\303\251 \360\237\214\271" },
+    { "<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<",
+      "&lt;&lt;&lt;&lt;&lt;&lt;&lt;&lt;&lt;&lt;&lt;&lt;&lt;&lt;&lt;&lt;&lt;"
+      "&lt;&lt;&lt;&lt;&lt;&lt;&lt;&lt;&lt;&lt;&lt;&lt;&lt;&lt;&lt;&lt;&lt;" }
+};
+
+static gchar *
+escape (const gchar *str, gsize len)
+{
+    gchar *out;
+    gsize  n;
+
+    n = _lm_escape_text (NULL, str, len);
+    out = g_malloc (n + 1);
+    g_assert_cmpuint (_lm_escape_text (out, str, len), ==, n);
+    out[n] = '\0';
+
+    return out;
+}
+
+static void
+test_escape_cases (void)
+{
+    guint i, k;
+
+    for (k = 0; k < G_N_ELEMENTS (kernels); ++k) {
+        if (!_lm_escape_set_kernel (kernels[k])) {
+            continue;
+        }
+
+        for (i = 0; i < G_N_ELEMENTS (escape_cases); ++i) {
+            const gchar *input = escape_cases[i].input;
+            gchar       *output;
+
+            output = escape (input, strlen (input));
+            g_assert_cmpstr (output, ==, escape_cases[i].output);
+            g_free (output);
+        }
+    }
+
+    _lm_escape_set_kernel (LM_ESCAPE_KERNEL_AUTO);
+}
+
+/* Mostly clean text with everything that needs escaping sprinkled in */
+static gchar *
+random_text (GRand *rand, gsize len)
+{
+    static const gchar *chars[] = {
+        "a", " ", "\n", "\303\251", "\320\226", "\360\237\230\200",
+        "\302\240", "&", "<", ">", "'", "\"", "\001", "\t", "\177",
+        "\302\205", "\302\201"
+    };
+    GString *str;
+
+    str = g_string_sized_new (len + 4);
+    while (str->len < len) {
+        if (g_rand_int_range (rand, 0, 8) == 0) {
+            g_string_append (str, chars[g_rand_int_range (rand, 2, G_N_ELEMENTS (chars))]);
+        } else {
+            g_string_append (str, chars[g_rand_int_range (rand, 0, 2)]);
+        }
+    }
+
+    return g_string_free (str, FALSE);
+}
+
+/* Checks every kernel against g_markup_escape_text(), at every offset
+ * into the vector blocks.
+ */
+static void
+test_escape_random (void)
+{
+    GRand *rand;
+    guint  k, round;
+
+    rand = g_rand_new_with_seed (4711);
+
+    for (round = 0; round < 200; ++round) {
+        gchar *text;
+        gsize  len, offset;
+
+        len = g_rand_int_range (rand, 1, 300);
+        text = random_text (rand, len);
+        len = strlen (text);
+
+        for (offset = 0; offset < MIN (len, 33); ++offset) {
+            gchar *expected;
+
+            expected = g_markup_escape_text (text + offset, -1);
+
+            for (k = 0; k < G_N_ELEMENTS (kernels); ++k) {
+                gchar *output;
+
+                if (!_lm_escape_set_kernel (kernels[k])) {
+                    continue;
+                }
+
+                output = escape (text + offset, len - offset);
+                g_assert_cmpstr (output, ==, expected);
+                g_free (output);
+            }
+
+            g_free (expected);
+        }
+
+        g_free (text);
+    }
+
+    g_rand_free (rand);
+    _lm_escape_set_kernel (LM_ESCAPE_KERNEL_AUTO);
+}
+
+/* A character split by the end of the input is left as it is */
+static void
+test_escape_cut (void)
+{
+    gchar out[8];
+
+    g_assert_cmpuint (_lm_escape_text (out, "a\302\200", 2), ==, 2);
+    g_assert (memcmp (out, "a\302", 2) == 0);
+}
+
+int
+main (int argc, char **argv)
+{
+    g_test_init (&argc, &argv, NULL);
+
+    g_test_add_func ("/escape/cases", test_escape_cases);
+    g_test_add_func ("/escape/random", test_escape_random);
+    g_test_add_func ("/escape/cut", test_escape_cut);
+
+    return g_test_run ();
+}
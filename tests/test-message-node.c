@@ -0,0 +1,1115 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (C) 2008 Imendio AB
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, see <https://www.gnu.org/licenses>
+ */
+
+#include <config.h>
+#include <string.h>
+#include <glib.h>
+
+#include "loudmouth/lm-error.h"
+#include "loudmouth/lm-internals.h"
+#include "loudmouth/lm-parser.h"
+
+static const gchar *lazy_stanzas[] = {
+    "<message from='juliet@example.com' type='chat'>"
+    "<body>Hi &amp; bye</body>"
+    "<x xmlns:foo='urn:foo'><foo:bar a='1'/>text</x></message>",
+
+    "<iq type='result' xmlns:p='urn:p'>"
+    "<p:query><item jid='a@b'/><item jid='c@d'/></p:query></iq>",
+
+    "<presence>before<show>away</show>after</presence>"
+};
+
+static const gchar *outer_ns_stanza =
+    "<stream:stream xmlns:stream='http://etherx.jabber.org/streams' xmlns:x='urn:x'>"
+    "<message id='1'><x:foo a='1'><x:bar/></x:foo></message>";
+
+static void
+test_atom_lookup ()
+{
+    gchar *copy;
+
+    copy = g_strdup ("message");
+    g_assert (_lm_atom_lookup (copy) == LM_ATOM (MESSAGE));
+    g_assert (_lm_atom_lookup (LM_ATOM (XMLNS)) == LM_ATOM (XMLNS));
+    g_assert (!_lm_atom_is_atom (copy));
+    g_free (copy);
+
+    g_assert (_lm_atom_lookup ("jabber:iq:roster") == LM_ATOM (NS_ROSTER));
+    g_assert (_lm_atom_lookup ("not-an-atom") == NULL);
+    g_assert (_lm_atom_lookup (NULL) == NULL);
+
+    /* Pointers into the middle of an atom are looked up like any string */
+    g_assert (!_lm_atom_is_atom (LM_ATOM (STREAM_FEATURES) + 7));
+    g_assert_cmpint (_lm_atom_id (LM_ATOM (STREAM_FEATURES) + 7), ==,
+                     _lm_atom_id ("features"));
+    g_assert (!_lm_atom_is_atom (LM_ATOM (NS_ROSTER) + 1));
+    g_assert_cmpint (_lm_atom_id (LM_ATOM (NS_ROSTER) + 1), ==, LM_ATOM_ID_NONE);
+}
+
+/* The generated hash table has to find every atom, even when it isn't
+ * handed the atom itself.
+ */
+static void
+test_atom_all ()
+{
+#define CHECK_ATOM(id, str)                                             \
+    {                                                                   \
+        gchar *copy = g_strdup (str);                                   \
+        g_assert (_lm_atom_lookup (copy) == LM_ATOM (id));              \
+        g_assert_cmpint (_lm_atom_id (copy), ==, LM_ATOM_ID_##id);      \
+        g_assert_cmpint (_lm_atom_id (LM_ATOM (id)), ==, LM_ATOM_ID_##id); \
+        g_assert (_lm_atom_from_id (LM_ATOM_ID_##id) == LM_ATOM (id));  \
+        g_free (copy);                                                  \
+    }
+
+    LM_ATOM_LIST (CHECK_ATOM)
+
+#undef CHECK_ATOM
+
+    g_assert_cmpint (_lm_atom_id ("messages"), ==, LM_ATOM_ID_NONE);
+    g_assert_cmpint (_lm_atom_id (""), ==, LM_ATOM_ID_NONE);
+    g_assert_cmpint (_lm_atom_id (NULL), ==, LM_ATOM_ID_NONE);
+    g_assert (_lm_atom_from_id (LM_ATOM_ID_NONE) == NULL);
+}
+
+static void
+test_namespaces ()
+{
+    LmMessageNode *node;
+
+    g_assert_cmpint (lm_namespace_from_string ("jabber:iq:roster"), ==,
+                     LM_NAMESPACE_ROSTER);
+    g_assert_cmpint (lm_namespace_from_string ("urn:xmpp:sid:0"), ==,
+                     LM_NAMESPACE_STANZA_ID);
+    g_assert_cmpint (lm_namespace_from_string ("JABBER:IQ:ROSTER"), ==,
+                     LM_NAMESPACE_UNKNOWN);
+    /* Atoms that aren't namespaces */
+    g_assert_cmpint (lm_namespace_from_string ("message"), ==,
+                     LM_NAMESPACE_UNKNOWN);
+    g_assert_cmpint (lm_namespace_from_string (NULL), ==, LM_NAMESPACE_UNKNOWN);
+
+    g_assert_cmpstr (lm_namespace_to_string (LM_NAMESPACE_BIND), ==,
+                     "urn:ietf:params:xml:ns:xmpp-bind");
+    g_assert (lm_namespace_to_string (LM_NAMESPACE_UNKNOWN) == NULL);
+    g_assert_cmpint (lm_namespace_from_string (lm_namespace_to_string (LM_NAMESPACE_SASL)),
+                     ==, LM_NAMESPACE_SASL);
+
+    node = _lm_message_node_new ("query");
+    g_assert_cmpint (lm_message_node_get_namespace (node), ==, LM_NAMESPACE_UNKNOWN);
+    lm_message_node_set_attribute (node, "xmlns", "jabber:iq:version");
+    g_assert_cmpint (lm_message_node_get_namespace (node), ==, LM_NAMESPACE_VERSION);
+    lm_message_node_set_attribute (node, "xmlns", "urn:example:unknown");
+    g_assert_cmpint (lm_message_node_get_namespace (node), ==, LM_NAMESPACE_UNKNOWN);
+    lm_message_node_unref (node);
+}
+
+static void
+test_interned_names ()
+{
+    LmMessageNode *node;
+    LmMessageNode *child;
+    gchar         *name;
+
+    node = _lm_message_node_new ("message");
+    g_assert (node->name == LM_ATOM (MESSAGE));
+
+    lm_message_node_set_attributes (node,
+                                    "type", "chat",
+                                    "xmlns", "jabber:client",
+                                    "id", "abc123",
+                                    "custom", "value",
+                                    NULL);
+
+    g_assert_cmpstr (lm_message_node_get_attribute (node, "custom"), ==, "value");
+    g_assert (lm_message_node_get_attribute (node, "type") == LM_ATOM (CHAT));
+    g_assert (lm_message_node_get_attribute (node, "xmlns") == LM_ATOM (NS_CLIENT));
+    g_assert_cmpstr (lm_message_node_get_attribute (node, "id"), ==, "abc123");
+    g_assert (lm_message_node_get_attribute (node, "to") == NULL);
+
+    /* Names built at runtime find the same attributes */
+    name = g_strdup ("type");
+    g_assert (lm_message_node_get_attribute (node, name) == LM_ATOM (CHAT));
+    g_free (name);
+
+    lm_message_node_set_attribute (node, "type", "groupchat");
+    g_assert (lm_message_node_get_attribute (node, "type") == LM_ATOM (GROUPCHAT));
+    lm_message_node_set_attribute (node, "type", "something-else");
+    g_assert_cmpstr (lm_message_node_get_attribute (node, "type"), ==, "something-else");
+
+    child = lm_message_node_add_child (node, "body", "hello");
+    lm_message_node_add_child (child, "custom", NULL);
+    g_assert (child->name == LM_ATOM (BODY));
+    g_assert (lm_message_node_get_child (node, "body") == child);
+    g_assert (lm_message_node_get_child (node, "custom") == NULL);
+    g_assert (lm_message_node_find_child (node, "custom") == child->children);
+
+    lm_message_node_unref (node);
+}
+
+static void
+test_arena_nodes ()
+{
+    LmArena       *arena;
+    LmMessageNode *node;
+    LmMessageNode *child;
+
+    arena = _lm_arena_new (0);
+
+    node = _lm_message_node_new_in_arena (arena, "iq", 1);
+    g_assert (node->name == LM_ATOM (IQ));
+    _lm_message_node_set_arena_attribute (node, "from", "juliet@example.com");
+
+    child = _lm_message_node_new_in_arena (arena, "custom-element", 0);
+    _lm_message_node_add_child_node (node, child);
+    _lm_message_node_append_arena_value (child, "text and more", 4);
+    g_assert_cmpstr (child->value, ==, "text");
+
+    /* Changes go to the heap */
+    lm_message_node_set_value (child, "replaced");
+    lm_message_node_set_attribute (node, "from", "romeo@example.net");
+    lm_message_node_set_attribute (node, "to", "juliet@example.com");
+    lm_message_node_unref (child);
+
+    g_assert_cmpstr (lm_message_node_get_value (child), ==, "replaced");
+    g_assert_cmpstr (lm_message_node_get_attribute (node, "from"),
+                     ==, "romeo@example.net");
+
+    /* Every node holds on to the arena */
+    _lm_arena_unref (arena);
+
+    lm_message_node_ref (child);
+    lm_message_node_unref (node);
+    g_assert_cmpstr (child->name, ==, "custom-element");
+    lm_message_node_unref (child);
+}
+
+static void
+test_children ()
+{
+    LmMessageNode *node;
+    LmMessageNode *child;
+    LmMessageNode *extra;
+    guint          i;
+
+    node = _lm_message_node_new ("query");
+    g_assert_cmpuint (lm_message_node_get_n_children (node), ==, 0);
+
+    for (i = 0; i < 10000; ++i) {
+        gchar jid[32];
+
+        g_snprintf (jid, sizeof (jid), "user%u@example.com", i);
+        child = lm_message_node_add_child (node, "item", NULL);
+        lm_message_node_set_attribute (child, "jid", jid);
+    }
+
+    g_assert_cmpuint (lm_message_node_get_n_children (node), ==, 10000);
+
+    for (i = 0, child = node->children; child; child = child->next, ++i) {
+        gchar jid[32];
+
+        g_snprintf (jid, sizeof (jid), "user%u@example.com", i);
+        g_assert_cmpstr (lm_message_node_get_attribute (child, "jid"), ==, jid);
+        g_assert (child->parent == node);
+    }
+    g_assert_cmpuint (i, ==, 10000);
+
+    /* Children linked in by hand still count */
+    for (child = node->children; child->next; child = child->next);
+    extra = _lm_message_node_new ("item");
+    extra->parent = node;
+    extra->prev = child;
+    child->next = extra;
+
+    g_assert_cmpuint (lm_message_node_get_n_children (node), ==, 10001);
+    child = lm_message_node_add_child (node, "last", NULL);
+    g_assert (extra->next == child);
+    g_assert_cmpuint (lm_message_node_get_n_children (node), ==, 10002);
+
+    lm_message_node_unref (node);
+}
+
+static void
+parsed_node_cb (LmParser *parser, LmMessage *m, gpointer user_data)
+{
+    if (lm_message_get_type (m) != LM_MESSAGE_TYPE_STREAM) {
+        *(LmMessageNode **) user_data = lm_message_node_ref (m->node);
+    }
+}
+
+/* Attributes stay in document order, however many there are */
+static void
+test_attributes ()
+{
+    LmMessageNode          *node;
+    LmMessageNodeAttribute *a;
+    LmParser               *parser;
+    gchar                  *str;
+    guint                   i;
+    const gchar            *stanza =
+        "<message a0='0' a1='1' a2='2' a3='3' a4='4' a5='5' a6='6' a7='7' "
+        "a8='8' a9='9' a10='10'><body x='1' y='2'>hi</body></message>";
+    const gchar            *expected =
+        "<message a0=\"0\" a1=\"1\" a2=\"2\" a3=\"3\" a4=\"4\" "
+        "a5=\"5\" a6=\"6\" a7=\"7\" a8=\"8\" a9=\"9\" a10=\"10\">"
+        "<body x=\"1\" y=\"2\">hi</body></message>";
+
+    node = _lm_message_node_new ("message");
+    for (i = 0; i < 11; ++i) {
+        gchar name[8], value[8];
+
+        g_snprintf (name, sizeof (name), "a%u", i);
+        g_snprintf (value, sizeof (value), "%u", i);
+        lm_message_node_set_attribute (node, name, value);
+    }
+    lm_message_node_set_attribute (node, "a3", "3");
+    lm_message_node_add_child (node, "body", "hi");
+    lm_message_node_set_attributes (node->children, "x", "1", "y", "2", NULL);
+
+    str = lm_message_node_to_string (node);
+    g_assert_cmpstr (str, ==, expected);
+    g_free (str);
+    lm_message_node_unref (node);
+
+    for (i = 0; i < 2; ++i) {
+        node = NULL;
+        parser = lm_parser_new (parsed_node_cb, &node, NULL);
+        _lm_parser_set_use_arena (parser, i == 0);
+        g_assert (lm_parser_parse (parser, stanza));
+        lm_parser_free (parser);
+
+        g_assert (node != NULL);
+        for (a = node->attributes; a->next; a = a->next);
+        g_assert_cmpstr (a->name, ==, "a10");
+
+        lm_message_node_set_attribute (node, "a10", "ten");
+        lm_message_node_set_attribute (node, "new", "yes");
+        g_assert_cmpstr (a->value, ==, "ten");
+        g_assert_cmpstr (a->next->name, ==, "new");
+
+        lm_message_node_unref (node);
+    }
+}
+
+/* However the text of a node is split, it adds up to the same value */
+static void
+test_append_value ()
+{
+    LmArena       *arena;
+    LmMessageNode *nodes[2];
+    GString       *expected;
+    guint          i, j;
+
+    arena = _lm_arena_new (0);
+    nodes[0] = _lm_message_node_new_in_arena (arena, "data", 0);
+    nodes[1] = _lm_message_node_new ("data");
+    expected = g_string_new (NULL);
+
+    for (i = 0; i < 1000; ++i) {
+        gchar piece[16];
+
+        g_snprintf (piece, sizeof (piece), "%u,", i);
+        g_string_append (expected, piece);
+
+        for (j = 0; j < G_N_ELEMENTS (nodes); ++j) {
+            _lm_message_node_append_arena_value (nodes[j], piece,
+                                                 strlen (piece));
+        }
+
+        /* Keeps the value from always being the last thing allocated */
+        if (i % 7 == 0) {
+            _lm_arena_strdup (arena, "in the way");
+        }
+    }
+
+    for (j = 0; j < G_N_ELEMENTS (nodes); ++j) {
+        g_assert_cmpstr (lm_message_node_get_value (nodes[j]), ==,
+                         expected->str);
+
+        lm_message_node_set_value (nodes[j], "a");
+        _lm_message_node_append_arena_value (nodes[j], "bc", 2);
+        g_assert_cmpstr (lm_message_node_get_value (nodes[j]), ==, "abc");
+
+        lm_message_node_unref (nodes[j]);
+    }
+
+    g_string_free (expected, TRUE);
+    _lm_arena_unref (arena);
+}
+
+static void
+test_to_string ()
+{
+    LmMessageNode *node;
+    LmMessageNode *child;
+    GString       *out;
+    gchar         *str;
+    gchar         *escaped;
+    const gchar   *text = "<&>'\" tab\there \x01\x1f\x7f \xc2\x85\xc2\x9f \xc2\xa0 caf\xc3\xa9";
+
+    node = _lm_message_node_new ("message");
+    lm_message_node_set_attribute (node, "id", "x&y");
+    child = lm_message_node_add_child (node, "body", text);
+    lm_message_node_add_child (child, "empty", NULL);
+    child = lm_message_node_add_child (node, "x", NULL);
+    lm_message_node_set_attribute (child, "xmlns", "jabber:x:data");
+    child = lm_message_node_add_child (child, "raw", "<b>bold</b>");
+    lm_message_node_set_raw_mode (child, TRUE);
+    lm_message_node_add_child (node, "last", "1");
+
+    escaped = g_markup_escape_text (text, -1);
+    str = g_strdup_printf ("<message id=\"x&amp;y\">"
+                           "<body>%s<empty></empty></body>"
+                           "<x xmlns=\"jabber:x:data\"><raw><b>bold</b></raw></x>"
+                           "<last>1</last></message>", escaped);
+    g_free (escaped);
+
+    out = g_string_new ("prefix");
+    g_assert_cmpuint (_lm_message_node_write (node, out, TRUE, TRUE), ==,
+                      strlen (str));
+    g_assert_cmpstr (out->str + strlen ("prefix"), ==, str);
+    g_free (str);
+
+    str = lm_message_node_to_string (node);
+    g_assert_cmpstr (str, ==, out->str + strlen ("prefix"));
+    g_free (str);
+    lm_message_node_unref (node);
+
+    /* What the connection sends to open a stream */
+    node = _lm_message_node_new ("stream:stream");
+    lm_message_node_set_attribute (node, "to", "example.com");
+    g_string_truncate (out, 0);
+    _lm_message_node_write (node, out, FALSE, TRUE);
+    g_assert_cmpstr (out->str, ==, "<stream:stream to=\"example.com\">");
+    lm_message_node_unref (node);
+
+    g_string_free (out, TRUE);
+}
+
+/* The serializer walks the tree without recursing */
+static void
+test_to_string_deep ()
+{
+    LmMessageNode *root;
+    LmMessageNode *node;
+    GString       *expected;
+    gchar         *str;
+    guint          i;
+
+    root = node = _lm_message_node_new ("a");
+    expected = g_string_new ("<a>");
+
+    for (i = 0; i < 10000; ++i) {
+        node = lm_message_node_add_child (node, "a", NULL);
+        g_string_append (expected, "<a>");
+    }
+    for (i = 0; i <= 10000; ++i) {
+        g_string_append (expected, "</a>");
+    }
+
+    str = lm_message_node_to_string (root);
+    g_assert_cmpstr (str, ==, expected->str);
+
+    g_free (str);
+    g_string_free (expected, TRUE);
+    lm_message_node_unref (root);
+}
+
+static void
+assert_node_string (LmMessageNode *node, const gchar *expected)
+{
+    gchar *str;
+
+    str = lm_message_node_to_string (node);
+    g_assert_cmpstr (str, ==, expected);
+    g_free (str);
+}
+
+static void
+test_wire_cache ()
+{
+    LmMessageNode *node;
+    LmMessageNode *body;
+    LmMessageNode *x;
+    GString       *out;
+    gchar         *value;
+
+    node = _lm_message_node_new ("message");
+    lm_message_node_set_attributes (node, "to", "a@example.com",
+                                    "type", "chat", NULL);
+    body = lm_message_node_add_child (node, "body", "hi & bye");
+    x = lm_message_node_add_child (node, "x", NULL);
+    lm_message_node_add_child (x, "item", "1");
+
+    g_assert (!lm_message_node_get_wire_cache (node));
+    lm_message_node_set_wire_cache (node, TRUE);
+    g_assert (lm_message_node_get_wire_cache (node));
+
+    assert_node_string (node, "<message to=\"a@example.com\" type=\"chat\">"
+                        "<body>hi &amp; bye</body><x><item>1</item></x></message>");
+
+    /* A different recipient only writes out the root again */
+    lm_message_node_set_attribute (node, "to", "b@example.com");
+    assert_node_string (node, "<message to=\"b@example.com\" type=\"chat\">"
+                        "<body>hi &amp; bye</body><x><item>1</item></x></message>");
+
+    /* Changes below the root are seen through all the parents */
+    lm_message_node_set_value (x->children, "2");
+    assert_node_string (node, "<message to=\"b@example.com\" type=\"chat\">"
+                        "<body>hi &amp; bye</body><x><item>2</item></x></message>");
+
+    lm_message_node_add_child (x, "item", "3");
+    lm_message_node_set_raw_mode (body, TRUE);
+    assert_node_string (node, "<message to=\"b@example.com\" type=\"chat\">"
+                        "<body>hi & bye</body><x><item>2</item><item>3</item></x>"
+                        "</message>");
+
+    /* Without the functions nothing notices, the cached XML goes out */
+    value = body->value;
+    body->value = g_strdup ("changed");
+    assert_node_string (node, "<message to=\"b@example.com\" type=\"chat\">"
+                        "<body>hi & bye</body><x><item>2</item><item>3</item></x>"
+                        "</message>");
+
+    /* Nodes that didn't change are copied from the XML of the root */
+    lm_message_node_set_value (x->children, "4");
+    assert_node_string (node, "<message to=\"b@example.com\" type=\"chat\">"
+                        "<body>hi & bye</body><x><item>4</item><item>3</item></x>"
+                        "</message>");
+    lm_message_node_set_value (x->children, "2");
+
+    lm_message_node_set_wire_cache (node, FALSE);
+    assert_node_string (node, "<message to=\"b@example.com\" type=\"chat\">"
+                        "<body>changed</body><x><item>2</item><item>3</item></x>"
+                        "</message>");
+    g_free (body->value);
+    body->value = value;
+
+    /* A stream start leaves the root open, its children are still cached */
+    lm_message_node_set_wire_cache (node, TRUE);
+    assert_node_string (node, "<message to=\"b@example.com\" type=\"chat\">"
+                        "<body>hi & bye</body><x><item>2</item><item>3</item></x>"
+                        "</message>");
+    out = g_string_new (NULL);
+    _lm_message_node_write (node, out, FALSE, TRUE);
+    g_assert_cmpstr (out->str, ==, "<message to=\"b@example.com\" type=\"chat\">"
+                     "<body>hi & bye</body><x><item>2</item><item>3</item></x>");
+    g_string_free (out, TRUE);
+
+    /* Writing from other threads leaves the cache as it is */
+    lm_message_node_set_wire_cache (node, FALSE);
+    lm_message_node_set_wire_cache (node, TRUE);
+    out = g_string_new (NULL);
+    _lm_message_node_write (node, out, TRUE, FALSE);
+    g_string_free (out, TRUE);
+
+    value = body->value;
+    body->value = g_strdup ("changed");
+    assert_node_string (node, "<message to=\"b@example.com\" type=\"chat\">"
+                        "<body>changed</body><x><item>2</item><item>3</item></x>"
+                        "</message>");
+    g_free (body->value);
+    body->value = value;
+
+    lm_message_node_unref (node);
+}
+
+static void
+test_copy ()
+{
+    LmMessage     *m;
+    LmMessage     *copy;
+    LmMessage     *copy2;
+    LmMessageNode *items;
+    LmMessageNode *node;
+    const gchar   *original_xml;
+    gchar         *str;
+
+    original_xml = "<message to=\"a@example.com\" type=\"chat\"><body>hi</body>"
+        "<event><items><item id=\"1\">one</item></items></event></message>";
+
+    node = _lm_message_node_new ("message");
+    lm_message_node_set_attributes (node, "to", "a@example.com",
+                                    "type", "chat", NULL);
+    m = _lm_message_new_from_node (node);
+    lm_message_node_unref (node);
+
+    lm_message_node_add_child (m->node, "body", "hi");
+    items = lm_message_node_add_child (m->node, "event", NULL);
+    items = lm_message_node_add_child (items, "items", NULL);
+    node = lm_message_node_add_child (items, "item", "one");
+    lm_message_node_set_attribute (node, "id", "1");
+
+    copy = lm_message_copy (m);
+    g_assert_cmpint (lm_message_get_type (copy), ==, LM_MESSAGE_TYPE_MESSAGE);
+    g_assert_cmpint (lm_message_get_sub_type (copy), ==, LM_MESSAGE_SUB_TYPE_CHAT);
+
+    /* Only the root is copied until somebody looks further */
+    g_assert (copy->node->children == NULL);
+    assert_node_string (copy->node, original_xml);
+
+    /* Changing the copy leaves the original alone */
+    lm_message_node_set_attribute (copy->node, "to", "b@example.com");
+    node = lm_message_node_find_child (copy->node, "item");
+    lm_message_node_set_value (node, "uno");
+    assert_node_string (m->node, original_xml);
+    assert_node_string (copy->node,
+                        "<message to=\"b@example.com\" type=\"chat\"><body>hi</body>"
+                        "<event><items><item id=\"1\">uno</item></items></event></message>");
+
+    /* And the other way around, while the copy still shares the children */
+    copy2 = lm_message_copy (m);
+    lm_message_node_add_child (items, "item", "two");
+    node = lm_message_node_get_child (m->node, "body");
+    lm_message_node_set_value (node, "bye");
+    assert_node_string (copy2->node, original_xml);
+    assert_node_string (m->node,
+                        "<message to=\"a@example.com\" type=\"chat\"><body>bye</body>"
+                        "<event><items><item id=\"1\">one</item><item>two</item>"
+                        "</items></event></message>");
+
+    /* Copies of copies, which outlive the message they came from */
+    lm_message_unref (m);
+    lm_message_unref (copy);
+    copy = lm_message_copy (copy2);
+    lm_message_unref (copy2);
+    assert_node_string (copy->node, original_xml);
+    g_assert_cmpuint (lm_message_node_get_n_children (copy->node), ==, 2);
+
+    str = lm_message_node_to_string (lm_message_node_find_child (copy->node, "items"));
+    g_assert_cmpstr (str, ==, "<items><item id=\"1\">one</item></items>");
+    g_free (str);
+
+    lm_message_unref (copy);
+}
+
+static void
+collect_messages_cb (LmParser *parser, LmMessage *m, gpointer user_data)
+{
+    g_ptr_array_add ((GPtrArray *) user_data, lm_message_ref (m));
+}
+
+static GPtrArray *
+parse_messages_in_chunks (const gchar *data, gboolean lazy, gsize chunk_size)
+{
+    LmParser  *parser;
+    GPtrArray *messages;
+    gsize      len, i;
+
+    messages = g_ptr_array_new_with_free_func ((GDestroyNotify) lm_message_unref);
+    parser = lm_parser_new (collect_messages_cb, messages, NULL);
+    _lm_parser_set_lazy (parser, lazy);
+
+    len = strlen (data);
+    for (i = 0; i < len; i += chunk_size) {
+        g_assert (lm_parser_parse_len (parser, data + i,
+                                       MIN (chunk_size, len - i)));
+    }
+    lm_parser_free (parser);
+
+    return messages;
+}
+
+static GPtrArray *
+parse_messages (const gchar *data, gboolean lazy)
+{
+    return parse_messages_in_chunks (data, lazy, strlen (data));
+}
+
+static void
+test_lazy_verbatim ()
+{
+    GPtrArray *messages;
+    LmMessage *copy;
+    gchar     *str, *expected;
+    guint      i;
+
+    for (i = 0; i < G_N_ELEMENTS (lazy_stanzas); ++i) {
+        LmMessageNode *node;
+
+        messages = parse_messages (lazy_stanzas[i], TRUE);
+        g_assert_cmpuint (messages->len, ==, 1);
+
+        node = ((LmMessage *) messages->pdata[0])->node;
+        g_assert (node->children == NULL);
+
+        /* Everything after the start tag comes out untouched */
+        str = lm_message_node_to_string (node);
+        g_assert (g_str_has_suffix (str, strchr (lazy_stanzas[i], '>') + 1));
+        g_assert (node->children == NULL);
+        g_free (str);
+
+        g_ptr_array_free (messages, TRUE);
+    }
+
+    /* Prefixes declared on the stream would be lost, so those are built */
+    messages = parse_messages (outer_ns_stanza, FALSE);
+    expected = lm_message_node_to_string (((LmMessage *) messages->pdata[1])->node);
+    g_assert (strstr (expected, "x:") == NULL);
+    g_ptr_array_free (messages, TRUE);
+
+    messages = parse_messages (outer_ns_stanza, TRUE);
+    g_assert_cmpuint (messages->len, ==, 2);
+    str = lm_message_node_to_string (((LmMessage *) messages->pdata[1])->node);
+    g_assert_cmpstr (str, ==, expected);
+    g_free (str);
+    g_ptr_array_free (messages, TRUE);
+
+    messages = parse_messages (outer_ns_stanza, TRUE);
+    copy = lm_message_copy (messages->pdata[1]);
+    str = lm_message_node_to_string (copy->node);
+    g_assert_cmpstr (str, ==, expected);
+    g_free (str);
+    lm_message_unref (copy);
+    g_ptr_array_free (messages, TRUE);
+
+    g_free (expected);
+}
+
+static gchar *
+messages_to_string (GPtrArray *messages)
+{
+    GString *str;
+    guint    i;
+
+    str = g_string_new (NULL);
+    for (i = 0; i < messages->len; ++i) {
+        gchar *s = lm_message_node_to_string (((LmMessage *) messages->pdata[i])->node);
+
+        g_string_append (str, s);
+        g_free (s);
+    }
+
+    return g_string_free (str, FALSE);
+}
+
+/* Stanzas split across reads are kept and built the same way */
+static void
+test_lazy_chunked ()
+{
+    GPtrArray *messages;
+    GString   *all;
+    gchar     *verbatim, *expected;
+    gsize      chunk_size;
+    guint      i;
+
+    all = g_string_new (NULL);
+    for (i = 0; i < G_N_ELEMENTS (lazy_stanzas); ++i) {
+        g_string_append (all, lazy_stanzas[i]);
+    }
+
+    messages = parse_messages (all->str, TRUE);
+    verbatim = messages_to_string (messages);
+    g_ptr_array_free (messages, TRUE);
+
+    messages = parse_messages (all->str, FALSE);
+    expected = messages_to_string (messages);
+    g_ptr_array_free (messages, TRUE);
+
+    for (chunk_size = 1; chunk_size < 20; ++chunk_size) {
+        gchar *str;
+
+        messages = parse_messages_in_chunks (all->str, TRUE, chunk_size);
+        g_assert_cmpuint (messages->len, ==, G_N_ELEMENTS (lazy_stanzas));
+
+        str = messages_to_string (messages);
+        g_assert_cmpstr (str, ==, verbatim);
+        g_free (str);
+
+        for (i = 0; i < messages->len; ++i) {
+            lm_message_node_get_children (((LmMessage *) messages->pdata[i])->node);
+        }
+
+        str = messages_to_string (messages);
+        g_assert_cmpstr (str, ==, expected);
+        g_free (str);
+
+        g_ptr_array_free (messages, TRUE);
+    }
+
+    g_free (verbatim);
+    g_free (expected);
+    g_string_free (all, TRUE);
+}
+
+/* Once looked at, a lazy stanza is the same as one parsed right away */
+static void
+test_lazy_materialize ()
+{
+    guint i;
+
+    for (i = 0; i < G_N_ELEMENTS (lazy_stanzas); ++i) {
+        GPtrArray     *eager, *lazy;
+        LmMessageNode *eager_node, *lazy_node;
+        gchar         *eager_str, *lazy_str;
+
+        eager = parse_messages (lazy_stanzas[i], FALSE);
+        lazy = parse_messages (lazy_stanzas[i], TRUE);
+
+        eager_node = ((LmMessage *) eager->pdata[0])->node;
+        lazy_node = ((LmMessage *) lazy->pdata[0])->node;
+
+        g_assert_cmpstr (lm_message_node_get_value (lazy_node),
+                         ==, lm_message_node_get_value (eager_node));
+        g_assert (lm_message_node_get_children (lazy_node) != NULL);
+
+        eager_str = lm_message_node_to_string (eager_node);
+        lazy_str = lm_message_node_to_string (lazy_node);
+        g_assert_cmpstr (lazy_str, ==, eager_str);
+        g_free (eager_str);
+        g_free (lazy_str);
+
+        g_ptr_array_free (eager, TRUE);
+        g_ptr_array_free (lazy, TRUE);
+    }
+}
+
+static void
+test_lazy_access ()
+{
+    GPtrArray     *messages;
+    LmMessageNode *node;
+    LmMessageNode *child;
+
+    messages = parse_messages (lazy_stanzas[0], TRUE);
+    node = ((LmMessage *) messages->pdata[0])->node;
+
+    g_assert_cmpstr (lm_message_node_get_attribute (node, "type"), ==, "chat");
+    g_assert (node->children == NULL);
+
+    child = lm_message_node_find_child (node, "bar");
+    g_assert (child != NULL);
+    g_assert_cmpstr (lm_message_node_get_attribute (child, "xmlns"), ==, "urn:foo");
+    g_assert_cmpstr (lm_message_node_get_value (lm_message_node_get_child (node, "body")),
+                     ==, "Hi & bye");
+
+    /* Stays valid without the message */
+    lm_message_node_ref (child);
+    g_ptr_array_free (messages, TRUE);
+    g_assert_cmpstr (lm_message_node_get_attribute (child, "a"), ==, "1");
+    lm_message_node_unref (child);
+
+    /* Changing it means it can't go out verbatim any more */
+    messages = parse_messages (lazy_stanzas[2], TRUE);
+    node = ((LmMessage *) messages->pdata[0])->node;
+    lm_message_node_add_child (node, "priority", "5");
+    g_assert (lm_message_node_get_child (node, "show") != NULL);
+    g_assert (lm_message_node_get_child (node, "priority") != NULL);
+    g_ptr_array_free (messages, TRUE);
+
+    /* The stream level isn't lazy, the connection looks at it */
+    messages = parse_messages ("<stream:stream xmlns:stream='http://etherx.jabber.org/streams'>"
+                               "<stream:features><bind/></stream:features>", TRUE);
+    g_assert_cmpuint (messages->len, ==, 2);
+    node = ((LmMessage *) messages->pdata[1])->node;
+    g_assert (node->children != NULL);
+    g_ptr_array_free (messages, TRUE);
+}
+
+/* Relaying an incoming stanza doesn't need its children parsed */
+static void
+test_lazy_copy ()
+{
+    GPtrArray     *messages;
+    LmMessage     *copy;
+    LmMessageNode *node;
+
+    messages = parse_messages (lazy_stanzas[0], TRUE);
+    node = ((LmMessage *) messages->pdata[0])->node;
+
+    copy = lm_message_copy (messages->pdata[0]);
+    lm_message_node_set_attribute (copy->node, "to", "b@example.com");
+    g_assert (node->children == NULL);
+
+    g_ptr_array_free (messages, TRUE);
+
+    node = lm_message_node_get_child (copy->node, "body");
+    g_assert_cmpstr (lm_message_node_get_value (node), ==, "Hi & bye");
+    g_assert_cmpstr (lm_message_node_get_attribute (copy->node, "to"), ==,
+                     "b@example.com");
+
+    lm_message_unref (copy);
+}
+
+static const gchar *binary_stanzas[] = {
+    "<message to='romeo@example.net' type='chat' xmlns='jabber:client'>"
+    "<body>a &lt; b &amp; &quot;c&quot;</body>"
+    "<html xmlns='http://jabber.org/protocol/xhtml-im'><p>x<br/>y</p></html>"
+    "</message>",
+
+    "<iq type='result' id='r1'><query xmlns='jabber:iq:roster'>"
+    "<item jid='a@b' name='\303\251'/><item jid='c@d'><group>G</group></item>"
+    "</query></iq>",
+
+    "<presence/>"
+};
+
+static LmMessageNode *
+binary_round_trip (LmMessageNode *node)
+{
+    LmMessageNode *copy;
+    GBytes        *bytes;
+    GError        *error = NULL;
+
+    bytes = lm_message_node_to_binary (node);
+    copy = lm_message_node_new_from_binary (bytes, &error);
+    g_assert (error == NULL);
+    g_assert (copy != NULL);
+    g_bytes_unref (bytes);
+
+    return copy;
+}
+
+/* A lazily parsed stanza comes out as if it had been parsed in full */
+static void
+test_binary_round_trip ()
+{
+    guint i, lazy;
+
+    for (i = 0; i < G_N_ELEMENTS (binary_stanzas); ++i) {
+        GPtrArray *messages;
+        gchar     *expected;
+
+        messages = parse_messages (binary_stanzas[i], FALSE);
+        expected = lm_message_node_to_string (((LmMessage *) messages->pdata[0])->node);
+        g_ptr_array_free (messages, TRUE);
+
+        for (lazy = 0; lazy < 2; ++lazy) {
+            LmMessageNode *copy;
+            gchar         *str;
+
+            messages = parse_messages (binary_stanzas[i], lazy);
+            copy = binary_round_trip (((LmMessage *) messages->pdata[0])->node);
+            g_ptr_array_free (messages, TRUE);
+
+            str = lm_message_node_to_string (copy);
+            g_assert_cmpstr (str, ==, expected);
+            g_free (str);
+
+            /* Names and namespaces are atoms like when parsed */
+            g_assert (_lm_atom_is_atom (copy->name));
+
+            lm_message_node_unref (copy);
+        }
+
+        g_free (expected);
+    }
+}
+
+/* Nodes read back can be changed like any others */
+static void
+test_binary_changes ()
+{
+    LmMessageNode *node;
+    LmMessageNode *copy;
+    LmMessageNode *child;
+    gchar         *str;
+
+    node = _lm_message_node_new ("message");
+    lm_message_node_set_attributes (node, "to", "juliet@example.com",
+                                    "type", "chat", NULL);
+    child = lm_message_node_add_child (node, "body", "Hi");
+    lm_message_node_add_child (node, "raw", "<b>bold</b>");
+    lm_message_node_set_raw_mode (lm_message_node_get_child (node, "raw"), TRUE);
+
+    copy = binary_round_trip (node);
+    lm_message_node_unref (node);
+
+    g_assert (lm_message_node_get_attribute (copy, "type") == LM_ATOM (CHAT));
+    g_assert (lm_message_node_get_raw_mode (lm_message_node_get_child (copy, "raw")));
+
+    child = lm_message_node_get_child (copy, "body");
+    _lm_message_node_append_arena_value (child, " there", 6);
+    lm_message_node_set_attribute (copy, "to", "romeo@example.net");
+    lm_message_node_add_child (copy, "thread", "t1");
+
+    str = lm_message_node_to_string (copy);
+    g_assert_cmpstr (str, ==,
+                     "<message to=\"romeo@example.net\" type=\"chat\">"
+                     "<body>Hi there</body><raw><b>bold</b></raw>"
+                     "<thread>t1</thread></message>");
+    g_free (str);
+
+    lm_message_node_unref (copy);
+}
+
+static void
+test_binary_message ()
+{
+    GPtrArray *messages;
+    LmMessage *m;
+    GBytes    *bytes;
+    GError    *error = NULL;
+
+    messages = parse_messages (binary_stanzas[1], FALSE);
+    bytes = lm_message_node_to_binary (((LmMessage *) messages->pdata[0])->node);
+    g_ptr_array_free (messages, TRUE);
+
+    m = lm_message_new_from_binary (bytes, &error);
+    g_assert (error == NULL);
+    g_assert_cmpint (lm_message_get_type (m), ==, LM_MESSAGE_TYPE_IQ);
+    g_assert_cmpint (lm_message_get_sub_type (m), ==, LM_MESSAGE_SUB_TYPE_RESULT);
+    lm_message_unref (m);
+    g_bytes_unref (bytes);
+}
+
+static void
+test_message_routing ()
+{
+    GPtrArray *messages;
+    LmMessage *m;
+    LmMessage *copy;
+
+    messages = parse_messages ("<iq from='juliet@example.com/balcony' "
+                               "type='result' id='r1' to='romeo@example.net'>"
+                               "<query xmlns='jabber:iq:roster'/></iq>"
+                               "<presence><show>away</show></presence>", FALSE);
+
+    m = messages->pdata[0];
+    g_assert_cmpstr (lm_message_get_id (m), ==, "r1");
+    g_assert_cmpstr (lm_message_get_from (m), ==, "juliet@example.com/balcony");
+    g_assert_cmpstr (lm_message_get_to (m), ==, "romeo@example.net");
+    g_assert_cmpstr (lm_message_get_type_attribute (m), ==, "result");
+    g_assert_cmpuint (_lm_message_get_id_hash (m), ==, g_str_hash ("r1"));
+    g_assert (lm_message_get_id (m) ==
+              lm_message_node_get_attribute (m->node, "id"));
+
+    /* Changes to the node show through */
+    lm_message_node_set_attribute (m->node, "to", "nurse@example.com");
+    g_assert_cmpstr (lm_message_get_to (m), ==, "nurse@example.com");
+
+    copy = lm_message_copy (m);
+    g_assert_cmpstr (lm_message_get_id (copy), ==, "r1");
+    g_assert_cmpstr (lm_message_get_to (copy), ==, "nurse@example.com");
+    lm_message_node_set_attribute (copy->node, "id", "r2");
+    g_assert_cmpstr (lm_message_get_id (copy), ==, "r2");
+    g_assert_cmpstr (lm_message_get_id (m), ==, "r1");
+    lm_message_unref (copy);
+
+    m = messages->pdata[1];
+    g_assert (lm_message_get_id (m) == NULL);
+    g_assert (lm_message_get_from (m) == NULL);
+    g_assert (lm_message_get_type_attribute (m) == NULL);
+    lm_message_node_set_attribute (m->node, "from", "nurse@example.com");
+    g_assert_cmpstr (lm_message_get_from (m), ==, "nurse@example.com");
+    /* Ids added or changed later on are what replies are matched with */
+    g_assert_cmpuint (_lm_message_get_id_hash (m), ==, 0);
+    lm_message_node_set_attribute (m->node, "id", "p1");
+    g_assert_cmpstr (lm_message_get_id (m), ==, "p1");
+    g_assert_cmpuint (_lm_message_get_id_hash (m), ==, g_str_hash ("p1"));
+    lm_message_node_set_attribute (m->node, "id", "p2");
+    g_assert_cmpstr (lm_message_get_id (m), ==, "p2");
+    g_assert_cmpuint (_lm_message_get_id_hash (m), ==, g_str_hash ("p2"));
+
+    g_ptr_array_free (messages, TRUE);
+
+    m = lm_message_new_with_sub_type ("romeo@example.net", LM_MESSAGE_TYPE_MESSAGE,
+                                      LM_MESSAGE_SUB_TYPE_CHAT);
+    g_assert (lm_message_get_id (m) != NULL);
+    g_assert_cmpuint (_lm_message_get_id_hash (m), ==,
+                      g_str_hash (lm_message_get_id (m)));
+    /* Changing an id that is in its slot takes its hash again */
+    lm_message_node_set_attribute (m->node, "id", "c1");
+    g_assert_cmpuint (_lm_message_get_id_hash (m), ==, g_str_hash ("c1"));
+    g_assert_cmpstr (lm_message_get_to (m), ==, "romeo@example.net");
+    g_assert_cmpstr (lm_message_get_type_attribute (m), ==, "chat");
+    lm_message_unref (m);
+}
+
+/* Every truncation and every single changed byte either reads back or
+ * is refused, without reading past the buffer.
+ */
+static void
+test_binary_invalid ()
+{
+    GPtrArray     *messages;
+    LmMessageNode *node;
+    GBytes        *bytes;
+    const guint8  *data;
+    gsize          size, i;
+
+    messages = parse_messages (binary_stanzas[0], FALSE);
+    bytes = lm_message_node_to_binary (((LmMessage *) messages->pdata[0])->node);
+    g_ptr_array_free (messages, TRUE);
+
+    data = g_bytes_get_data (bytes, &size);
+
+    for (i = 0; i < size; ++i) {
+        GBytes *part;
+        GError *error = NULL;
+
+        part = g_bytes_new (data, i);
+        node = lm_message_node_new_from_binary (part, &error);
+        g_assert (node == NULL);
+        g_assert (g_error_matches (error, LM_ERROR, LM_ERROR_INVALID_BINARY));
+        g_clear_error (&error);
+        g_bytes_unref (part);
+    }
+
+    for (i = 0; i < size; ++i) {
+        guint8 *changed;
+        GBytes *part;
+
+        changed = g_malloc (size);
+        memcpy (changed, data, size);
+        changed[i] ^= 0x81;
+        part = g_bytes_new_take (changed, size);
+
+        node = lm_message_node_new_from_binary (part, NULL);
+        if (node) {
+            g_free (lm_message_node_to_string (node));
+            lm_message_node_unref (node);
+        }
+        g_bytes_unref (part);
+    }
+
+    g_bytes_unref (bytes);
+}
+
+int
+main (int argc, char **argv)
+{
+    g_test_init (&argc, &argv, NULL);
+
+    g_test_add_func ("/atoms/lookup", test_atom_lookup);
+    g_test_add_func ("/atoms/all", test_atom_all);
+    g_test_add_func ("/namespace", test_namespaces);
+    g_test_add_func ("/message_node/interned_names", test_interned_names);
+    g_test_add_func ("/message_node/arena", test_arena_nodes);
+    g_test_add_func ("/message_node/children", test_children);
+    g_test_add_func ("/message_node/attributes", test_attributes);
+    g_test_add_func ("/message_node/append_value", test_append_value);
+    g_test_add_func ("/message_node/to_string", test_to_string);
+    g_test_add_func ("/message_node/to_string/deep", test_to_string_deep);
+    g_test_add_func ("/message_node/wire_cache", test_wire_cache);
+    g_test_add_func ("/message_node/copy", test_copy);
+    g_test_add_func ("/message/routing", test_message_routing);
+    g_test_add_func ("/message_node/binary/round_trip", test_binary_round_trip);
+    g_test_add_func ("/message_node/binary/changes", test_binary_changes);
+    g_test_add_func ("/message_node/binary/message", test_binary_message);
+    g_test_add_func ("/message_node/binary/invalid", test_binary_invalid);
+#ifndef LM_PARSER_USE_GMARKUP
+    g_test_add_func ("/message_node/lazy/verbatim", test_lazy_verbatim);
+    g_test_add_func ("/message_node/lazy/chunked", test_lazy_chunked);
+    g_test_add_func ("/message_node/lazy/materialize", test_lazy_materialize);
+    g_test_add_func ("/message_node/lazy/access", test_lazy_access);
+    g_test_add_func ("/message_node/lazy/copy", test_lazy_copy);
+#endif
+
+    return g_test_run ();
+}
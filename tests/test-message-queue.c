@@ -0,0 +1,465 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (C) 2008 Imendio AB
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, see <https://www.gnu.org/licenses>
+ */
+
+#include <config.h>
+#include <string.h>
+#include <glib.h>
+
+#include "loudmouth/lm-message-queue.h"
+
+typedef struct {
+    GMainContext *context;
+    guint         n_handled;
+    guint         n_idle;
+    gboolean      detach_after;
+} QueueTest;
+
+static void
+handle_message_cb (LmMessageQueue *queue, gpointer user_data)
+{
+    QueueTest *test = user_data;
+    LmMessage *m;
+
+    m = lm_message_queue_pop_nth (queue, 0);
+    g_assert (m != NULL);
+    lm_message_unref (m);
+
+    if (++test->n_handled == test->detach_after) {
+        lm_message_queue_detach (queue);
+    }
+}
+
+static gboolean
+idle_cb (gpointer user_data)
+{
+    ((QueueTest *) user_data)->n_idle++;
+
+    return TRUE;
+}
+
+static LmMessageQueue *
+queue_new (QueueTest *test, guint n_messages)
+{
+    LmMessageQueue *queue;
+    guint           i;
+
+    test->context = g_main_context_new ();
+    test->n_handled = 0;
+    test->n_idle = 0;
+    test->detach_after = 0;
+
+    queue = lm_message_queue_new (handle_message_cb, test);
+    for (i = 0; i < n_messages; ++i) {
+        lm_message_queue_push_tail (queue,
+                                    lm_message_new (NULL, LM_MESSAGE_TYPE_MESSAGE));
+    }
+    lm_message_queue_attach (queue, test->context);
+
+    return queue;
+}
+
+static void
+queue_free (QueueTest *test, LmMessageQueue *queue)
+{
+    lm_message_queue_unref (queue);
+    g_main_context_unref (test->context);
+}
+
+static void
+test_batches ()
+{
+    QueueTest       test;
+    LmMessageQueue *queue;
+    guint           max_length;
+
+    queue = queue_new (&test, 10);
+
+    /* One at a time unless asked for more */
+    g_main_context_iteration (test.context, FALSE);
+    g_assert_cmpuint (test.n_handled, ==, 1);
+
+    lm_message_queue_set_budget (queue, 4, 0, FALSE);
+
+    g_main_context_iteration (test.context, FALSE);
+    g_assert_cmpuint (test.n_handled, ==, 5);
+    g_main_context_iteration (test.context, FALSE);
+    g_assert_cmpuint (test.n_handled, ==, 9);
+    g_main_context_iteration (test.context, FALSE);
+    g_assert_cmpuint (test.n_handled, ==, 10);
+    g_assert (lm_message_queue_is_empty (queue));
+
+    lm_message_queue_get_stats (queue, &max_length, NULL, NULL);
+    g_assert_cmpuint (max_length, ==, 10);
+
+    /* Without a limit everything goes in one batch */
+    lm_message_queue_set_budget (queue, 0, 0, FALSE);
+    lm_message_queue_push_tail (queue, lm_message_new (NULL, LM_MESSAGE_TYPE_IQ));
+    lm_message_queue_push_tail (queue, lm_message_new (NULL, LM_MESSAGE_TYPE_IQ));
+    g_main_context_iteration (test.context, FALSE);
+    g_assert_cmpuint (test.n_handled, ==, 12);
+
+    queue_free (&test, queue);
+}
+
+/* An idle source of lower priority only gets to run in between batches
+ * when the queue is fair.
+ */
+static void
+run_fairness (gboolean fair, guint expected_handled, guint expected_idle)
+{
+    QueueTest       test;
+    LmMessageQueue *queue;
+    GSource        *idle;
+    guint           i;
+
+    queue = queue_new (&test, 6);
+    lm_message_queue_set_budget (queue, 2, 0, fair);
+
+    idle = g_idle_source_new ();
+    g_source_set_callback (idle, idle_cb, &test, NULL);
+    g_source_attach (idle, test.context);
+
+    for (i = 0; i < 4; ++i) {
+        g_main_context_iteration (test.context, FALSE);
+    }
+    g_assert_cmpuint (test.n_handled, ==, expected_handled);
+    g_assert_cmpuint (test.n_idle, ==, expected_idle);
+
+    g_source_destroy (idle);
+    g_source_unref (idle);
+    queue_free (&test, queue);
+}
+
+static void
+test_fair ()
+{
+    /* Batches take turns with the idle source */
+    run_fairness (TRUE, 4, 2);
+}
+
+static void
+test_unfair ()
+{
+    /* All three batches first, the idle source only once they're done */
+    run_fairness (FALSE, 6, 1);
+}
+
+static void
+test_detach_in_batch ()
+{
+    QueueTest       test;
+    LmMessageQueue *queue;
+    gint64          last_latency, max_latency;
+
+    queue = queue_new (&test, 5);
+    lm_message_queue_set_budget (queue, 0, 0, FALSE);
+    test.detach_after = 2;
+
+    g_main_context_iteration (test.context, FALSE);
+    g_assert_cmpuint (test.n_handled, ==, 2);
+    g_assert_cmpuint (lm_message_queue_get_length (queue), ==, 3);
+
+    lm_message_queue_get_stats (queue, NULL, &last_latency, &max_latency);
+    g_assert_cmpint (last_latency, >=, 0);
+    g_assert_cmpint (max_latency, >=, last_latency);
+
+    queue_free (&test, queue);
+}
+
+static LmMessage *
+message_with_id (const gchar *id)
+{
+    LmMessage *m;
+
+    m = lm_message_new (NULL, LM_MESSAGE_TYPE_IQ);
+    lm_message_node_set_attribute (m->node, "id", id);
+
+    return m;
+}
+
+static void
+test_pop_id ()
+{
+    LmMessageQueue *queue;
+    LmMessage      *m;
+    gchar          *id;
+    guint           i;
+
+    queue = lm_message_queue_new (NULL, NULL);
+
+    /* Enough to grow the ring a few times */
+    for (i = 0; i < 100; ++i) {
+        id = g_strdup_printf ("m%u", i);
+        lm_message_queue_push_tail (queue, message_with_id (id));
+        g_free (id);
+    }
+
+    m = lm_message_queue_pop_id (queue, "m50");
+    g_assert_cmpstr (lm_message_get_id (m), ==, "m50");
+    lm_message_unref (m);
+    g_assert (lm_message_queue_pop_id (queue, "m50") == NULL);
+    g_assert_cmpuint (lm_message_queue_get_length (queue), ==, 99);
+
+    /* The tombstone left behind isn't counted */
+    g_assert_cmpstr (lm_message_get_id (lm_message_queue_peek_nth (queue, 49)), ==, "m49");
+    g_assert_cmpstr (lm_message_get_id (lm_message_queue_peek_nth (queue, 50)), ==, "m51");
+
+    /* Taking out every other message has it compacted along the way */
+    for (i = 1; i < 100; i += 2) {
+        id = g_strdup_printf ("m%u", i);
+        m = lm_message_queue_pop_id (queue, id);
+        g_assert_cmpstr (lm_message_get_id (m), ==, id);
+        lm_message_unref (m);
+        g_free (id);
+    }
+    g_assert_cmpuint (lm_message_queue_get_length (queue), ==, 49);
+
+    for (i = 0; i < 100; i += 2) {
+        if (i == 50) {
+            continue;
+        }
+        m = lm_message_queue_pop_nth (queue, 0);
+        id = g_strdup_printf ("m%u", i);
+        g_assert_cmpstr (lm_message_get_id (m), ==, id);
+        g_free (id);
+        lm_message_unref (m);
+    }
+    g_assert (lm_message_queue_is_empty (queue));
+    g_assert (lm_message_queue_pop_nth (queue, 0) == NULL);
+
+    lm_message_queue_unref (queue);
+}
+
+/* Messages with the same id come out oldest first */
+static void
+test_same_id ()
+{
+    LmMessageQueue *queue;
+    LmMessage      *first, *second, *third;
+
+    queue = lm_message_queue_new (NULL, NULL);
+
+    first = message_with_id ("dup");
+    second = message_with_id ("dup");
+    third = message_with_id ("dup");
+    lm_message_queue_push_tail (queue, first);
+    lm_message_queue_push_tail (queue, message_with_id ("other"));
+    lm_message_queue_push_tail (queue, second);
+    lm_message_queue_push_tail (queue, third);
+
+    g_assert (lm_message_queue_pop_id (queue, "dup") == first);
+    /* Not the oldest one */
+    g_assert (lm_message_queue_pop_nth (queue, 2) == third);
+    g_assert (lm_message_queue_pop_id (queue, "dup") == second);
+    g_assert (lm_message_queue_pop_id (queue, "dup") == NULL);
+    g_assert_cmpuint (lm_message_queue_get_length (queue), ==, 1);
+
+    lm_message_unref (first);
+    lm_message_unref (second);
+    lm_message_unref (third);
+    lm_message_queue_unref (queue);
+}
+
+/* Random pushes and pops, checked against a GQueue doing the same */
+static void
+test_random ()
+{
+    LmMessageQueue *queue;
+    GQueue         *expected;
+    GRand          *rand;
+    guint           i, n;
+
+    queue = lm_message_queue_new (NULL, NULL);
+    expected = g_queue_new ();
+    rand = g_rand_new_with_seed (42);
+
+    for (i = 0; i < 20000; ++i) {
+        guint      op = g_rand_int_range (rand, 0, 10);
+        LmMessage *m;
+
+        if (op < 5 || g_queue_is_empty (expected)) {
+            gchar *id = g_strdup_printf ("id%d", g_rand_int_range (rand, 0, 64));
+
+            m = message_with_id (id);
+            lm_message_queue_push_tail (queue, m);
+            g_queue_push_tail (expected, m);
+            g_free (id);
+        } else if (op < 8) {
+            n = g_rand_int_range (rand, 0, g_queue_get_length (expected));
+            m = lm_message_queue_pop_nth (queue, n);
+            g_assert (m == g_queue_pop_nth (expected, n));
+            lm_message_unref (m);
+        } else {
+            const gchar *id;
+            GList       *l;
+
+            n = g_rand_int_range (rand, 0, g_queue_get_length (expected));
+            id = lm_message_get_id (g_queue_peek_nth (expected, n));
+            for (l = expected->head; l; l = l->next) {
+                if (strcmp (lm_message_get_id (l->data), id) == 0) {
+                    break;
+                }
+            }
+            m = lm_message_queue_pop_id (queue, id);
+            g_assert (m == l->data);
+            g_queue_delete_link (expected, l);
+            lm_message_unref (m);
+        }
+
+        g_assert_cmpuint (lm_message_queue_get_length (queue), ==,
+                          g_queue_get_length (expected));
+    }
+
+    for (n = 0; n < g_queue_get_length (expected); ++n) {
+        g_assert (lm_message_queue_peek_nth (queue, n) ==
+                  g_queue_peek_nth (expected, n));
+    }
+
+    g_queue_free (expected);
+    g_rand_free (rand);
+    lm_message_queue_unref (queue);
+}
+
+/* Lanes are handed out in order, each one in the order it was filled */
+static void
+test_lanes ()
+{
+    LmMessageQueue *queue;
+    LmMessage      *m;
+    const gchar    *order[] = { "h0", "h1", "n0", "n1", "l0", "l1" };
+    guint           i;
+
+    queue = lm_message_queue_new (NULL, NULL);
+
+    lm_message_queue_push (queue, message_with_id ("l0"), LM_MESSAGE_LANE_LOW, 0);
+    lm_message_queue_push (queue, message_with_id ("n0"), LM_MESSAGE_LANE_NORMAL, 0);
+    lm_message_queue_push (queue, message_with_id ("h0"), LM_MESSAGE_LANE_HIGH, 0);
+    lm_message_queue_push (queue, message_with_id ("l1"), LM_MESSAGE_LANE_LOW, 0);
+    lm_message_queue_push_tail (queue, message_with_id ("n1"));
+    lm_message_queue_push (queue, message_with_id ("h1"), LM_MESSAGE_LANE_HIGH, 0);
+    g_assert_cmpuint (lm_message_queue_get_length (queue), ==, 6);
+
+    for (i = 0; i < G_N_ELEMENTS (order); ++i) {
+        g_assert_cmpstr (lm_message_get_id (lm_message_queue_peek_nth (queue, i)), ==, order[i]);
+    }
+
+    /* Ids are found whichever lane they are in */
+    m = lm_message_queue_pop_id (queue, "l1");
+    g_assert_cmpstr (lm_message_get_id (m), ==, "l1");
+    lm_message_unref (m);
+    m = lm_message_queue_pop_id (queue, "h0");
+    g_assert_cmpstr (lm_message_get_id (m), ==, "h0");
+    lm_message_unref (m);
+    g_assert_cmpstr (lm_message_get_id (lm_message_queue_peek_nth (queue, 2)), ==, "n1");
+
+    for (i = 1; i < G_N_ELEMENTS (order) - 1; ++i) {
+        m = lm_message_queue_pop_next (queue);
+        g_assert_cmpstr (lm_message_get_id (m), ==, order[i]);
+        lm_message_unref (m);
+    }
+    g_assert (lm_message_queue_is_empty (queue));
+    g_assert (lm_message_queue_pop_next (queue) == NULL);
+
+    lm_message_queue_unref (queue);
+}
+
+/* Lower lanes get a message out now and then while a higher one is busy */
+static void
+test_lane_starvation ()
+{
+    LmMessageQueue *queue;
+    GString        *order;
+    LmMessage      *m;
+    gchar          *id;
+    guint           i;
+
+    queue = lm_message_queue_new (NULL, NULL);
+    order = g_string_new (NULL);
+
+    for (i = 0; i < 20; ++i) {
+        lm_message_queue_push (queue, message_with_id ("h"), LM_MESSAGE_LANE_HIGH, 0);
+    }
+    for (i = 0; i < 3; ++i) {
+        id = g_strdup_printf ("%u", i);
+        lm_message_queue_push (queue, message_with_id (id), LM_MESSAGE_LANE_LOW, 0);
+        g_free (id);
+    }
+    lm_message_queue_push (queue, message_with_id ("n"), LM_MESSAGE_LANE_NORMAL, 0);
+
+    while ((m = lm_message_queue_pop_next (queue))) {
+        g_string_append (order, lm_message_get_id (m));
+        lm_message_unref (m);
+    }
+
+    g_assert_cmpstr (order->str, ==, "hhhhhhhhn0hhhhhhhh1hhhh2");
+
+    g_string_free (order, TRUE);
+    lm_message_queue_unref (queue);
+}
+
+/* The size of the queue follows the messages going in and out of it */
+static void
+test_size ()
+{
+    LmMessageQueue *queue;
+    LmMessage      *m;
+
+    queue = lm_message_queue_new (NULL, NULL);
+
+    lm_message_queue_push (queue, message_with_id ("a"), LM_MESSAGE_LANE_LOW, 100);
+    lm_message_queue_push (queue, message_with_id ("b"), LM_MESSAGE_LANE_HIGH, 20);
+    lm_message_queue_push_tail (queue, message_with_id ("c"));
+    lm_message_queue_push (queue, message_with_id ("d"), LM_MESSAGE_LANE_NORMAL, 3);
+    g_assert_cmpuint (lm_message_queue_get_size (queue), ==, 123);
+
+    m = lm_message_queue_pop_id (queue, "a");
+    lm_message_unref (m);
+    g_assert_cmpuint (lm_message_queue_get_size (queue), ==, 23);
+
+    m = lm_message_queue_pop_next (queue);
+    g_assert_cmpstr (lm_message_get_id (m), ==, "b");
+    lm_message_unref (m);
+    g_assert_cmpuint (lm_message_queue_get_size (queue), ==, 3);
+
+    m = lm_message_queue_pop_nth (queue, 1);
+    g_assert_cmpstr (lm_message_get_id (m), ==, "d");
+    lm_message_unref (m);
+    g_assert_cmpuint (lm_message_queue_get_size (queue), ==, 0);
+    g_assert_cmpuint (lm_message_queue_get_length (queue), ==, 1);
+
+    lm_message_queue_unref (queue);
+}
+
+int
+main (int argc, char **argv)
+{
+    g_test_init (&argc, &argv, NULL);
+
+    g_test_add_func ("/message_queue/batches", test_batches);
+    g_test_add_func ("/message_queue/fair", test_fair);
+    g_test_add_func ("/message_queue/unfair", test_unfair);
+    g_test_add_func ("/message_queue/detach", test_detach_in_batch);
+    g_test_add_func ("/message_queue/pop_id", test_pop_id);
+    g_test_add_func ("/message_queue/same_id", test_same_id);
+    g_test_add_func ("/message_queue/random", test_random);
+    g_test_add_func ("/message_queue/lanes", test_lanes);
+    g_test_add_func ("/message_queue/lanes/starvation", test_lane_starvation);
+    g_test_add_func ("/message_queue/size", test_size);
+
+    return g_test_run ();
+}
@@ -16,10 +16,13 @@
  * License along with this program; if not, see <https://www.gnu.org/licenses>
  */
 
+#include <config.h>
 #include <stdlib.h>
+#include <string.h>
 #include <glib.h>
 
 #include "loudmouth/lm-parser.h"
+#include "loudmouth/lm-message.h"
 
 static GSList *
 get_files (const gchar *prefix)
@@ -109,6 +112,419 @@ test_invalid_suite ()
     g_slist_free (list);
 }
 
+static void
+store_body_cb (LmParser *parser, LmMessage *m, gpointer user_data)
+{
+    gchar        **body = (gchar **) user_data;
+    LmMessageNode *node;
+
+    node = lm_message_node_get_child (m->node, "body");
+    if (node) {
+        g_free (*body);
+        *body = g_strdup (lm_message_node_get_value (node));
+    }
+}
+
+static gchar *
+parse_body_in_chunks (const gchar *data, gsize chunk_size)
+{
+    LmParser *parser;
+    gchar    *body = NULL;
+    gsize     len, i;
+
+    parser = lm_parser_new (store_body_cb, &body, NULL);
+
+    len = strlen (data);
+    for (i = 0; i < len; i += chunk_size) {
+        g_assert (lm_parser_parse_len (parser, data + i,
+                                       MIN (chunk_size, len - i)));
+    }
+
+    lm_parser_free (parser);
+
+    return body;
+}
+
+static void
+test_split_utf8 ()
+{
+    const gchar *stanza = "<message><body>caf\303\251 \360\235\204\236</body></message>";
+    gsize        chunk_size;
+
+    for (chunk_size = 1; chunk_size < 8; chunk_size++) {
+        gchar *body = parse_body_in_chunks (stanza, chunk_size);
+
+        g_assert_cmpstr (body, ==, "caf\303\251 \360\235\204\236");
+        g_free (body);
+    }
+}
+
+static void
+test_invalid_utf8 ()
+{
+    gchar *body;
+
+    body = parse_body_in_chunks ("<message><body>a\377b\303c</body></message>", 64);
+    g_assert_cmpstr (body, ==, "a\357\277\275b\357\277\275c");
+    g_free (body);
+
+    /* A lead byte at the end of one read followed by garbage */
+    body = parse_body_in_chunks ("<message><body>ab\342x</body></message>", 18);
+    g_assert_cmpstr (body, ==, "ab\357\277\275x");
+    g_free (body);
+}
+
+static void
+collect_messages_cb (LmParser *parser, LmMessage *m, gpointer user_data)
+{
+    GPtrArray *messages = (GPtrArray *) user_data;
+
+    g_ptr_array_add (messages, lm_message_ref (m));
+}
+
+static GPtrArray *
+parse_messages (const gchar *data, gsize chunk_size, gboolean *result)
+{
+    LmParser  *parser;
+    GPtrArray *messages;
+    gsize      len, i;
+
+    messages = g_ptr_array_new_with_free_func ((GDestroyNotify) lm_message_unref);
+    parser = lm_parser_new (collect_messages_cb, messages, NULL);
+
+    *result = TRUE;
+    len = strlen (data);
+    for (i = 0; i < len && *result; i += chunk_size) {
+        *result = lm_parser_parse_len (parser, data + i,
+                                       MIN (chunk_size, len - i));
+    }
+
+    lm_parser_free (parser);
+
+    return messages;
+}
+
+static LmMessageNode *
+parse_single_stanza (const gchar *data)
+{
+    GPtrArray     *messages;
+    LmMessageNode *node;
+    gboolean       result;
+
+    messages = parse_messages (data, strlen (data), &result);
+    g_assert (result);
+    g_assert_cmpuint (messages->len, ==, 1);
+
+    node = lm_message_node_ref (((LmMessage *) messages->pdata[0])->node);
+    g_ptr_array_free (messages, TRUE);
+
+    return node;
+}
+
+/* Splitting the input anywhere mustn't change what comes out */
+static void
+test_chunked_suite ()
+{
+    GSList *list, *l;
+
+    list = get_files ("valid");
+    for (l = list; l; l = l->next) {
+        GPtrArray *whole, *chunked;
+        gchar     *contents;
+        gboolean   result;
+        guint      i;
+
+        g_assert (g_file_get_contents (l->data, &contents, NULL, NULL));
+
+        whole = parse_messages (contents, strlen (contents), &result);
+        g_assert (result);
+        chunked = parse_messages (contents, 1, &result);
+        g_assert (result);
+
+        g_assert_cmpuint (whole->len, ==, 2);
+        g_assert_cmpuint (whole->len, ==, chunked->len);
+        g_assert_cmpint (lm_message_get_type (whole->pdata[0]), ==,
+                         LM_MESSAGE_TYPE_STREAM);
+
+        for (i = 0; i < whole->len; ++i) {
+            gchar *a = lm_message_node_to_string (((LmMessage *) whole->pdata[i])->node);
+            gchar *b = lm_message_node_to_string (((LmMessage *) chunked->pdata[i])->node);
+
+            g_assert_cmpstr (a, ==, b);
+            g_free (a);
+            g_free (b);
+        }
+
+        g_ptr_array_free (whole, TRUE);
+        g_ptr_array_free (chunked, TRUE);
+        g_free (contents);
+        g_free (l->data);
+    }
+    g_slist_free (list);
+}
+
+static void
+test_namespaces ()
+{
+    LmMessageNode *node, *query;
+
+    node = parse_single_stanza ("<iq type='get' id='r1'>"
+                                "<r:query xmlns:r='jabber:iq:roster'/>"
+                                "</iq>");
+
+    query = lm_message_node_get_child (node, "query");
+    g_assert (query != NULL);
+    g_assert_cmpstr (lm_message_node_get_attribute (query, "xmlns"), ==,
+                     "jabber:iq:roster");
+
+    lm_message_node_unref (node);
+}
+
+static void
+test_entities ()
+{
+    LmMessageNode *node;
+
+    node = parse_single_stanza ("<?xml version='1.0'?>"
+                                "<message to='a&apos;b&amp;c'>"
+                                "<!-- a comment -->"
+                                "<body>&lt;b&gt; &amp; &#65;&#x263a;</body>"
+                                "</message>");
+
+    g_assert_cmpstr (lm_message_node_get_attribute (node, "to"), ==, "a'b&c");
+    g_assert_cmpstr (lm_message_node_get_value (lm_message_node_get_child (node, "body")),
+                     ==, "<b> & A\342\230\272");
+
+    lm_message_node_unref (node);
+}
+
+#ifndef LM_PARSER_USE_GMARKUP
+/* GMarkup hands CDATA sections to its passthrough callback */
+static void
+test_cdata ()
+{
+    LmMessageNode *node;
+
+    node = parse_single_stanza ("<message><body>a <![CDATA[<x> ]] & ]]>b</body></message>");
+
+    g_assert_cmpstr (lm_message_node_get_value (lm_message_node_get_child (node, "body")),
+                     ==, "a <x> ]] & b");
+
+    lm_message_node_unref (node);
+
+    /* Brackets before the end of the section are part of it */
+    node = parse_single_stanza ("<message><body><![CDATA[a]]]]]]>b</body></message>");
+
+    g_assert_cmpstr (lm_message_node_get_value (lm_message_node_get_child (node, "body")),
+                     ==, "a]]]]b");
+
+    lm_message_node_unref (node);
+}
+#endif
+
+/* Text around child elements all ends up in the value */
+static void
+test_mixed_text ()
+{
+    LmMessageNode *node;
+
+    node = parse_single_stanza ("<message><body>one<br/>two &amp; "
+                                "<br/>three</body></message>");
+
+    g_assert_cmpstr (lm_message_node_get_value (lm_message_node_get_child (node, "body")),
+                     ==, "onetwo & three");
+
+    lm_message_node_unref (node);
+}
+
+static void
+test_mismatched_tag ()
+{
+    GPtrArray *messages;
+    gboolean   result;
+
+    messages = parse_messages ("<message><body>hi</message>", 64, &result);
+    g_assert (!result);
+    g_assert_cmpuint (messages->len, ==, 0);
+    g_ptr_array_free (messages, TRUE);
+}
+
+static void
+mutate_message_cb (LmParser *parser, LmMessage *m, gpointer user_data)
+{
+    GPtrArray     *bodies = (GPtrArray *) user_data;
+    LmMessageNode *body;
+
+    body = lm_message_node_get_child (m->node, "body");
+    if (!body) {
+        return;
+    }
+
+    /* Replaces parsed strings and hangs heap nodes off the parsed tree */
+    lm_message_node_set_value (body, "changed");
+    lm_message_node_set_attribute (m->node, "to", "romeo@example.net");
+    lm_message_node_set_attribute (m->node, "new", "attribute");
+    lm_message_node_add_child (body, "extra", "value");
+
+    /* Outlives the message and the rest of its tree */
+    g_ptr_array_add (bodies, lm_message_node_ref (body));
+}
+
+static void
+test_arena_mutation ()
+{
+    const gchar *data =
+        "<message to='juliet@example.com' id='1'>"
+        "<body xml:lang='en'>one</body></message>"
+        "<presence/><presence/>"
+        "<message to='juliet@example.com' id='2'>"
+        "<body xml:lang='de'>two</body></message>";
+    LmParser    *parser;
+    GPtrArray   *bodies;
+    guint        i;
+
+    bodies = g_ptr_array_new ();
+    parser = lm_parser_new (mutate_message_cb, bodies, NULL);
+    g_assert (lm_parser_parse (parser, data));
+    lm_parser_free (parser);
+
+    g_assert_cmpuint (bodies->len, ==, 2);
+
+    for (i = 0; i < bodies->len; ++i) {
+        LmMessageNode *body = bodies->pdata[i];
+
+        g_assert_cmpstr (lm_message_node_get_value (body), ==, "changed");
+        g_assert_cmpstr (lm_message_node_get_attribute (body, "xml:lang"),
+                         ==, i == 0 ? "en" : "de");
+        g_assert_cmpstr (lm_message_node_get_value (lm_message_node_get_child (body, "extra")),
+                         ==, "value");
+
+        lm_message_node_set_attribute (body, "xml:lang", "fr");
+        g_assert_cmpstr (lm_message_node_get_attribute (body, "xml:lang"),
+                         ==, "fr");
+
+        lm_message_node_unref (body);
+    }
+
+    g_ptr_array_free (bodies, TRUE);
+}
+
+#ifndef LM_PARSER_USE_GMARKUP
+typedef struct {
+    gsize          max_size;
+    guint          max_depth;
+    guint          max_attributes;
+    gsize          max_text;
+    const gchar   *stanza;
+    LmStanzaLimit  limit;
+} LimitTest;
+
+static const LimitTest limit_tests[] = {
+    { 120, 0, 0, 0,
+      "<message id='2'><body>Far too long for the limit, far too long for "
+      "the limit, far too long for the limit, far too long for the limit, "
+      "far too long.</body></message>",
+      LM_STANZA_LIMIT_SIZE },
+    { 0, 3, 0, 0,
+      "<iq id='2' type='set'><a xmlns='urn:test'><b><c/><c>deep</c></b></a></iq>",
+      LM_STANZA_LIMIT_DEPTH },
+    { 0, 0, 4, 0,
+      "<presence id='2' a='1' b='2' c='3' d='4'/>",
+      LM_STANZA_LIMIT_ATTRIBUTES },
+    { 0, 0, 4, 0,
+      "<message id='2'><x xmlns='urn:test' a='1' b='2' c='3' d='4'/></message>",
+      LM_STANZA_LIMIT_ATTRIBUTES },
+    { 0, 0, 0, 16,
+      "<message id='2'><body>more than sixteen bytes</body></message>",
+      LM_STANZA_LIMIT_TEXT },
+    { 0, 0, 0, 16,
+      "<message id='2'><body>&lt;&lt;&lt;&lt;&lt;&lt;&lt;&lt;&lt;"
+      "&lt;&lt;&lt;&lt;&lt;&lt;&lt;&lt;</body></message>",
+      LM_STANZA_LIMIT_TEXT },
+    { 0, 0, 0, 16,
+      "<message id='2'><body>ten bytes<br/>ten bytes</body></message>",
+      LM_STANZA_LIMIT_TEXT }
+};
+
+static void
+count_dropped_cb (LmParser      *parser,
+                  LmStanzaLimit  limit,
+                  const gchar   *name,
+                  gpointer       user_data)
+{
+    GArray *dropped = (GArray *) user_data;
+
+    g_array_append_val (dropped, limit);
+}
+
+/* Dropping a stanza leaves the ones around it alone */
+static void
+test_limits ()
+{
+    const gchar *ok_stanza =
+        "<message id='%d' type='chat'><body>short</body></message>";
+    guint i;
+
+    for (i = 0; i < G_N_ELEMENTS (limit_tests); ++i) {
+        const LimitTest *test = &limit_tests[i];
+        gchar           *data, *first, *last;
+        gsize            chunk_size, len;
+        gint             lazy;
+
+        first = g_strdup_printf (ok_stanza, 1);
+        last = g_strdup_printf (ok_stanza, 3);
+        data = g_strconcat ("<stream:stream xmlns='jabber:client' "
+                            "xmlns:stream='http://etherx.jabber.org/streams' "
+                            "from='example.com' id='s1' version='1.0'>",
+                            first, test->stanza, last, NULL);
+        len = strlen (data);
+
+        for (lazy = 0; lazy < 2; ++lazy) {
+            for (chunk_size = 1; chunk_size <= len; chunk_size += 7) {
+                LmParser  *parser;
+                GPtrArray *messages;
+                GArray    *dropped;
+                gsize      pos;
+
+                messages = g_ptr_array_new_with_free_func ((GDestroyNotify) lm_message_unref);
+                dropped = g_array_new (FALSE, FALSE, sizeof (LmStanzaLimit));
+
+                parser = lm_parser_new (collect_messages_cb, messages, NULL);
+                _lm_parser_set_lazy (parser, lazy);
+                _lm_parser_set_limits (parser, test->max_size, test->max_depth,
+                                       test->max_attributes, test->max_text);
+                _lm_parser_set_limit_function (parser, count_dropped_cb, dropped);
+
+                for (pos = 0; pos < len; pos += chunk_size) {
+                    g_assert (lm_parser_parse_len (parser, data + pos,
+                                                   MIN (chunk_size, len - pos)));
+                }
+                lm_parser_free (parser);
+
+                g_assert_cmpuint (dropped->len, ==, 1);
+                g_assert_cmpint (g_array_index (dropped, LmStanzaLimit, 0), ==,
+                                 test->limit);
+
+                g_assert_cmpuint (messages->len, ==, 3);
+                g_assert_cmpstr (lm_message_node_get_attribute (((LmMessage *) messages->pdata[1])->node, "id"),
+                                 ==, "1");
+                g_assert_cmpstr (lm_message_node_get_attribute (((LmMessage *) messages->pdata[2])->node, "id"),
+                                 ==, "3");
+                g_assert_cmpstr (lm_message_node_get_value (lm_message_node_get_child (((LmMessage *) messages->pdata[2])->node, "body")),
+                                 ==, "short");
+
+                g_array_free (dropped, TRUE);
+                g_ptr_array_free (messages, TRUE);
+            }
+        }
+
+        g_free (data);
+        g_free (first);
+        g_free (last);
+    }
+}
+#endif
+
 int
 main (int argc, char **argv)
 {
@@ -116,6 +532,20 @@ main (int argc, char **argv)
 
     g_test_add_func ("/parser/valid_suite", test_valid_suite);
     g_test_add_func ("/parser/invalid/suite", test_invalid_suite);
+    g_test_add_func ("/parser/invalid/mismatched_tag", test_mismatched_tag);
+    g_test_add_func ("/parser/chunked_suite", test_chunked_suite);
+    g_test_add_func ("/parser/namespaces", test_namespaces);
+    g_test_add_func ("/parser/entities", test_entities);
+    g_test_add_func ("/parser/mixed_text", test_mixed_text);
+#ifndef LM_PARSER_USE_GMARKUP
+    g_test_add_func ("/parser/cdata", test_cdata);
+#endif
+    g_test_add_func ("/parser/utf8/split", test_split_utf8);
+    g_test_add_func ("/parser/utf8/invalid", test_invalid_utf8);
+    g_test_add_func ("/parser/arena/mutation", test_arena_mutation);
+#ifndef LM_PARSER_USE_GMARKUP
+    g_test_add_func ("/parser/limits", test_limits);
+#endif
 
     return g_test_run ();
 }
@@ -0,0 +1,226 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (C) 2008 Imendio AB
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, see <https://www.gnu.org/licenses>
+ */
+
+#include <string.h>
+#include <glib.h>
+
+#include "loudmouth/lm-error.h"
+#include "loudmouth/lm-internals.h"
+#include "loudmouth/lm-selector.h"
+
+#define NS_PUBSUB_EVENT "http://jabber.org/protocol/pubsub#event"
+
+static LmMessage *
+create_event (void)
+{
+    LmMessage     *m;
+    LmMessageNode *node;
+    LmMessageNode *items;
+    LmMessageNode *item;
+
+    m = lm_message_new ("juliet@example.com", LM_MESSAGE_TYPE_MESSAGE);
+    lm_message_node_add_child (m->node, "body", "news");
+
+    node = lm_message_node_add_child (m->node, "event", NULL);
+    lm_message_node_set_attribute (node, "xmlns", NS_PUBSUB_EVENT);
+
+    items = lm_message_node_add_child (node, "items", NULL);
+    lm_message_node_set_attribute (items, "node", "princely_musings");
+
+    item = lm_message_node_add_child (items, "item", NULL);
+    lm_message_node_set_attribute (item, "id", "1");
+    lm_message_node_add_child (item, "entry", "first");
+
+    item = lm_message_node_add_child (items, "item", NULL);
+    lm_message_node_set_attribute (item, "id", "2");
+    lm_message_node_add_child (item, "entry", "second");
+
+    /* Not in the event */
+    node = lm_message_node_add_child (m->node, "x", NULL);
+    item = lm_message_node_add_child (node, "item", NULL);
+    lm_message_node_set_attribute (item, "id", "3");
+
+    return m;
+}
+
+static gboolean
+collect_ids_cb (LmSelector *selector, LmMessageNode *node, gpointer user_data)
+{
+    GString *ids = user_data;
+
+    g_string_append (ids, lm_message_node_get_attribute (node, "id"));
+
+    return TRUE;
+}
+
+static gchar *
+select_ids (LmMessageNode *node, const gchar *path)
+{
+    LmSelector *selector;
+    GString    *ids;
+
+    selector = lm_selector_new (path, NULL);
+    g_assert (selector != NULL);
+
+    ids = g_string_new (NULL);
+    lm_selector_foreach (selector, node, collect_ids_cb, ids);
+    lm_selector_unref (selector);
+
+    return g_string_free (ids, FALSE);
+}
+
+static void
+test_selector_paths (void)
+{
+    static const struct {
+        const gchar *path;
+        const gchar *ids;
+    } cases[] = {
+        { "message/event/items/item", "12" },
+        { "message/event[xmlns='" NS_PUBSUB_EVENT "']/items/item", "12" },
+        { "message/event[xmlns='jabber:x:event']/items/item", "" },
+        { "message/event/items[@node=\"princely_musings\"]/item[@id]", "12" },
+        { "message/*/item", "3" },
+        { "message/*/*/item[@id='2']", "2" },
+        { "//item", "123" },
+        { "message//item", "123" },
+        { "message/event//item", "12" },
+        { "iq/event/items/item", "" },
+        { "message[@to='juliet@example.com']/x/item", "3" }
+    };
+    LmMessage *m;
+    guint      i;
+
+    m = create_event ();
+
+    for (i = 0; i < G_N_ELEMENTS (cases); ++i) {
+        gchar *ids;
+
+        ids = select_ids (m->node, cases[i].path);
+        g_assert_cmpstr (ids, ==, cases[i].ids);
+        g_free (ids);
+    }
+
+    lm_message_unref (m);
+}
+
+static void
+test_selector_find (void)
+{
+    LmSelector    *selector;
+    LmMessageNode *node;
+    LmMessage     *m;
+
+    m = create_event ();
+
+    selector = lm_selector_new ("message/event/items/item/entry", NULL);
+    node = lm_selector_find (selector, m->node);
+    g_assert (node != NULL);
+    g_assert_cmpstr (lm_message_node_get_value (node), ==, "first");
+    lm_selector_unref (selector);
+
+    /* Starting further down the tree */
+    selector = lm_selector_new ("items/item[@id='2']/entry", NULL);
+    g_assert (lm_selector_find (selector, m->node) == NULL);
+    node = lm_selector_find (selector, lm_message_node_find_child (m->node, "items"));
+    g_assert_cmpstr (lm_message_node_get_value (node), ==, "second");
+    lm_selector_unref (selector);
+
+    lm_message_unref (m);
+}
+
+static void
+test_selector_invalid (void)
+{
+    static const gchar *invalid[] = {
+        "",
+        "message/",
+        "message//",
+        "message/[@id]",
+        "message[id]",
+        "message[@id",
+        "message[@id=1]",
+        "message[@id='1]",
+        "message item"
+    };
+    guint i;
+
+    for (i = 0; i < G_N_ELEMENTS (invalid); ++i) {
+        GError *error = NULL;
+
+        g_assert (lm_selector_new (invalid[i], &error) == NULL);
+        g_assert (g_error_matches (error, LM_ERROR, LM_ERROR_INVALID_SELECTOR));
+        g_error_free (error);
+    }
+}
+
+static LmHandlerResult
+count_messages_cb (LmMessageHandler *handler,
+                   LmConnection     *connection,
+                   LmMessage        *m,
+                   gpointer          user_data)
+{
+    (*(guint *) user_data)++;
+
+    return LM_HANDLER_RESULT_REMOVE_MESSAGE;
+}
+
+static void
+test_selector_handler (void)
+{
+    LmMessageHandler *handler;
+    LmSelector       *selector;
+    LmMessage        *event;
+    LmMessage        *chat;
+    guint             count = 0;
+
+    handler = lm_message_handler_new (count_messages_cb, &count, NULL);
+    selector = lm_selector_new ("message/event[xmlns='" NS_PUBSUB_EVENT "']", NULL);
+    lm_message_handler_set_selector (handler, selector);
+    lm_selector_unref (selector);
+
+    event = create_event ();
+    chat = lm_message_new ("juliet@example.com", LM_MESSAGE_TYPE_MESSAGE);
+
+    g_assert_cmpint (_lm_message_handler_handle_message (handler, NULL, chat),
+                     ==, LM_HANDLER_RESULT_ALLOW_MORE_HANDLERS);
+    g_assert_cmpint (_lm_message_handler_handle_message (handler, NULL, event),
+                     ==, LM_HANDLER_RESULT_REMOVE_MESSAGE);
+    g_assert_cmpuint (count, ==, 1);
+
+    lm_message_handler_set_selector (handler, NULL);
+    _lm_message_handler_handle_message (handler, NULL, chat);
+    g_assert_cmpuint (count, ==, 2);
+
+    lm_message_unref (event);
+    lm_message_unref (chat);
+    lm_message_handler_unref (handler);
+}
+
+int
+main (int argc, char **argv)
+{
+    g_test_init (&argc, &argv, NULL);
+
+    g_test_add_func ("/selector/paths", test_selector_paths);
+    g_test_add_func ("/selector/find", test_selector_find);
+    g_test_add_func ("/selector/invalid", test_selector_invalid);
+    g_test_add_func ("/selector/handler", test_selector_handler);
+
+    return g_test_run ();
+}
@@ -0,0 +1,185 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (C) 2008 Imendio AB
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, see <https://www.gnu.org/licenses>
+ */
+
+/*
+ * Like test-threads, meant to be run under ThreadSanitizer as well.
+ */
+
+#include <config.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+
+#include "loudmouth/lm-send-queue.h"
+
+#define N_THREADS 8
+#define N_ITEMS   20000
+
+typedef struct {
+    GString *out;
+    guint    n_batches;
+    gsize    max_batch;
+
+    /* Items seen from each producer, as "thread:item;" */
+    guint    next[N_THREADS];
+    guint    n_items;
+} SendTest;
+
+static void
+collect_cb (LmSendQueue *queue, const gchar *buf, gsize len, gpointer user_data)
+{
+    SendTest *test = user_data;
+
+    g_string_append_len (test->out, buf, len);
+    test->n_batches++;
+    test->max_batch = MAX (test->max_batch, len);
+}
+
+static void
+check_items_cb (LmSendQueue *queue, const gchar *buf, gsize len, gpointer user_data)
+{
+    SendTest    *test = user_data;
+    const gchar *p = buf;
+    const gchar *end = buf + len;
+
+    /* Batches only ever hold whole items */
+    while (p < end) {
+        gchar *next;
+        guint  thread, item;
+
+        thread = strtoul (p, &next, 10);
+        g_assert (*next == ':');
+        item = strtoul (next + 1, &next, 10);
+        g_assert (*next == ';');
+        p = next + 1;
+
+        g_assert_cmpuint (thread, <, N_THREADS);
+        g_assert_cmpuint (item, ==, test->next[thread]);
+        test->next[thread]++;
+        test->n_items++;
+    }
+    g_assert (p == end);
+}
+
+static void
+test_order ()
+{
+    LmSendQueue *queue;
+    SendTest     test = { NULL };
+    gchar       *big;
+
+    test.out = g_string_new (NULL);
+    queue = lm_send_queue_new (NULL, collect_cb, &test);
+
+    g_assert_cmpuint (lm_send_queue_flush (queue), ==, 0);
+    g_assert_cmpuint (test.n_batches, ==, 0);
+
+    lm_send_queue_push (queue, "<a/>", 4);
+    lm_send_queue_push (queue, "<b/>", 4);
+    lm_send_queue_push (queue, "", 0);
+    lm_send_queue_push (queue, "<c/>", 4);
+    g_assert_cmpuint (lm_send_queue_flush (queue), ==, 3);
+    g_assert_cmpstr (test.out->str, ==, "<a/><b/><c/>");
+    g_assert_cmpuint (test.n_batches, ==, 1);
+
+    /* Big ones are written out in more than one batch */
+    g_string_truncate (test.out, 0);
+    big = g_strnfill (10000, 'x');
+    lm_send_queue_push (queue, big, 10000);
+    lm_send_queue_push (queue, big, 10000);
+    lm_send_queue_push (queue, big, 10000);
+    g_assert_cmpuint (lm_send_queue_flush (queue), ==, 3);
+    g_assert_cmpuint (test.out->len, ==, 30000);
+    g_assert_cmpuint (test.n_batches, ==, 3);
+    g_free (big);
+
+    /* Dropped */
+    lm_send_queue_push (queue, "<d/>", 4);
+    lm_send_queue_free (queue);
+    g_string_free (test.out, TRUE);
+}
+
+typedef struct {
+    LmSendQueue *queue;
+    guint        thread;
+} Producer;
+
+static gpointer
+produce_thread (gpointer user_data)
+{
+    Producer *producer = user_data;
+    guint     i;
+
+    for (i = 0; i < N_ITEMS; ++i) {
+        gchar buf[32];
+        gint  len;
+
+        len = g_snprintf (buf, sizeof (buf), "%u:%u;", producer->thread, i);
+        lm_send_queue_push (producer->queue, buf, len);
+    }
+
+    return NULL;
+}
+
+/* Producers race each other while the main context takes what they push,
+ * sleeping whenever it has caught up.
+ */
+static void
+test_threads ()
+{
+    GMainContext *context;
+    LmSendQueue  *queue;
+    SendTest      test = { NULL };
+    Producer      producers[N_THREADS];
+    GThread      *threads[N_THREADS];
+    guint         i;
+
+    context = g_main_context_new ();
+    queue = lm_send_queue_new (context, check_items_cb, &test);
+
+    for (i = 0; i < N_THREADS; ++i) {
+        producers[i].queue = queue;
+        producers[i].thread = i;
+        threads[i] = g_thread_new ("producer", produce_thread, &producers[i]);
+    }
+
+    while (test.n_items < N_THREADS * N_ITEMS) {
+        g_main_context_iteration (context, TRUE);
+    }
+
+    for (i = 0; i < N_THREADS; ++i) {
+        g_thread_join (threads[i]);
+        g_assert_cmpuint (test.next[i], ==, N_ITEMS);
+    }
+
+    g_assert_cmpuint (lm_send_queue_flush (queue), ==, 0);
+
+    lm_send_queue_free (queue);
+    g_main_context_unref (context);
+}
+
+int
+main (int argc, char **argv)
+{
+    g_test_init (&argc, &argv, NULL);
+
+    g_test_add_func ("/send_queue/order", test_order);
+    g_test_add_func ("/send_queue/threads", test_threads);
+
+    return g_test_run ();
+}
@@ -0,0 +1,106 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (C) 2008 Imendio AB
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, see <https://www.gnu.org/licenses>
+ */
+
+#include <string.h>
+#include <glib.h>
+
+#include "loudmouth/lm-error.h"
+#include "loudmouth/lm-template.h"
+
+static void
+test_template_fill (void)
+{
+    LmTemplate  *tmpl;
+    const gchar *values[3];
+    gchar       *str;
+
+    tmpl = lm_template_new ("<message to=\"{to}\" type='chat' id=\"{id}\">"
+                            "<body>{body}</body><thread>{id}</thread>"
+                            "<x>{{literal}</x></message>", NULL);
+    g_assert (tmpl != NULL);
+
+    g_assert_cmpuint (lm_template_get_n_slots (tmpl), ==, 3);
+    g_assert_cmpint (lm_template_get_slot (tmpl, "to"), ==, 0);
+    g_assert_cmpint (lm_template_get_slot (tmpl, "id"), ==, 1);
+    g_assert_cmpint (lm_template_get_slot (tmpl, "body"), ==, 2);
+    g_assert_cmpint (lm_template_get_slot (tmpl, "from"), ==, -1);
+
+    values[0] = "juliet@example.com";
+    values[1] = "a\"1'";
+    values[2] = "<3 & more";
+
+    str = lm_template_to_string (tmpl, values);
+    g_assert_cmpstr (str, ==,
+                     "<message to=\"juliet@example.com\" type='chat' "
+                     "id=\"a&quot;1&apos;\"><body>&lt;3 &amp; more</body>"
+                     "<thread>a&quot;1&apos;</thread><x>{literal}</x></message>");
+    g_free (str);
+
+    /* Empty slots */
+    values[1] = NULL;
+    values[2] = "";
+    str = lm_template_to_string (tmpl, values);
+    g_assert_cmpstr (str, ==,
+                     "<message to=\"juliet@example.com\" type='chat' id=\"\">"
+                     "<body></body><thread></thread><x>{literal}</x></message>");
+    g_free (str);
+
+    lm_template_unref (tmpl);
+
+    /* No slots at all */
+    tmpl = lm_template_new ("<presence/>", NULL);
+    g_assert_cmpuint (lm_template_get_n_slots (tmpl), ==, 0);
+    str = lm_template_to_string (tmpl, NULL);
+    g_assert_cmpstr (str, ==, "<presence/>");
+    g_free (str);
+    lm_template_unref (tmpl);
+}
+
+static void
+test_template_invalid (void)
+{
+    static const gchar *invalid[] = {
+        "<message {attr}=\"x\"/>",
+        "<{name}/>",
+        "<message to=\"{}\"/>",
+        "<message to=\"{to\"/>",
+        "<message to=\"{a b}\"/>",
+        "<message><body>{body}</message>",
+        "<message to=\"{to}\">"
+    };
+    guint i;
+
+    for (i = 0; i < G_N_ELEMENTS (invalid); ++i) {
+        GError *error = NULL;
+
+        g_assert (lm_template_new (invalid[i], &error) == NULL);
+        g_assert (g_error_matches (error, LM_ERROR, LM_ERROR_INVALID_TEMPLATE));
+        g_error_free (error);
+    }
+}
+
+int
+main (int argc, char **argv)
+{
+    g_test_init (&argc, &argv, NULL);
+
+    g_test_add_func ("/template/fill", test_template_fill);
+    g_test_add_func ("/template/invalid", test_template_invalid);
+
+    return g_test_run ();
+}
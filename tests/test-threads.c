@@ -0,0 +1,242 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (C) 2008 Imendio AB
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, see <https://www.gnu.org/licenses>
+ */
+
+/*
+ * Messages shared between threads. Meant to be run under ThreadSanitizer
+ * as well, configure with CFLAGS="-fsanitize=thread -g" to do that and
+ * run with G_SLICE=always-malloc, or the thread caches of the slice
+ * allocator are reported instead.
+ */
+
+#include <config.h>
+#include <string.h>
+#include <glib.h>
+
+#include "loudmouth/lm-internals.h"
+#include "loudmouth/lm-parser.h"
+#include "loudmouth/lm-selector.h"
+
+#define N_THREADS 8
+#define N_ROUNDS  200
+
+static const gchar *stanzas =
+    "<message from='juliet@example.com/balcony' to='romeo@example.net' "
+    "type='chat' id='m1'><body>Wherefore art thou?</body>"
+    "<active xmlns='http://jabber.org/protocol/chatstates'/></message>"
+    "<iq type='result' id='r1'><query xmlns='jabber:iq:roster'>"
+    "<item jid='nurse@example.com' name='Nurse'><group>Capulet</group></item>"
+    "<item jid='tybalt@example.com'/></query></iq>"
+    "<presence from='mercutio@example.com/verona'><show>away</show>"
+    "<status>Gone fishing &amp; back soon</status></presence>";
+
+typedef struct {
+    GPtrArray  *messages;
+    GPtrArray  *expected;
+    LmSelector *selector;
+} SharedData;
+
+static void
+collect_messages_cb (LmParser *parser, LmMessage *m, gpointer user_data)
+{
+    g_ptr_array_add ((GPtrArray *) user_data, lm_message_ref (m));
+}
+
+static GPtrArray *
+parse_stanzas (gboolean lazy)
+{
+    LmParser  *parser;
+    GPtrArray *messages;
+
+    messages = g_ptr_array_new_with_free_func ((GDestroyNotify) lm_message_unref);
+    parser = lm_parser_new (collect_messages_cb, messages, NULL);
+    _lm_parser_set_lazy (parser, lazy);
+    g_assert (lm_parser_parse (parser, stanzas));
+    lm_parser_free (parser);
+
+    return messages;
+}
+
+static gboolean
+count_match_cb (LmSelector *selector, LmMessageNode *node, gpointer user_data)
+{
+    (*(guint *) user_data)++;
+
+    return TRUE;
+}
+
+static gpointer
+read_messages_thread (gpointer user_data)
+{
+    SharedData *data = user_data;
+    guint       round, i;
+
+    for (round = 0; round < N_ROUNDS; ++round) {
+        for (i = 0; i < data->messages->len; ++i) {
+            LmMessage     *m;
+            LmMessage     *copy;
+            LmMessageNode *child;
+            gchar         *str;
+            guint          n_matches = 0;
+
+            m = lm_message_ref (data->messages->pdata[i]);
+
+            str = lm_message_node_to_string (m->node);
+            g_assert_cmpstr (str, ==, data->expected->pdata[i]);
+            g_free (str);
+
+            for (child = lm_message_node_get_children (m->node);
+                 child; child = child->next) {
+                g_assert (lm_message_node_get_child (m->node, child->name) != NULL);
+            }
+            g_assert (lm_message_node_get_attribute (m->node, "to") ==
+                      lm_message_node_get_attribute (m->node, "to"));
+
+            lm_selector_foreach (data->selector, m->node,
+                                 count_match_cb, &n_matches);
+            g_assert_cmpuint (n_matches, ==, i == 1 ? 2 : 0);
+
+            /* Copies are the thread's own to change */
+            copy = lm_message_copy (m);
+            lm_message_node_set_attribute (copy->node, "id", "changed");
+            child = lm_message_node_get_children (copy->node);
+            lm_message_node_set_value (child, "changed");
+            lm_message_node_add_child (copy->node, "thread", "t1");
+            lm_message_unref (copy);
+
+            lm_message_unref (m);
+        }
+    }
+
+    return NULL;
+}
+
+/* Readers race against each other and against the last references to
+ * the messages being dropped by the main thread.
+ */
+static void
+run_shared (gboolean lazy)
+{
+    SharedData  data;
+    GThread    *threads[N_THREADS];
+    GPtrArray  *reference;
+    guint       i;
+
+    reference = parse_stanzas (FALSE);
+    data.expected = g_ptr_array_new_with_free_func (g_free);
+    for (i = 0; i < reference->len; ++i) {
+        g_ptr_array_add (data.expected,
+                         lm_message_node_to_string (((LmMessage *) reference->pdata[i])->node));
+    }
+    g_ptr_array_free (reference, TRUE);
+
+    data.messages = parse_stanzas (lazy);
+    data.selector = lm_selector_new ("iq/query[xmlns='jabber:iq:roster']/item", NULL);
+
+    for (i = 0; i < data.messages->len; ++i) {
+        LmMessage *m = data.messages->pdata[i];
+
+        /* Half of them are written out once while freezing */
+        if (i % 2) {
+            lm_message_node_set_wire_cache (m->node, TRUE);
+        }
+        lm_message_freeze (m);
+        g_assert (lm_message_node_is_frozen (m->node));
+        g_assert (lm_message_node_is_frozen (lm_message_node_get_children (m->node)));
+    }
+
+    for (i = 0; i < N_THREADS; ++i) {
+        threads[i] = g_thread_new ("reader", read_messages_thread, &data);
+    }
+
+    for (i = 0; i < N_THREADS; ++i) {
+        g_thread_join (threads[i]);
+    }
+
+    g_ptr_array_free (data.messages, TRUE);
+    g_ptr_array_free (data.expected, TRUE);
+    lm_selector_unref (data.selector);
+}
+
+static void
+test_shared_messages ()
+{
+    run_shared (FALSE);
+}
+
+static void
+test_shared_lazy_messages ()
+{
+    run_shared (TRUE);
+}
+
+static gpointer
+ref_unref_thread (gpointer user_data)
+{
+    LmMessage *m = user_data;
+    guint      i;
+
+    for (i = 0; i < 10000; ++i) {
+        lm_message_ref (m);
+        lm_message_node_ref (m->node);
+        lm_message_node_unref (m->node);
+        lm_message_unref (m);
+    }
+
+    lm_message_unref (m);
+
+    return NULL;
+}
+
+/* Each thread drops a reference of its own at the end, whichever comes
+ * last frees the message along with its arena.
+ */
+static void
+test_ref_counts ()
+{
+    GPtrArray *messages;
+    GThread   *threads[N_THREADS];
+    LmMessage *m;
+    guint      i;
+
+    messages = parse_stanzas (FALSE);
+    m = lm_message_ref (messages->pdata[0]);
+    g_ptr_array_free (messages, TRUE);
+
+    for (i = 0; i < N_THREADS; ++i) {
+        threads[i] = g_thread_new ("ref", ref_unref_thread, lm_message_ref (m));
+    }
+    lm_message_unref (m);
+
+    for (i = 0; i < N_THREADS; ++i) {
+        g_thread_join (threads[i]);
+    }
+}
+
+int
+main (int argc, char **argv)
+{
+    g_test_init (&argc, &argv, NULL);
+
+    g_test_add_func ("/threads/ref_counts", test_ref_counts);
+    g_test_add_func ("/threads/shared", test_shared_messages);
+#ifndef LM_PARSER_USE_GMARKUP
+    g_test_add_func ("/threads/shared/lazy", test_shared_lazy_messages);
+#endif
+
+    return g_test_run ();
+}
@@ -0,0 +1,204 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (C) 2008 Imendio AB
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, see <https://www.gnu.org/licenses>
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+
+#include "loudmouth/lm-utf8.h"
+
+static const LmUtf8Kernel kernels[] = {
+    LM_UTF8_KERNEL_SCALAR,
+    LM_UTF8_KERNEL_SSE2,
+    LM_UTF8_KERNEL_AVX2,
+    LM_UTF8_KERNEL_NEON
+};
+
+static const struct {
+    const gchar *input;
+    gsize        valid;
+} validate_cases[] = {
+    { "plain ascii", 11 },
+    { "caf\303\251", 5 },
+    { "\342\202\254 euro", 8 },
+    { "\360\237\230\200 emoji", 10 },
+    { "ab\300\200", 2 },               /* overlong */
+    { "ab\340\200\200", 2 },           /* overlong 3 byte */
+    { "ab\355\240\200", 2 },           /* surrogate */
+    { "ab\364\220\200\200", 2 },       /* above U+10FFFF */
+    { "ab\370\210\200\200\200", 2 },   /* 5 byte form */
+    { "ab\200cd", 2 },                 /* stray continuation */
+    { "ab\342\202", 2 },               /* cut off */
+    { "ab\342(cd", 2 },
+};
+
+static const struct {
+    const gchar *input;
+    const gchar *output;
+} repair_cases[] = {
+    { "abc", "abc" },
+    { "a\377b", "a\357\277\275b" },
+    /* One replacement for each maximal subpart */
+    { "a\342\202b", "a\357\277\275b" },
+    { "a\340\200\200b", "a\357\277\275\357\277\275\357\277\275b" },
+    { "a\360\237\230", "a\357\277\275" },
+    { "\200\200", "\357\277\275\357\277\275" },
+};
+
+static gsize
+reference_validate (const gchar *buffer, gsize len)
+{
+    const gchar *end;
+
+    g_utf8_validate (buffer, (gssize) len, &end);
+
+    return end - buffer;
+}
+
+/* Random mix of ASCII and multi-byte characters, with a bad byte every
+ * now and then when @corrupt is set.
+ */
+static gchar *
+random_text (GRand *rand, gsize len, gboolean corrupt)
+{
+    static const gchar *chars[] = {
+        "a", "<", " ", "\303\251", "\320\226", "\344\270\255", "\360\237\230\200"
+    };
+    GString *str;
+
+    str = g_string_sized_new (len + 4);
+    while (str->len < len) {
+        if (corrupt && g_rand_int_range (rand, 0, 200) == 0) {
+            g_string_append_c (str, (gchar) g_rand_int_range (rand, 0x80, 0x100));
+        } else if (g_rand_int_range (rand, 0, 4) == 0) {
+            g_string_append (str, chars[g_rand_int_range (rand, 3, G_N_ELEMENTS (chars))]);
+        } else {
+            g_string_append (str, chars[g_rand_int_range (rand, 0, 3)]);
+        }
+    }
+
+    return g_string_free (str, FALSE);
+}
+
+static void
+test_validate_cases (void)
+{
+    guint i, k;
+
+    for (k = 0; k < G_N_ELEMENTS (kernels); ++k) {
+        if (!_lm_utf8_set_kernel (kernels[k])) {
+            continue;
+        }
+
+        for (i = 0; i < G_N_ELEMENTS (validate_cases); ++i) {
+            const gchar *input = validate_cases[i].input;
+
+            g_assert_cmpuint (_lm_utf8_validate (input, strlen (input)),
+                              ==, validate_cases[i].valid);
+        }
+
+        /* The nul byte isn't valid in the stream */
+        g_assert_cmpuint (_lm_utf8_validate ("ab\0cd", 5), ==, 2);
+    }
+
+    _lm_utf8_set_kernel (LM_UTF8_KERNEL_AUTO);
+}
+
+/* Checks every kernel against g_utf8_validate(), at every offset into the
+ * vector blocks so that characters straddle them.
+ */
+static void
+test_validate_random (void)
+{
+    GRand *rand;
+    guint  k, round;
+
+    rand = g_rand_new_with_seed (4711);
+
+    for (round = 0; round < 200; ++round) {
+        gchar *text;
+        gsize  len, offset;
+
+        len = g_rand_int_range (rand, 1, 300);
+        text = random_text (rand, len, round % 2);
+        len = strlen (text);
+
+        for (offset = 0; offset < MIN (len, 33); ++offset) {
+            gsize expected;
+
+            expected = reference_validate (text + offset, len - offset);
+
+            for (k = 0; k < G_N_ELEMENTS (kernels); ++k) {
+                if (!_lm_utf8_set_kernel (kernels[k])) {
+                    continue;
+                }
+
+                g_assert_cmpuint (_lm_utf8_validate (text + offset,
+                                                     len - offset),
+                                  ==, expected);
+            }
+        }
+
+        g_free (text);
+    }
+
+    g_rand_free (rand);
+    _lm_utf8_set_kernel (LM_UTF8_KERNEL_AUTO);
+}
+
+static void
+test_incomplete_tail (void)
+{
+    g_assert_cmpuint (_lm_utf8_incomplete_tail ("ab", 2), ==, 0);
+    g_assert_cmpuint (_lm_utf8_incomplete_tail ("ab\303", 3), ==, 1);
+    g_assert_cmpuint (_lm_utf8_incomplete_tail ("ab\360\237\230", 5), ==, 3);
+    g_assert_cmpuint (_lm_utf8_incomplete_tail ("ab\303\251", 4), ==, 0);
+    g_assert_cmpuint (_lm_utf8_incomplete_tail ("ab\340\200", 4), ==, 0);
+}
+
+static void
+test_repair (void)
+{
+    GString *out;
+    guint    i;
+
+    out = g_string_new (NULL);
+
+    for (i = 0; i < G_N_ELEMENTS (repair_cases); ++i) {
+        const gchar *input = repair_cases[i].input;
+
+        g_string_truncate (out, 0);
+        _lm_utf8_repair (input, strlen (input), out);
+        g_assert_cmpstr (out->str, ==, repair_cases[i].output);
+    }
+
+    g_string_free (out, TRUE);
+}
+
+int
+main (int argc, char **argv)
+{
+    g_test_init (&argc, &argv, NULL);
+
+    g_test_add_func ("/utf8/validate/cases", test_validate_cases);
+    g_test_add_func ("/utf8/validate/random", test_validate_random);
+    g_test_add_func ("/utf8/incomplete_tail", test_incomplete_tail);
+    g_test_add_func ("/utf8/repair", test_repair);
+
+    return g_test_run ();
+}